@@ -70,6 +70,16 @@ alsa_driver_release_channel_dependent_memory (alsa_driver_t *driver)
 		driver->capture_addr = 0;
 	}
 
+	if (driver->playback_bufs) {
+		free (driver->playback_bufs);
+		driver->playback_bufs = NULL;
+	}
+
+	if (driver->capture_bufs) {
+		free (driver->capture_bufs);
+		driver->capture_bufs = NULL;
+	}
+
 	if (driver->playback_interleave_skip) {
 		free (driver->playback_interleave_skip);
 		driver->playback_interleave_skip = NULL;
@@ -305,6 +315,10 @@ alsa_driver_setup_io_function_pointers (alsa_driver_t *driver)
 				exit (1);
 			}
 		}
+
+		/* no-op for float, byte swapped or noise-shaped output */
+		driver->write_via_copy =
+			sample_move_accel_out (driver->write_via_copy);
 	}
 	
 	if (driver->capture_handle) {
@@ -329,6 +343,14 @@ alsa_driver_setup_io_function_pointers (alsa_driver_t *driver)
 				break;
 			}
 		}
+
+		driver->read_via_copy =
+			sample_move_accel_in (driver->read_via_copy);
+	}
+
+	if (sample_move_accel_name ()) {
+		jack_info ("ALSA: using %s sample conversion",
+			   sample_move_accel_name ());
 	}
 }
 
@@ -844,6 +866,13 @@ alsa_driver_set_parameters (alsa_driver_t *driver,
 		driver->dither_state = (dither_state_t *)
 			calloc ( driver->playback_nchannels,
 				 sizeof (dither_state_t));
+
+		/* per-cycle source buffers for batched interleaving */
+		if (driver->playback_interleaved) {
+			driver->playback_bufs = (jack_default_audio_sample_t **)
+				calloc (driver->playback_nchannels,
+					sizeof (jack_default_audio_sample_t *));
+		}
 	}
 
 	if (driver->capture_handle) {
@@ -855,6 +884,12 @@ alsa_driver_set_parameters (alsa_driver_t *driver,
 			malloc (sizeof (unsigned long *) * driver->capture_nchannels);
 		memset (driver->capture_interleave_skip, 0,
 			sizeof (unsigned long *) * driver->capture_nchannels);
+
+		if (driver->capture_interleaved) {
+			driver->capture_bufs = (jack_default_audio_sample_t **)
+				calloc (driver->capture_nchannels,
+					sizeof (jack_default_audio_sample_t *));
+		}
 	}
 
 	driver->clock_sync_data = (ClockSyncStatus *)
@@ -1583,11 +1618,29 @@ alsa_driver_read (alsa_driver_t *driver, jack_nframes_t nframes)
 			
 			if (!jack_port_connected (port)) {
 				/* no-copy optimization */
+				if (driver->capture_bufs) {
+					driver->capture_bufs[chn] = NULL;
+				}
 				continue;
 			}
 			buf = jack_port_get_buffer (port, orig_nframes);
-			alsa_driver_read_from_channel (driver, chn,
-				buf + nread, contiguous);
+			if (driver->capture_bufs) {
+				driver->capture_bufs[chn] = buf + nread;
+			} else {
+				alsa_driver_read_from_channel (driver, chn,
+					buf + nread, contiguous);
+			}
+		}
+
+		/* interleaved: de-interleave all channels in one pass
+		   over the mmap area rather than one pass per channel */
+
+		if (driver->capture_bufs) {
+			sample_move_batch_in (driver->read_via_copy,
+					      driver->capture_bufs,
+					      driver->capture_addr,
+					      driver->capture_interleave_skip,
+					      chn, contiguous);
 		}
 		
 		if ((err = snd_pcm_mmap_commit (driver->capture_handle,
@@ -1671,11 +1724,19 @@ alsa_driver_write (alsa_driver_t* driver, jack_nframes_t nframes)
 			port = (jack_port_t *) node->data;
 
 			if (!jack_port_connected (port)) {
+				if (driver->playback_bufs) {
+					driver->playback_bufs[chn] = NULL;
+				}
 				continue;
 			}
 			buf = jack_port_get_buffer (port, orig_nframes);
-			alsa_driver_write_to_channel (driver, chn,
-				buf + nwritten, contiguous);
+			if (driver->playback_bufs) {
+				driver->playback_bufs[chn] = buf + nwritten;
+				alsa_driver_mark_channel_done (driver, chn);
+			} else {
+				alsa_driver_write_to_channel (driver, chn,
+					buf + nwritten, contiguous);
+			}
 
 			if (mon_node) {
 				port = (jack_port_t *) mon_node->data;
@@ -1688,6 +1749,14 @@ alsa_driver_write (alsa_driver_t* driver, jack_nframes_t nframes)
 			}
 		}
 
+		if (driver->playback_bufs) {
+			sample_move_batch_out (driver->write_via_copy,
+					       driver->playback_addr,
+					       driver->playback_bufs,
+					       driver->playback_interleave_skip,
+					       driver->dither_state,
+					       chn, contiguous);
+		}
 		
 		if (!bitset_empty (driver->channels_not_done)) {
 			alsa_driver_silence_untouched_channels (driver,
@@ -2167,6 +2236,8 @@ alsa_driver_detach (alsa_driver_t *driver)
 
 	driver->playback_addr = 0;
 	driver->capture_addr = 0;
+	driver->playback_bufs = NULL;
+	driver->capture_bufs = NULL;
 	driver->playback_interleave_skip = NULL;
 	driver->capture_interleave_skip = NULL;
         driver->previously_successfully_configured = FALSE;
@@ -54,6 +54,8 @@ typedef struct _alsa_driver {
     jack_time_t                   poll_next;
     char                        **playback_addr;
     char                        **capture_addr;
+    jack_default_audio_sample_t **playback_bufs;
+    jack_default_audio_sample_t **capture_bufs;
     const snd_pcm_channel_area_t *capture_areas;
     const snd_pcm_channel_area_t *playback_areas;
     struct pollfd                *pfd;
@@ -34,6 +34,20 @@
 
 #include "memops.h"
 
+/* Vectorized versions of the native endian conversions are built with
+   per-function target attributes and picked at runtime (see
+   sample_move_accel_out() and sample_move_accel_in() below).
+*/
+
+#if (defined(__i386__) || defined(__x86_64__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define MEMOPS_X86 1
+#include <immintrin.h>
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && __BYTE_ORDER == __LITTLE_ENDIAN
+#define MEMOPS_NEON 1
+#include <arm_neon.h>
+#endif
+
 /* Notes about these *_SCALING values.
 
    the MAX_<N>BIT values are floating point. when multiplied by
@@ -163,17 +177,22 @@
  * less random than rand(), but good enough and 10x faster 
  */
 
-inline unsigned int fast_rand() {
-	static unsigned int seed = 22222;
-	seed = (seed * 96314165) + 907633515;
+static unsigned int fast_rand_seed = 22222;
 
-	return seed;
+static inline unsigned int fast_rand() {
+	fast_rand_seed = (fast_rand_seed * 96314165) + 907633515;
+
+	return fast_rand_seed;
 }
 
 
 /* functions for native float sample data */
 
 void sample_move_floatLE_sSs (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip) {
+	if (src_skip == sizeof (float)) {
+		memcpy (dst, src, nsamples * sizeof (float));
+		return;
+	}
 	while (nsamples--) {
 		*dst = *((float *) src);
 		dst++;
@@ -182,6 +201,10 @@ void sample_move_floatLE_sSs (jack_default_audio_sample_t *dst, char *src, unsig
 }
 
 void sample_move_dS_floatLE (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state) {
+	if (dst_skip == sizeof (float)) {
+		memcpy (dst, src, nsamples * sizeof (float));
+		return;
+	}
 	while (nsamples--) {
 		*((float *) dst) = *src;
 		dst += dst_skip;
@@ -675,3 +698,739 @@ memcpy_interleave_d32_s32 (char *dst, char *src, unsigned long src_bytes,
 	}
 }
 
+
+/* MULTI-CHANNEL FUNCTIONS: used with interleaved hardware buffers,
+   where converting one channel at a time walks the whole mmap area once
+   per channel.  These instead convert all channels for a block of
+   frames small enough to stay in cache, then move on to the next
+   block.  Channels whose buffer pointer is NULL are skipped.
+*/
+
+#define MEMOPS_BATCH_BYTES 4096
+
+static unsigned long
+memops_batch_frames (unsigned long skip)
+{
+	unsigned long frames = skip ? MEMOPS_BATCH_BYTES / skip : 0;
+
+	/* keep whole vectors for the SIMD kernels */
+	frames &= ~7UL;
+	return frames ? frames : 8;
+}
+
+void
+sample_move_batch_out (sample_move_out_t func, char **dst, jack_default_audio_sample_t **src,
+		       unsigned long *dst_skip, dither_state_t *state,
+		       unsigned int nchannels, unsigned long nsamples)
+{
+	unsigned long block, done, n;
+	unsigned int chn;
+
+	if (nchannels == 0) {
+		return;
+	}
+
+	block = memops_batch_frames (dst_skip[0]);
+
+	for (done = 0; done < nsamples; done += n) {
+		n = nsamples - done;
+		if (n > block) {
+			n = block;
+		}
+		for (chn = 0; chn < nchannels; chn++) {
+			if (src[chn]) {
+				func (dst[chn] + done * dst_skip[chn], src[chn] + done,
+				      n, dst_skip[chn], state + chn);
+			}
+		}
+	}
+}
+
+void
+sample_move_batch_in (sample_move_in_t func, jack_default_audio_sample_t **dst, char **src,
+		      unsigned long *src_skip, unsigned int nchannels, unsigned long nsamples)
+{
+	unsigned long block, done, n;
+	unsigned int chn;
+
+	if (nchannels == 0) {
+		return;
+	}
+
+	block = memops_batch_frames (src_skip[0]);
+
+	for (done = 0; done < nsamples; done += n) {
+		n = nsamples - done;
+		if (n > block) {
+			n = block;
+		}
+		for (chn = 0; chn < nchannels; chn++) {
+			if (dst[chn]) {
+				func (dst[chn] + done, src[chn] + done * src_skip[chn],
+				      n, src_skip[chn]);
+			}
+		}
+	}
+}
+
+/* VECTORIZED CONVERSIONS: native endian only, for the formats and
+   dither types that the ALSA driver uses in its fast paths.  Each
+   kernel converts whole vectors of samples and leaves the remainder
+   to the scalar function it replaces.  Undithered results match that
+   function exactly; the dithered ones draw from the same noise
+   generator, but a vector of lanes at a time, so the noise sequence
+   (not its distribution) differs.
+
+   Both contiguous (skip == sample width) and interleaved data are
+   handled; for the latter, samples are converted a vector at a time
+   and then scattered (or gathered first, for capture).
+*/
+
+#if defined(MEMOPS_X86) || defined(MEMOPS_NEON)
+
+#define MEMOPS_LANES_MAX 8
+
+/* Fill `lanes' with the next `n' values of the fast_rand() stream and
+   return the LCG step that moves a value `n' places along it.
+*/
+
+static void
+fast_rand_lanes (uint32_t *lanes, int n, uint32_t *mul, uint32_t *add)
+{
+	uint32_t m = 1;
+	uint32_t a = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		lanes[i] = fast_rand ();
+		m *= 96314165;
+		a = (a * 96314165) + 907633515;
+	}
+	*mul = m;
+	*add = a;
+}
+
+static inline void
+memops_scatter (char *dst, const int32_t *z, int n, unsigned long dst_skip, int bits)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		switch (bits) {
+		case 16:
+			*((int16_t *) dst) = (int16_t) z[i];
+			break;
+		case 24:
+			memcpy (dst, &z[i], 3);
+			break;
+		default:
+			*((int32_t *) dst) = z[i];
+			break;
+		}
+		dst += dst_skip;
+	}
+}
+
+/* 32 bit samples are returned as read; callers shift them down */
+
+static inline int32_t
+memops_load (const char *src, int bits)
+{
+	int32_t z = 0;
+
+	switch (bits) {
+	case 16:
+		z = *((int16_t *) src);
+		break;
+	case 24:
+		memcpy ((char *) &z + 1, src, 3);
+		z >>= 8;
+		break;
+	default:
+		z = *((int32_t *) src);
+		break;
+	}
+	return z;
+}
+
+/* The exported kernels: `name' is the scalar function's name without
+   its sample_move_ prefix; that function also converts the samples
+   left over after the last whole vector.
+*/
+
+#define MEMOPS_OUT_KERNEL(attr, isa, name, bits, dither) \
+static attr void \
+isa##_##name (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state) \
+{ \
+	isa##_move_out (dst, src, nsamples, dst_skip, state, bits, dither, sample_move_##name); \
+}
+
+#define MEMOPS_IN_KERNEL(attr, isa, name, bits) \
+static attr void \
+isa##_##name (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip) \
+{ \
+	isa##_move_in (dst, src, nsamples, src_skip, bits, sample_move_##name); \
+}
+
+#endif /* MEMOPS_X86 || MEMOPS_NEON */
+
+#ifdef MEMOPS_X86
+
+#define MEMOPS_SSE41 __attribute__((always_inline, target("sse4.1")))
+#define MEMOPS_AVX2  __attribute__((always_inline, target("avx2")))
+#define MEMOPS_SSE41_FN __attribute__((target("sse4.1")))
+#define MEMOPS_AVX2_FN  __attribute__((target("avx2")))
+
+/* 4 x int32 <-> 12 bytes of packed 24 bit samples */
+
+static inline MEMOPS_SSE41 void
+sse41_store_24 (char *dst, __m128i z)
+{
+	int32_t last;
+
+	z = _mm_shuffle_epi8 (z, _mm_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9, 10,
+						 12, 13, 14, -1, -1, -1, -1));
+	_mm_storel_epi64 ((__m128i *) dst, z);
+	last = _mm_extract_epi32 (z, 2);
+	memcpy (dst + 8, &last, 4);
+}
+
+static inline MEMOPS_SSE41 __m128i
+sse41_load_24 (const char *src)
+{
+	int32_t last;
+	__m128i z;
+
+	memcpy (&last, src + 8, 4);
+	z = _mm_insert_epi32 (_mm_loadl_epi64 ((const __m128i *) src), last, 2);
+	z = _mm_shuffle_epi8 (z, _mm_setr_epi8 (-1, 0, 1, 2, -1, 3, 4, 5,
+						 -1, 6, 7, 8, -1, 9, 10, 11));
+	return _mm_srai_epi32 (z, 8);
+}
+
+static inline MEMOPS_SSE41 void
+sse41_move_out (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples,
+		unsigned long dst_skip, dither_state_t *state, int bits, int dither,
+		void (*tail)(char *, jack_default_audio_sample_t *, unsigned long,
+			     unsigned long, dither_state_t *))
+{
+	const float full = (bits == 16) ? SAMPLE_16BIT_SCALING : SAMPLE_24BIT_SCALING;
+	const unsigned long width = (bits == 32) ? 4 : bits / 8;
+	const __m128 scale = _mm_set1_ps (full);
+	const __m128 lo = _mm_set1_ps (-full);
+	const __m128 unit = _mm_set1_ps (1.0f / 16777216.0f);
+	const __m128 offset = _mm_set1_ps (dither == Triangular ? 1.0f : 0.5f);
+	__m128i lcg = _mm_setzero_si128 ();
+	__m128i mul = _mm_setzero_si128 ();
+	__m128i add = _mm_setzero_si128 ();
+	uint32_t lanes[4], m, a;
+	int32_t z[4];
+
+	if (dither != None) {
+		fast_rand_lanes (lanes, 4, &m, &a);
+		lcg = _mm_loadu_si128 ((__m128i *) lanes);
+		mul = _mm_set1_epi32 (m);
+		add = _mm_set1_epi32 (a);
+	}
+
+	for (; nsamples >= 4; nsamples -= 4) {
+		__m128 val = _mm_mul_ps (_mm_loadu_ps (src), scale);
+		__m128i q;
+
+		if (dither != None) {
+			__m128 r = _mm_cvtepi32_ps (_mm_srli_epi32 (lcg, 8));
+			lcg = _mm_add_epi32 (_mm_mullo_epi32 (lcg, mul), add);
+			if (dither == Triangular) {
+				r = _mm_add_ps (r, _mm_cvtepi32_ps (_mm_srli_epi32 (lcg, 8)));
+				lcg = _mm_add_epi32 (_mm_mullo_epi32 (lcg, mul), add);
+			}
+			val = _mm_add_ps (val, _mm_sub_ps (_mm_mul_ps (r, unit), offset));
+		}
+
+		/* a NaN becomes 0, as lrintf() leaves it in the scalar
+		   code; max() and min() would make it full scale */
+		val = _mm_and_ps (val, _mm_cmpord_ps (val, val));
+		val = _mm_min_ps (_mm_max_ps (val, lo), scale);
+		q = _mm_cvtps_epi32 (val);
+		if (bits == 32) {
+			q = _mm_slli_epi32 (q, 8);
+		}
+
+		if (dst_skip == width) {
+			switch (bits) {
+			case 16:
+				_mm_storel_epi64 ((__m128i *) dst, _mm_packs_epi32 (q, q));
+				break;
+			case 24:
+				sse41_store_24 (dst, q);
+				break;
+			default:
+				_mm_storeu_si128 ((__m128i *) dst, q);
+				break;
+			}
+		} else {
+			_mm_storeu_si128 ((__m128i *) z, q);
+			memops_scatter (dst, z, 4, dst_skip, bits);
+		}
+		dst += 4 * dst_skip;
+		src += 4;
+	}
+
+	if (dither != None) {
+		_mm_storeu_si128 ((__m128i *) lanes, lcg);
+		fast_rand_seed = lanes[3];
+	}
+
+	if (nsamples) {
+		tail (dst, src, nsamples, dst_skip, state);
+	}
+}
+
+static inline MEMOPS_SSE41 void
+sse41_move_in (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples,
+	       unsigned long src_skip, int bits,
+	       void (*tail)(jack_default_audio_sample_t *, char *, unsigned long,
+			    unsigned long))
+{
+	const unsigned long width = (bits == 32) ? 4 : bits / 8;
+	const __m128 scale = _mm_set1_ps (bits == 16 ? SAMPLE_16BIT_SCALING : SAMPLE_24BIT_SCALING);
+
+	for (; nsamples >= 4; nsamples -= 4) {
+		__m128i q;
+
+		if (src_skip == width) {
+			switch (bits) {
+			case 16:
+				q = _mm_cvtepi16_epi32 (_mm_loadl_epi64 ((__m128i *) src));
+				break;
+			case 24:
+				q = sse41_load_24 (src);
+				break;
+			default:
+				q = _mm_loadu_si128 ((__m128i *) src);
+				break;
+			}
+		} else {
+			/* build the vector in registers: storing lanes to
+			   memory and reloading them defeats store forwarding */
+			q = _mm_setr_epi32 (memops_load (src, bits),
+					    memops_load (src + src_skip, bits),
+					    memops_load (src + 2 * src_skip, bits),
+					    memops_load (src + 3 * src_skip, bits));
+		}
+		if (bits == 32) {
+			q = _mm_srai_epi32 (q, 8);
+		}
+
+		_mm_storeu_ps (dst, _mm_div_ps (_mm_cvtepi32_ps (q), scale));
+		dst += 4;
+		src += 4 * src_skip;
+	}
+
+	if (nsamples) {
+		tail (dst, src, nsamples, src_skip);
+	}
+}
+
+static inline MEMOPS_AVX2 void
+avx2_move_out (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples,
+	       unsigned long dst_skip, dither_state_t *state, int bits, int dither,
+	       void (*tail)(char *, jack_default_audio_sample_t *, unsigned long,
+			    unsigned long, dither_state_t *))
+{
+	const float full = (bits == 16) ? SAMPLE_16BIT_SCALING : SAMPLE_24BIT_SCALING;
+	const unsigned long width = (bits == 32) ? 4 : bits / 8;
+	const __m256 scale = _mm256_set1_ps (full);
+	const __m256 lo = _mm256_set1_ps (-full);
+	const __m256 unit = _mm256_set1_ps (1.0f / 16777216.0f);
+	const __m256 offset = _mm256_set1_ps (dither == Triangular ? 1.0f : 0.5f);
+	__m256i lcg = _mm256_setzero_si256 ();
+	__m256i mul = _mm256_setzero_si256 ();
+	__m256i add = _mm256_setzero_si256 ();
+	uint32_t lanes[8], m, a;
+	int32_t z[8];
+
+	if (dither != None) {
+		fast_rand_lanes (lanes, 8, &m, &a);
+		lcg = _mm256_loadu_si256 ((__m256i *) lanes);
+		mul = _mm256_set1_epi32 (m);
+		add = _mm256_set1_epi32 (a);
+	}
+
+	for (; nsamples >= 8; nsamples -= 8) {
+		__m256 val = _mm256_mul_ps (_mm256_loadu_ps (src), scale);
+		__m256i q;
+
+		if (dither != None) {
+			__m256 r = _mm256_cvtepi32_ps (_mm256_srli_epi32 (lcg, 8));
+			lcg = _mm256_add_epi32 (_mm256_mullo_epi32 (lcg, mul), add);
+			if (dither == Triangular) {
+				r = _mm256_add_ps (r, _mm256_cvtepi32_ps (_mm256_srli_epi32 (lcg, 8)));
+				lcg = _mm256_add_epi32 (_mm256_mullo_epi32 (lcg, mul), add);
+			}
+			val = _mm256_add_ps (val, _mm256_sub_ps (_mm256_mul_ps (r, unit), offset));
+		}
+
+		val = _mm256_and_ps (val, _mm256_cmp_ps (val, val, _CMP_ORD_Q));
+		val = _mm256_min_ps (_mm256_max_ps (val, lo), scale);
+		q = _mm256_cvtps_epi32 (val);
+		if (bits == 32) {
+			q = _mm256_slli_epi32 (q, 8);
+		}
+
+		if (dst_skip == width) {
+			switch (bits) {
+			case 16:
+				_mm_storeu_si128 ((__m128i *) dst,
+						  _mm_packs_epi32 (_mm256_castsi256_si128 (q),
+								   _mm256_extracti128_si256 (q, 1)));
+				break;
+			case 24:
+				sse41_store_24 (dst, _mm256_castsi256_si128 (q));
+				sse41_store_24 (dst + 12, _mm256_extracti128_si256 (q, 1));
+				break;
+			default:
+				_mm256_storeu_si256 ((__m256i *) dst, q);
+				break;
+			}
+		} else {
+			_mm256_storeu_si256 ((__m256i *) z, q);
+			memops_scatter (dst, z, 8, dst_skip, bits);
+		}
+		dst += 8 * dst_skip;
+		src += 8;
+	}
+
+	if (dither != None) {
+		_mm256_storeu_si256 ((__m256i *) lanes, lcg);
+		fast_rand_seed = lanes[7];
+	}
+
+	if (nsamples) {
+		tail (dst, src, nsamples, dst_skip, state);
+	}
+}
+
+static inline MEMOPS_AVX2 void
+avx2_move_in (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples,
+	      unsigned long src_skip, int bits,
+	      void (*tail)(jack_default_audio_sample_t *, char *, unsigned long,
+			   unsigned long))
+{
+	const unsigned long width = (bits == 32) ? 4 : bits / 8;
+	const __m256 scale = _mm256_set1_ps (bits == 16 ? SAMPLE_16BIT_SCALING : SAMPLE_24BIT_SCALING);
+
+	for (; nsamples >= 8; nsamples -= 8) {
+		__m256i q;
+
+		if (src_skip == width) {
+			switch (bits) {
+			case 16:
+				q = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((__m128i *) src));
+				break;
+			case 24:
+				q = _mm256_inserti128_si256 (_mm256_castsi128_si256 (sse41_load_24 (src)),
+							     sse41_load_24 (src + 12), 1);
+				break;
+			default:
+				q = _mm256_loadu_si256 ((__m256i *) src);
+				break;
+			}
+		} else {
+			if (bits == 32) {
+				q = _mm256_i32gather_epi32 ((const int *) src, _mm256_mullo_epi32 (
+								    _mm256_set1_epi32 (src_skip),
+								    _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7)), 1);
+			} else {
+				q = _mm256_setr_epi32 (memops_load (src, bits),
+						       memops_load (src + src_skip, bits),
+						       memops_load (src + 2 * src_skip, bits),
+						       memops_load (src + 3 * src_skip, bits),
+						       memops_load (src + 4 * src_skip, bits),
+						       memops_load (src + 5 * src_skip, bits),
+						       memops_load (src + 6 * src_skip, bits),
+						       memops_load (src + 7 * src_skip, bits));
+			}
+		}
+		if (bits == 32) {
+			q = _mm256_srai_epi32 (q, 8);
+		}
+
+		_mm256_storeu_ps (dst, _mm256_div_ps (_mm256_cvtepi32_ps (q), scale));
+		dst += 8;
+		src += 8 * src_skip;
+	}
+
+	if (nsamples) {
+		tail (dst, src, nsamples, src_skip);
+	}
+}
+
+MEMOPS_OUT_KERNEL (MEMOPS_SSE41_FN, sse41, d32u24_sS, 32, None)
+MEMOPS_OUT_KERNEL (MEMOPS_SSE41_FN, sse41, d24_sS, 24, None)
+MEMOPS_OUT_KERNEL (MEMOPS_SSE41_FN, sse41, d16_sS, 16, None)
+MEMOPS_OUT_KERNEL (MEMOPS_SSE41_FN, sse41, dither_rect_d16_sS, 16, Rectangular)
+MEMOPS_OUT_KERNEL (MEMOPS_SSE41_FN, sse41, dither_tri_d16_sS, 16, Triangular)
+MEMOPS_IN_KERNEL  (MEMOPS_SSE41_FN, sse41, dS_s32u24, 32)
+MEMOPS_IN_KERNEL  (MEMOPS_SSE41_FN, sse41, dS_s24, 24)
+MEMOPS_IN_KERNEL  (MEMOPS_SSE41_FN, sse41, dS_s16, 16)
+
+MEMOPS_OUT_KERNEL (MEMOPS_AVX2_FN, avx2, d32u24_sS, 32, None)
+MEMOPS_OUT_KERNEL (MEMOPS_AVX2_FN, avx2, d24_sS, 24, None)
+MEMOPS_OUT_KERNEL (MEMOPS_AVX2_FN, avx2, d16_sS, 16, None)
+MEMOPS_OUT_KERNEL (MEMOPS_AVX2_FN, avx2, dither_rect_d16_sS, 16, Rectangular)
+MEMOPS_OUT_KERNEL (MEMOPS_AVX2_FN, avx2, dither_tri_d16_sS, 16, Triangular)
+MEMOPS_IN_KERNEL  (MEMOPS_AVX2_FN, avx2, dS_s32u24, 32)
+MEMOPS_IN_KERNEL  (MEMOPS_AVX2_FN, avx2, dS_s24, 24)
+MEMOPS_IN_KERNEL  (MEMOPS_AVX2_FN, avx2, dS_s16, 16)
+
+#endif /* MEMOPS_X86 */
+
+#ifdef MEMOPS_NEON
+
+static inline int32x4_t
+neon_round (float32x4_t val)
+{
+#ifdef __aarch64__
+	return vcvtnq_s32_f32 (val);
+#else
+	/* no round-to-nearest conversion before ARMv8: add +/- 0.5 and
+	   truncate (this rounds halves away from zero, unlike lrintf) */
+	uint32x4_t sign = vandq_u32 (vreinterpretq_u32_f32 (val), vdupq_n_u32 (0x80000000));
+	float32x4_t half = vreinterpretq_f32_u32 (vorrq_u32 (sign, vreinterpretq_u32_f32 (vdupq_n_f32 (0.5f))));
+	return vcvtq_s32_f32 (vaddq_f32 (val, half));
+#endif
+}
+
+static inline void
+neon_move_out (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples,
+	       unsigned long dst_skip, dither_state_t *state, int bits, int dither,
+	       void (*tail)(char *, jack_default_audio_sample_t *, unsigned long,
+			    unsigned long, dither_state_t *))
+{
+	const float full = (bits == 16) ? SAMPLE_16BIT_SCALING : SAMPLE_24BIT_SCALING;
+	const unsigned long width = (bits == 32) ? 4 : bits / 8;
+	const float32x4_t scale = vdupq_n_f32 (full);
+	const float32x4_t lo = vdupq_n_f32 (-full);
+	const float32x4_t offset = vdupq_n_f32 (dither == Triangular ? 1.0f : 0.5f);
+	uint32x4_t lcg = vdupq_n_u32 (0);
+	uint32x4_t mul = vdupq_n_u32 (0);
+	uint32x4_t add = vdupq_n_u32 (0);
+	uint32_t lanes[4], m, a;
+	int32_t z[4];
+
+	if (dither != None) {
+		fast_rand_lanes (lanes, 4, &m, &a);
+		lcg = vld1q_u32 (lanes);
+		mul = vdupq_n_u32 (m);
+		add = vdupq_n_u32 (a);
+	}
+
+	for (; nsamples >= 4; nsamples -= 4) {
+		float32x4_t val = vmulq_f32 (vld1q_f32 (src), scale);
+		int32x4_t q;
+
+		if (dither != None) {
+			float32x4_t r = vcvtq_f32_u32 (vshrq_n_u32 (lcg, 8));
+			lcg = vmlaq_u32 (add, lcg, mul);
+			if (dither == Triangular) {
+				r = vaddq_f32 (r, vcvtq_f32_u32 (vshrq_n_u32 (lcg, 8)));
+				lcg = vmlaq_u32 (add, lcg, mul);
+			}
+			val = vaddq_f32 (val, vsubq_f32 (vmulq_n_f32 (r, 1.0f / 16777216.0f), offset));
+		}
+
+		val = vreinterpretq_f32_u32 (vandq_u32 (vreinterpretq_u32_f32 (val),
+							vceqq_f32 (val, val)));
+		val = vminq_f32 (vmaxq_f32 (val, lo), scale);
+		q = neon_round (val);
+
+		if (dst_skip == width && bits == 16) {
+			vst1_s16 ((int16_t *) dst, vqmovn_s32 (q));
+		} else if (dst_skip == width && bits == 32) {
+			vst1q_s32 ((int32_t *) dst, vshlq_n_s32 (q, 8));
+		} else {
+			if (bits == 32) {
+				q = vshlq_n_s32 (q, 8);
+			}
+			vst1q_s32 (z, q);
+			memops_scatter (dst, z, 4, dst_skip, bits);
+		}
+		dst += 4 * dst_skip;
+		src += 4;
+	}
+
+	if (dither != None) {
+		vst1q_u32 (lanes, lcg);
+		fast_rand_seed = lanes[3];
+	}
+
+	if (nsamples) {
+		tail (dst, src, nsamples, dst_skip, state);
+	}
+}
+
+static inline void
+neon_move_in (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples,
+	      unsigned long src_skip, int bits,
+	      void (*tail)(jack_default_audio_sample_t *, char *, unsigned long,
+			   unsigned long))
+{
+	const unsigned long width = (bits == 32) ? 4 : bits / 8;
+	const float full = (bits == 16) ? SAMPLE_16BIT_SCALING : SAMPLE_24BIT_SCALING;
+	int32_t z[4];
+
+	for (; nsamples >= 4; nsamples -= 4) {
+		int32x4_t q;
+		float32x4_t val;
+
+		if (src_skip == width && bits == 16) {
+			q = vmovl_s16 (vld1_s16 ((int16_t *) src));
+		} else if (src_skip == width && bits == 32) {
+			q = vld1q_s32 ((int32_t *) src);
+		} else {
+			z[0] = memops_load (src, bits);
+			z[1] = memops_load (src + src_skip, bits);
+			z[2] = memops_load (src + 2 * src_skip, bits);
+			z[3] = memops_load (src + 3 * src_skip, bits);
+			q = vld1q_s32 (z);
+		}
+		if (bits == 32) {
+			q = vshrq_n_s32 (q, 8);
+		}
+
+		val = vcvtq_f32_s32 (q);
+#ifdef __aarch64__
+		val = vdivq_f32 (val, vdupq_n_f32 (full));
+#else
+		val = vmulq_n_f32 (val, 1.0f / full);
+#endif
+		vst1q_f32 (dst, val);
+		dst += 4;
+		src += 4 * src_skip;
+	}
+
+	if (nsamples) {
+		tail (dst, src, nsamples, src_skip);
+	}
+}
+
+MEMOPS_OUT_KERNEL (, neon, d32u24_sS, 32, None)
+MEMOPS_OUT_KERNEL (, neon, d24_sS, 24, None)
+MEMOPS_OUT_KERNEL (, neon, d16_sS, 16, None)
+MEMOPS_OUT_KERNEL (, neon, dither_rect_d16_sS, 16, Rectangular)
+MEMOPS_OUT_KERNEL (, neon, dither_tri_d16_sS, 16, Triangular)
+MEMOPS_IN_KERNEL  (, neon, dS_s32u24, 32)
+MEMOPS_IN_KERNEL  (, neon, dS_s24, 24)
+MEMOPS_IN_KERNEL  (, neon, dS_s16, 16)
+
+#endif /* MEMOPS_NEON */
+
+/* RUNTIME SELECTION: map a scalar conversion function to the fastest
+   vectorized one the CPU can run, or return it unchanged.
+*/
+
+#if defined(MEMOPS_X86)
+#define MEMOPS_ACCEL(name) { sample_move_##name, { sse41_##name, avx2_##name } }
+#elif defined(MEMOPS_NEON)
+#define MEMOPS_ACCEL(name) { sample_move_##name, { neon_##name, neon_##name } }
+#endif
+
+#ifdef MEMOPS_ACCEL
+
+static const struct {
+	sample_move_out_t scalar;
+	sample_move_out_t accel[2];
+} memops_out_kernels[] = {
+	MEMOPS_ACCEL (d32u24_sS),
+	MEMOPS_ACCEL (d24_sS),
+	MEMOPS_ACCEL (d16_sS),
+	MEMOPS_ACCEL (dither_rect_d16_sS),
+	MEMOPS_ACCEL (dither_tri_d16_sS),
+};
+
+static const struct {
+	sample_move_in_t scalar;
+	sample_move_in_t accel[2];
+} memops_in_kernels[] = {
+	MEMOPS_ACCEL (dS_s32u24),
+	MEMOPS_ACCEL (dS_s24),
+	MEMOPS_ACCEL (dS_s16),
+};
+
+/* 0 = none, 1 = SSE4.1 or NEON, 2 = AVX2 */
+
+static int
+memops_simd_level ()
+{
+#ifdef MEMOPS_X86
+	static int level = -1;
+
+	if (level < 0) {
+		__builtin_cpu_init ();
+		if (__builtin_cpu_supports ("avx2")) {
+			level = 2;
+		} else if (__builtin_cpu_supports ("sse4.1")) {
+			level = 1;
+		} else {
+			level = 0;
+		}
+	}
+	return level;
+#else
+	return 1;
+#endif
+}
+
+#endif /* MEMOPS_ACCEL */
+
+const char *
+sample_move_accel_name ()
+{
+#if defined(MEMOPS_X86)
+	static const char *names[] = { NULL, "SSE4.1", "AVX2" };
+	return names[memops_simd_level ()];
+#elif defined(MEMOPS_NEON)
+	return "NEON";
+#else
+	return NULL;
+#endif
+}
+
+sample_move_out_t
+sample_move_accel_out (sample_move_out_t func)
+{
+#ifdef MEMOPS_ACCEL
+	int level = memops_simd_level ();
+	unsigned int i;
+
+	if (level == 0) {
+		return func;
+	}
+	for (i = 0; i < sizeof (memops_out_kernels) / sizeof (memops_out_kernels[0]); i++) {
+		if (memops_out_kernels[i].scalar == func) {
+			return memops_out_kernels[i].accel[level - 1];
+		}
+	}
+#endif
+	return func;
+}
+
+sample_move_in_t
+sample_move_accel_in (sample_move_in_t func)
+{
+#ifdef MEMOPS_ACCEL
+	int level = memops_simd_level ();
+	unsigned int i;
+
+	if (level == 0) {
+		return func;
+	}
+	for (i = 0; i < sizeof (memops_in_kernels) / sizeof (memops_in_kernels[0]); i++) {
+		if (memops_in_kernels[i].scalar == func) {
+			return memops_in_kernels[i].accel[level - 1];
+		}
+	}
+#endif
+	return func;
+}
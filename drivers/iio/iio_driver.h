@@ -61,6 +61,16 @@ typedef struct _iio_driver {
     void *IIO_devices; ///< The IIO C++ class maintaining all devices with a particular chip name.
     float maxDelayUSecs; ///< The maximum number of micro seconds the buffer can hold
     void *data; ///< The data read in from the IIO devices is stored here.
+    unsigned int capture_devices; ///< The number of capture devices in use, one column of data each.
+    void *capture_blocks; ///< With HAVE_IIO_MMAP_BLOCKS, each capture device's current mmap block, converted from in place of data.
+    void *IIO_out_devices; ///< The IIO C++ class maintaining the playback (DAC) devices, NULL if there is no playback.
+    void *playback_data; ///< The data to write out to the IIO playback devices is assembled here.
+    unsigned int sample_bits; ///< The converter resolution, samples are unsigned in the low sample_bits bits.
+    float capture_offset; ///< Subtracted from each raw sample to centre it on zero.
+    float capture_scale; ///< Multiplies each centred sample to bring it into [-1, 1).
+    unsigned int playback_bits; ///< The DAC resolution, playback samples are unsigned in the low playback_bits bits.
+    float playback_offset; ///< Added to each scaled playback sample, the raw value of silence.
+    float playback_scale; ///< Multiplies each playback sample in [-1, 1) up to raw DAC units.
 } iio_driver_t;
 
 /** Function called by jack to init. the IIO driver, possibly passing in variables.
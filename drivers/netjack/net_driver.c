@@ -137,7 +137,7 @@ net_driver_read (net_driver_t* driver, jack_nframes_t nframes)
     unsigned int *packet_buf, *packet_bufX;
 
     if( ! netj->packet_data_valid ) {
-	render_payload_to_jack_ports (netj->bitdepth, NULL, netj->net_period_down, netj->capture_ports, netj->capture_srcs, nframes, netj->dont_htonl_floats );
+	render_payload_to_jack_ports_typed (netj->bitdepth, NULL, netj->net_period_down, netj->capture_ports, netj->capture_types, netj->capture_srcs, nframes, netj->dont_htonl_floats );
 	return 0;
     }
     packet_buf = netj->rx_buf;
@@ -205,7 +205,7 @@ net_driver_read (net_driver_t* driver, jack_nframes_t nframes)
         }
     }
 
-    render_payload_to_jack_ports (netj->bitdepth, packet_bufX, netj->net_period_down, netj->capture_ports, netj->capture_srcs, nframes, netj->dont_htonl_floats );
+    render_payload_to_jack_ports_typed (netj->bitdepth, packet_bufX, netj->net_period_down, netj->capture_ports, netj->capture_types, netj->capture_srcs, nframes, netj->dont_htonl_floats );
     packet_cache_release_packet(netj->packcache, netj->expected_framecnt );
 
     return 0;
@@ -239,7 +239,7 @@ net_driver_write (net_driver_t* driver, jack_nframes_t nframes)
     pkthdr->framecnt = netj->expected_framecnt;
 
 
-    render_jack_ports_to_payload(netj->bitdepth, netj->playback_ports, netj->playback_srcs, nframes, packet_bufX, netj->net_period_up, netj->dont_htonl_floats );
+    render_jack_ports_to_payload_typed (netj->bitdepth, netj->playback_ports, netj->playback_types, netj->playback_srcs, nframes, packet_bufX, netj->net_period_up, netj->dont_htonl_floats );
 
     packet_header_hton(pkthdr);
     if (netj->srcaddress_valid)
@@ -256,8 +256,8 @@ net_driver_write (net_driver_t* driver, jack_nframes_t nframes)
             netj->syncsource_address.sin_port = htons(netj->reply_port);
 
 	for( r=0; r<netj->redundancy; r++ )
-	    netjack_sendto(netj->sockfd, (char *)packet_buf, packet_size,
-			   flag, (struct sockaddr*)&(netj->syncsource_address), sizeof(struct sockaddr_in), netj->mtu);
+	    netjack_sendto_fec(netj->sockfd, (char *)packet_buf, packet_size,
+			   flag, (struct sockaddr*)&(netj->syncsource_address), sizeof(struct sockaddr_in), netj->mtu, netj->fec_group);
     }
 
     return 0;
@@ -318,7 +318,9 @@ net_driver_new (jack_client_t * client,
 		unsigned int redundancy,
 		int dont_htonl_floats,
 		int always_deadline,
-		int jitter_val)
+		int jitter_val,
+		unsigned int jitter_percentile,
+		unsigned int fec_group)
 {
     net_driver_t * driver;
 
@@ -362,7 +364,9 @@ net_driver_new (jack_client_t * client,
 		redundancy,
 		dont_htonl_floats,
 	        always_deadline, 
-		jitter_val	);
+		jitter_val,
+		jitter_percentile,
+		fec_group );
 
     netjack_startup( netj );
 
@@ -387,7 +391,7 @@ driver_get_descriptor ()
 
     desc = calloc (1, sizeof (jack_driver_desc_t));
     strcpy (desc->name, "net");
-    desc->nparams = 18;
+    desc->nparams = 20;
 
     params = calloc (desc->nparams, sizeof (jack_driver_param_desc_t));
 
@@ -545,6 +549,31 @@ driver_get_descriptor ()
     strcpy (params[i].short_desc,
             "Always wait until deadline");
     strcpy (params[i].long_desc, params[i].short_desc);
+
+    i++;
+    strcpy (params[i].name, "jitter-target");
+    params[i].character  = 'P';
+    params[i].type       = JackDriverParamUInt;
+    params[i].value.ui   = 0U;
+    strcpy (params[i].short_desc,
+            "Percentile of packet delay to wait for (0 is off)");
+    strcpy (params[i].long_desc,
+            "Track the master's packet clock, and wait for this percentile "
+            "of the packet arrival delay before giving up on a packet. "
+            "Overrides the master's deadline feedback.  0 is off");
+
+    i++;
+    strcpy (params[i].name, "fec");
+    params[i].character  = 'F';
+    params[i].type       = JackDriverParamUInt;
+    params[i].value.ui   = 0U;
+    strcpy (params[i].short_desc,
+            "Data fragments per parity fragment sent (0 is off)");
+    strcpy (params[i].long_desc,
+            "Forward error correction: add an XOR parity fragment for "
+            "every N data fragments sent upstream, so the master can "
+            "rebuild one lost fragment per group.  Parity from the "
+            "master is used whatever this is set to.  0 is off");
     desc->params = params;
 
     return desc;
@@ -572,6 +601,8 @@ driver_initialize (jack_client_t *client, const JSList * params)
     int dont_htonl_floats = 0;
     int always_deadline = 0;
     int jitter_val = 0;
+    unsigned int jitter_percentile = 0;
+    unsigned int fec_group = 0;
     const JSList * node;
     const jack_driver_param_t * param;
 
@@ -665,6 +696,12 @@ driver_initialize (jack_client_t *client, const JSList * params)
             case 'D':
                 always_deadline = param->value.ui;
                 break;
+            case 'P':
+                jitter_percentile = param->value.ui;
+                break;
+            case 'F':
+                fec_group = param->value.ui;
+                break;
         }
     }
 
@@ -674,7 +711,8 @@ driver_initialize (jack_client_t *client, const JSList * params)
                            listen_port, handle_transport_sync,
                            resample_factor, resample_factor_up, bitdepth,
 			   use_autoconfig, latency, redundancy,
-			   dont_htonl_floats, always_deadline, jitter_val);
+			   dont_htonl_floats, always_deadline, jitter_val,
+			   jitter_percentile, fec_group);
 }
 
 void
@@ -70,6 +70,7 @@ $Id: net_driver.c,v 1.17 2006/04/16 20:16:10 torbenh Exp $
 //#include "jack/control.h"
 
 #define MIN(x,y) ((x)<(y) ? (x) : (y))
+#define MAX(x,y) ((x)>(y) ? (x) : (y))
 
 static int sync_state = 1;
 static jack_transport_state_t last_transport_state;
@@ -88,12 +89,131 @@ net_driver_sync_cb(jack_transport_state_t state, jack_position_t *pos, void *dat
     return retval;
 }
 
+static void
+netjack_jitter_reset( netjack_driver_state_t *netj )
+{
+    netjack_jitter_t *jit = &(netj->jitter);
+
+    jit->cursor = netj->packcache->arrivals_head;
+    jit->valid = 0;
+    jit->period_usecs = netj->period_usecs;
+    // same loop bandwidth as the engine's frame timer.
+    jit->omega = netj->period_usecs * 7.854e-7f;
+
+    // bins reach from a period early to the whole latency late.
+    jit->min_delay = -(int)netj->period_usecs;
+    jit->bin_usecs = (netj->latency + 2) * netj->period_usecs / NETJACK_JITTER_BINS;
+    if( jit->bin_usecs < 1 )
+	jit->bin_usecs = 1;
+    jit->delay = 0;
+
+    jit->window_pos = 0;
+    jit->window_fill = 0;
+    memset( jit->hist, 0, sizeof( jit->hist ) );
+}
+
+static inline int
+netjack_jitter_ready( netjack_jitter_t *jit )
+{
+    return jit->percentile && (jit->window_fill >= NETJACK_JITTER_MIN);
+}
+
+static void
+netjack_jitter_add_delay( netjack_jitter_t *jit, double delay )
+{
+    int bin = (int) floor( (delay - jit->min_delay) / jit->bin_usecs );
+
+    if( bin < 0 )
+	bin = 0;
+    if( bin >= NETJACK_JITTER_BINS )
+	bin = NETJACK_JITTER_BINS - 1;
+
+    if( jit->window_fill == NETJACK_JITTER_WINDOW )
+	jit->hist[jit->window[jit->window_pos]] -= 1;
+    else
+	jit->window_fill += 1;
+
+    jit->window[jit->window_pos] = bin;
+    jit->hist[bin] += 1;
+    jit->window_pos = (jit->window_pos + 1) % NETJACK_JITTER_WINDOW;
+}
+
+// Feed the packets that arrived since last time to the DLL, and
+// place the deadline at the wanted percentile of their delay.
+static void
+netjack_jitter_update( netjack_driver_state_t *netj )
+{
+    netjack_jitter_t *jit = &(netj->jitter);
+    jack_nframes_t framecnt;
+    jack_time_t timestamp;
+    unsigned int wanted, seen;
+    int bin, added = 0;
+
+    while( packet_cache_next_arrival( netj->packcache, &(jit->cursor), &framecnt, &timestamp ) ) {
+	int32_t ahead = (int32_t) (framecnt - jit->framecnt);
+	double predicted, delta;
+
+	// a new master, or the old one restarted.
+	if( jit->valid && (abs( ahead ) > (int) (netj->latency + 50)) )
+	    jit->valid = 0;
+
+	if( !jit->valid ) {
+	    jit->framecnt = framecnt;
+	    jit->arrival = timestamp;
+	    jit->valid = 1;
+	    continue;
+	}
+
+	predicted = jit->arrival + ahead * jit->period_usecs;
+	delta = (double) timestamp - predicted;
+	netjack_jitter_add_delay( jit, delta );
+	added = 1;
+
+	// a reordered or duplicate packet says nothing about the clock.
+	if( ahead <= 0 )
+	    continue;
+
+	delta *= jit->omega;
+	jit->period_usecs += jit->omega * delta;
+	jit->arrival = predicted + 1.41 * delta;
+	jit->framecnt = framecnt;
+    }
+
+    if( !added || !netjack_jitter_ready( jit ) )
+	return;
+
+    wanted = (jit->window_fill * jit->percentile + 99) / 100;
+    if( wanted < 1 )
+	wanted = 1;
+    for( bin = 0, seen = 0; bin < NETJACK_JITTER_BINS - 1; bin++ ) {
+	seen += jit->hist[bin];
+	if( seen >= wanted )
+	    break;
+    }
+
+    // upper edge of the bin.
+    jit->delay = jit->min_delay + (bin + 1) * jit->bin_usecs;
+}
+
+static jack_time_t
+netjack_jitter_deadline( netjack_jitter_t *jit, jack_nframes_t framecnt )
+{
+    int32_t ahead = (int32_t) (framecnt - jit->framecnt);
+
+    return (jack_time_t) (jit->arrival + ahead * jit->period_usecs + jit->delay);
+}
+
 int netjack_wait( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)(void) )
 {
     int we_have_the_expected_frame = 0;
     jack_nframes_t next_frame_avail;
     jack_time_t packet_recv_time_stamp;
     jacknet_packet_header *pkthdr;
+    int adaptive;
+
+    if( netj->jitter.percentile )
+	netjack_jitter_update( netj );
+    adaptive = netjack_jitter_ready( &(netj->jitter) );
 
     if( !netj->next_deadline_valid ) {
 	    netj->next_deadline = get_microseconds() + netj->period_usecs;
@@ -118,6 +238,10 @@ int netjack_wait( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)(
 
     }
 
+    // The DLL knows when this packet is due, so there is nothing to steer.
+    if( adaptive )
+	netj->next_deadline = netjack_jitter_deadline( &(netj->jitter), netj->expected_framecnt );
+
     //jack_log( "expect %d", netj->expected_framecnt );
     // Now check if required packet is already in the cache.
     // then poll (have deadline calculated)
@@ -176,7 +300,7 @@ int netjack_wait( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)(
 	else
 		want_deadline = (netj->period_usecs/4+10*(int)netj->period_usecs*netj->latency/100);
 
-	if( netj->deadline_goodness != MASTER_FREEWHEELS ) {
+	if( !adaptive && (netj->deadline_goodness != MASTER_FREEWHEELS) ) {
 		if( netj->deadline_goodness < want_deadline ) {
 			netj->next_deadline -= netj->period_usecs/100;
 			//jack_log( "goodness: %d, Adjust deadline: --- %d\n", netj->deadline_goodness, (int) netj->period_usecs*netj->latency/100 );
@@ -210,7 +334,9 @@ int netjack_wait( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)(
 
 	    //XXX: hmm... i need to remember why resync_threshold wasnt right.
 	    //if( offset < netj->resync_threshold )
-	    if( offset < 10 ) {
+	    // The adaptive deadline follows the master, so a packet more
+	    // than latency ahead can only mean frames were skipped.
+	    if( offset < (adaptive ? MAX( netj->latency, 2 ) : 10) ) {
 		// ok. dont do nothing. we will run without data.
 		// this seems to be one or 2 lost packets.
 		//
@@ -222,7 +348,7 @@ int netjack_wait( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)(
 
 		// I also found this happening, when the packet queue, is too full.
 		// but wtf ? use a smaller latency. this link can handle that ;S
-		if( packet_cache_get_fill( netj->packcache, netj->expected_framecnt ) > 80.0 )
+		if( !adaptive && (packet_cache_get_fill( netj->packcache, netj->expected_framecnt ) > 80.0) )
 		    netj->next_deadline -= netj->period_usecs/2;
 
 
@@ -244,7 +370,9 @@ int netjack_wait( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)(
 	    netj->packet_data_valid = 0;
 
 	    //printf( "frame %d No Packet in queue. num_lost_packets = %d \n", netj->expected_framecnt, netj->num_lost_packets );
-	    if( netj->num_lost_packets < 5 ) {
+	    if( adaptive && (netj->num_lost_packets <= 100) ) {
+		// lost or late. the DLL keeps running at the master's rate.
+	    } else if( netj->num_lost_packets < 5 ) {
 		// ok. No Packet in queue. The packet was either lost,
 		// or we are running too fast.
 		//
@@ -287,6 +415,7 @@ int netjack_wait( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)(
 		    netj->next_deadline_valid = 0;
 		    netj->packet_data_valid = 1;
 		    netj->running_free = 0;
+		    netjack_jitter_reset( netj );
 		    jack_info( "resync after freerun... %d", netj->expected_framecnt );
 		} else {
 		    if( netj->num_lost_packets == 101 ) {
@@ -302,6 +431,7 @@ int netjack_wait( netjack_driver_state_t *netj, jack_time_t (*get_microseconds)(
 		    if (netj->num_lost_packets > 200 ) {
 			netj->srcaddress_valid = 0;
 			packet_cache_reset_master_address( netj->packcache );
+			netjack_jitter_reset( netj );
 		    }
 		}
 	    }
@@ -355,8 +485,8 @@ void netjack_send_silence( netjack_driver_state_t *netj, int syncstate )
 	    netj->syncsource_address.sin_port = htons(netj->reply_port);
 
 	for( r=0; r<netj->redundancy; r++ )
-	    netjack_sendto(netj->outsockfd, (char *)packet_buf, tx_size,
-		    0, (struct sockaddr*)&(netj->syncsource_address), sizeof(struct sockaddr_in), netj->mtu);
+	    netjack_sendto_fec(netj->outsockfd, (char *)packet_buf, tx_size,
+		    0, (struct sockaddr*)&(netj->syncsource_address), sizeof(struct sockaddr_in), netj->mtu, netj->fec_group);
     }
 }
 
@@ -482,6 +612,9 @@ void netjack_attach( netjack_driver_state_t *netj )
             jack_slist_append (netj->playback_ports, port);
     }
 
+    netj->capture_types = netjack_port_types (netj->capture_ports);
+    netj->playback_types = netjack_port_types (netj->playback_ports);
+
     jack_activate (netj->client);
 }
 
@@ -496,6 +629,8 @@ void netjack_detach( netjack_driver_state_t *netj )
 
     jack_slist_free (netj->capture_ports);
     netj->capture_ports = NULL;
+    free (netj->capture_types);
+    netj->capture_types = NULL;
 
     for (node = netj->capture_srcs; node; node = jack_slist_next (node))
     {
@@ -523,6 +658,8 @@ void netjack_detach( netjack_driver_state_t *netj )
 
     jack_slist_free (netj->playback_ports);
     netj->playback_ports = NULL;
+    free (netj->playback_types);
+    netj->playback_types = NULL;
 
     for (node = netj->playback_srcs; node; node = jack_slist_next (node))
     {
@@ -570,7 +707,9 @@ netjack_driver_state_t *netjack_init (netjack_driver_state_t *netj,
 		unsigned int redundancy,
 		int dont_htonl_floats,
 		int always_deadline,
-		int jitter_val )
+		int jitter_val,
+		unsigned int jitter_percentile,
+		unsigned int fec_group )
 {
 
     // Fill in netj values.
@@ -588,10 +727,12 @@ netjack_driver_state_t *netjack_init (netjack_driver_state_t *netj,
     netj->capture_channels_audio  = capture_ports;
     netj->capture_channels_midi   = capture_ports_midi;
     netj->capture_ports     = NULL;
+    netj->capture_types     = NULL;
     netj->playback_channels = playback_ports + playback_ports_midi;
     netj->playback_channels_audio = playback_ports;
     netj->playback_channels_midi = playback_ports_midi;
     netj->playback_ports    = NULL;
+    netj->playback_types    = NULL;
     netj->codec_latency = 0;
 
     netj->handle_transport_sync = transport_sync;
@@ -621,6 +762,20 @@ netjack_driver_state_t *netjack_init (netjack_driver_state_t *netj,
 
     netj->jitter_val = jitter_val;
 
+    if (jitter_percentile > 100)
+    {
+        jack_info ("Jitter percentile %d is above 100, using 100", jitter_percentile);
+        jitter_percentile = 100;
+    }
+    netj->jitter.percentile = jitter_percentile;
+
+    if (fec_group > NETJACK_FEC_GROUP_MAX)
+    {
+        jack_info ("FEC group %d is above %d, using %d", fec_group, NETJACK_FEC_GROUP_MAX, NETJACK_FEC_GROUP_MAX);
+        fec_group = NETJACK_FEC_GROUP_MAX;
+    }
+    netj->fec_group = fec_group;
+
     return netj;
 }
 
@@ -795,6 +950,7 @@ netjack_startup( netjack_driver_state_t *netj )
     netj->next_deadline_valid = 0;
     netj->deadline_goodness = 0;
     netj->time_to_deadline = 0;
+    netjack_jitter_reset( netj );
 
     // Special handling for latency=0
     if( netj->latency == 0 )
@@ -44,6 +44,32 @@ struct _packet_cache;
 
 typedef struct _netjack_driver_state netjack_driver_state_t;
 
+// Adaptive jitter buffer.  A DLL predicts when each packet should
+// arrive, and the deadline waits for a percentile of the observed
+// delay past that prediction.
+#define NETJACK_JITTER_BINS	256
+#define NETJACK_JITTER_WINDOW	4096	// delays the percentile is taken over
+#define NETJACK_JITTER_MIN	64	// delays seen before it takes over
+
+typedef struct _netjack_jitter netjack_jitter_t;
+
+struct _netjack_jitter {
+    unsigned int    percentile;		// 0 is off
+    unsigned int    cursor;		// into the packet cache arrival log
+    int		    valid;
+    jack_nframes_t  framecnt;		// last packet the DLL was fed
+    double	    arrival;		// its filtered arrival time
+    double	    period_usecs;	// filtered packet interval
+    double	    omega;
+    int		    bin_usecs;
+    int		    min_delay;		// lower edge of bin 0
+    int		    delay;		// the deadline, past the prediction
+    unsigned int    window_pos;
+    unsigned int    window_fill;
+    unsigned char   window[NETJACK_JITTER_WINDOW];	// bins, oldest first
+    unsigned short  hist[NETJACK_JITTER_BINS];
+};
+
 struct _netjack_driver_state {
     jack_nframes_t  net_period_up;
     jack_nframes_t  net_period_down;
@@ -68,6 +94,8 @@ struct _netjack_driver_state {
 
     JSList	    *capture_ports;
     JSList	    *playback_ports;
+    char	    *capture_types;	// NETJACK_PORT_* per port
+    char	    *playback_types;
     JSList	    *playback_srcs;
     JSList	    *capture_srcs;
 
@@ -95,6 +123,7 @@ struct _netjack_driver_state {
     unsigned int mtu;
     unsigned int latency;
     unsigned int redundancy;
+    int		 fec_group;	// data fragments per parity fragment, 0 is off
 
     jack_nframes_t expected_framecnt;
     int		   expected_framecnt_valid;
@@ -111,6 +140,7 @@ struct _netjack_driver_state {
     unsigned int   resample_factor;
     unsigned int   resample_factor_up;
     int		   jitter_val;
+    netjack_jitter_t jitter;
     struct _packet_cache * packcache;
 #if HAVE_CELT
     CELTMode	   *celt_mode;
@@ -143,7 +173,9 @@ netjack_driver_state_t *netjack_init (netjack_driver_state_t *netj,
 		unsigned int redundancy,
 		int dont_htonl_floats,
 		int always_deadline,
-		int jitter_val );
+		int jitter_val,
+		unsigned int jitter_percentile,
+		unsigned int fec_group );
 
 void netjack_release( netjack_driver_state_t *netj );
 int netjack_startup( netjack_driver_state_t *netj );
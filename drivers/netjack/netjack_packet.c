@@ -32,7 +32,7 @@
 #define _DARWIN_C_SOURCE
 #endif
 
-#if HAVE_PPOLL
+#if HAVE_PPOLL || defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
 #define _GNU_SOURCE
 #endif
 
@@ -56,7 +56,9 @@
 #include <malloc.h>
 #else
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <poll.h>
 #endif
 
@@ -73,6 +75,14 @@
 
 #include "netjack_packet.h"
 
+#if defined(__SSE2__)
+#define NETJACK_SSE2 1
+#include <emmintrin.h>
+#elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define NETJACK_NEON 1
+#include <arm_neon.h>
+#endif
+
 // JACK2 specific.
 //#include "jack/control.h"
 
@@ -82,6 +92,38 @@
 
 int fraggo = 0;
 
+// Fragments received per recvmmsg() call.
+#define NETJACK_RX_BATCH 32
+
+// Batched receive state of a packet cache.
+//
+// Fragments of one packet usually arrive in order, so each datagram
+// of a batch is received straight into the slot that the fragment
+// following the previous one would occupy in its cache packet.  Only
+// mispredicted datagrams, and those past the end of the packet, go
+// through the spare buffers and get copied.
+struct _packet_cache_rx
+{
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr msgs[NETJACK_RX_BATCH];
+    struct iovec iov[2 * NETJACK_RX_BATCH];
+    struct sockaddr_in addrs[NETJACK_RX_BATCH];
+    jacknet_packet_header headers[NETJACK_RX_BATCH];
+    cache_packet *predicted[NETJACK_RX_BATCH];
+    int predicted_fragment[NETJACK_RX_BATCH];
+    char *payload[NETJACK_RX_BATCH];
+#endif
+    char *spare;		// NETJACK_RX_BATCH fragment payloads
+    cache_packet *pack;		// where the last fragment went
+    jack_nframes_t framecnt;
+    int next_fragment;
+};
+
+#if !defined(WIN32) && defined(UDP_SEGMENT)
+// Cleared when the kernel or the interface rejects UDP GSO.
+static int netjack_udp_gso = 1;
+#endif
+
 void
 packet_header_hton (jacknet_packet_header *pkthdr)
 {
@@ -143,8 +185,292 @@ int jack_port_is_midi(const char *porttype)
     return (strncmp (porttype, JACK_DEFAULT_MIDI_TYPE, jack_port_type_size()) == 0);
 }
 
+static void
+netjack_port_types_fill (JSList *ports, char *types)
+{
+    JSList *node;
+    int chn = 0;
+
+    for (node = ports; node; node = jack_slist_next (node), chn++)
+    {
+        const char *porttype = jack_port_type ((jack_port_t *) node->data);
+
+        if (jack_port_is_audio (porttype))
+            types[chn] = NETJACK_PORT_AUDIO;
+        else if (jack_port_is_midi (porttype))
+            types[chn] = NETJACK_PORT_MIDI;
+        else
+            types[chn] = NETJACK_PORT_OTHER;
+    }
+}
+
+// Classify the ports of a list once, so the render functions do not
+// have to compare type names every cycle.  Returns a malloc()ed array
+// of NETJACK_PORT_* values, in list order.
+char *
+netjack_port_types (JSList *ports)
+{
+    char *types = malloc (jack_slist_length (ports) + 1);
+
+    if (types == NULL)
+        return NULL;
+
+    netjack_port_types_fill (ports, types);
+    return types;
+}
+
+
+// sample conversion kernels.
+//
+// The wire formats are big endian: 32 bit floats, unsigned 16 bit
+// samples offset by 32768, and signed 8 bit samples.  The vector
+// versions give the same results as the scalar tails, except that
+// out of range samples are clipped instead of wrapped.
+
+// byteswap 32 bit words, in place if dst == src.
+static void
+netjack_swap32 (uint32_t *dst, const uint32_t *src, jack_nframes_t nframes)
+{
+    jack_nframes_t i = 0;
+
+#if defined(NETJACK_SSE2)
+    for (; i + 4 <= nframes; i += 4)
+    {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+        // swap the 16 bit halves, then the bytes within them
+        v = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (v, 0xb1), 0xb1);
+        v = _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));
+        _mm_storeu_si128 ((__m128i *) (dst + i), v);
+    }
+#elif defined(NETJACK_NEON)
+    for (; i + 4 <= nframes; i += 4)
+        vst1q_u32 (dst + i, vreinterpretq_u32_u8 (vrev32q_u8 (vreinterpretq_u8_u32 (vld1q_u32 (src + i)))));
+#endif
+    for (; i < nframes; i++)
+        dst[i] = ntohl (src[i]);
+}
+
+static void
+netjack_u16be_to_float (jack_default_audio_sample_t *dst, const uint16_t *src, jack_nframes_t nframes)
+{
+    jack_nframes_t i = 0;
+
+#if defined(NETJACK_SSE2)
+    const __m128 scale = _mm_set1_ps (1.0f / 32768.0f);
+    const __m128 one = _mm_set1_ps (1.0f);
+    const __m128i zero = _mm_setzero_si128 ();
+
+    for (; i + 8 <= nframes; i += 8)
+    {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+        v = _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));
+        __m128 lo = _mm_cvtepi32_ps (_mm_unpacklo_epi16 (v, zero));
+        __m128 hi = _mm_cvtepi32_ps (_mm_unpackhi_epi16 (v, zero));
+        _mm_storeu_ps (dst + i, _mm_sub_ps (_mm_mul_ps (lo, scale), one));
+        _mm_storeu_ps (dst + i + 4, _mm_sub_ps (_mm_mul_ps (hi, scale), one));
+    }
+#elif defined(NETJACK_NEON)
+    const float32x4_t one = vdupq_n_f32 (1.0f);
+
+    for (; i + 8 <= nframes; i += 8)
+    {
+        uint16x8_t v = vreinterpretq_u16_u8 (vrev16q_u8 (vreinterpretq_u8_u16 (vld1q_u16 (src + i))));
+        float32x4_t lo = vcvtq_f32_u32 (vmovl_u16 (vget_low_u16 (v)));
+        float32x4_t hi = vcvtq_f32_u32 (vmovl_u16 (vget_high_u16 (v)));
+        vst1q_f32 (dst + i, vsubq_f32 (vmulq_n_f32 (lo, 1.0f / 32768.0f), one));
+        vst1q_f32 (dst + i + 4, vsubq_f32 (vmulq_n_f32 (hi, 1.0f / 32768.0f), one));
+    }
+#endif
+    for (; i < nframes; i++)
+        dst[i] = ((float) ntohs (src[i])) / 32768.0 - 1.0;
+}
+
+static void
+netjack_float_to_u16be (uint16_t *dst, const jack_default_audio_sample_t *src, jack_nframes_t nframes)
+{
+    jack_nframes_t i = 0;
+
+#if defined(NETJACK_SSE2)
+    // (x + 1.0) * 32767.0 is computed in double, like the scalar
+    // code, so that truncation gives the same sample.
+    const __m128d one = _mm_set1_pd (1.0);
+    const __m128d scale = _mm_set1_pd (32767.0);
+    const __m128d top = _mm_set1_pd (65535.0);
+    const __m128d bottom = _mm_setzero_pd ();
+    const __m128i bias = _mm_set1_epi32 (32768);
+    const __m128i bias16 = _mm_set1_epi16 ((short) 0x8000);
+
+    for (; i + 8 <= nframes; i += 8)
+    {
+        __m128 a = _mm_loadu_ps (src + i);
+        __m128 b = _mm_loadu_ps (src + i + 4);
+        __m128d d0 = _mm_cvtps_pd (a);
+        __m128d d1 = _mm_cvtps_pd (_mm_movehl_ps (a, a));
+        __m128d d2 = _mm_cvtps_pd (b);
+        __m128d d3 = _mm_cvtps_pd (_mm_movehl_ps (b, b));
+        d0 = _mm_min_pd (_mm_max_pd (_mm_mul_pd (_mm_add_pd (d0, one), scale), bottom), top);
+        d1 = _mm_min_pd (_mm_max_pd (_mm_mul_pd (_mm_add_pd (d1, one), scale), bottom), top);
+        d2 = _mm_min_pd (_mm_max_pd (_mm_mul_pd (_mm_add_pd (d2, one), scale), bottom), top);
+        d3 = _mm_min_pd (_mm_max_pd (_mm_mul_pd (_mm_add_pd (d3, one), scale), bottom), top);
+        __m128i lo = _mm_unpacklo_epi64 (_mm_cvttpd_epi32 (d0), _mm_cvttpd_epi32 (d1));
+        __m128i hi = _mm_unpacklo_epi64 (_mm_cvttpd_epi32 (d2), _mm_cvttpd_epi32 (d3));
+        // SSE2 only packs signed, so pack around zero and flip back
+        __m128i v = _mm_xor_si128 (_mm_packs_epi32 (_mm_sub_epi32 (lo, bias), _mm_sub_epi32 (hi, bias)), bias16);
+        v = _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));
+        _mm_storeu_si128 ((__m128i *) (dst + i), v);
+    }
+#elif defined(NETJACK_NEON) && defined(__aarch64__)
+    // in double, like the SSE2 path.  vcvtq truncates like the
+    // scalar cast and saturates at the ends of the range.  32 bit ARM
+    // has no double vectors, so it uses the scalar loop.
+    const float64x2_t one = vdupq_n_f64 (1.0);
+    const float64x2_t scale = vdupq_n_f64 (32767.0);
+
+    for (; i + 8 <= nframes; i += 8)
+    {
+        float32x4_t a = vld1q_f32 (src + i);
+        float32x4_t b = vld1q_f32 (src + i + 4);
+        float64x2_t d0 = vmulq_f64 (vaddq_f64 (vcvt_f64_f32 (vget_low_f32 (a)), one), scale);
+        float64x2_t d1 = vmulq_f64 (vaddq_f64 (vcvt_high_f64_f32 (a), one), scale);
+        float64x2_t d2 = vmulq_f64 (vaddq_f64 (vcvt_f64_f32 (vget_low_f32 (b)), one), scale);
+        float64x2_t d3 = vmulq_f64 (vaddq_f64 (vcvt_high_f64_f32 (b), one), scale);
+        uint32x4_t lo = vcombine_u32 (vqmovn_u64 (vcvtq_u64_f64 (d0)), vqmovn_u64 (vcvtq_u64_f64 (d1)));
+        uint32x4_t hi = vcombine_u32 (vqmovn_u64 (vcvtq_u64_f64 (d2)), vqmovn_u64 (vcvtq_u64_f64 (d3)));
+        uint16x8_t v = vcombine_u16 (vqmovn_u32 (lo), vqmovn_u32 (hi));
+        vst1q_u16 (dst + i, vreinterpretq_u16_u8 (vrev16q_u8 (vreinterpretq_u8_u16 (v))));
+    }
+#endif
+    for (; i < nframes; i++)
+    {
+        double val = (src[i] + 1.0) * 32767.0;
+
+        if (val <= 0.0)
+            dst[i] = 0;
+        else if (val >= 65535.0)
+            dst[i] = 0xffff;
+        else
+            dst[i] = htons ((uint16_t) val);
+    }
+}
+
+static void
+netjack_s8_to_float (jack_default_audio_sample_t *dst, const int8_t *src, jack_nframes_t nframes)
+{
+    jack_nframes_t i = 0;
+
+#if defined(NETJACK_SSE2)
+    const __m128 div = _mm_set1_ps (127.0f);
+
+    for (; i + 16 <= nframes; i += 16)
+    {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+        // sign extend by unpacking into the high byte and shifting down
+        __m128i w0 = _mm_srai_epi16 (_mm_unpacklo_epi8 (v, v), 8);
+        __m128i w1 = _mm_srai_epi16 (_mm_unpackhi_epi8 (v, v), 8);
+        _mm_storeu_ps (dst + i, _mm_div_ps (_mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (w0, w0), 16)), div));
+        _mm_storeu_ps (dst + i + 4, _mm_div_ps (_mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpackhi_epi16 (w0, w0), 16)), div));
+        _mm_storeu_ps (dst + i + 8, _mm_div_ps (_mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (w1, w1), 16)), div));
+        _mm_storeu_ps (dst + i + 12, _mm_div_ps (_mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpackhi_epi16 (w1, w1), 16)), div));
+    }
+#endif
+    for (; i < nframes; i++)
+        dst[i] = ((float) src[i]) / 127.0;
+}
+
+static void
+netjack_float_to_s8 (int8_t *dst, const jack_default_audio_sample_t *src, jack_nframes_t nframes)
+{
+    jack_nframes_t i = 0;
+
+#if defined(NETJACK_SSE2)
+    // computed in double like the scalar code, see above.
+    const __m128d scale = _mm_set1_pd (127.0);
+    const __m128d top = _mm_set1_pd (127.0);
+    const __m128d bottom = _mm_set1_pd (-128.0);
+
+    for (; i + 8 <= nframes; i += 8)
+    {
+        __m128 a = _mm_loadu_ps (src + i);
+        __m128 b = _mm_loadu_ps (src + i + 4);
+        __m128d d0 = _mm_cvtps_pd (a);
+        __m128d d1 = _mm_cvtps_pd (_mm_movehl_ps (a, a));
+        __m128d d2 = _mm_cvtps_pd (b);
+        __m128d d3 = _mm_cvtps_pd (_mm_movehl_ps (b, b));
+        d0 = _mm_min_pd (_mm_max_pd (_mm_mul_pd (d0, scale), bottom), top);
+        d1 = _mm_min_pd (_mm_max_pd (_mm_mul_pd (d1, scale), bottom), top);
+        d2 = _mm_min_pd (_mm_max_pd (_mm_mul_pd (d2, scale), bottom), top);
+        d3 = _mm_min_pd (_mm_max_pd (_mm_mul_pd (d3, scale), bottom), top);
+        __m128i lo = _mm_unpacklo_epi64 (_mm_cvttpd_epi32 (d0), _mm_cvttpd_epi32 (d1));
+        __m128i hi = _mm_unpacklo_epi64 (_mm_cvttpd_epi32 (d2), _mm_cvttpd_epi32 (d3));
+        __m128i v = _mm_packs_epi16 (_mm_packs_epi32 (lo, hi), _mm_setzero_si128 ());
+        _mm_storel_epi64 ((__m128i *) (dst + i), v);
+    }
+#endif
+    for (; i < nframes; i++)
+    {
+        double val = src[i] * 127.0;
+
+        if (val <= -128.0)
+            dst[i] = -128;
+        else if (val >= 127.0)
+            dst[i] = 127;
+        else
+            dst[i] = (int8_t) val;
+    }
+}
+
 
 // fragment management functions.
+//
+// The cache is a ring indexed by framecnt: a packet lives in
+// packets[framecnt % size], so lookups are O(1).  Each packet keeps
+// a bitmap of the fragments it has, and the cache keeps bitmaps of
+// the slots in use and of the complete packets, plus the highest
+// complete framecnt, all updated as fragments arrive.
+
+#define BITMAP_WORDS(bits) (((bits) + 31) / 32)
+
+static inline void
+bitmap_set (uint32_t *map, int bit)
+{
+    map[bit >> 5] |= (1U << (bit & 31));
+}
+
+static inline void
+bitmap_clear (uint32_t *map, int bit)
+{
+    map[bit >> 5] &= ~(1U << (bit & 31));
+}
+
+static inline int
+bitmap_test (const uint32_t *map, int bit)
+{
+    return (map[bit >> 5] & (1U << (bit & 31))) != 0;
+}
+
+// Iterate `slot' over the set bits of `map', which has `words' words.
+#define bitmap_foreach(map, words, w, bits, slot)			\
+    for ((w) = 0; (w) < (words); (w)++)					\
+        for ((bits) = (map)[(w)];					\
+             (bits) && ((slot) = ((w) << 5) + __builtin_ctz (bits), 1);	\
+             (bits) &= (bits) - 1)
+
+static inline cache_packet *
+packet_cache_slot (packet_cache *pcache, jack_nframes_t framecnt)
+{
+    return &(pcache->packets[framecnt % pcache->size]);
+}
+
+// The packet for `framecnt', or NULL when it is not in the cache.
+static inline cache_packet *
+packet_cache_lookup (packet_cache *pcache, jack_nframes_t framecnt)
+{
+    cache_packet *cpack = packet_cache_slot (pcache, framecnt);
+
+    if (cpack->valid && (cpack->framecnt == framecnt))
+        return cpack;
+    return NULL;
+}
 
 packet_cache
 *packet_cache_new (int num_packets, int pkt_size, int mtu)
@@ -166,11 +492,26 @@ packet_cache
 
     pcache->size = num_packets;
     pcache->packets = malloc (sizeof (cache_packet) * num_packets);
+    pcache->valid_bitmap = calloc (BITMAP_WORDS (num_packets), sizeof (uint32_t));
+    pcache->complete_bitmap = calloc (BITMAP_WORDS (num_packets), sizeof (uint32_t));
+    pcache->highest_framecnt = 0;
+    pcache->highest_framecnt_valid = 0;
     pcache->master_address_valid = 0;
     pcache->last_framecnt_retreived = 0;
     pcache->last_framecnt_retreived_valid = 0;
+    pcache->arrivals_head = 0;
+    pcache->late_framecnt_valid = 0;
+    pcache->rx = calloc (1, sizeof (packet_cache_rx));
 
-    if (pcache->packets == NULL)
+    if ((pcache->packets == NULL) || (pcache->valid_bitmap == NULL)
+        || (pcache->complete_bitmap == NULL) || (pcache->rx == NULL))
+    {
+        jack_error ("could not allocate packet cache (2)");
+        return NULL;
+    }
+
+    pcache->rx->spare = malloc (NETJACK_RX_BATCH * fragment_payload_size);
+    if (pcache->rx->spare == NULL)
     {
         jack_error ("could not allocate packet cache (2)");
         return NULL;
@@ -180,12 +521,19 @@ packet_cache
     {
         pcache->packets[i].valid = 0;
         pcache->packets[i].num_fragments = fragment_number;
+        pcache->packets[i].fragments_received = 0;
         pcache->packets[i].packet_size = pkt_size;
         pcache->packets[i].mtu = mtu;
         pcache->packets[i].framecnt = 0;
-        pcache->packets[i].fragment_array = malloc (sizeof (char) * fragment_number);
-        pcache->packets[i].packet_buf = malloc (pkt_size);
-        if ((pcache->packets[i].fragment_array == NULL) || (pcache->packets[i].packet_buf == NULL))
+        pcache->packets[i].fec_group = 0;
+        pcache->packets[i].parity_bitmap = NULL;
+        pcache->packets[i].parity_buf = NULL;
+        pcache->packets[i].fragment_bitmap = calloc (BITMAP_WORDS (fragment_number), sizeof (uint32_t));
+        // room for a whole last fragment, so any fragment can be
+        // received in place.
+        pcache->packets[i].packet_buf = malloc (sizeof (jacknet_packet_header)
+                                                + fragment_number * fragment_payload_size);
+        if ((pcache->packets[i].fragment_bitmap == NULL) || (pcache->packets[i].packet_buf == NULL))
         {
             jack_error ("could not allocate packet cache (3)");
             return NULL;
@@ -205,158 +553,364 @@ packet_cache_free (packet_cache *pcache)
 
     for (i = 0; i < pcache->size; i++)
     {
-        free (pcache->packets[i].fragment_array);
+        free (pcache->packets[i].fragment_bitmap);
         free (pcache->packets[i].packet_buf);
+        free (pcache->packets[i].parity_bitmap);
+        free (pcache->packets[i].parity_buf);
     }
 
     free (pcache->packets);
+    free (pcache->valid_bitmap);
+    free (pcache->complete_bitmap);
+    free (pcache->rx->spare);
+    free (pcache->rx);
     free (pcache);
 }
 
+// Find the highest complete packet again, after it left the cache.
+static void
+packet_cache_update_highest (packet_cache *pcache)
+{
+    int words = BITMAP_WORDS (pcache->size);
+    uint32_t bits;
+    int w, slot;
+
+    pcache->highest_framecnt_valid = 0;
+
+    bitmap_foreach (pcache->complete_bitmap, words, w, bits, slot)
+    {
+        cache_packet *cpack = &(pcache->packets[slot]);
+
+        if (!pcache->highest_framecnt_valid || (cpack->framecnt > pcache->highest_framecnt))
+        {
+            pcache->highest_framecnt = cpack->framecnt;
+            pcache->highest_framecnt_valid = 1;
+        }
+    }
+}
+
+// Drop a packet from the cache.
+static void
+packet_cache_reset_packet (packet_cache *pcache, cache_packet *cpack)
+{
+    int slot = cpack - pcache->packets;
+    int was_highest = cache_packet_is_complete (cpack)
+        && pcache->highest_framecnt_valid
+        && (cpack->framecnt == pcache->highest_framecnt);
+
+    cache_packet_reset (cpack);
+    bitmap_clear (pcache->valid_bitmap, slot);
+    bitmap_clear (pcache->complete_bitmap, slot);
+
+    if (was_highest)
+        packet_cache_update_highest (pcache);
+}
+
+// The packet to store fragments of `framecnt' in.  A packet that is
+// still occupying the slot is dropped, unless it is newer, in which
+// case there is no room for `framecnt' any more and NULL is returned.
 cache_packet
 *packet_cache_get_packet (packet_cache *pcache, jack_nframes_t framecnt)
 {
-    int i;
-    cache_packet *retval;
+    cache_packet *cpack = packet_cache_slot (pcache, framecnt);
 
-    for (i = 0; i < pcache->size; i++)
+    if (cpack->valid)
     {
-        if (pcache->packets[i].valid && (pcache->packets[i].framecnt == framecnt))
-            return &(pcache->packets[i]);
+        if (cpack->framecnt == framecnt)
+            return cpack;
+        if (cpack->framecnt > framecnt)
+            return NULL;
+
+        //printf( "Dropping %d from Cache :S\n", cpack->framecnt );
+        packet_cache_reset_packet (pcache, cpack);
     }
 
-    // The Packet is not in the packet cache.
-    // find a free packet.
+    cache_packet_set_framecnt (cpack, framecnt);
+    bitmap_set (pcache->valid_bitmap, cpack - pcache->packets);
 
-    retval = packet_cache_get_free_packet (pcache);
-    if (retval != NULL)
+    return cpack;
+}
+
+void
+cache_packet_reset (cache_packet *pack)
+{
+    pack->valid = 0;
+    pack->fragments_received = 0;
+    memset (pack->fragment_bitmap, 0, BITMAP_WORDS (pack->num_fragments) * sizeof (uint32_t));
+    pack->fec_group = 0;
+    if (pack->parity_bitmap)
+        memset (pack->parity_bitmap, 0, BITMAP_WORDS (pack->num_fragments) * sizeof (uint32_t));
+}
+
+void
+cache_packet_set_framecnt (cache_packet *pack, jack_nframes_t framecnt)
+{
+    cache_packet_reset (pack);
+    pack->framecnt = framecnt;
+    pack->valid = 1;
+}
+
+int
+cache_packet_has_fragment (cache_packet *pack, int fragment_nr)
+{
+    return bitmap_test (pack->fragment_bitmap, fragment_nr);
+}
+
+static void
+packet_cache_log_arrival (packet_cache *pcache, jack_nframes_t framecnt, jack_time_t timestamp)
+{
+    packet_arrival *arrival = &(pcache->arrivals[pcache->arrivals_head % NETJACK_ARRIVAL_LOG]);
+
+    arrival->framecnt = framecnt;
+    arrival->timestamp = timestamp;
+    pcache->arrivals_head++;
+}
+
+// A fragment of a packet we already retreived, or gave up on.
+// Log the first one, so the jitter estimate sees late packets too.
+static void
+packet_cache_log_late (packet_cache *pcache, jack_nframes_t framecnt, jack_time_t timestamp)
+{
+    if (pcache->late_framecnt_valid && (framecnt <= pcache->late_framecnt))
+        return;
+
+    pcache->late_framecnt = framecnt;
+    pcache->late_framecnt_valid = 1;
+    packet_cache_log_arrival (pcache, framecnt, timestamp);
+}
+
+// Count in data fragment `fragment_nr', now that it is in place.
+static void
+packet_cache_fragment_done (packet_cache *pcache, cache_packet *pack, int fragment_nr)
+{
+    if (bitmap_test (pack->fragment_bitmap, fragment_nr))
+        return;
+
+    bitmap_set (pack->fragment_bitmap, fragment_nr);
+    if (++pack->fragments_received < pack->num_fragments)
+        return;
+
+    // that completed the packet
+    bitmap_set (pcache->complete_bitmap, pack - pcache->packets);
+    packet_cache_log_arrival (pcache, pack->framecnt, pack->recv_timestamp);
+    if (!pcache->highest_framecnt_valid || (pack->framecnt > pcache->highest_framecnt))
     {
-        cache_packet_set_framecnt (retval, framecnt);
-        return retval;
+        pcache->highest_framecnt = pack->framecnt;
+        pcache->highest_framecnt_valid = 1;
     }
+}
 
-    // No Free Packet available
-    // Get The Oldest packet and reset it.
+// XOR `len' bytes of `src' into `dst'.
+static inline void
+netjack_xor (char *dst, const char *src, int len)
+{
+    int i = 0;
 
-    retval = packet_cache_get_oldest_packet (pcache);
-    //printf( "Dropping %d from Cache :S\n", retval->framecnt );
-    cache_packet_reset (retval);
-    cache_packet_set_framecnt (retval, framecnt);
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t a, b;
 
-    return retval;
+        memcpy (&a, dst + i, 8);
+        memcpy (&b, src + i, 8);
+        a ^= b;
+        memcpy (dst + i, &a, 8);
+    }
+    for (; i < len; i++)
+        dst[i] ^= src[i];
 }
 
-// TODO: fix wrapping case... need to pass
-//       current expected frame here.
-//
-//       or just save framecount into packet_cache.
+// Payload bytes of data fragment `fragment_nr'.  Only the last one
+// is short.
+static inline int
+cache_packet_fragment_len (cache_packet *pack, int fragment_nr)
+{
+    int fragment_payload_size = pack->mtu - sizeof (jacknet_packet_header);
 
-cache_packet
-*packet_cache_get_oldest_packet (packet_cache *pcache)
+    if (fragment_nr < pack->num_fragments - 1)
+        return fragment_payload_size;
+    return pack->packet_size - sizeof (jacknet_packet_header) - fragment_nr * fragment_payload_size;
+}
+
+static inline int
+cache_packet_fec_groups (cache_packet *pack)
 {
-    jack_nframes_t minimal_frame = JACK_MAX_FRAMES;
-    cache_packet *retval = &(pcache->packets[0]);
+    return (pack->num_fragments + pack->fec_group - 1) / pack->fec_group;
+}
+
+// Parity buffers are only needed once a sender uses FEC, so they
+// are allocated for the whole cache when the first parity arrives.
+static int
+packet_cache_fec_alloc (packet_cache *pcache)
+{
+    int fragment_payload_size = pcache->mtu - sizeof (jacknet_packet_header);
     int i;
 
     for (i = 0; i < pcache->size; i++)
     {
-        if (pcache->packets[i].valid && (pcache->packets[i].framecnt < minimal_frame))
+        cache_packet *pack = &(pcache->packets[i]);
+
+        if (pack->parity_buf)
+            continue;
+
+        pack->parity_bitmap = calloc (BITMAP_WORDS (pack->num_fragments), sizeof (uint32_t));
+        pack->parity_buf = malloc (pack->num_fragments * fragment_payload_size);
+        if ((pack->parity_bitmap == NULL) || (pack->parity_buf == NULL))
         {
-            minimal_frame = pcache->packets[i].framecnt;
-            retval = &(pcache->packets[i]);
+            free (pack->parity_bitmap);
+            free (pack->parity_buf);
+            pack->parity_bitmap = NULL;
+            pack->parity_buf = NULL;
+            jack_error ("could not allocate FEC parity buffers");
+            return -1;
         }
     }
 
-    return retval;
+    return 0;
 }
 
-cache_packet
-*packet_cache_get_free_packet (packet_cache *pcache)
+// Rebuild the fragment missing from `group', if it is the only one
+// and the group's parity is here.
+static void
+packet_cache_fec_recover (packet_cache *pcache, cache_packet *pack, int group)
 {
-    int i;
+    int fragment_payload_size = pack->mtu - sizeof (jacknet_packet_header);
+    char *packet_bufX = pack->packet_buf + sizeof (jacknet_packet_header);
+    int groups, missing = -1;
+    int nr, len;
+    char *dst;
 
-    for (i = 0; i < pcache->size; i++)
+    if (!bitmap_test (pack->parity_bitmap, group))
+        return;
+
+    groups = cache_packet_fec_groups (pack);
+    for (nr = group; nr < pack->num_fragments; nr += groups)
+    {
+        if (bitmap_test (pack->fragment_bitmap, nr))
+            continue;
+        if (missing >= 0)
+            return;
+        missing = nr;
+    }
+    if (missing < 0)
+        return;
+
+    len = cache_packet_fragment_len (pack, missing);
+    dst = packet_bufX + missing * fragment_payload_size;
+    memcpy (dst, pack->parity_buf + group * fragment_payload_size, len);
+    for (nr = group; nr < pack->num_fragments; nr += groups)
     {
-        if (pcache->packets[i].valid == 0)
-            return &(pcache->packets[i]);
+        int nr_len = cache_packet_fragment_len (pack, nr);
+
+        if (nr != missing)
+            netjack_xor (dst, packet_bufX + nr * fragment_payload_size,
+                         (nr_len < len) ? nr_len : len);
     }
 
-    return NULL;
+    packet_cache_fragment_done (pcache, pack, missing);
 }
 
-void
-cache_packet_reset (cache_packet *pack)
+// Fragment `fragment_nr' came in; its group may now be rebuilt.
+// Not done while storing, because a rebuilt fragment may land in a
+// slot a batched receive is still using.
+static inline void
+packet_cache_fec_check (packet_cache *pcache, cache_packet *pack, jack_nframes_t fragment_nr)
 {
-    int i;
-    pack->valid = 0;
-
-    // XXX: i dont think this is necessary here...
-    //      fragement array is cleared in _set_framecnt()
-
-    for (i = 0; i < pack->num_fragments; i++)
-        pack->fragment_array[i] = 0;
+    if (pack->fec_group && (fragment_nr < pack->num_fragments))
+        packet_cache_fec_recover (pcache, pack, fragment_nr % cache_packet_fec_groups (pack));
 }
 
-void
-cache_packet_set_framecnt (cache_packet *pack, jack_nframes_t framecnt)
+static void
+packet_cache_store_parity (packet_cache *pcache, cache_packet *pack, jacknet_packet_header *pkthdr, char *payload, int payload_len)
 {
-    int i;
+    int fragment_payload_size = pack->mtu - sizeof (jacknet_packet_header);
+    jack_nframes_t fragment_nr = ntohl (pkthdr->fragment_nr);
+    int k = (fragment_nr >> NETJACK_FEC_GROUP_SHIFT) & NETJACK_FEC_GROUP_MAX;
+    int group = fragment_nr & NETJACK_FEC_INDEX_MASK;
 
-    pack->framecnt = framecnt;
+    if ((k == 0) || (pack->fec_group && (pack->fec_group != k)))
+        return;
 
-    for (i = 0; i < pack->num_fragments; i++)
-        pack->fragment_array[i] = 0;
+    if ((pack->parity_buf == NULL) && (packet_cache_fec_alloc (pcache) < 0))
+        return;
 
-    pack->valid = 1;
+    pack->fec_group = k;
+    if ((group >= cache_packet_fec_groups (pack))
+        || (payload_len < cache_packet_fragment_len (pack, group))
+        || (payload_len > fragment_payload_size))
+        return;
+
+    if (bitmap_test (pack->parity_bitmap, group))
+        return;
+
+    // the header comes with fragment 0, which may be the one to rebuild.
+    if (!bitmap_test (pack->fragment_bitmap, 0))
+    {
+        memcpy (pack->packet_buf, pkthdr, sizeof (jacknet_packet_header));
+        ((jacknet_packet_header *) pack->packet_buf)->fragment_nr = 0;
+    }
+
+    memcpy (pack->parity_buf + group * fragment_payload_size, payload, payload_len);
+    bitmap_set (pack->parity_bitmap, group);
+    packet_cache_fec_recover (pcache, pack, group);
 }
 
-void
-cache_packet_add_fragment (cache_packet *pack, char *packet_buf, int rcv_len)
+// Store one fragment, whose payload may already be in place.
+// The caller sets recv_timestamp first, and calls
+// packet_cache_fec_check() for data fragments when it is safe.
+static void
+packet_cache_store_fragment (packet_cache *pcache, cache_packet *pack, jacknet_packet_header *pkthdr, char *payload, int payload_len)
 {
-    jacknet_packet_header *pkthdr = (jacknet_packet_header *) packet_buf;
     int fragment_payload_size = pack->mtu - sizeof (jacknet_packet_header);
     char *packet_bufX = pack->packet_buf + sizeof (jacknet_packet_header);
-    char *dataX = packet_buf + sizeof (jacknet_packet_header);
-
     jack_nframes_t fragment_nr = ntohl (pkthdr->fragment_nr);
-    jack_nframes_t framecnt    = ntohl (pkthdr->framecnt);
+    char *dst;
 
-    if (framecnt != pack->framecnt)
+    if (fragment_nr & NETJACK_FEC_PARITY)
     {
-        jack_error ("errror. framecnts dont match");
+        packet_cache_store_parity (pcache, pack, pkthdr, payload, payload_len);
         return;
     }
 
+    if (fragment_nr >= pack->num_fragments)
+        return;
 
-    if (fragment_nr == 0)
+    if ((fragment_nr * fragment_payload_size + payload_len) > (pack->packet_size - sizeof (jacknet_packet_header)))
     {
-        memcpy (pack->packet_buf, packet_buf, rcv_len);
-        pack->fragment_array[0] = 1;
-
+        jack_error ("too long packet received...");
         return;
     }
 
-    if ((fragment_nr < pack->num_fragments) && (fragment_nr > 0))
+    if (fragment_nr == 0)
+        memcpy (pack->packet_buf, pkthdr, sizeof (jacknet_packet_header));
+
+    dst = packet_bufX + fragment_nr * fragment_payload_size;
+    if (payload != dst)
+        memcpy (dst, payload, payload_len);
+
+    packet_cache_fragment_done (pcache, pack, fragment_nr);
+}
+
+void
+packet_cache_add_fragment (packet_cache *pcache, cache_packet *pack, char *packet_buf, int rcv_len)
+{
+    jacknet_packet_header *pkthdr = (jacknet_packet_header *) packet_buf;
+    jack_nframes_t framecnt    = ntohl (pkthdr->framecnt);
+
+    if (framecnt != pack->framecnt)
     {
-        if ((fragment_nr * fragment_payload_size + rcv_len - sizeof (jacknet_packet_header)) <= (pack->packet_size - sizeof (jacknet_packet_header)))
-        {
-            memcpy (packet_bufX + fragment_nr * fragment_payload_size, dataX, rcv_len - sizeof (jacknet_packet_header));
-            pack->fragment_array[fragment_nr] = 1;
-        }
-        else
-            jack_error ("too long packet received...");
+        jack_error ("errror. framecnts dont match");
+        return;
     }
+
+    packet_cache_store_fragment (pcache, pack, pkthdr, packet_buf + sizeof (jacknet_packet_header),
+                                 rcv_len - sizeof (jacknet_packet_header));
+    packet_cache_fec_check (pcache, pack, ntohl (pkthdr->fragment_nr));
 }
 
 int
 cache_packet_is_complete (cache_packet *pack)
 {
-    int i;
-    for (i = 0; i < pack->num_fragments; i++)
-        if (pack->fragment_array[i] == 0)
-            return 0;
-
-    return 1;
+    return pack->fragments_received == pack->num_fragments;
 }
 
 #ifndef WIN32
@@ -516,13 +1070,156 @@ netjack_poll_deadline (int sockfd, jack_time_t deadline, jack_time_t (*get_micro
     return 0;
 }
 #endif
+// Accept a datagram from the master only, adopting the first sender
+// as the master.
+static int
+packet_cache_check_sender (packet_cache *pcache, struct sockaddr_in *sender_address, int senderlen)
+{
+    if (pcache->master_address_valid) {
+	// Verify its from our master.
+	return memcmp (sender_address, &(pcache->master_address), senderlen) == 0;
+    }
+
+    // Setup this one as master
+    memcpy ( &(pcache->master_address), sender_address, senderlen );
+    pcache->master_address_valid = 1;
+    return 1;
+}
+
 // This now reads all a socket has into the cache.
 // replacing netjack_recv functions.
 
+#if defined(HAVE_RECVMMSG) && !defined(WIN32)
 void
 packet_cache_drain_socket( packet_cache *pcache, int sockfd, jack_time_t (*get_microseconds)(void) )
 {
-    char *rx_packet = alloca (pcache->mtu);
+    packet_cache_rx *rx = pcache->rx;
+    int hdr_size = sizeof (jacknet_packet_header);
+    int fragment_payload_size = pcache->mtu - hdr_size;
+    jack_time_t now;
+    jack_nframes_t framecnt;
+    int fragment_nr;
+    int i, n;
+
+    do {
+	// Aim each datagram at the slot of the fragment that should
+	// follow the previous one, while it is still missing.
+	cache_packet *pack = rx->pack;
+	int next = rx->next_fragment;
+
+	if (pack && (!pack->valid || pack->framecnt != rx->framecnt))
+	    pack = NULL;
+
+	for (i = 0; i < NETJACK_RX_BATCH; i++) {
+	    struct iovec *iov = &(rx->iov[2*i]);
+	    struct msghdr *msg = &(rx->msgs[i].msg_hdr);
+
+	    iov[0].iov_base = &(rx->headers[i]);
+	    iov[0].iov_len = hdr_size;
+
+	    if (pack && (next < pack->num_fragments) && !cache_packet_has_fragment (pack, next)) {
+		rx->predicted[i] = pack;
+		rx->predicted_fragment[i] = next;
+		iov[1].iov_base = pack->packet_buf + hdr_size + next * fragment_payload_size;
+		next++;
+	    } else {
+		rx->predicted[i] = NULL;
+		iov[1].iov_base = rx->spare + i * fragment_payload_size;
+		pack = NULL;
+	    }
+	    iov[1].iov_len = fragment_payload_size;
+
+	    msg->msg_name = &(rx->addrs[i]);
+	    msg->msg_namelen = sizeof (struct sockaddr_in);
+	    msg->msg_iov = iov;
+	    msg->msg_iovlen = 2;
+	    msg->msg_control = NULL;
+	    msg->msg_controllen = 0;
+	    msg->msg_flags = 0;
+	}
+
+	n = recvmmsg (sockfd, rx->msgs, NETJACK_RX_BATCH, MSG_DONTWAIT, NULL);
+	if (n <= 0)
+	    return;
+
+	now = get_microseconds();
+
+	// First settle the datagrams that landed where they belong,
+	// and move the others out of the slots they were aimed at,
+	// before anything else is written to the cache.
+	for (i = 0; i < n; i++) {
+	    int payload_len = (int) rx->msgs[i].msg_len - hdr_size;
+	    jacknet_packet_header *pkthdr = &(rx->headers[i]);
+	    char *landed = rx->iov[2*i+1].iov_base;
+
+	    rx->payload[i] = NULL;
+
+	    if (payload_len < 0 || (rx->msgs[i].msg_hdr.msg_flags & MSG_TRUNC))
+		continue;
+	    if (!packet_cache_check_sender (pcache, &(rx->addrs[i]), rx->msgs[i].msg_hdr.msg_namelen))
+		continue;
+
+	    framecnt = ntohl (pkthdr->framecnt);
+	    if( pcache->last_framecnt_retreived_valid && (framecnt <= pcache->last_framecnt_retreived )) {
+		packet_cache_log_late (pcache, framecnt, now);
+		continue;
+	    }
+
+	    fragment_nr = ntohl (pkthdr->fragment_nr);
+	    if (rx->predicted[i]
+		&& rx->predicted[i]->framecnt == framecnt
+		&& rx->predicted_fragment[i] == fragment_nr) {
+		rx->predicted[i]->recv_timestamp = now;
+		packet_cache_store_fragment (pcache, rx->predicted[i], pkthdr, landed, payload_len);
+		continue;
+	    }
+
+	    if (rx->predicted[i]) {
+		rx->payload[i] = rx->spare + i * fragment_payload_size;
+		memcpy (rx->payload[i], landed, payload_len);
+	    } else {
+		rx->payload[i] = landed;
+	    }
+	}
+
+	for (i = 0; i < n; i++) {
+	    jacknet_packet_header *pkthdr = &(rx->headers[i]);
+	    cache_packet *cpack;
+
+	    if (rx->payload[i] == NULL) {
+		if (rx->predicted[i] && cache_packet_has_fragment (rx->predicted[i], rx->predicted_fragment[i])) {
+		    packet_cache_fec_check (pcache, rx->predicted[i], rx->predicted_fragment[i]);
+		    rx->pack = rx->predicted[i];
+		    rx->framecnt = rx->pack->framecnt;
+		    rx->next_fragment = rx->predicted_fragment[i] + 1;
+		}
+		continue;
+	    }
+
+	    framecnt = ntohl (pkthdr->framecnt);
+	    cpack = packet_cache_get_packet (pcache, framecnt);
+	    if (cpack == NULL)
+		continue;
+	    cpack->recv_timestamp = now;
+	    packet_cache_store_fragment (pcache, cpack, pkthdr, rx->payload[i],
+					 (int) rx->msgs[i].msg_len - hdr_size);
+
+	    fragment_nr = ntohl (pkthdr->fragment_nr);
+	    if (fragment_nr & NETJACK_FEC_PARITY)
+		continue;
+	    packet_cache_fec_check (pcache, cpack, fragment_nr);
+
+	    rx->pack = cpack;
+	    rx->framecnt = framecnt;
+	    rx->next_fragment = fragment_nr + 1;
+	}
+    } while (n == NETJACK_RX_BATCH);
+}
+#else
+void
+packet_cache_drain_socket( packet_cache *pcache, int sockfd, jack_time_t (*get_microseconds)(void) )
+{
+    char *rx_packet = pcache->rx->spare;
     jacknet_packet_header *pkthdr = (jacknet_packet_header *) rx_packet;
     int rcv_len;
     jack_nframes_t framecnt;
@@ -547,62 +1244,59 @@ packet_cache_drain_socket( packet_cache *pcache, int sockfd, jack_time_t (*get_m
         if (rcv_len < 0)
             return;
 
-	if (pcache->master_address_valid) {
-	    // Verify its from our master.
-	    if (memcmp (&sender_address, &(pcache->master_address), senderlen) != 0)
-		continue;
-	} else {
-	    // Setup this one as master
-	    //printf( "setup master...\n" );
-	    memcpy ( &(pcache->master_address), &sender_address, senderlen );
-	    pcache->master_address_valid = 1;
-	}
+	if (!packet_cache_check_sender (pcache, &sender_address, senderlen))
+	    continue;
 
         framecnt = ntohl (pkthdr->framecnt);
-	if( pcache->last_framecnt_retreived_valid && (framecnt <= pcache->last_framecnt_retreived ))
+	if( pcache->last_framecnt_retreived_valid && (framecnt <= pcache->last_framecnt_retreived )) {
+	    packet_cache_log_late (pcache, framecnt, get_microseconds());
 	    continue;
+	}
 
         cpack = packet_cache_get_packet (pcache, framecnt);
-        cache_packet_add_fragment (cpack, rx_packet, rcv_len);
+        if (cpack == NULL)
+            continue;
 	cpack->recv_timestamp = get_microseconds();
+        packet_cache_add_fragment (pcache, cpack, rx_packet, rcv_len);
     }
 }
+#endif
 
 void
 packet_cache_reset_master_address( packet_cache *pcache )
 {
+    int words = BITMAP_WORDS (pcache->size);
+    uint32_t bits;
+    int w, slot;
+
     pcache->master_address_valid = 0;
     pcache->last_framecnt_retreived = 0;
     pcache->last_framecnt_retreived_valid = 0;
+    pcache->late_framecnt_valid = 0;
+
+    // a new master starts counting frames afresh.
+    bitmap_foreach (pcache->valid_bitmap, words, w, bits, slot)
+        packet_cache_reset_packet (pcache, &(pcache->packets[slot]));
 }
 
 void
 packet_cache_clear_old_packets (packet_cache *pcache, jack_nframes_t framecnt )
 {
-    int i;
+    int words = BITMAP_WORDS (pcache->size);
+    uint32_t bits;
+    int w, slot;
 
-    for (i = 0; i < pcache->size; i++)
+    bitmap_foreach (pcache->valid_bitmap, words, w, bits, slot)
     {
-        if (pcache->packets[i].valid && (pcache->packets[i].framecnt < framecnt))
-        {
-            cache_packet_reset (&(pcache->packets[i]));
-        }
+        if (pcache->packets[slot].framecnt < framecnt)
+            packet_cache_reset_packet (pcache, &(pcache->packets[slot]));
     }
 }
 
 int
 packet_cache_retreive_packet_pointer( packet_cache *pcache, jack_nframes_t framecnt, char **packet_buf, int pkt_size, jack_time_t *timestamp )
 {
-    int i;
-    cache_packet *cpack = NULL;
-
-
-    for (i = 0; i < pcache->size; i++) {
-        if (pcache->packets[i].valid && (pcache->packets[i].framecnt == framecnt)) {
-	    cpack = &(pcache->packets[i]);
-            break;
-	}
-    }
+    cache_packet *cpack = packet_cache_lookup (pcache, framecnt);
 
     if( cpack == NULL ) {
 	//printf( "retreive packet: %d....not found\n", framecnt );
@@ -627,16 +1321,7 @@ packet_cache_retreive_packet_pointer( packet_cache *pcache, jack_nframes_t frame
 int
 packet_cache_release_packet( packet_cache *pcache, jack_nframes_t framecnt )
 {
-    int i;
-    cache_packet *cpack = NULL;
-
-
-    for (i = 0; i < pcache->size; i++) {
-        if (pcache->packets[i].valid && (pcache->packets[i].framecnt == framecnt)) {
-	    cpack = &(pcache->packets[i]);
-            break;
-	}
-    }
+    cache_packet *cpack = packet_cache_lookup (pcache, framecnt);
 
     if( cpack == NULL ) {
 	//printf( "retreive packet: %d....not found\n", framecnt );
@@ -647,7 +1332,7 @@ packet_cache_release_packet( packet_cache *pcache, jack_nframes_t framecnt )
 	return -1;
     }
 
-    cache_packet_reset (cpack);
+    packet_cache_reset_packet (pcache, cpack);
     packet_cache_clear_old_packets( pcache, framecnt );
 
     return 0;
@@ -656,14 +1341,14 @@ float
 packet_cache_get_fill( packet_cache *pcache, jack_nframes_t expected_framecnt )
 {
     int num_packets_before_us = 0;
-    int i;
+    int words = BITMAP_WORDS (pcache->size);
+    uint32_t bits;
+    int w, slot;
 
-    for (i = 0; i < pcache->size; i++)
+    bitmap_foreach (pcache->complete_bitmap, words, w, bits, slot)
     {
-	cache_packet *cpack = &(pcache->packets[i]);
-        if (cpack->valid && cache_packet_is_complete( cpack ))
-	    if( cpack->framecnt >= expected_framecnt )
-		num_packets_before_us += 1;
+	if( pcache->packets[slot].framecnt >= expected_framecnt )
+	    num_packets_before_us += 1;
     }
 
     return 100.0 * (float)num_packets_before_us / (float)( pcache->size ) ;
@@ -673,19 +1358,24 @@ packet_cache_get_fill( packet_cache *pcache, jack_nframes_t expected_framecnt )
 int
 packet_cache_get_next_available_framecnt( packet_cache *pcache, jack_nframes_t expected_framecnt, jack_nframes_t *framecnt )
 {
-    int i;
     jack_nframes_t best_offset = JACK_MAX_FRAMES/2-1;
     int retval = 0;
+    int words = BITMAP_WORDS (pcache->size);
+    uint32_t bits;
+    int w, slot;
+    cache_packet *cpack;
 
-    for (i = 0; i < pcache->size; i++)
-    {
-	cache_packet *cpack = &(pcache->packets[i]);
-	//printf( "p%d: valid=%d, frame %d\n", i, cpack->valid, cpack->framecnt );
+    // the common case: the expected packet is there.
+    cpack = packet_cache_lookup (pcache, expected_framecnt);
+    if( cpack && cache_packet_is_complete( cpack ) ) {
+	if( framecnt )
+	    *framecnt = expected_framecnt;
+	return 1;
+    }
 
-        if (!cpack->valid || !cache_packet_is_complete( cpack )) {
-	    //printf( "invalid\n" );
-	    continue;
-	}
+    bitmap_foreach (pcache->complete_bitmap, words, w, bits, slot)
+    {
+	cpack = &(pcache->packets[slot]);
 
 	if( cpack->framecnt < expected_framecnt )
 	    continue;
@@ -696,9 +1386,6 @@ packet_cache_get_next_available_framecnt( packet_cache *pcache, jack_nframes_t e
 
 	best_offset = cpack->framecnt - expected_framecnt;
 	retval = 1;
-
-	if( best_offset == 0 )
-	    break;
     }
     if( retval && framecnt )
 	*framecnt = expected_framecnt + best_offset;
@@ -709,51 +1396,28 @@ packet_cache_get_next_available_framecnt( packet_cache *pcache, jack_nframes_t e
 int
 packet_cache_get_highest_available_framecnt( packet_cache *pcache, jack_nframes_t *framecnt )
 {
-    int i;
-    jack_nframes_t best_value = 0;
-    int retval = 0;
-
-    for (i = 0; i < pcache->size; i++)
-    {
-	cache_packet *cpack = &(pcache->packets[i]);
-	//printf( "p%d: valid=%d, frame %d\n", i, cpack->valid, cpack->framecnt );
-
-        if (!cpack->valid || !cache_packet_is_complete( cpack )) {
-	    //printf( "invalid\n" );
-	    continue;
-	}
-
-	if (cpack->framecnt < best_value) {
-	    continue;
-	}
-
-	best_value = cpack->framecnt;
-	retval = 1;
+    if( !pcache->highest_framecnt_valid )
+	return 0;
 
-    }
-    if( retval && framecnt )
-	*framecnt = best_value;
+    if( framecnt )
+	*framecnt = pcache->highest_framecnt;
 
-    return retval;
+    return 1;
 }
 
 // Returns 0 when no valid packet is inside the cache.
 int
 packet_cache_find_latency( packet_cache *pcache, jack_nframes_t expected_framecnt, jack_nframes_t *framecnt )
 {
-    int i;
     jack_nframes_t best_offset = 0;
     int retval = 0;
+    int words = BITMAP_WORDS (pcache->size);
+    uint32_t bits;
+    int w, slot;
 
-    for (i = 0; i < pcache->size; i++)
+    bitmap_foreach (pcache->complete_bitmap, words, w, bits, slot)
     {
-	cache_packet *cpack = &(pcache->packets[i]);
-	//printf( "p%d: valid=%d, frame %d\n", i, cpack->valid, cpack->framecnt );
-
-        if (!cpack->valid || !cache_packet_is_complete( cpack )) {
-	    //printf( "invalid\n" );
-	    continue;
-	}
+	cache_packet *cpack = &(pcache->packets[slot]);
 
 	if( (cpack->framecnt - expected_framecnt) < best_offset ) {
 	    continue;
@@ -763,16 +1427,218 @@ packet_cache_find_latency( packet_cache *pcache, jack_nframes_t expected_framecn
 	retval = 1;
 
 	if( best_offset == 0 )
-	    break;
+	    goto done;
     }
+done:
     if( retval && framecnt )
 	*framecnt = JACK_MAX_FRAMES - best_offset;
 
     return retval;
 }
+
+// Returns 0 when the reader at `cursor' has seen every arrival.
+// A reader that fell more than NETJACK_ARRIVAL_LOG behind loses
+// the oldest ones.
+int
+packet_cache_next_arrival( packet_cache *pcache, unsigned int *cursor, jack_nframes_t *framecnt, jack_time_t *timestamp )
+{
+    packet_arrival *arrival;
+
+    if( *cursor == pcache->arrivals_head )
+	return 0;
+
+    if( (pcache->arrivals_head - *cursor) > NETJACK_ARRIVAL_LOG )
+	*cursor = pcache->arrivals_head - NETJACK_ARRIVAL_LOG;
+
+    arrival = &(pcache->arrivals[*cursor % NETJACK_ARRIVAL_LOG]);
+    *framecnt = arrival->framecnt;
+    *timestamp = arrival->timestamp;
+    (*cursor)++;
+
+    return 1;
+}
 // fragmented packet IO
+#ifndef WIN32
+
+// Send `count' fragments, described by header/payload iovec pairs.
+static void
+netjack_send_fragments (int sockfd, struct iovec *iov, int count, int flags, struct sockaddr *addr, int addr_size, int mtu)
+{
+    int sent = 0;
+    int err;
+
+#ifdef UDP_SEGMENT
+    // With GSO the kernel (or the NIC) cuts one large send into
+    // mtu sized datagrams.  Only the last one may be short, and
+    // there are limits on the segment count and the total size.
+    if (netjack_udp_gso && count > 1) {
+	int max_segments = 65000 / mtu;
+	char control[CMSG_SPACE (sizeof (uint16_t))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+
+	if (max_segments > 64)
+	    max_segments = 64;
+
+	while (netjack_udp_gso && (count - sent) > 1) {
+	    int chunk = count - sent;
+
+	    if (chunk > max_segments)
+		chunk = max_segments;
+
+	    memset (&msg, 0, sizeof (msg));
+	    msg.msg_name = addr;
+	    msg.msg_namelen = addr_size;
+	    msg.msg_iov = &(iov[2*sent]);
+	    msg.msg_iovlen = 2*chunk;
+	    msg.msg_control = control;
+	    msg.msg_controllen = sizeof (control);
+
+	    cmsg = CMSG_FIRSTHDR (&msg);
+	    cmsg->cmsg_level = SOL_UDP;
+	    cmsg->cmsg_type = UDP_SEGMENT;
+	    cmsg->cmsg_len = CMSG_LEN (sizeof (uint16_t));
+	    *((uint16_t *) CMSG_DATA (cmsg)) = mtu;
+
+	    if (sendmsg (sockfd, &msg, flags) >= 0) {
+		sent += chunk;
+	    } else if (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP) {
+		jack_error ("netjack: UDP segmentation offload unavailable, sending fragments one by one");
+		netjack_udp_gso = 0;
+	    } else {
+		perror( "send" );
+		return;
+	    }
+	}
+    }
+#endif
+
+#ifdef HAVE_SENDMMSG
+    {
+	struct mmsghdr *msgs = alloca (sizeof (struct mmsghdr) * count);
+	int i;
+
+	memset (msgs, 0, sizeof (struct mmsghdr) * count);
+	for (i = sent; i < count; i++) {
+	    msgs[i].msg_hdr.msg_name = addr;
+	    msgs[i].msg_hdr.msg_namelen = addr_size;
+	    msgs[i].msg_hdr.msg_iov = &(iov[2*i]);
+	    msgs[i].msg_hdr.msg_iovlen = 2;
+	}
+
+	while (sent < count) {
+	    err = sendmmsg (sockfd, &(msgs[sent]), count - sent, flags);
+	    if (err <= 0) {
+		perror( "send" );
+		return;
+	    }
+	    sent += err;
+	}
+    }
+#else
+    {
+	struct msghdr msg;
+
+	memset (&msg, 0, sizeof (msg));
+	msg.msg_name = addr;
+	msg.msg_namelen = addr_size;
+	msg.msg_iovlen = 2;
+
+	for (; sent < count; sent++) {
+	    msg.msg_iov = &(iov[2*sent]);
+	    err = sendmsg (sockfd, &msg, flags);
+	    if( err<0 ) {
+		perror( "send" );
+		return;
+	    }
+	}
+    }
+#endif
+}
+
+// Send one parity fragment for each group of `fec_group' fragments,
+// see NETJACK_FEC_PARITY.  `iov' describes the data fragments.
+static void
+netjack_send_parity (int sockfd, struct iovec *iov, int frag_cnt, int fec_group, int flags, struct sockaddr *addr, int addr_size, int mtu)
+{
+    int fragment_payload_size = mtu - sizeof (jacknet_packet_header);
+    int groups = (frag_cnt + fec_group - 1) / fec_group;
+    jacknet_packet_header *headers = alloca (sizeof (jacknet_packet_header) * groups);
+    struct iovec *parity_iov = alloca (sizeof (struct iovec) * 2 * groups);
+    char *parity = alloca (groups * fragment_payload_size);
+    int g, i;
+
+    for (g = 0; g < groups; g++)
+    {
+	char *dst = parity + g * fragment_payload_size;
+
+	// the first member is the longest one.
+	memcpy (dst, iov[2*g+1].iov_base, iov[2*g+1].iov_len);
+	for (i = g + groups; i < frag_cnt; i += groups)
+	    netjack_xor (dst, iov[2*i+1].iov_base, iov[2*i+1].iov_len);
+
+	memcpy (&(headers[g]), iov[0].iov_base, sizeof (jacknet_packet_header));
+	headers[g].fragment_nr = htonl (NETJACK_FEC_PARITY
+					| (fec_group << NETJACK_FEC_GROUP_SHIFT) | g);
+
+	parity_iov[2*g].iov_base = &(headers[g]);
+	parity_iov[2*g].iov_len = sizeof (jacknet_packet_header);
+	parity_iov[2*g+1].iov_base = dst;
+	parity_iov[2*g+1].iov_len = iov[2*g+1].iov_len;
+    }
+
+    netjack_send_fragments (sockfd, parity_iov, groups, flags, addr, addr_size, mtu);
+}
+
 void
-netjack_sendto (int sockfd, char *packet_buf, int pkt_size, int flags, struct sockaddr *addr, int addr_size, int mtu)
+netjack_sendto_fec (int sockfd, char *packet_buf, int pkt_size, int flags, struct sockaddr *addr, int addr_size, int mtu, int fec_group)
+{
+    jacknet_packet_header *pkthdr;
+    int fragment_payload_size = mtu - sizeof (jacknet_packet_header);
+
+    if (pkt_size <= mtu && fec_group == 0) {
+	int err;
+	pkthdr = (jacknet_packet_header *) packet_buf;
+        pkthdr->fragment_nr = htonl (0);
+        err = sendto(sockfd, packet_buf, pkt_size, flags, addr, addr_size);
+	if( err<0 ) {
+	    //printf( "error in send\n" );
+	    perror( "send" );
+	}
+    }
+    else
+    {
+	// Every fragment gets its own copy of the header, the payload
+	// is sent straight from packet_buf.
+	int payload_size = pkt_size - sizeof (jacknet_packet_header);
+	int frag_cnt = (payload_size - 1) / fragment_payload_size + 1;
+	jacknet_packet_header *headers = alloca (sizeof (jacknet_packet_header) * frag_cnt);
+	struct iovec *iov = alloca (sizeof (struct iovec) * 2 * frag_cnt);
+	char *packet_bufX = packet_buf + sizeof (jacknet_packet_header);
+	int i;
+
+	for (i = 0; i < frag_cnt; i++)
+	{
+	    memcpy (&(headers[i]), packet_buf, sizeof (jacknet_packet_header));
+	    headers[i].fragment_nr = htonl (i);
+
+	    iov[2*i].iov_base = &(headers[i]);
+	    iov[2*i].iov_len = sizeof (jacknet_packet_header);
+	    iov[2*i+1].iov_base = packet_bufX + i * fragment_payload_size;
+	    iov[2*i+1].iov_len = (i < frag_cnt - 1) ? fragment_payload_size
+		: payload_size - i * fragment_payload_size;
+	}
+
+	netjack_send_fragments (sockfd, iov, frag_cnt, flags, addr, addr_size, mtu);
+	if (fec_group)
+	    netjack_send_parity (sockfd, iov, frag_cnt, fec_group, flags, addr, addr_size, mtu);
+    }
+}
+
+#else
+// No FEC here, `fec_group' is ignored.
+void
+netjack_sendto_fec (int sockfd, char *packet_buf, int pkt_size, int flags, struct sockaddr *addr, int addr_size, int mtu, int fec_group)
 {
     int frag_cnt = 0;
     char *tx_packet, *dataX;
@@ -824,6 +1690,13 @@ netjack_sendto (int sockfd, char *packet_buf, int pkt_size, int flags, struct so
 	}
     }
 }
+#endif
+
+void
+netjack_sendto (int sockfd, char *packet_buf, int pkt_size, int flags, struct sockaddr *addr, int addr_size, int mtu)
+{
+    netjack_sendto_fec (sockfd, packet_buf, pkt_size, flags, addr, addr_size, mtu, 0);
+}
 
 
 void
@@ -896,7 +1769,7 @@ encode_midi_buffer (uint32_t *buffer_uint32, unsigned int buffer_size_uint32, ja
 
 // render functions for float
 void
-render_payload_to_jack_ports_float ( void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes, int dont_htonl_floats)
+render_payload_to_jack_ports_float (void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, const char *capture_types, JSList *capture_srcs, jack_nframes_t nframes, int dont_htonl_floats)
 {
     int chn = 0;
     JSList *node = capture_ports;
@@ -911,8 +1784,6 @@ render_payload_to_jack_ports_float ( void *packet_payload, jack_nframes_t net_pe
 
     while (node != NULL)
     {
-        int i;
-        int_float_t val;
 #if HAVE_SAMPLERATE
         SRC_DATA src;
 #endif
@@ -920,19 +1791,14 @@ render_payload_to_jack_ports_float ( void *packet_payload, jack_nframes_t net_pe
         jack_port_t *port = (jack_port_t *) node->data;
         jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
 
-        const char *porttype = jack_port_type (port);
-
-        if (jack_port_is_audio (porttype))
+        if (capture_types[chn] == NETJACK_PORT_AUDIO)
         {
 #if HAVE_SAMPLERATE
             // audio port, resample if necessary
             if (net_period_down != nframes)
             {
                 SRC_STATE *src_state = src_node->data;
-                for (i = 0; i < net_period_down; i++)
-                {
-                    packet_bufX[i] = ntohl (packet_bufX[i]);
-                }
+                netjack_swap32 (packet_bufX, packet_bufX, net_period_down);
 
                 src.data_in = (float *) packet_bufX;
                 src.input_frames = net_period_down;
@@ -956,16 +1822,11 @@ render_payload_to_jack_ports_float ( void *packet_payload, jack_nframes_t net_pe
 		}
 		else
 		{
-		    for (i = 0; i < net_period_down; i++)
-		    {
-			val.i = packet_bufX[i];
-			val.i = ntohl (val.i);
-			buf[i] = val.f;
-		    }
+		    netjack_swap32 ((uint32_t *) buf, packet_bufX, net_period_down);
 		}
             }
         }
-        else if (jack_port_is_midi (porttype))
+        else if (capture_types[chn] == NETJACK_PORT_MIDI)
         {
             // midi port, decode midi events
             // convert the data buffer to a standard format (uint32_t based)
@@ -980,7 +1841,7 @@ render_payload_to_jack_ports_float ( void *packet_payload, jack_nframes_t net_pe
 }
 
 void
-render_jack_ports_to_payload_float (JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats )
+render_jack_ports_to_payload_float (JSList *playback_ports, const char *playback_types, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats )
 {
     int chn = 0;
     JSList *node = playback_ports;
@@ -995,14 +1856,10 @@ render_jack_ports_to_payload_float (JSList *playback_ports, JSList *playback_src
 #if HAVE_SAMPLERATE
         SRC_DATA src;
 #endif
-        int i;
-        int_float_t val;
         jack_port_t *port = (jack_port_t *) node->data;
         jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
 
-        const char *porttype = jack_port_type (port);
-
-        if (jack_port_is_audio (porttype))
+        if (playback_types[chn] == NETJACK_PORT_AUDIO)
         {
             // audio port, resample if necessary
 
@@ -1021,10 +1878,7 @@ render_jack_ports_to_payload_float (JSList *playback_ports, JSList *playback_src
                 src_set_ratio (src_state, src.src_ratio);
                 src_process (src_state, &src);
 
-                for (i = 0; i < net_period_up; i++)
-                {
-                    packet_bufX[i] = htonl (packet_bufX[i]);
-                }
+                netjack_swap32 (packet_bufX, packet_bufX, net_period_up);
                 src_node = jack_slist_next (src_node);
             }
             else
@@ -1036,16 +1890,11 @@ render_jack_ports_to_payload_float (JSList *playback_ports, JSList *playback_src
 		}
 		else
 		{
-		    for (i = 0; i < net_period_up; i++)
-		    {
-			val.f = buf[i];
-			val.i = htonl (val.i);
-			packet_bufX[i] = val.i;
-		    }
+		    netjack_swap32 (packet_bufX, (uint32_t *) buf, net_period_up);
 		}
             }
         }
-        else if (jack_port_is_midi (porttype))
+        else if (playback_types[chn] == NETJACK_PORT_MIDI)
         {
             // encode midi events from port to packet
             // convert the data buffer to a standard format (uint32_t based)
@@ -1061,7 +1910,7 @@ render_jack_ports_to_payload_float (JSList *playback_ports, JSList *playback_src
 
 // render functions for 16bit
 void
-render_payload_to_jack_ports_16bit (void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes)
+render_payload_to_jack_ports_16bit (void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, const char *capture_types, JSList *capture_srcs, jack_nframes_t nframes)
 {
     int chn = 0;
     JSList *node = capture_ports;
@@ -1076,9 +1925,9 @@ render_payload_to_jack_ports_16bit (void *packet_payload, jack_nframes_t net_per
 
     while (node != NULL)
     {
-        int i;
         //uint32_t val;
 #if HAVE_SAMPLERATE
+        int i;
         SRC_DATA src;
 #endif
 
@@ -1088,9 +1937,8 @@ render_payload_to_jack_ports_16bit (void *packet_payload, jack_nframes_t net_per
 #if HAVE_SAMPLERATE
         float *floatbuf = alloca (sizeof(float) * net_period_down);
 #endif
-        const char *porttype = jack_port_type (port);
 
-        if (jack_port_is_audio (porttype))
+        if (capture_types[chn] == NETJACK_PORT_AUDIO)
         {
             // audio port, resample if necessary
 
@@ -1118,10 +1966,9 @@ render_payload_to_jack_ports_16bit (void *packet_payload, jack_nframes_t net_per
             }
             else
 #endif
-                for (i = 0; i < net_period_down; i++)
-                    buf[i] = ((float) ntohs (packet_bufX[i])) / 32768.0 - 1.0;
+                netjack_u16be_to_float (buf, packet_bufX, net_period_down);
         }
-        else if (jack_port_is_midi (porttype))
+        else if (capture_types[chn] == NETJACK_PORT_MIDI)
         {
             // midi port, decode midi events
             // convert the data buffer to a standard format (uint32_t based)
@@ -1136,7 +1983,7 @@ render_payload_to_jack_ports_16bit (void *packet_payload, jack_nframes_t net_per
 }
 
 void
-render_jack_ports_to_payload_16bit (JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up)
+render_jack_ports_to_payload_16bit (JSList *playback_ports, const char *playback_types, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up)
 {
     int chn = 0;
     JSList *node = playback_ports;
@@ -1151,12 +1998,10 @@ render_jack_ports_to_payload_16bit (JSList *playback_ports, JSList *playback_src
 #if HAVE_SAMPLERATE
         SRC_DATA src;
 #endif
-        int i;
         jack_port_t *port = (jack_port_t *) node->data;
         jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
-        const char *porttype = jack_port_type (port);
 
-        if (jack_port_is_audio (porttype))
+        if (playback_types[chn] == NETJACK_PORT_AUDIO)
         {
             // audio port, resample if necessary
 
@@ -1179,18 +2024,14 @@ render_jack_ports_to_payload_16bit (JSList *playback_ports, JSList *playback_src
                 src_set_ratio (src_state, src.src_ratio);
                 src_process (src_state, &src);
 
-                for (i = 0; i < net_period_up; i++)
-                {
-                    packet_bufX[i] = htons (((uint16_t)((floatbuf[i] + 1.0) * 32767.0)));
-                }
+                netjack_float_to_u16be (packet_bufX, floatbuf, net_period_up);
                 src_node = jack_slist_next (src_node);
             }
             else
 #endif
-                for (i = 0; i < net_period_up; i++)
-                    packet_bufX[i] = htons(((uint16_t)((buf[i] + 1.0) * 32767.0)));
+                netjack_float_to_u16be (packet_bufX, buf, net_period_up);
         }
-        else if (jack_port_is_midi (porttype))
+        else if (playback_types[chn] == NETJACK_PORT_MIDI)
         {
             // encode midi events from port to packet
             // convert the data buffer to a standard format (uint32_t based)
@@ -1206,7 +2047,7 @@ render_jack_ports_to_payload_16bit (JSList *playback_ports, JSList *playback_src
 
 // render functions for 8bit
 void
-render_payload_to_jack_ports_8bit (void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes)
+render_payload_to_jack_ports_8bit (void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, const char *capture_types, JSList *capture_srcs, jack_nframes_t nframes)
 {
     int chn = 0;
     JSList *node = capture_ports;
@@ -1222,7 +2063,6 @@ render_payload_to_jack_ports_8bit (void *packet_payload, jack_nframes_t net_peri
 
     while (node != NULL)
     {
-        int i;
         //uint32_t val;
 #if HAVE_SAMPLERATE
         SRC_DATA src;
@@ -1234,17 +2074,15 @@ render_payload_to_jack_ports_8bit (void *packet_payload, jack_nframes_t net_peri
 #if HAVE_SAMPLERATE
         float *floatbuf = alloca (sizeof (float) * net_period_down);
 #endif
-        const char *porttype = jack_port_type (port);
 
-        if (jack_port_is_audio(porttype))
+        if (capture_types[chn] == NETJACK_PORT_AUDIO)
         {
 #if HAVE_SAMPLERATE
             // audio port, resample if necessary
             if (net_period_down != nframes)
             {
                 SRC_STATE *src_state = src_node->data;
-                for (i = 0; i < net_period_down; i++)
-                    floatbuf[i] = ((float) packet_bufX[i]) / 127.0;
+                netjack_s8_to_float (floatbuf, packet_bufX, net_period_down);
 
                 src.data_in = floatbuf;
                 src.input_frames = net_period_down;
@@ -1261,10 +2099,9 @@ render_payload_to_jack_ports_8bit (void *packet_payload, jack_nframes_t net_peri
             }
             else
 #endif
-                for (i = 0; i < net_period_down; i++)
-                    buf[i] = ((float) packet_bufX[i]) / 127.0;
+                netjack_s8_to_float (buf, packet_bufX, net_period_down);
         }
-        else if (jack_port_is_midi (porttype))
+        else if (capture_types[chn] == NETJACK_PORT_MIDI)
         {
             // midi port, decode midi events
             // convert the data buffer to a standard format (uint32_t based)
@@ -1279,7 +2116,7 @@ render_payload_to_jack_ports_8bit (void *packet_payload, jack_nframes_t net_peri
 }
 
 void
-render_jack_ports_to_payload_8bit (JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up)
+render_jack_ports_to_payload_8bit (JSList *playback_ports, const char *playback_types, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up)
 {
     int chn = 0;
     JSList *node = playback_ports;
@@ -1294,13 +2131,11 @@ render_jack_ports_to_payload_8bit (JSList *playback_ports, JSList *playback_srcs
 #if HAVE_SAMPLERATE
         SRC_DATA src;
 #endif
-        int i;
         jack_port_t *port = (jack_port_t *) node->data;
 
         jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
-        const char *porttype = jack_port_type (port);
 
-        if (jack_port_is_audio (porttype))
+        if (playback_types[chn] == NETJACK_PORT_AUDIO)
         {
 #if HAVE_SAMPLERATE
             // audio port, resample if necessary
@@ -1323,16 +2158,14 @@ render_jack_ports_to_payload_8bit (JSList *playback_ports, JSList *playback_srcs
                 src_set_ratio (src_state, src.src_ratio);
                 src_process (src_state, &src);
 
-                for (i = 0; i < net_period_up; i++)
-                    packet_bufX[i] = floatbuf[i] * 127.0;
+                netjack_float_to_s8 (packet_bufX, floatbuf, net_period_up);
                 src_node = jack_slist_next (src_node);
             }
             else
 #endif
-                for (i = 0; i < net_period_up; i++)
-                    packet_bufX[i] = buf[i] * 127.0;
+                netjack_float_to_s8 (packet_bufX, buf, net_period_up);
         }
-        else if (jack_port_is_midi (porttype))
+        else if (playback_types[chn] == NETJACK_PORT_MIDI)
         {
             // encode midi events from port to packet
             // convert the data buffer to a standard format (uint32_t based)
@@ -1349,7 +2182,7 @@ render_jack_ports_to_payload_8bit (JSList *playback_ports, JSList *playback_srcs
 #if HAVE_CELT
 // render functions for celt.
 void
-render_payload_to_jack_ports_celt (void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes)
+render_payload_to_jack_ports_celt (void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, const char *capture_types, JSList *capture_srcs, jack_nframes_t nframes)
 {
     int chn = 0;
     JSList *node = capture_ports;
@@ -1362,9 +2195,7 @@ render_payload_to_jack_ports_celt (void *packet_payload, jack_nframes_t net_peri
         jack_port_t *port = (jack_port_t *) node->data;
         jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
 
-        const char *porttype = jack_port_type (port);
-
-        if (jack_port_is_audio (porttype))
+        if (capture_types[chn] == NETJACK_PORT_AUDIO)
         {
             // audio port, decode celt data.
 
@@ -1383,7 +2214,7 @@ render_payload_to_jack_ports_celt (void *packet_payload, jack_nframes_t net_peri
 
 	    src_node = jack_slist_next (src_node);
         }
-        else if (jack_port_is_midi (porttype))
+        else if (capture_types[chn] == NETJACK_PORT_MIDI)
         {
             // midi port, decode midi events
             // convert the data buffer to a standard format (uint32_t based)
@@ -1399,7 +2230,7 @@ render_payload_to_jack_ports_celt (void *packet_payload, jack_nframes_t net_peri
 }
 
 void
-render_jack_ports_to_payload_celt (JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up)
+render_jack_ports_to_payload_celt (JSList *playback_ports, const char *playback_types, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up)
 {
     int chn = 0;
     JSList *node = playback_ports;
@@ -1411,9 +2242,8 @@ render_jack_ports_to_payload_celt (JSList *playback_ports, JSList *playback_srcs
     {
         jack_port_t *port = (jack_port_t *) node->data;
         jack_default_audio_sample_t* buf = jack_port_get_buffer (port, nframes);
-        const char *porttype = jack_port_type (port);
 
-        if (jack_port_is_audio (porttype))
+        if (playback_types[chn] == NETJACK_PORT_AUDIO)
         {
             // audio port, encode celt data.
 
@@ -1430,7 +2260,7 @@ render_jack_ports_to_payload_celt (JSList *playback_ports, JSList *playback_srcs
 		printf( "something in celt changed. netjack needs to be changed to handle this.\n" );
 	    src_node = jack_slist_next( src_node );
         }
-        else if (jack_port_is_midi (porttype))
+        else if (playback_types[chn] == NETJACK_PORT_MIDI)
         {
             // encode midi events from port to packet
             // convert the data buffer to a standard format (uint32_t based)
@@ -1447,31 +2277,51 @@ render_jack_ports_to_payload_celt (JSList *playback_ports, JSList *playback_srcs
 #endif
 /* Wrapper functions with bitdepth argument... */
 void
-render_payload_to_jack_ports (int bitdepth, void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes, int dont_htonl_floats)
+render_payload_to_jack_ports_typed (int bitdepth, void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, const char *capture_types, JSList *capture_srcs, jack_nframes_t nframes, int dont_htonl_floats)
 {
     if (bitdepth == 8)
-        render_payload_to_jack_ports_8bit (packet_payload, net_period_down, capture_ports, capture_srcs, nframes);
+        render_payload_to_jack_ports_8bit (packet_payload, net_period_down, capture_ports, capture_types, capture_srcs, nframes);
     else if (bitdepth == 16)
-        render_payload_to_jack_ports_16bit (packet_payload, net_period_down, capture_ports, capture_srcs, nframes);
+        render_payload_to_jack_ports_16bit (packet_payload, net_period_down, capture_ports, capture_types, capture_srcs, nframes);
 #if HAVE_CELT
     else if (bitdepth == CELT_MODE)
-        render_payload_to_jack_ports_celt (packet_payload, net_period_down, capture_ports, capture_srcs, nframes);
+        render_payload_to_jack_ports_celt (packet_payload, net_period_down, capture_ports, capture_types, capture_srcs, nframes);
 #endif
     else
-        render_payload_to_jack_ports_float (packet_payload, net_period_down, capture_ports, capture_srcs, nframes, dont_htonl_floats);
+        render_payload_to_jack_ports_float (packet_payload, net_period_down, capture_ports, capture_types, capture_srcs, nframes, dont_htonl_floats);
 }
 
 void
-render_jack_ports_to_payload (int bitdepth, JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats)
+render_jack_ports_to_payload_typed (int bitdepth, JSList *playback_ports, const char *playback_types, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats)
 {
     if (bitdepth == 8)
-        render_jack_ports_to_payload_8bit (playback_ports, playback_srcs, nframes, packet_payload, net_period_up);
+        render_jack_ports_to_payload_8bit (playback_ports, playback_types, playback_srcs, nframes, packet_payload, net_period_up);
     else if (bitdepth == 16)
-        render_jack_ports_to_payload_16bit (playback_ports, playback_srcs, nframes, packet_payload, net_period_up);
+        render_jack_ports_to_payload_16bit (playback_ports, playback_types, playback_srcs, nframes, packet_payload, net_period_up);
 #if HAVE_CELT
     else if (bitdepth == CELT_MODE)
-        render_jack_ports_to_payload_celt (playback_ports, playback_srcs, nframes, packet_payload, net_period_up);
+        render_jack_ports_to_payload_celt (playback_ports, playback_types, playback_srcs, nframes, packet_payload, net_period_up);
 #endif
     else
-        render_jack_ports_to_payload_float (playback_ports, playback_srcs, nframes, packet_payload, net_period_up, dont_htonl_floats);
+        render_jack_ports_to_payload_float (playback_ports, playback_types, playback_srcs, nframes, packet_payload, net_period_up, dont_htonl_floats);
+}
+
+/* The untyped entry points, as used by jack_netsource.  These class
+ * the ports on every call, on the stack. */
+void
+render_payload_to_jack_ports (int bitdepth, void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes, int dont_htonl_floats)
+{
+    char *capture_types = alloca (jack_slist_length (capture_ports) + 1);
+
+    netjack_port_types_fill (capture_ports, capture_types);
+    render_payload_to_jack_ports_typed (bitdepth, packet_payload, net_period_down, capture_ports, capture_types, capture_srcs, nframes, dont_htonl_floats);
+}
+
+void
+render_jack_ports_to_payload (int bitdepth, JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats)
+{
+    char *playback_types = alloca (jack_slist_length (playback_ports) + 1);
+
+    netjack_port_types_fill (playback_ports, playback_types);
+    render_jack_ports_to_payload_typed (bitdepth, playback_ports, playback_types, playback_srcs, nframes, packet_payload, net_period_up, dont_htonl_floats);
 }
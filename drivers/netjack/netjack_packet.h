@@ -70,6 +70,21 @@ struct _jacknet_packet_header
     jack_nframes_t fragment_nr;
 };
 
+// Forward error correction.  After the data fragments of a packet,
+// the sender may add parity fragments: with k data fragments per
+// parity, the n data fragments form G = ceil(n/k) groups, group g
+// being fragments g, g+G, g+2G, ..., so a burst of up to G lost
+// fragments hits each group once.  A parity fragment is the XOR of
+// its group's payloads, and any one missing fragment of a group can
+// be rebuilt from it.
+//
+// A parity fragment's fragment_nr carries NETJACK_FEC_PARITY, k and
+// g.  Receivers that predate FEC drop it as an out of range fragment.
+#define NETJACK_FEC_PARITY	0x80000000
+#define NETJACK_FEC_GROUP_SHIFT	16
+#define NETJACK_FEC_GROUP_MAX	255
+#define NETJACK_FEC_INDEX_MASK	0xffff
+
 typedef union _int_float int_float_t;
 
 union _int_float
@@ -85,25 +100,50 @@ struct _cache_packet
 {
     int		    valid;
     int		    num_fragments;
+    int		    fragments_received;
     int		    packet_size;
     int		    mtu;
     jack_time_t	    recv_timestamp;
     jack_nframes_t  framecnt;
-    char *	    fragment_array;
+    uint32_t *	    fragment_bitmap;
     char *	    packet_buf;
+    int		    fec_group;		// k of the parity seen, or 0
+    uint32_t *	    parity_bitmap;	// parity fragments held, per group
+    char *	    parity_buf;		// allocated at the first parity
 };
 
 typedef struct _packet_cache packet_cache;
+typedef struct _packet_cache_rx packet_cache_rx;
+
+// Arrival log, as read by the adaptive jitter buffer.
+#define NETJACK_ARRIVAL_LOG 64
+
+typedef struct _packet_arrival packet_arrival;
+
+struct _packet_arrival
+{
+    jack_nframes_t framecnt;
+    jack_time_t	   timestamp;	// recv_timestamp when it completed
+};
 
 struct _packet_cache
 {
     int size;
-    cache_packet *packets;
+    cache_packet *packets;	// packets[framecnt % size]
+    uint32_t *valid_bitmap;	// slots in use
+    uint32_t *complete_bitmap;	// slots holding a complete packet
+    jack_nframes_t highest_framecnt;	// of the complete packets
+    int highest_framecnt_valid;
     int mtu;
     struct sockaddr_in master_address;
     int master_address_valid;
     jack_nframes_t last_framecnt_retreived;
     int last_framecnt_retreived_valid;
+    packet_arrival arrivals[NETJACK_ARRIVAL_LOG];
+    unsigned int arrivals_head;	// arrivals ever logged
+    jack_nframes_t late_framecnt;	// last arrival after retrieval
+    int late_framecnt_valid;
+    packet_cache_rx *rx;	// batched receive state, private
 };
 
 // fragment cache function prototypes
@@ -112,12 +152,11 @@ packet_cache *packet_cache_new(int num_packets, int pkt_size, int mtu);
 void	      packet_cache_free(packet_cache *pkt_cache);
 
 cache_packet *packet_cache_get_packet(packet_cache *pkt_cache, jack_nframes_t framecnt);
-cache_packet *packet_cache_get_oldest_packet(packet_cache *pkt_cache);
-cache_packet *packet_cache_get_free_packet(packet_cache *pkt_cache);
+void	packet_cache_add_fragment(packet_cache *pkt_cache, cache_packet *pack, char *packet_buf, int rcv_len);
 
 void	cache_packet_reset(cache_packet *pack);
 void	cache_packet_set_framecnt(cache_packet *pack, jack_nframes_t framecnt);
-void	cache_packet_add_fragment(cache_packet *pack, char *packet_buf, int rcv_len);
+int	cache_packet_has_fragment(cache_packet *pack, int fragment_nr);
 int	cache_packet_is_complete(cache_packet *pack);
 
 void packet_cache_drain_socket( packet_cache *pcache, int sockfd, jack_time_t (*get_microseconds)(void) );
@@ -128,11 +167,13 @@ int packet_cache_release_packet( packet_cache *pcache, jack_nframes_t framecnt )
 int packet_cache_get_next_available_framecnt( packet_cache *pcache, jack_nframes_t expected_framecnt, jack_nframes_t *framecnt );
 int packet_cache_get_highest_available_framecnt( packet_cache *pcache, jack_nframes_t *framecnt );
 int packet_cache_find_latency( packet_cache *pcache, jack_nframes_t expected_framecnt, jack_nframes_t *framecnt );
+int packet_cache_next_arrival( packet_cache *pcache, unsigned int *cursor, jack_nframes_t *framecnt, jack_time_t *timestamp );
 // Function Prototypes
 
 int netjack_poll_deadline (int sockfd, jack_time_t deadline, jack_time_t (*get_microseconds)(void));
 
 void netjack_sendto(int sockfd, char *packet_buf, int pkt_size, int flags, struct sockaddr *addr, int addr_size, int mtu);
+void netjack_sendto_fec(int sockfd, char *packet_buf, int pkt_size, int flags, struct sockaddr *addr, int addr_size, int mtu, int fec_group);
 
 
 int get_sample_size(int bitdepth);
@@ -140,6 +181,17 @@ void packet_header_hton(jacknet_packet_header *pkthdr);
 
 void packet_header_ntoh(jacknet_packet_header *pkthdr);
 
+// Port types, see netjack_port_types().
+#define NETJACK_PORT_AUDIO 0
+#define NETJACK_PORT_MIDI  1
+#define NETJACK_PORT_OTHER 2
+
+char *netjack_port_types(JSList *ports);
+
+void render_payload_to_jack_ports_typed(int bitdepth, void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, const char *capture_types, JSList *capture_srcs, jack_nframes_t nframes, int dont_htonl_floats );
+
+void render_jack_ports_to_payload_typed(int bitdepth, JSList *playback_ports, const char *playback_types, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats );
+
 void render_payload_to_jack_ports(int bitdepth, void *packet_payload, jack_nframes_t net_period_down, JSList *capture_ports, JSList *capture_srcs, jack_nframes_t nframes, int dont_htonl_floats );
 
 void render_jack_ports_to_payload(int bitdepth, JSList *playback_ports, JSList *playback_srcs, jack_nframes_t nframes, void *packet_payload, jack_nframes_t net_period_up, int dont_htonl_floats );
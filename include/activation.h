@@ -0,0 +1,149 @@
+/*
+ * activation.h -- process graph wakeup primitives shared by jackd
+ * and libjack.
+ *
+ *  The FIFO mechanism lives in engine.c and client.c; this header
+ *  provides the futex based alternative and the per-hop latency
+ *  accounting used by both.
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __jack_activation_h__
+#define __jack_activation_h__
+
+#include <errno.h>
+#include <time.h>
+
+#include "internal.h"
+
+#if defined(HAVE_LINUX_FUTEX_H) && defined(HAVE_SYS_SYSCALL_H)
+#define JACK_HAVE_FUTEX_ACTIVATION 1
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+/* Called by the waker just before it triggers the slot. */
+static inline void
+jack_activation_stamp (jack_activation_t *act)
+{
+	act->signalled_at = jack_get_microseconds ();
+}
+
+/* Called by the slot owner once it is awake. */
+static inline void
+jack_activation_hop (jack_activation_t *act, jack_time_t awake_at)
+{
+	jack_time_t then = act->signalled_at;
+	uint32_t usecs;
+
+	if (then == 0 || awake_at < then) {
+		return;
+	}
+
+	usecs = (uint32_t) (awake_at - then);
+	act->hop_usecs += usecs;
+	act->hop_count++;
+	if (usecs > act->hop_max_usecs) {
+		act->hop_max_usecs = usecs;
+	}
+	act->signalled_at = 0;
+}
+
+/* Slot sets, as used for subgraph members and successors. */
+static inline void
+jack_activation_set_add (uint32_t *set, uint32_t slot)
+{
+	set[slot >> 5] |= (1U << (slot & 31));
+}
+
+static inline int
+jack_activation_set_has (const uint32_t *set, uint32_t slot)
+{
+	return (set[slot >> 5] & (1U << (slot & 31))) != 0;
+}
+
+#ifdef JACK_HAVE_FUTEX_ACTIVATION
+
+/* Set `bits' in the slot's trigger word and wake its owner.
+ * This is RT safe: one atomic OR and one (non-blocking) syscall.
+ */
+static inline void
+jack_activation_signal (jack_activation_t *act, int32_t bits)
+{
+	__sync_fetch_and_or (&act->trigger, bits);
+	syscall (SYS_futex, &act->trigger, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/* Wait until some trigger bits are set on the slot, consume and
+ * return them.  Returns 0 if `timeout_usecs' elapsed first, -1 on
+ * error.
+ */
+static inline int32_t
+jack_activation_wait (jack_activation_t *act, jack_time_t timeout_usecs)
+{
+	jack_time_t then = jack_get_microseconds ();
+	jack_time_t now;
+	struct timespec ts;
+	int32_t bits;
+
+	while ((bits = __sync_lock_test_and_set (&act->trigger, 0)) == 0) {
+
+		now = jack_get_microseconds ();
+		if (now - then >= timeout_usecs) {
+			return 0;
+		}
+		ts.tv_sec = (timeout_usecs - (now - then)) / 1000000;
+		ts.tv_nsec = ((timeout_usecs - (now - then)) % 1000000) * 1000;
+
+		if (syscall (SYS_futex, &act->trigger, FUTEX_WAIT, 0,
+			     &ts, NULL, 0) < 0) {
+			if (errno != EAGAIN && errno != EINTR
+			    && errno != ETIMEDOUT) {
+				return -1;
+			}
+		}
+	}
+
+	return bits;
+}
+
+/* Parallel scheduling: `act' has finished, so count it off each of
+ * its successors in `slots' and run those that have nothing left to
+ * wait for.
+ */
+static inline void
+jack_activation_release (jack_activation_t *slots, jack_activation_t *act)
+{
+	uint32_t w, bits, slot;
+
+	for (w = 0; w < JACK_ACTIVATION_WORDS; w++) {
+		for (bits = act->successors[w]; bits; bits &= bits - 1) {
+			slot = (w << 5) + __builtin_ctz (bits);
+			if (__sync_sub_and_fetch (&slots[slot].pending, 1) == 0) {
+				jack_activation_stamp (&slots[slot]);
+				jack_activation_signal (&slots[slot],
+							JACK_ACTIVATE_PROCESS);
+			}
+		}
+	}
+}
+
+#endif /* JACK_HAVE_FUTEX_ACTIVATION */
+
+#endif /* __jack_activation_h__ */
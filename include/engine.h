@@ -49,6 +49,14 @@ typedef struct _jack_port_buffer_list {
     pthread_mutex_t          lock;	/* only lock within server */
     JSList	            *freelist;	/* list of free buffers */
     jack_port_buffer_info_t *info;	/* jack_buffer_info_t array */
+
+    jack_shmsize_t	     one_buffer; /* the segment's buffer stride */
+
+    /* the buffers are split into `nodes' groups of `per_node', each
+       group starting on a page of its own, `node_bytes' apart */
+    unsigned int	     nodes;
+    unsigned long	     per_node;
+    jack_shmsize_t	     node_bytes;
 } jack_port_buffer_list_t;
 
 typedef struct _jack_reserved_name {
@@ -104,6 +112,7 @@ struct _jack_engine {
     jack_shm_info_t         port_segment[JACK_MAX_PORT_TYPES];
 
     unsigned int    port_max;
+    jack_nframes_t  port_buffer_frames; /* largest period size so far */
     pthread_t	    server_thread;
 
     int		    fds[2];
@@ -131,6 +140,12 @@ struct _jack_engine {
     char	    temporary;
     int		    reordered;
     int		    feedbackcount;
+    unsigned long   sort_generation;
+    int		    graph_batch;	  /* applying a ChangeConnections request */
+    int		    graph_batch_changed;  /* ... and the graph has changed */
+    int		    latency_seeded;	  /* see jack_latency_edge_changed() */
+    unsigned long   latency_ports;	  /* recomputed for the last change */
+    unsigned long   latency_callbacks;	  /* sent for the last change */
     int             removing_clients;
     pid_t           wait_pid;
     int             nozombies;
@@ -160,6 +175,13 @@ struct _jack_engine {
     float	    spare_usecs;
 
     int first_wakeup;
+
+    /* memory locality, see locality.h */
+    int		    numa_nodes;
+    int		    tlb_fd;		/* process thread, -2 if unavailable */
+    uint64_t	    tlb_misses_seen;
+    uint64_t	    tlb_cycles;
+    uint64_t	    tlb_cycles_seen;
     
 #ifdef JACK_USE_MACH_THREADS
     /* specific resources for server/client real-time thread communication */
@@ -183,6 +205,9 @@ jack_engine_t  *jack_engine_new (int real_time, int real_time_priority,
 				 unsigned int port_max,
                                  pid_t waitpid, jack_nframes_t frame_time_offset, int nozombies, 
 				 int timeout_count_threshold,
+				 jack_activation_mode_t activation,
+				 int parallel, const char *hugepages,
+				 jack_nframes_t max_buffer_size,
 				 JSList *drivers);
 void		jack_engine_delete (jack_engine_t *);
 int		jack_run (jack_engine_t *engine);
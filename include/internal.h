@@ -151,7 +151,7 @@ typedef enum {
     TransportCommandStop = 2,
 } transport_command_t;
 
-typedef struct {
+typedef struct _jack_frame_timer {
 
 	volatile uint32_t       guard1;
 	volatile jack_nframes_t frames;
@@ -168,6 +168,51 @@ typedef struct {
 
 } POST_PACKED_STRUCTURE jack_frame_timer_t;
 
+/* Process graph activation.
+ *
+ * With FIFO activation, each hop of the process chain writes a byte
+ * to the next FIFO, and the woken client polls and reads it back.
+ * With futex activation, each client owns a slot in the engine's
+ * shared memory, and a wakeup is an atomic OR of the trigger bits
+ * followed by a FUTEX_WAKE.  The engine waits on slot 0 for the end
+ * of each subgraph.  Both modes keep the per-hop latency counters
+ * up to date.
+ *
+ * Futex activation can also run a subgraph in parallel: instead of
+ * a single next slot, each slot lists its successors in the
+ * dependency graph and counts the predecessors it is still waiting
+ * for.  A client that finishes decrements the counter of each
+ * successor and triggers those that reach zero, so clients with no
+ * path between them run at the same time on different CPUs.  The
+ * engine slot counts the sinks of the subgraph being run.
+ */
+typedef enum {
+	JackActivationFifo = 0,
+	JackActivationFutex = 1
+} jack_activation_mode_t;
+
+#define JACK_ACTIVATION_MAX	256	/* slots, including the engine */
+#define JACK_ACTIVATION_ENGINE	0	/* slot the engine waits on */
+
+#define JACK_ACTIVATE_PROCESS	0x1	/* run process() */
+#define JACK_ACTIVATE_EVENT	0x2	/* event queued, see jack_event_queue_t */
+
+#define JACK_ACTIVATION_WORDS	(JACK_ACTIVATION_MAX / 32)
+
+typedef struct {
+
+	volatile int32_t      trigger;	     /* futex word, JACK_ACTIVATE_* bits */
+	volatile jack_time_t  signalled_at;  /* w: upstream r: slot owner */
+	volatile uint64_t     hop_count;     /* w: slot owner r: engine */
+	volatile uint64_t     hop_usecs;     /* w: slot owner r: engine */
+	volatile uint32_t     hop_max_usecs; /* w: slot owner r: engine */
+	int32_t		      in_use;	     /* r/w: engine */
+	volatile int32_t      pending;	     /* predecessors still running */
+	int32_t		      npredecessors; /* w: engine r: engine */
+	uint32_t	      successors[JACK_ACTIVATION_WORDS]; /* w: engine r: all */
+
+} POST_PACKED_STRUCTURE jack_activation_t;
+
 /* JACK engine shared memory data structure. */
 typedef struct {
 
@@ -204,6 +249,13 @@ typedef struct {
     int32_t		  engine_ok;
     jack_port_type_id_t	  n_port_types;
     jack_port_type_info_t port_types[JACK_MAX_PORT_TYPES];
+    int32_t		  activation_mode; /* jack_activation_mode_t */
+    int32_t		  parallel;	/* run subgraphs as a DAG */
+    int32_t		  tlb_stats;	/* clients count dTLB misses */
+    volatile uint32_t	  process_cycle; /* bumped before each process cycle */
+    jack_shm_registry_index_t metadata_shm_index; /* see metadatastore.h */
+    volatile uint32_t	  metadata_generation;
+    jack_activation_t	  activation[JACK_ACTIVATION_MAX];
     jack_port_shared_t    ports[0];
 
 } POST_PACKED_STRUCTURE jack_control_t;
@@ -246,11 +298,52 @@ typedef struct {
         uint32_t key_size; /* key data will follow the event structure */
     } y;
     union {
+            uint32_t n;
             char other_name[JACK_PORT_NAME_SIZE];
             jack_property_change_t property_change;
     } z;
 } POST_PACKED_STRUCTURE jack_event_t;
 
+/* Events reach an external client through a queue in its control
+ * block.  The engine appends at tail and the client's event thread
+ * consumes from head, so the engine does not have to wait for the
+ * client to handle one event before posting the next.  A byte on
+ * the event fd (or JACK_ACTIVATE_EVENT in futex mode) wakes the
+ * client when the queue was empty.  Only entries marked `ack' are
+ * answered, with one status byte each on the event fd: the engine
+ * waits for those where it must know the client has caught up, for
+ * instance a GraphReordered before the next cycle.  The entry that
+ * fills the queue is always answered, with 0, so that the engine can
+ * block on the event fd until there is room again.  Keys longer than
+ * JACK_EVENT_KEY_MAX are delivered as a change of the whole subject.
+ *
+ * An entry takes 1048 bytes, half of them the key, so the queue adds
+ * 65.5 KiB to each client's control block (8.4 MB of shared memory
+ * for 128 clients).  jack_event_t is 528 bytes by itself, and keys
+ * have to travel inline since the queue is shared memory.  The
+ * metadata keys in use are URIs well under 100 bytes long, so 512
+ * leaves room for private ones.  64 entries hold the 33 events that a
+ * client registering itself and 32 ports sends every other client,
+ * with room to spare, so the engine only blocks on stuck clients.
+ */
+#define JACK_EVENT_QUEUE_SIZE	64	/* power of 2 */
+#define JACK_EVENT_KEY_MAX	512
+
+#define JACK_EVENT_ACK_STATUS	1	/* answer with the handler's status */
+#define JACK_EVENT_ACK_ROOM	2	/* filled the queue, answer 0 */
+
+typedef struct {
+    jack_event_t	event;
+    int32_t		ack;		/* 0 or JACK_EVENT_ACK_* */
+    char		key[JACK_EVENT_KEY_MAX];   /* PropertyChange only */
+} POST_PACKED_STRUCTURE jack_queued_event_t;
+
+typedef struct {
+    volatile uint32_t	head;		/* w: client r: engine and client */
+    volatile uint32_t	tail;		/* w: engine r: engine and client */
+    jack_queued_event_t	entries[JACK_EVENT_QUEUE_SIZE];
+} POST_PACKED_STRUCTURE jack_event_queue_t;
+
 typedef enum {
 	ClientInternal, /* connect request just names .so */
 	ClientDriver,   /* code is loaded along with driver */
@@ -288,6 +381,10 @@ typedef volatile struct {
     volatile uint64_t	awake_at;
     volatile uint64_t	finished_at;
     volatile int32_t	last_status;         /* w: client, r: engine and client */
+    volatile uint32_t	activation_slot;     /* w: engine r: engine and client */
+    volatile int32_t	numa_node;           /* w: client r: engine; -1 if unknown */
+    volatile uint64_t	tlb_misses;          /* w: client r: engine; see locality.h */
+    volatile uint64_t	tlb_cycles;          /* w: client r: engine */
 
     /* indicators for whether callbacks have been set for this client.
        We do not include ptrs to the callbacks here (or their arguments)
@@ -314,6 +411,8 @@ typedef volatile struct {
     volatile uint8_t	property_cbset;
     volatile uint8_t	port_rename_cbset;
 
+    jack_event_queue_t	events;		  /* external clients only */
+
 } POST_PACKED_STRUCTURE jack_client_control_t;
 
 typedef struct {
@@ -399,9 +498,29 @@ typedef enum {
 	ReserveName = 30,
 	SessionReply = 31,
 	SessionHasCallback = 32,
-        PropertyChangeNotify = 33
+        PropertyChangeNotify = 33,
+	SetProperty = 34,
+	RemoveProperty = 35,
+	RemoveProperties = 36,
+	RemoveAllProperties = 37,
+	ChangeConnections = 38
 } RequestType;
 
+/* these are followed on the request socket by their key, value and
+   type strings, see oop_client_deliver_request() */
+#define jack_is_property_request(type) \
+	((type) >= PropertyChangeNotify && (type) <= RemoveAllProperties)
+
+/* A ChangeConnections request is followed on the request socket by
+   its changes, and its reply by one status per change. */
+#define JACK_CONNECTION_CHANGES_MAX	65536
+
+typedef struct {
+    int32_t connect;		/* else disconnect */
+    char source_port[JACK_PORT_NAME_SIZE];
+    char destination_port[JACK_PORT_NAME_SIZE];
+} POST_PACKED_STRUCTURE jack_connection_change_t;
+
 struct _jack_request {
 
     //RequestType type;
@@ -458,7 +577,16 @@ struct _jack_request {
                 jack_uuid_t uuid;
                 size_t keylen;
                 const char* key; /* not delivered inline to server, see oop_client_deliver_request() */
+                uint32_t valuelen; /* SetProperty only, as is the type */
+                uint32_t typelen;
+                const char* value;
+                const char* type;
         } POST_PACKED_STRUCTURE property;
+        struct {
+                uint32_t count;
+                jack_connection_change_t *changes; /* not delivered inline either */
+                int32_t *results;
+        } POST_PACKED_STRUCTURE connections;
 	jack_uuid_t client_id;
 	jack_nframes_t nframes;
 	jack_time_t timeout;
@@ -484,10 +612,14 @@ typedef struct _jack_client_internal {
     JSList    *truefeeds;    /* protected by engine->client_lock */
     JSList    *sortfeeds;    /* protected by engine->client_lock */
     int	       fedcount;
-    int	       tfedcount;
+    int	       tfedcount;    /* scratch for the graph sorts */
+    int	       sort_index;   /* position in engine->clients, -1 if unsorted */
+    unsigned long sort_mark; /* visit stamp for jack_client_feeds_transitive() */
     jack_shm_info_t control_shm;
     unsigned long execution_order;
     struct  _jack_client_internal *next_client; /* not a linked list! */
+    uint32_t subgraph_members[JACK_ACTIVATION_WORDS]; /* parallel mode, */
+    int      subgraph_sinks;			      /* subgraph heads only */
     dlhandle handle;
     int     (*initialize)(jack_client_t*, const char*); /* int. clients only */
     void    (*finish)(void *);		/* internal clients only */
@@ -495,6 +627,14 @@ typedef struct _jack_client_internal {
 
     int		session_reply_pending;
 
+    int		latency_dirty;		/* JACK_LATENCY_*_DIRTY, engine.c */
+
+    int		event_acks_pending;	/* status bytes still to be read */
+    JackEventType event_ack_type;	/* of the last one, for messages */
+
+    uint64_t	tlb_misses_seen;	/* control->tlb_* at the last report */
+    uint64_t	tlb_cycles_seen;
+
 #ifdef JACK_USE_MACH_THREADS
     /* specific resources for server/client real-time thread communication */
     mach_port_t serverport;
@@ -557,6 +697,78 @@ extern jack_port_t *jack_port_by_name_int (jack_client_t *client,
 					   const char *port_name);
 extern int jack_port_name_equals (jack_port_shared_t* port, const char* target);
 
+/* port name index, see libjack/port.c */
+
+#define NO_PORT ((jack_port_id_t) -1)
+
+typedef struct {
+    volatile int32_t  lock;	/* pid of the writer, jackd or a renaming client */
+    volatile uint32_t seq;	/* odd while a writer is changing it */
+    uint32_t	      nslots;	/* a power of 2 */
+    uint32_t	      used;	/* live and deleted slots */
+    volatile uint64_t slots[0];	/* name hash << 32 | ((id << 2 | name) + 1) */
+} jack_port_name_index_t;
+
+extern size_t jack_port_name_index_size (uint32_t port_max);
+extern jack_port_name_index_t *jack_port_name_index (jack_control_t *control);
+extern void jack_port_name_index_init (jack_control_t *control);
+extern void jack_port_name_index_add (jack_control_t *control, jack_port_id_t id);
+extern void jack_port_name_index_remove (jack_control_t *control, jack_port_id_t id);
+extern uint32_t jack_port_name_index_seq (jack_control_t *control);
+extern jack_port_id_t jack_port_name_index_find (jack_control_t *control, const char *target);
+
+/* compiled port queries, see libjack/portquery.c
+ *
+ * A query is jack_get_ports() with its patterns compiled once.  Its
+ * result is cached and only recomputed after ports have been
+ * registered, unregistered or renamed; the array returned by
+ * jack_port_query_get_ports() is the caller's to free, as with
+ * jack_get_ports().
+ */
+typedef struct _jack_port_query jack_port_query_t;
+
+extern jack_port_query_t *jack_port_query_new (const char *port_name_pattern,
+					       const char *type_name_pattern,
+					       unsigned long flags);
+extern const char **jack_port_query_get_ports (jack_client_t *client,
+					       jack_port_query_t *query);
+extern void jack_port_query_free (jack_port_query_t *query);
+
+/* batched connection changes, see libjack/client.c
+ *
+ * jack_connect() and jack_disconnect() calls made between these two
+ * are sent to the server in one request by jack_connections_commit(),
+ * which then re-sorts the graph and tells clients about it once.  The
+ * calls themselves return 0; jack_connections_commit() returns the
+ * number of changes that failed, or -1 if the request did.
+ */
+extern int jack_connections_begin (jack_client_t *client);
+extern int jack_connections_commit (jack_client_t *client);
+
+/* ringbuffer extensions, see libjack/ringbuffer.c
+ *
+ * The _stage() calls copy like jack_ringbuffer_read() and _write(),
+ * but the other side only sees the result at the next _commit(), so
+ * that several messages can be handed over with one index update.
+ * The _window() calls are zero-copy access to as much contiguous data
+ * or space as there is, finished with jack_ringbuffer_read_advance()
+ * or _write_advance(); on a mirrored ringbuffer that is everything.
+ */
+#include <jack/ringbuffer.h>
+
+extern jack_ringbuffer_t *jack_ringbuffer_create_mirrored (size_t sz);
+extern int jack_ringbuffer_mirrored (const jack_ringbuffer_t *rb);
+extern size_t jack_ringbuffer_read_stage (jack_ringbuffer_t *rb, char *dest,
+					  size_t cnt);
+extern void jack_ringbuffer_read_commit (jack_ringbuffer_t *rb);
+extern size_t jack_ringbuffer_write_stage (jack_ringbuffer_t *rb,
+					   const char *src, size_t cnt);
+extern void jack_ringbuffer_write_commit (jack_ringbuffer_t *rb);
+extern char *jack_ringbuffer_read_window (jack_ringbuffer_t *rb, size_t want,
+					  size_t *len);
+extern char *jack_ringbuffer_write_window (jack_ringbuffer_t *rb, size_t want,
+					   size_t *len);
+
 /** Get the size (in bytes) of the data structure used to store
  *  MIDI events internally.
  */
@@ -0,0 +1,143 @@
+/*
+ * locality.h -- NUMA placement and TLB miss counting, shared by
+ * jackd and libjack.
+ *
+ *  Everything here is Linux specific and talks to the kernel
+ *  directly, so that neither libnuma nor libpfm is needed.  On
+ *  other systems the functions report a single node and no counter.
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __jack_locality_h__
+#define __jack_locality_h__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
+
+#if defined(HAVE_LINUX_PERF_EVENT_H) && defined(SYS_perf_event_open)
+#define JACK_HAVE_TLB_COUNTER 1
+#include <linux/perf_event.h>
+#endif
+
+#define JACK_NUMA_MAX_NODES	64	/* bits in a node mask */
+#define JACK_NUMA_PREFERRED	1	/* MPOL_PREFERRED */
+
+/* The NUMA node the calling thread is running on, -1 if unknown. */
+static inline int32_t
+jack_numa_node (void)
+{
+#ifdef SYS_getcpu
+	unsigned int cpu, node;
+
+	if (syscall (SYS_getcpu, &cpu, &node, NULL) == 0
+	    && node < JACK_NUMA_MAX_NODES) {
+		return node;
+	}
+#endif
+	return -1;
+}
+
+/* The number of NUMA nodes, counting from node 0 up to the highest
+ * one online.
+ */
+static inline int
+jack_numa_nodes (void)
+{
+	char buf[128];
+	char *p;
+	int last = 0;
+	FILE *f;
+
+	if ((f = fopen ("/sys/devices/system/node/online", "r")) == NULL) {
+		return 1;
+	}
+	if (fgets (buf, sizeof (buf), f) == NULL) {
+		buf[0] = '\0';
+	}
+	fclose (f);
+
+	/* a list of ranges, such as "0-1,3" */
+	for (p = buf; *p; p++) {
+		if (*p >= '0' && *p <= '9' && (p == buf || p[-1] < '0' || p[-1] > '9')) {
+			last = atoi (p);
+		}
+	}
+
+	return (last + 1 < JACK_NUMA_MAX_NODES) ? last + 1 : JACK_NUMA_MAX_NODES;
+}
+
+/* Prefer `node' for the pages of [addr, addr + len) that have not
+ * been touched yet.  addr must be page aligned.
+ */
+static inline int
+jack_numa_prefer (void *addr, size_t len, int node)
+{
+#ifdef SYS_mbind
+	unsigned long mask = 1UL << node;
+
+	return syscall (SYS_mbind, addr, len, JACK_NUMA_PREFERRED, &mask,
+			JACK_NUMA_MAX_NODES, 0);
+#else
+	return -1;
+#endif
+}
+
+/* A counter of the data TLB load misses of the calling thread in
+ * user space, or -1 if the kernel or CPU do not provide one.
+ */
+static inline int
+jack_tlb_counter_open (void)
+{
+#ifdef JACK_HAVE_TLB_COUNTER
+	struct perf_event_attr attr;
+
+	memset (&attr, 0, sizeof (attr));
+	attr.size = sizeof (attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB
+		| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall (SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+static inline uint64_t
+jack_tlb_counter_read (int fd)
+{
+	uint64_t count;
+
+	if (fd < 0 || read (fd, &count, sizeof (count)) != sizeof (count)) {
+		return 0;
+	}
+	return count;
+}
+
+#endif /* __jack_locality_h__ */
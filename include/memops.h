@@ -98,6 +98,18 @@ sample_memcpy (jack_default_audio_sample_t *dst, jack_default_audio_sample_t *sr
 	memcpy (dst, src, cnt * sizeof (jack_default_audio_sample_t));
 }
 
+/* vectorized conversions, chosen at runtime */
+typedef void (*sample_move_out_t) (char *dst, jack_default_audio_sample_t *src, unsigned long nsamples, unsigned long dst_skip, dither_state_t *state);
+typedef void (*sample_move_in_t)  (jack_default_audio_sample_t *dst, char *src, unsigned long nsamples, unsigned long src_skip);
+
+sample_move_out_t sample_move_accel_out (sample_move_out_t func);
+sample_move_in_t  sample_move_accel_in  (sample_move_in_t func);
+const char       *sample_move_accel_name (void);
+
+/* convert every channel with a non-NULL buffer, in one pass over interleaved data */
+void sample_move_batch_out (sample_move_out_t func, char **dst, jack_default_audio_sample_t **src, unsigned long *dst_skip, dither_state_t *state, unsigned int nchannels, unsigned long nsamples);
+void sample_move_batch_in  (sample_move_in_t func, jack_default_audio_sample_t **dst, char **src, unsigned long *src_skip, unsigned int nchannels, unsigned long nsamples);
+
 void memset_interleave               (char *dst, char val, unsigned long bytes, unsigned long unit_bytes, unsigned long skip_bytes);
 void memcpy_fake                     (char *dst, char *src, unsigned long src_bytes, unsigned long foo, unsigned long bar);
 
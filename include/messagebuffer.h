@@ -39,6 +39,14 @@ void jack_message_buffer_thread_init (void (*cb)(void*), void*);
 
 void jack_messagebuffer_add(const char *fmt, ...);
 
+/* Tag queued messages with the engine's frame time, and prefix
+ * them with it when `stamp' is set.  Pass NULL before the timer
+ * goes away.
+ */
+struct _jack_frame_timer;
+void jack_messagebuffer_set_frame_timer (struct _jack_frame_timer *timer,
+					 int stamp);
+
 void jack_messagebuffer_thread_init (void (*cb)(void*), void* arg);
 
 #endif /* __jack_messagebuffer_h__ */
@@ -0,0 +1,156 @@
+/*
+ * metadatastore.h -- the server's in-memory metadata index.
+ *
+ *  jackd keeps every property in one shared memory segment, hashed
+ *  by (subject, key), with each subject also chaining its own
+ *  entries so that per-subject queries and removals do not have to
+ *  look at anything else.  Only the server writes.  Clients map the
+ *  segment and read it without taking any lock, retrying whenever
+ *  the server was writing meanwhile (seq is odd during a write and
+ *  bumped again afterwards).  When the segment fills up the server
+ *  builds a bigger, compacted one and publishes it through the
+ *  engine control block.
+ *
+ *  Berkeley DB is only used as the on-disk copy, written in batches
+ *  by a server thread, and as the fallback for processes that have
+ *  no client open.
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __jack_metadatastore_h__
+#define __jack_metadatastore_h__
+
+#include <jack/uuid.h>
+#include <jack/metadata.h>
+
+#include "internal.h"
+#include "shm.h"
+
+#define JACK_METADATA_MAGIC		0x4a4d4458	/* "JMDX" */
+#define JACK_METADATA_MIN_BUCKETS	256		/* power of 2 */
+#define JACK_METADATA_MIN_SIZE		(64 * 1024)
+#define JACK_METADATA_FLUSH_USECS	100000		/* disk write batching */
+
+/* jack_metadata_store_read() and reader return values, besides the
+ * reader's own */
+#define JACK_METADATA_TORN	-2	/* inconsistent snapshot, retry */
+#define JACK_METADATA_NO_STORE	-3	/* no server store reachable */
+
+/* All offsets are from the start of the segment; 0 means none. */
+
+typedef struct {
+	uint32_t	next;		/* next entry in this hash bucket */
+	uint32_t	subject_next;	/* next entry of the same subject */
+	uint32_t	size;		/* of the entry, a multiple of 8 */
+	uint32_t	keylen;		/* string lengths include the nul */
+	uint32_t	valuelen;
+	uint32_t	typelen;	/* 0 when there is no type */
+	jack_uuid_t	subject;
+	char		data[0];	/* key, value, type */
+} jack_metadata_entry_t;
+
+typedef struct {
+	uint32_t	next;		/* next subject in this hash bucket */
+	uint32_t	all_next;	/* list of all subjects */
+	uint32_t	all_prev;
+	uint32_t	first;		/* first entry of this subject */
+	uint32_t	count;
+	uint32_t	pad;
+	jack_uuid_t	subject;
+} jack_metadata_subject_t;
+
+typedef struct {
+	/* fixed for the life of the segment */
+	uint32_t	magic;
+	uint32_t	generation;	/* as published in jack_control_t */
+	uint32_t	size;		/* of the segment */
+	uint32_t	nbuckets;	/* power of 2, both tables */
+	uint32_t	entry_buckets;	/* offsets of the bucket arrays */
+	uint32_t	subject_buckets;
+
+	/* changed under seq */
+	volatile uint32_t seq;		/* odd while the server writes */
+	uint32_t	used;		/* end of the allocated arena */
+	uint32_t	garbage;	/* bytes of unlinked records */
+	uint32_t	nentries;
+	uint32_t	nsubjects;
+	uint32_t	subjects;	/* head of the all-subjects list */
+} jack_metadata_store_t;
+
+/* A validated copy of an entry's header, with pointers to its
+ * nul-terminated strings.  The strings may still be torn if the
+ * server was writing, which the caller learns from the seq check.
+ */
+typedef struct {
+	jack_uuid_t	subject;
+	const char     *key;
+	const char     *value;
+	const char     *type;		/* NULL when there is none */
+	uint32_t	keylen;
+	uint32_t	valuelen;
+	uint32_t	typelen;
+	uint32_t	subject_next;
+} jack_metadata_view_t;
+
+typedef int (*jack_metadata_reader_t) (const jack_metadata_store_t *, void *);
+typedef void (*jack_metadata_discard_t) (void *);
+
+/* server side; the store functions return -1 on failure */
+int	jack_metadata_store_init (jack_control_t *control,
+				  const char *server_name);
+void	jack_metadata_store_exit (void);
+int	jack_metadata_store_local (void);
+int	jack_metadata_store_set (jack_uuid_t subject, const char *key,
+				 const char *value, const char *type,
+				 jack_property_change_t *change);
+int	jack_metadata_store_remove (jack_uuid_t subject, const char *key);
+int	jack_metadata_store_remove_subject (jack_uuid_t subject);
+int	jack_metadata_store_remove_all (void);
+
+/* client side, one reference per open client */
+void	jack_metadata_store_attach (jack_shm_registry_index_t control_index);
+void	jack_metadata_store_detach (void);
+
+/* Run `reader' on a consistent view of the store, calling `discard'
+ * on whatever a reader built from a view that turned out to be torn.
+ * Returns the reader's result, or JACK_METADATA_NO_STORE.
+ */
+int	jack_metadata_store_read (jack_metadata_reader_t reader,
+				  jack_metadata_discard_t discard,
+				  void *arg);
+
+/* for readers */
+int	jack_metadata_store_find (const jack_metadata_store_t *store,
+				  jack_uuid_t subject, const char *key,
+				  jack_metadata_view_t *view);
+int	jack_metadata_store_first (const jack_metadata_store_t *store,
+				   jack_uuid_t subject, uint32_t *count,
+				   uint32_t *first);
+int	jack_metadata_store_entry (const jack_metadata_store_t *store,
+				   uint32_t offset,
+				   jack_metadata_view_t *view);
+const jack_metadata_subject_t *
+	jack_metadata_store_subject_at (const jack_metadata_store_t *store,
+					uint32_t offset);
+
+/* libjack/metadata.c keeps the Berkeley DB handle */
+struct __db;
+struct __db *jack_property_db (const char *server_name);
+
+#endif /* __jack_metadatastore_h__ */
@@ -170,6 +170,18 @@ struct _jack_port {
     jack_port_functions_t    fptr;
     pthread_mutex_t          connection_lock;
     JSList                   *connections;
+
+    /* The process thread uses a flat copy of the connection list,
+     * and mixes the inputs down at most once per engine cycle.
+     */
+    struct _jack_port       **sources;
+    void                    **source_buffers; /* scratch for mixdowns */
+    uint32_t                 *source_heap;	 /* ... for the MIDI merge */
+    uint32_t                 *source_next;
+    uint32_t                  nsources;
+    volatile uint32_t        *cycle;	 /* engine process cycle count */
+    uint32_t                  mixed_cycle;
+    jack_nframes_t            mixed_nframes; /* 0: mix_buffer is stale */
 };
 
 /*  Inline would be cleaner, but it needs to be fast even in
@@ -107,4 +107,9 @@ extern void jack_destroy_shm (jack_shm_info_t*);
 extern int  jack_attach_shm (jack_shm_info_t*);
 extern int  jack_resize_shm (jack_shm_info_t*, jack_shmsize_t size);
 
+/* huge page backed segments, for the server's own use */
+extern int  jack_shm_use_hugepages (const char *mount);
+extern jack_shmsize_t jack_shm_hugepage_size (void);
+extern int  jack_shmalloc_huge (jack_shmsize_t size, jack_shm_info_t* result);
+
 #endif /* __jack_shm_h__ */
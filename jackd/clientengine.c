@@ -561,6 +561,39 @@ jack_client_name_invalid (jack_engine_t *engine, char *name,
 	return FALSE;
 }
 
+/* Claim an activation slot for an external client.  Slot 0 belongs to
+ * the engine, so 0 means "none available". */
+static uint32_t
+jack_activation_slot_alloc (jack_engine_t *engine)
+{
+	uint32_t i;
+
+	for (i = JACK_ACTIVATION_ENGINE + 1; i < JACK_ACTIVATION_MAX; i++) {
+		jack_activation_t *act = &engine->control->activation[i];
+		if (__sync_bool_compare_and_swap (&act->in_use, 0, 1)) {
+			act->trigger = 0;
+			act->signalled_at = 0;
+			act->hop_count = 0;
+			act->hop_usecs = 0;
+			act->hop_max_usecs = 0;
+			act->pending = 0;
+			act->npredecessors = 0;
+			memset (act->successors, 0, sizeof (act->successors));
+			return i;
+		}
+	}
+
+	return JACK_ACTIVATION_ENGINE;
+}
+
+static void
+jack_activation_slot_free (jack_engine_t *engine, uint32_t slot)
+{
+	if (slot != JACK_ACTIVATION_ENGINE) {
+		engine->control->activation[slot].in_use = 0;
+	}
+}
+
 /* Set up the engine's client internal and control structures for both
  * internal and external clients. */
 static jack_client_internal_t *
@@ -576,11 +609,19 @@ jack_setup_client_control (jack_engine_t *engine, int fd, ClientType type, const
 	client->ports = 0;
 	client->truefeeds = 0;
 	client->sortfeeds = 0;
+	client->fedcount = 0;
+	client->tfedcount = 0;
+	client->sort_index = -1;
+	client->sort_mark = 0;
+	memset (client->subgraph_members, 0, sizeof (client->subgraph_members));
+	client->subgraph_sinks = 0;
 	client->execution_order = UINT_MAX;
 	client->next_client = NULL;
 	client->handle = NULL;
 	client->finish = NULL;
 	client->error = 0;
+	client->tlb_misses_seen = 0;
+	client->tlb_cycles_seen = 0;
 
 	if (type != ClientExternal) {
 
@@ -609,6 +650,27 @@ jack_setup_client_control (jack_engine_t *engine, int fd, ClientType type, const
 			jack_shm_addr (&client->control_shm);
 	}
 
+	client->control->activation_slot = JACK_ACTIVATION_ENGINE;
+	client->control->numa_node = -1;
+	client->control->tlb_misses = 0;
+	client->control->tlb_cycles = 0;
+
+	if (type == ClientExternal) {
+		client->control->activation_slot =
+			jack_activation_slot_alloc (engine);
+
+		if (client->control->activation_slot == JACK_ACTIVATION_ENGINE
+		    && engine->control->activation_mode == JackActivationFutex) {
+			jack_error ("no activation slot left for %s "
+				    "(at most %d clients)", name,
+				    JACK_ACTIVATION_MAX - 1);
+			jack_release_shm (&client->control_shm);
+			jack_destroy_shm (&client->control_shm);
+			free (client);
+			return 0;
+		}
+	}
+
 	client->control->type = type;
 	client->control->active = 0;
 	client->control->dead = FALSE;
@@ -625,6 +687,11 @@ jack_setup_client_control (jack_engine_t *engine, int fd, ClientType type, const
 	client->subgraph_wait_fd = -1;
 
 	client->session_reply_pending = FALSE;
+	client->latency_dirty = 0;
+	client->event_acks_pending = 0;
+	client->event_ack_type = BufferSizeChange;
+	client->control->events.head = 0;
+	client->control->events.tail = 0;
 
 	client->control->process_cbset = FALSE;
 	client->control->bufsize_cbset = FALSE;
@@ -1105,6 +1172,8 @@ jack_client_delete (jack_engine_t *engine, jack_client_internal_t *client)
 
 	if (jack_client_is_internal (client)) {
 
+		jack_port_query_cleanup (client->private_client);
+		free (client->private_client->connection_changes);
 		free (client->private_client);
 		free ((void *) client->control);
 
@@ -1115,6 +1184,8 @@ jack_client_delete (jack_engine_t *engine, jack_client_internal_t *client)
 		   information so that it can be reused.
 		*/
 
+		jack_activation_slot_free (engine,
+					   client->control->activation_slot);
 		jack_release_shm (&client->control_shm);
 		jack_destroy_shm (&client->control_shm);
         }
@@ -117,6 +117,22 @@ struct jackctl_server
     /* int, timeout thres... */
     union jackctl_parameter_value timothres;
     union jackctl_parameter_value default_timothres;
+
+    /* bool, wake clients through futexes instead of FIFOs */
+    union jackctl_parameter_value futex;
+    union jackctl_parameter_value default_futex;
+
+    /* bool, run independent clients of a subgraph concurrently */
+    union jackctl_parameter_value parallel;
+    union jackctl_parameter_value default_parallel;
+
+    /* string, hugetlbfs mount or "auto" for huge page shm, "" for none */
+    union jackctl_parameter_value hugepages;
+    union jackctl_parameter_value default_hugepages;
+
+    /* uint, period size to lay port buffers out for */
+    union jackctl_parameter_value max_buffer_size;
+    union jackctl_parameter_value default_max_buffer_size;
 };
 
 struct jackctl_driver
@@ -1087,6 +1103,66 @@ jackctl_server_t * jackctl_server_create(
         goto fail_free_parameters;
     }
 
+    value.b = false;
+    if (jackctl_add_parameter(
+            &server_ptr->parameters,
+	    'a',
+            "futex",
+            "use futex instead of FIFO process graph activation",
+            "",
+            JackParamBool,
+            &server_ptr->futex,
+            &server_ptr->default_futex,
+            value, NULL) == NULL)
+    {
+        goto fail_free_parameters;
+    }
+
+    value.b = false;
+    if (jackctl_add_parameter(
+            &server_ptr->parameters,
+	    'j',
+            "parallel",
+            "run independent clients in parallel (requires futex)",
+            "",
+            JackParamBool,
+            &server_ptr->parallel,
+            &server_ptr->default_parallel,
+            value, NULL) == NULL)
+    {
+        goto fail_free_parameters;
+    }
+
+    value.str[0] = 0;
+    if (jackctl_add_parameter(
+            &server_ptr->parameters,
+	    'H',
+            "hugepages",
+            "huge page shared memory",
+            "Back the engine and port segments with huge pages: \"auto\" or a hugetlbfs mount, empty for normal pages",
+            JackParamString,
+            &server_ptr->hugepages,
+            &server_ptr->default_hugepages,
+            value, NULL) == NULL)
+    {
+        goto fail_free_parameters;
+    }
+
+    value.ui = 0;
+    if (jackctl_add_parameter(
+            &server_ptr->parameters,
+	    'B',
+            "max-buffer-size",
+            "largest buffer size without reallocation",
+            "Lay port buffers out for buffer sizes up to this many frames, so that switching to any of them does not reallocate shared memory",
+            JackParamUInt,
+            &server_ptr->max_buffer_size,
+            &server_ptr->default_max_buffer_size,
+            value, NULL) == NULL)
+    {
+        goto fail_free_parameters;
+    }
+
     //TODO: need 
     //JackServerGlobals::on_device_acquire = on_device_acquire;
     //JackServerGlobals::on_device_release = on_device_release;
@@ -1193,7 +1269,12 @@ jackctl_server_start(
 				    server_ptr->do_mlock.b, server_ptr->do_unlock.b, server_ptr->name.str,
 				    server_ptr->temporary.b, server_ptr->verbose.b, server_ptr->client_timeout.i,
 				    server_ptr->port_max.i, getpid(), frame_time_offset, 
-				    server_ptr->nozombies.b, server_ptr->timothres.ui, drivers)) == 0) {
+				    server_ptr->nozombies.b, server_ptr->timothres.ui,
+				    server_ptr->futex.b ? JackActivationFutex : JackActivationFifo,
+				    server_ptr->parallel.b,
+				    server_ptr->hugepages.str,
+				    server_ptr->max_buffer_size.ui,
+				    drivers)) == 0) {
 	    jack_error ("cannot create engine");
 	    goto fail_unregister;
     }
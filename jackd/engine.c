@@ -45,6 +45,8 @@
 
 #include "internal.h"
 #include "engine.h"
+#include "activation.h"
+#include "locality.h"
 #include "messagebuffer.h"
 #include "driver.h"
 #include "shm.h"
@@ -63,6 +65,7 @@
 #endif
 
 #include "clientengine.h"
+#include "metadatastore.h"
 #include "transengine.h"
 
 #include "libjack/local.h"
@@ -76,6 +79,11 @@ typedef struct {
     jack_client_internal_t *dstclient;
 } jack_connection_internal_t;
 
+/* jack_client_internal_t.latency_dirty: a connection of the client
+ * changed, see jack_latency_edge_changed() */
+#define JACK_LATENCY_CAPTURE_DIRTY	0x1
+#define JACK_LATENCY_PLAYBACK_DIRTY	0x2
+
 typedef struct _jack_driver_info {
     jack_driver_t *(*initialize)(jack_client_t*, const JSList *);
     void           (*finish);
@@ -86,10 +94,12 @@ typedef struct _jack_driver_info {
 jack_timer_type_t clock_source = JACK_TIMER_SYSTEM_CLOCK;
 
 static int                    jack_port_assign_buffer (jack_engine_t *,
-						       jack_port_internal_t *);
+						       jack_port_internal_t *,
+						       int32_t node);
 static jack_port_internal_t *jack_get_port_by_name (jack_engine_t *,
 						    const char *name);
 static int  jack_rechain_graph (jack_engine_t *engine);
+static void jack_rechain_parallel (jack_engine_t *engine);
 static void jack_clear_fifos (jack_engine_t *engine);
 static int  jack_port_do_connect (jack_engine_t *engine,
 				  const char *source_port,
@@ -97,6 +107,9 @@ static int  jack_port_do_connect (jack_engine_t *engine,
 static int  jack_port_do_disconnect (jack_engine_t *engine,
 				     const char *source_port,
 				     const char *destination_port);
+static int  jack_port_do_change_connections (jack_engine_t *engine,
+					     const jack_connection_change_t *changes,
+					     uint32_t count, int32_t *results);
 static int  jack_port_do_disconnect_all (jack_engine_t *engine,
 					 jack_port_id_t);
 static int  jack_port_do_unregister (jack_engine_t *engine, jack_request_t *);
@@ -112,6 +125,19 @@ static int  jack_send_connection_notification (jack_engine_t *,
 					       jack_port_id_t, int);
 static void jack_deliver_event_to_all (jack_engine_t *engine,
 				       jack_event_t *event);
+
+typedef enum {
+	JackEventNoAck,		/* queue it and go on */
+	JackEventAck,		/* wait until the client has handled it */
+	JackEventAckLater	/* see jack_collect_event_acks() */
+} jack_event_ack_t;
+
+static int  jack_post_event (jack_engine_t *engine,
+			     jack_client_internal_t *client,
+			     const jack_event_t *event, const char *key,
+			     jack_event_ack_t ack);
+static jack_event_ack_t jack_event_ack_mode (JackEventType type);
+static void jack_collect_event_acks (jack_engine_t *engine);
 static void jack_notify_all_port_interested_clients (jack_engine_t *engine,
 						     jack_uuid_t exclude_src_id,
 						     jack_uuid_t exclude_dst_id,
@@ -127,11 +153,12 @@ static void jack_engine_delay (jack_engine_t *engine,
 			       float delayed_usecs);
 static void jack_engine_driver_exit (jack_engine_t* engine);
 static int  jack_start_freewheeling (jack_engine_t* engine, jack_uuid_t);
-static int jack_client_feeds_transitive (jack_client_internal_t *source,
+static int jack_client_feeds_transitive (jack_engine_t *engine,
+					 jack_client_internal_t *source,
 					 jack_client_internal_t *dest);
-static int jack_client_sort (jack_client_internal_t *a,
-			     jack_client_internal_t *b);
-static void jack_check_acyclic (jack_engine_t* engine);
+static void jack_topological_sort (jack_engine_t *engine);
+static void jack_graph_changed (jack_engine_t *engine);
+static int jack_check_acyclic (jack_engine_t* engine);
 static void jack_compute_all_port_total_latencies (jack_engine_t *engine);
 static void jack_compute_port_total_latency (jack_engine_t *engine, jack_port_shared_t*);
 static int jack_check_client_status (jack_engine_t* engine);
@@ -345,6 +372,70 @@ make_sockets (const char *server_name, int fd[2])
 	return 0;
 }
 
+#define JACK_PORT_BUFFER_ALIGN	64	/* a cache line */
+
+/* Work out where the buffers of a port type go, and return the size
+ * of the segment.  On a NUMA machine the buffers are split evenly
+ * between the nodes, each node's share starting on a page of its own
+ * so that it can be placed on that node.
+ */
+static jack_shmsize_t
+jack_engine_layout_port_buffers (jack_engine_t *engine,
+				 jack_port_type_id_t ptid,
+				 jack_shmsize_t one_buffer,
+				 unsigned long nports)
+{
+	jack_port_buffer_list_t* pti = &engine->port_buffers[ptid];
+	jack_shmsize_t page;
+
+	if (engine->numa_nodes < 2 || nports < (unsigned long) engine->numa_nodes) {
+		pti->nodes = 1;
+		pti->per_node = nports;
+		pti->node_bytes = nports * one_buffer;
+		return pti->node_bytes;
+	}
+
+	if ((page = jack_shm_hugepage_size ()) == 0) {
+		page = getpagesize ();
+	}
+
+	pti->nodes = engine->numa_nodes;
+	pti->per_node = (nports + pti->nodes - 1) / pti->nodes;
+	pti->node_bytes = (pti->per_node * one_buffer + page - 1) & ~(page - 1);
+
+	return pti->nodes * pti->node_bytes;
+}
+
+static inline jack_shmsize_t
+jack_port_buffer_offset (jack_port_buffer_list_t* pti,
+			 jack_shmsize_t one_buffer, unsigned long n)
+{
+	return (n / pti->per_node) * pti->node_bytes
+		+ (n % pti->per_node) * one_buffer;
+}
+
+/* Ask for each node's share of a new port segment to be allocated on
+ * that node.  This has to happen before the buffers are initialized,
+ * which is when the pages are first touched.
+ */
+static void
+jack_engine_bind_port_buffers (jack_engine_t *engine,
+			       jack_port_type_id_t ptid)
+{
+	jack_port_buffer_list_t* pti = &engine->port_buffers[ptid];
+	char *addr = jack_shm_addr (&engine->port_segment[ptid]);
+	unsigned int node;
+
+	for (node = 0; node < pti->nodes && pti->nodes > 1; node++) {
+		if (jack_numa_prefer (addr + node * pti->node_bytes,
+				      pti->node_bytes, node)) {
+			VERBOSE (engine, "cannot place port buffers on NUMA "
+				 "node %u (%s)", node, strerror (errno));
+			break;
+		}
+	}
+}
+
 void
 jack_engine_place_port_buffers (jack_engine_t* engine, 
 				jack_port_type_id_t ptid,
@@ -353,13 +444,13 @@ jack_engine_place_port_buffers (jack_engine_t* engine,
 				unsigned long nports,
 				jack_nframes_t nframes)
 {
-	jack_shmsize_t offset;		/* shared memory offset */
+	unsigned long n;
 	jack_port_buffer_info_t *bi;
 	jack_port_buffer_list_t* pti = &engine->port_buffers[ptid];
 	jack_port_functions_t *pfuncs = jack_get_port_functions(ptid);
+	jack_port_type_info_t* port_type = &engine->control->port_types[ptid];
 
 	pthread_mutex_lock (&pti->lock);
-	offset = 0;
 	
 	if (pti->info) {
 
@@ -371,10 +462,8 @@ jack_engine_place_port_buffers (jack_engine_t* engine,
 		int i;
 
 		bi = pti->info;
-		while (offset < size) {
-			bi->offset = offset;
-			offset += one_buffer;
-			++bi;
+		for (n = 0; n < nports; n++, bi++) {
+			bi->offset = jack_port_buffer_offset (pti, one_buffer, n);
 		}
 
 		/* update any existing output port offsets */
@@ -391,7 +480,6 @@ jack_engine_place_port_buffers (jack_engine_t* engine,
 		}
 
 	} else {
-		jack_port_type_info_t* port_type = &engine->control->port_types[ptid];
 
 		/* Allocate an array of buffer info structures for all
 		 * the buffers in the segment.  Chain them to the free
@@ -401,11 +489,9 @@ jack_engine_place_port_buffers (jack_engine_t* engine,
 		bi = pti->info = (jack_port_buffer_info_t *)
 			malloc (nports * sizeof (jack_port_buffer_info_t));
 
-		while (offset < size) {
-			bi->offset = offset;
+		for (n = 0; n < nports; n++, bi++) {
+			bi->offset = jack_port_buffer_offset (pti, one_buffer, n);
 			pti->freelist = jack_slist_append (pti->freelist, bi);
-			offset += one_buffer;
-			++bi;
 		}
 
 		/* Allocate the first buffer of the port segment
@@ -424,10 +510,12 @@ jack_engine_place_port_buffers (jack_engine_t* engine,
 		int i;
 		jack_shm_info_t *shm_info = &engine->port_segment[ptid];
 		char* shm_segment = (char *) jack_shm_addr(shm_info);
+		size_t buffer_size =
+			jack_port_type_buffer_size (port_type, nframes);
 
 		bi = pti->info;
 		for (i=0; i<nports; ++i, ++bi)
-			pfuncs->buffer_init(shm_segment + bi->offset, one_buffer, nframes);
+			pfuncs->buffer_init(shm_segment + bi->offset, buffer_size, nframes);
 	}
 
 	pthread_mutex_unlock (&pti->lock);
@@ -444,15 +532,34 @@ jack_resize_port_segment (jack_engine_t *engine,
 	jack_shmsize_t size;		/* segment size */
 	jack_port_type_info_t* port_type = &engine->control->port_types[ptid];
 	jack_shm_info_t* shm_info = &engine->port_segment[ptid];
+	jack_port_buffer_list_t* pti = &engine->port_buffers[ptid];
+
+	/* The segment is laid out for the largest period size seen
+	 * (or reserved) so far.  If it already has room, the buffers
+	 * only need to be set up for the new size: the offsets stay
+	 * the same and clients keep their mappings.
+	 */
+	one_buffer = jack_port_type_buffer_size (port_type, engine->port_buffer_frames);
+	one_buffer = (one_buffer + JACK_PORT_BUFFER_ALIGN - 1)
+		& ~(JACK_PORT_BUFFER_ALIGN - 1);
+
+	if (shm_info->attached_at != 0 && one_buffer <= pti->one_buffer) {
+		VERBOSE (engine, "reusing port buffer segment for type %d, "
+			 "one buffer = %u bytes", ptid, pti->one_buffer);
+		jack_engine_place_port_buffers (engine, ptid, pti->one_buffer,
+						pti->nodes * pti->node_bytes,
+						nports,
+						engine->control->buffer_size);
+		return 0;
+	}
 
-	one_buffer = jack_port_type_buffer_size (port_type, engine->control->buffer_size);
 	VERBOSE (engine, "resizing port buffer segment for type %d, one buffer = %u bytes", ptid, one_buffer);
 
-	size = nports * one_buffer;
+	size = jack_engine_layout_port_buffers (engine, ptid, one_buffer, nports);
 
 	if (shm_info->attached_at == 0) {
 
-		if (jack_shmalloc (size, shm_info)) {
+		if (jack_shmalloc_huge (size, shm_info)) {
 			jack_error ("cannot create new port segment of %d"
 				    " bytes (%s)", 
 				    size,
@@ -480,6 +587,8 @@ jack_resize_port_segment (jack_engine_t *engine,
 		}
 	}
 
+	pti->one_buffer = one_buffer;
+	jack_engine_bind_port_buffers (engine, ptid);
 	jack_engine_place_port_buffers (engine, ptid, one_buffer, size, nports, engine->control->buffer_size);
 
 #ifdef USE_MLOCK
@@ -524,6 +633,9 @@ jack_driver_buffer_size (jack_engine_t *engine, jack_nframes_t nframes)
 	VERBOSE (engine, "new buffer size %" PRIu32, nframes);
 
 	engine->control->buffer_size = nframes;
+	if (nframes > engine->port_buffer_frames) {
+		engine->port_buffer_frames = nframes;
+	}
 	if (engine->driver)
 		engine->rolling_interval =
 			jack_rolling_interval (engine->driver->period_usecs);
@@ -665,6 +777,162 @@ jack_process_external(jack_engine_t *engine, JSList *node)
         return jack_slist_next (node);
 }
 #else /* !JACK_USE_MACH_THREADS */
+
+#ifdef JACK_HAVE_FUTEX_ACTIVATION
+
+/* Arm the predecessor counters of every client in the subgraph
+ * headed by `head', then trigger the clients that depend on nothing
+ * else in it.  The engine slot is released by the subgraph's sinks.
+ */
+static void
+jack_start_subgraph_parallel (jack_engine_t *engine,
+			      jack_client_internal_t *head)
+{
+	jack_activation_t *slots = engine->control->activation;
+	uint32_t w, bits, slot;
+
+	slots[JACK_ACTIVATION_ENGINE].pending = head->subgraph_sinks;
+
+	for (w = 0; w < JACK_ACTIVATION_WORDS; w++) {
+		for (bits = head->subgraph_members[w]; bits; bits &= bits - 1) {
+			slot = (w << 5) + __builtin_ctz (bits);
+			slots[slot].pending = slots[slot].npredecessors;
+		}
+	}
+
+	/* all counters must be visible before anyone can run */
+	__sync_synchronize ();
+
+	for (w = 0; w < JACK_ACTIVATION_WORDS; w++) {
+		for (bits = head->subgraph_members[w]; bits; bits &= bits - 1) {
+			slot = (w << 5) + __builtin_ctz (bits);
+			if (slots[slot].npredecessors == 0) {
+				jack_activation_stamp (&slots[slot]);
+				jack_activation_signal (&slots[slot],
+							JACK_ACTIVATE_PROCESS);
+			}
+		}
+	}
+}
+
+static JSList *
+jack_process_external_futex (jack_engine_t *engine, JSList *node)
+{
+	int status = 0;
+	int32_t bits;
+	jack_time_t timeout_usecs;
+	jack_client_internal_t *client;
+	jack_client_control_t *ctl;
+	jack_activation_t *engine_act;
+	jack_activation_t *client_act;
+	jack_time_t now, then;
+
+	client = (jack_client_internal_t *) node->data;
+	ctl = client->control;
+	engine_act = &engine->control->activation[JACK_ACTIVATION_ENGINE];
+	client_act = &engine->control->activation[ctl->activation_slot];
+
+	/* a race exists if we do this after the wakeup */
+	ctl->state = Triggered; 
+
+	ctl->signalled_at = jack_get_microseconds();
+
+	engine->current_client = client;
+
+	/* drop any trigger left behind by a client that finished
+	   after we gave up on it in an earlier cycle.
+	*/
+	engine_act->trigger = 0;
+
+	DEBUG ("calling process() on an external subgraph, slot==%d",
+	       ctl->activation_slot);
+
+	if (engine->control->parallel) {
+		jack_start_subgraph_parallel (engine, client);
+	} else {
+		jack_activation_stamp (client_act);
+		jack_activation_signal (client_act, JACK_ACTIVATE_PROCESS);
+	}
+
+	then = jack_get_microseconds ();
+
+	if (engine->freewheeling) {
+		timeout_usecs = 250000; /* 0.25 seconds */
+	} else {
+		timeout_usecs = (engine->client_timeout_msecs > 0 ?
+				 engine->client_timeout_msecs * 1000 :
+				 engine->driver->period_usecs);
+	}
+
+     again:
+	bits = jack_activation_wait (engine_act, timeout_usecs);
+	now = jack_get_microseconds ();
+
+	if (bits < 0) {
+		jack_error ("futex wait on subgraph processing failed (%s)",
+			    strerror (errno));
+		status = -1;
+	} else if (bits == 0) {
+
+		if (engine->freewheeling) {
+			if (jack_check_client_status (engine)) {
+				return NULL;
+			} else {
+				/* all clients are fine - we're just not done yet. since
+				   we're freewheeling, that is fine.
+				*/
+				goto again;
+			}
+		}
+
+		jack_error ("subgraph starting at %s timed out "
+			    "(slot=%d, state = %s)",
+			    client->control->name,
+			    ctl->activation_slot,
+			    jack_client_state_name (client));
+		status = 1;
+	} else {
+		jack_activation_hop (engine_act, now);
+	}
+
+	if (status != 0) {
+		VERBOSE (engine, "at %" PRIu64
+			 " waiting on slot %d for %" PRIu64
+			 " usecs, status = %d sig = %" PRIu64
+			 " awa = %" PRIu64 " fin = %" PRIu64
+			 " dur=%" PRIu64,
+			 now,
+			 ctl->activation_slot,
+			 now - then,
+			 status,
+			 ctl->signalled_at,
+			 ctl->awake_at,
+			 ctl->finished_at,
+			 ctl->finished_at? (ctl->finished_at -
+					    ctl->signalled_at): 0);
+
+		if (jack_check_clients (engine, 1)) {
+
+			engine->process_errors++;
+			return NULL;		/* will stop the loop */
+		}
+	} else {
+		engine->timeout_count = 0;
+	}
+
+	/* Move to next internal client (or end of client list) */
+	while (node) {
+		if (jack_client_is_internal ((jack_client_internal_t *)
+					     node->data)) {
+			break;
+		}
+		node = jack_slist_next (node);
+	}
+	
+	return node;
+}
+#endif /* JACK_HAVE_FUTEX_ACTIVATION */
+
 static JSList * 
 jack_process_external(jack_engine_t *engine, JSList *node)
 {
@@ -678,6 +946,12 @@ jack_process_external(jack_engine_t *engine, JSList *node)
 	jack_time_t now, then;
 	int pollret;
 
+#ifdef JACK_HAVE_FUTEX_ACTIVATION
+	if (engine->control->activation_mode == JackActivationFutex) {
+		return jack_process_external_futex (engine, node);
+	}
+#endif
+
 	client = (jack_client_internal_t *) node->data;
 	
 	ctl = client->control;
@@ -694,6 +968,8 @@ jack_process_external(jack_engine_t *engine, JSList *node)
 	DEBUG ("calling process() on an external subgraph, fd==%d",
 	       client->subgraph_start_fd);
 
+	jack_activation_stamp (&engine->control->activation[ctl->activation_slot]);
+
 	if (write (client->subgraph_start_fd, &c, sizeof (c)) != sizeof (c)) {
 		jack_error ("cannot initiate graph processing (%s)",
 			    strerror (errno));
@@ -737,6 +1013,8 @@ jack_process_external(jack_engine_t *engine, JSList *node)
 	if (pfd[0].revents & POLLIN) {
 
 		status = 0;
+		jack_activation_hop (&engine->control->activation[JACK_ACTIVATION_ENGINE],
+				     jack_get_microseconds ());
 
 	} else if (status == 0) {
 
@@ -843,6 +1121,7 @@ jack_engine_process (jack_engine_t *engine, jack_nframes_t nframes)
 	JSList *node;
 
 	engine->process_errors = 0;
+	engine->control->process_cycle++;
 
 	for (node = engine->clients; node; node = jack_slist_next (node)) {
 		jack_client_control_t *ctl =
@@ -874,6 +1153,88 @@ jack_engine_process (jack_engine_t *engine, jack_nframes_t nframes)
 	return engine->process_errors > 0;
 }
 
+static void
+jack_engine_report_activation (jack_engine_t *engine)
+{
+	uint64_t hops = 0;
+	uint64_t usecs = 0;
+	uint32_t max_usecs = 0;
+	int i;
+
+	for (i = 0; i < JACK_ACTIVATION_MAX; i++) {
+		jack_activation_t *act = &engine->control->activation[i];
+
+		if (!act->in_use) {
+			continue;
+		}
+		hops += act->hop_count;
+		usecs += act->hop_usecs;
+		if (act->hop_max_usecs > max_usecs) {
+			max_usecs = act->hop_max_usecs;
+		}
+	}
+
+	if (hops) {
+		VERBOSE (engine, "%s activation: %" PRIu64 " hops, "
+			 "mean wakeup %.3f usecs, max %" PRIu32 " usecs",
+			 engine->control->activation_mode == JackActivationFutex ?
+			 "futex" : "fifo",
+			 hops, (float) usecs / hops, max_usecs);
+	}
+}
+
+/* dTLB load misses per cycle since the last report, of the server's
+ * process thread and of the clients' */
+static void
+jack_engine_report_tlb (jack_engine_t *engine)
+{
+	JSList *node;
+	jack_client_internal_t *client;
+	uint64_t misses, cycles;
+	float clients = 0.0f;
+	float worst = 0.0f;
+	const char *worst_name = NULL;
+
+	if (engine->tlb_fd < 0) {
+		return;
+	}
+
+	misses = jack_tlb_counter_read (engine->tlb_fd);
+	cycles = engine->tlb_cycles - engine->tlb_cycles_seen;
+	if (cycles == 0) {
+		return;
+	}
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		uint64_t m, c;
+
+		client = (jack_client_internal_t *) node->data;
+		m = client->control->tlb_misses - client->tlb_misses_seen;
+		c = client->control->tlb_cycles - client->tlb_cycles_seen;
+		client->tlb_misses_seen = client->control->tlb_misses;
+		client->tlb_cycles_seen = client->control->tlb_cycles;
+		if (c == 0) {
+			continue;
+		}
+		clients += (float) m / c;
+		if ((float) m / c > worst) {
+			worst = (float) m / c;
+			worst_name = (const char *) client->control->name;
+		}
+	}
+
+	VERBOSE (engine, "dTLB load misses per cycle: server %.1f, "
+		 "clients %.1f%s%s%s",
+		 (float) (misses - engine->tlb_misses_seen) / cycles,
+		 clients,
+		 worst_name ? " (most: " : "",
+		 worst_name ? worst_name : "",
+		 worst_name ? ")" : "");
+
+	engine->tlb_misses_seen = misses;
+	engine->tlb_cycles_seen = engine->tlb_cycles;
+}
+
 static void 
 jack_calc_cpu_load(jack_engine_t *engine)
 {
@@ -925,6 +1286,11 @@ jack_calc_cpu_load(jack_engine_t *engine)
 		VERBOSE (engine, "load = %.4f max usecs: %.3f, "
 			 "spare = %.3f", engine->control->cpu_load,
 			 max_usecs, engine->spare_usecs);
+
+		if (engine->verbose) {
+			jack_engine_report_activation (engine);
+			jack_engine_report_tlb (engine);
+		}
 	}
 
 }
@@ -934,6 +1300,16 @@ jack_engine_post_process (jack_engine_t *engine)
 {
 	/* precondition: caller holds the graph lock. */
 
+	if (engine->control->tlb_stats) {
+		/* count in the thread running the cycles */
+		if (engine->tlb_fd == -1
+		    && (engine->tlb_fd = jack_tlb_counter_open ()) < 0) {
+			VERBOSE (engine, "no dTLB miss counter available");
+			engine->tlb_fd = -2;
+		}
+		engine->tlb_cycles++;
+	}
+
 	jack_transport_cycle_end (engine);
 	jack_calc_cpu_load (engine);
 	jack_check_clients (engine, 0);
@@ -1195,6 +1571,53 @@ jack_set_client_capabilities (jack_engine_t *engine, pid_t cap_pid)
  *
  * reply_fd is NULL for internal requests
  */
+/* Change the metadata store for a client and tell everyone with
+ * a property change callback about it.
+ */
+static int
+jack_do_property_request (jack_engine_t *engine, jack_request_t *req)
+{
+	jack_property_change_t change = PropertyDeleted;
+	jack_uuid_t uuid = req->x.property.uuid;
+	const char *key = req->x.property.key;
+	int ret;
+
+	if (req->type != RemoveAllProperties && req->type != RemoveProperties
+	    && key == NULL) {
+		return -1;
+	}
+
+	switch (req->type) {
+	case SetProperty:
+		if (req->x.property.value == NULL) {
+			return -1;
+		}
+		ret = jack_metadata_store_set (uuid, key, req->x.property.value,
+					       req->x.property.type, &change);
+		break;
+	case RemoveProperty:
+		ret = jack_metadata_store_remove (uuid, key);
+		break;
+	case RemoveProperties:
+		key = NULL;
+		if ((ret = jack_metadata_store_remove_subject (uuid)) == 0) {
+			return 0;
+		}
+		break;
+	default:
+		key = NULL;
+		jack_uuid_clear (&uuid);
+		ret = jack_metadata_store_remove_all ();
+		break;
+	}
+
+	if (ret >= 0) {
+		jack_property_change_notify (engine, change, uuid, key);
+	}
+
+	return ret;
+}
+
 static void
 do_request (jack_engine_t *engine, jack_request_t *req, int *reply_fd)
 {
@@ -1232,6 +1655,12 @@ do_request (jack_engine_t *engine, jack_request_t *req, int *reply_fd)
 			 req->x.connect.destination_port);
 		break;
 
+	case ChangeConnections:
+		req->status = jack_port_do_change_connections
+			(engine, req->x.connections.changes,
+			 req->x.connections.count, req->x.connections.results);
+		break;
+
 	case ActivateClient:
 		req->status = jack_client_activate (engine, req->x.client_id);
 		break;
@@ -1370,6 +1799,12 @@ do_request (jack_engine_t *engine, jack_request_t *req, int *reply_fd)
         case PropertyChangeNotify:
                 jack_property_change_notify (engine, req->x.property.change, req->x.property.uuid, req->x.property.key);
                 break;
+	case SetProperty:
+	case RemoveProperty:
+	case RemoveProperties:
+	case RemoveAllProperties:
+		req->status = jack_do_property_request (engine, req);
+		break;
 
 	default:
 		/* some requests are handled entirely on the client
@@ -1389,6 +1824,91 @@ internal_client_request (void* ptr, jack_request_t *request)
 	return request->status;
 }
 
+static int
+jack_read_property_data (int fd, const char **data, size_t len)
+{
+	char *buf;
+	size_t got = 0;
+	ssize_t n;
+
+	if (len == 0) {
+		return 0;
+	}
+
+	if ((buf = (char *) malloc (len)) == NULL) {
+		return -1;
+	}
+
+	while (got < len) {
+		if ((n = read (fd, buf + got, len - got)) <= 0) {
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			free (buf);
+			return -1;
+		}
+		got += n;
+	}
+
+	buf[len-1] = '\0';
+	*data = buf;
+
+	return 0;
+}
+
+static void
+jack_free_property_data (jack_request_t *req)
+{
+	free ((char *) req->x.property.key);
+	free ((char *) req->x.property.value);
+	free ((char *) req->x.property.type);
+}
+
+static int
+jack_read_connection_changes (int fd, jack_request_t *req)
+{
+	size_t len = req->x.connections.count * sizeof (jack_connection_change_t);
+	size_t got = 0;
+	char *buf;
+	ssize_t n;
+
+	req->x.connections.changes = NULL;
+	req->x.connections.results = NULL;
+
+	if (req->x.connections.count > JACK_CONNECTION_CHANGES_MAX) {
+		jack_error ("too many connection changes in one request (%" PRIu32 ")",
+			    req->x.connections.count);
+		return -1;
+	}
+
+	if ((buf = (char *) malloc (len + 1)) == NULL
+	    || (req->x.connections.results = (int32_t *)
+		calloc (req->x.connections.count + 1, sizeof (int32_t))) == NULL) {
+		free (buf);
+		return -1;
+	}
+	req->x.connections.changes = (jack_connection_change_t *) buf;
+
+	while (got < len) {
+		if ((n = read (fd, buf + got, len - got)) <= 0) {
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		got += n;
+	}
+
+	return 0;
+}
+
+static void
+jack_free_connection_changes (jack_request_t *req)
+{
+	free (req->x.connections.changes);
+	free (req->x.connections.results);
+}
+
 static int
 handle_external_client_request (jack_engine_t *engine, int fd)
 {
@@ -1439,27 +1959,36 @@ handle_external_client_request (jack_engine_t *engine, int fd)
 		}
 	}
 
-        if (req.type == PropertyChangeNotify) {
-                if (req.x.property.keylen) {
-                        req.x.property.key = (char*) malloc (req.x.property.keylen);
-                        if ((r = read (client->request_fd, (char*) req.x.property.key, req.x.property.keylen)) != req.x.property.keylen) {
-                                jack_error ("cannot read property key from client (%d/%d/%s)",
-                                            r, sizeof(req), strerror (errno));
-                                return -1;
-                        }
-                } else {
-                        req.x.property.key = 0;
+        if (jack_is_property_request (req.type)) {
+                req.x.property.key = NULL;
+                req.x.property.value = NULL;
+                req.x.property.type = NULL;
+                if (jack_read_property_data (client->request_fd, &req.x.property.key, req.x.property.keylen)
+                    || jack_read_property_data (client->request_fd, &req.x.property.value, req.x.property.valuelen)
+                    || jack_read_property_data (client->request_fd, &req.x.property.type, req.x.property.typelen)) {
+                        jack_error ("cannot read property data from client (%s)",
+                                    strerror (errno));
+                        jack_free_property_data (&req);
+                        return -1;
                 }
         }
 
-	reply_fd = client->request_fd;
+	if (req.type == ChangeConnections
+	    && jack_read_connection_changes (client->request_fd, &req)) {
+		jack_error ("cannot read connection changes from client (%s)",
+			    strerror (errno));
+		jack_free_connection_changes (&req);
+		return -1;
+	}
+
+	reply_fd = client->request_fd;
 	
 	jack_unlock_graph (engine);
 	do_request (engine, &req, &reply_fd);
 	jack_lock_graph (engine);
 
-        if (req.type == PropertyChangeNotify && req.x.property.key) {
-                free ((char *) req.x.property.key);
+        if (jack_is_property_request (req.type)) {
+                jack_free_property_data (&req);
         }
 
 	if (reply_fd >= 0) {
@@ -1467,12 +1996,28 @@ handle_external_client_request (jack_engine_t *engine, int fd)
 		if (write (reply_fd, &req, sizeof (req))
 		    < (ssize_t) sizeof (req)) {
 			jack_error ("cannot write request result to client");
+			if (req.type == ChangeConnections) {
+				jack_free_connection_changes (&req);
+			}
 			return -1;
 		}
+		if (req.type == ChangeConnections) {
+			size_t len = req.x.connections.count * sizeof (int32_t);
+			if (write (reply_fd, req.x.connections.results, len)
+			    < (ssize_t) len) {
+				jack_error ("cannot write connection change results to client");
+				jack_free_connection_changes (&req);
+				return -1;
+			}
+		}
 	} else {
 		DEBUG ("*not* replying to client");
         }
 
+	if (req.type == ChangeConnections) {
+		jack_free_connection_changes (&req);
+	}
+
 	return 0;
 }
 
@@ -1737,7 +2282,10 @@ jack_engine_t *
 jack_engine_new (int realtime, int rtpriority, int do_mlock, int do_unlock,
 		 const char *server_name, int temporary, int verbose,
 		 int client_timeout, unsigned int port_max, pid_t wait_pid,
-		 jack_nframes_t frame_time_offset, int nozombies, int timeout_count_threshold, JSList *drivers)
+		 jack_nframes_t frame_time_offset, int nozombies, int timeout_count_threshold,
+		 jack_activation_mode_t activation, int parallel,
+		 const char *hugepages, jack_nframes_t max_buffer_size,
+		 JSList *drivers)
 {
 	jack_engine_t *engine;
 	unsigned int i;
@@ -1798,6 +2346,7 @@ jack_engine_new (int realtime, int rtpriority, int do_mlock, int do_unlock,
 	engine->problems = 0;
 
 	engine->port_max = port_max;
+	engine->port_buffer_frames = max_buffer_size;
 	engine->server_thread = 0;
 	engine->rtpriority = rtpriority;
 	engine->silent_buffer = 0;
@@ -1808,6 +2357,8 @@ jack_engine_new (int realtime, int rtpriority, int do_mlock, int do_unlock,
 	engine->stop_freewheeling = 0;
 	jack_uuid_clear (&engine->fwclient);
 	engine->feedbackcount = 0;
+	engine->graph_batch = 0;
+	engine->latency_seeded = 0;
 	engine->wait_pid = wait_pid;
 	engine->nozombies = nozombies;
 	engine->timeout_count_threshold = timeout_count_threshold;
@@ -1825,6 +2376,12 @@ jack_engine_new (int realtime, int rtpriority, int do_mlock, int do_unlock,
 	jack_engine_reset_rolling_usecs (engine);
 	engine->max_usecs = 0.0f;
 
+	engine->numa_nodes = jack_numa_nodes ();
+	engine->tlb_fd = -1;
+	engine->tlb_misses_seen = 0;
+	engine->tlb_cycles = 0;
+	engine->tlb_cycles_seen = 0;
+
 	pthread_rwlock_init (&engine->client_lock, 0);
 	pthread_mutex_init (&engine->port_lock, 0);
 	pthread_mutex_init (&engine->request_lock, 0);
@@ -1862,8 +2419,21 @@ jack_engine_new (int realtime, int rtpriority, int do_mlock, int do_unlock,
 
 	srandom (time ((time_t *) 0));
 
-	if (jack_shmalloc (sizeof (jack_control_t)
-			   + ((sizeof (jack_port_shared_t) * engine->port_max)),
+	if (hugepages && hugepages[0]) {
+		if (jack_shm_use_hugepages (strcmp (hugepages, "auto") ?
+					    hugepages : NULL) == 0) {
+			VERBOSE (engine, "using %u kB huge pages for shared "
+				 "memory", jack_shm_hugepage_size () / 1024);
+		}
+	}
+	if (engine->numa_nodes > 1) {
+		VERBOSE (engine, "placing port buffers on %d NUMA nodes",
+			 engine->numa_nodes);
+	}
+
+	if (jack_shmalloc_huge (sizeof (jack_control_t)
+			   + ((sizeof (jack_port_shared_t) * engine->port_max))
+			   + jack_port_name_index_size (engine->port_max),
 			   &engine->control_shm)) {
 		jack_error ("cannot create engine control shared memory "
 			    "segment (%s)", strerror (errno));
@@ -1918,6 +2488,10 @@ jack_engine_new (int realtime, int rtpriority, int do_mlock, int do_unlock,
 		engine->control->ports[i].alias2[0] = '\0';
 	}
 
+	if (jack_metadata_store_init (engine->control, server_name)) {
+		return NULL;
+	}
+
 	/* allocate internal port structures so that we can keep track
 	 * of port connections.
 	 */
@@ -1934,6 +2508,7 @@ jack_engine_new (int realtime, int rtpriority, int do_mlock, int do_unlock,
 	}
 
 	engine->control->port_max = engine->port_max;
+	jack_port_name_index_init (engine->control);
 	engine->control->real_time = realtime;
 	
 	/* leave some headroom for other client threads to run
@@ -1955,6 +2530,29 @@ jack_engine_new (int realtime, int rtpriority, int do_mlock, int do_unlock,
 	engine->control->xrun_delayed_usecs = 0;
 	engine->control->max_delayed_usecs = 0;
 
+#ifndef JACK_HAVE_FUTEX_ACTIVATION
+	if (activation == JackActivationFutex) {
+		jack_error ("futex activation is not supported on this "
+			    "platform, using FIFOs");
+		activation = JackActivationFifo;
+	}
+#endif
+	if (parallel && activation != JackActivationFutex) {
+		jack_error ("parallel scheduling requires futex activation, "
+			    "running subgraphs serially");
+		parallel = 0;
+	}
+	engine->control->activation_mode = activation;
+	engine->control->parallel = parallel;
+	engine->control->tlb_stats = verbose;
+	memset (engine->control->activation, 0,
+		sizeof (engine->control->activation));
+	engine->control->activation[JACK_ACTIVATION_ENGINE].in_use = 1;
+
+	VERBOSE (engine, "process graph activation = %s, %s scheduling",
+		 activation == JackActivationFutex ? "futex" : "fifo",
+		 parallel ? "parallel" : "serial");
+
 	jack_set_clock_source (clock_source);
 	engine->control->clock_source = clock_source;
 	engine->get_microseconds = jack_get_microseconds_pointer();
@@ -1969,6 +2567,9 @@ jack_engine_new (int realtime, int rtpriority, int do_mlock, int do_unlock,
 	engine->control->frame_timer.filter_omega = 0; /* Initialised later */
 	engine->control->frame_timer.period_usecs = 0;
 
+	jack_messagebuffer_set_frame_timer (&engine->control->frame_timer,
+					    engine->verbose);
+
 	engine->first_wakeup = 1;
 
 	engine->control->buffer_size = 0;
@@ -2579,6 +3180,10 @@ jack_engine_delete (jack_engine_t *engine)
 		engine->driver = NULL;
 	}
 
+	if (engine->tlb_fd >= 0) {
+		close (engine->tlb_fd);
+	}
+
 	VERBOSE (engine, "freeing shared port segments");
 	for (i = 0; i < engine->control->n_port_types; ++i) {
 		jack_release_shm (&engine->port_segment[i]);
@@ -2603,7 +3208,11 @@ jack_engine_delete (jack_engine_t *engine)
 	VERBOSE (engine, "max delay reported by backend: %.3f usecs",
 		engine->control->max_delayed_usecs);
 
+	VERBOSE (engine, "freeing metadata store");
+	jack_metadata_store_exit ();
+
 	/* free engine control shm segment */
+	jack_messagebuffer_set_frame_timer (NULL, 0);
 	engine->control = NULL;
 	VERBOSE (engine, "freeing engine shared memory");
 	jack_release_shm (&engine->control_shm);
@@ -2640,13 +3249,21 @@ static void
 jack_deliver_event_to_all (jack_engine_t *engine, jack_event_t *event)
 {
 	JSList *node;
+	jack_event_ack_t ack = jack_event_ack_mode (event->type);
+
+	/* let every client get on with it before waiting for any */
+
+	if (ack == JackEventAck) {
+		ack = JackEventAckLater;
+	}
 
 	jack_rdlock_graph (engine);
 	for (node = engine->clients; node; node = jack_slist_next (node)) {
-		jack_deliver_event (engine,
-				    (jack_client_internal_t *) node->data,
-				    event);
+		jack_post_event (engine,
+				 (jack_client_internal_t *) node->data,
+				 event, NULL, ack);
 	}
+	jack_collect_event_acks (engine);
 	jack_unlock_graph (engine);
 }
 
@@ -2912,334 +3529,636 @@ jack_notify_all_port_interested_clients (jack_engine_t *engine, jack_uuid_t src,
 		if (src_client != client &&  dst_client  != client && client->control->port_connect_cbset != FALSE) {
 			
 			/* one of the ports belong to this client or it has a port connect callback */
-			jack_deliver_event (engine, client, &event);
+			jack_post_event (engine, client, &event, NULL,
+					 JackEventNoAck);
 		} 
 	}
 }
 
-int
-jack_deliver_event (jack_engine_t *engine, jack_client_internal_t *client,
-		    const jack_event_t *event, ...)
+static void
+jack_deliver_event_internal (jack_client_internal_t *client,
+			     const jack_event_t *event, const char *key)
 {
-        va_list ap;
-	char status=0;
-        char* key = 0;
-        size_t keylen = 0;
+	switch (event->type) {
+	case PortConnected:
+	case PortDisconnected:
+		jack_client_handle_port_connection
+			(client->private_client, (jack_event_t *) event);
+		break;
 
-        va_start (ap, event);
+	case BufferSizeChange:
+		jack_client_fix_port_buffers (client->private_client);
 
-	/* caller must hold the graph lock */
+		if (client->control->bufsize_cbset) {
+			if (event->x.n < 16) {
+				abort ();
+			}
+			client->private_client->bufsize
+				(event->x.n, client->private_client->bufsize_arg);
+		}
+		break;
 
-	DEBUG ("delivering event (type %s)", jack_event_type_name (event->type));
+	case SampleRateChange:
+		if (client->control->srate_cbset) {
+			client->private_client->srate
+				(event->x.n,
+				 client->private_client->srate_arg);
+		}
+		break;
 
-	/* we are not RT-constrained here, so use kill(2) to beef up
-	   our check on a client's continued well-being
-	*/
+	case GraphReordered:
+		if (client->control->graph_order_cbset) {
+			client->private_client->graph_order
+				(client->private_client->graph_order_arg);
+		}
+		break;
 
-	if (client->control->dead || client->error >= JACK_ERROR_WITH_SOCKETS 
-	    || (client->control->type == ClientExternal && kill (client->control->pid, 0))) {
-		DEBUG ("client %s is dead - no event sent",
-		       client->control->name);
-		return 0;
-	}
+	case XRun:
+		if (client->control->xrun_cbset) {
+			client->private_client->xrun
+				(client->private_client->xrun_arg);
+		}
+		break;
 
-	DEBUG ("client %s is still alive", client->control->name);
+	case PropertyChange:
+		if (client->control->property_cbset) {
+			client->private_client->property_cb
+				(event->x.uuid, key, event->z.property_change,
+				 client->private_client->property_cb_arg);
+		}
+		break;
 
-        /* Check property change events for matching key_size and keys */
+	case LatencyCallback:
+		jack_client_handle_latency_callback (client->private_client, (jack_event_t *) event, (client->control->type == ClientDriver));
+		break;
 
-        if (event->type == PropertyChange) {
-                key = va_arg (ap, char*);
-                if (key && key[0] != '\0') {
-                        keylen = strlen (key) + 1;
-                        if (event->y.key_size != keylen) {
-                                jack_error ("property change key %s sent with wrong length (%d vs %d)", key, event->y.key_size, keylen);
-                                return -1;
-                        }
-                }
-        }
+	default:
+		/* internal clients don't need to know */
+		break;
+	}
+}
 
-        va_end (ap);
+/* Whether the engine has to wait for a client to handle an event
+ * before going on.  Notifications about other clients, their ports
+ * and properties are only for the client's callbacks; everything
+ * else changes what the client does in its next process cycle, or
+ * is answered.
+ */
+static jack_event_ack_t
+jack_event_ack_mode (JackEventType type)
+{
+	switch (type) {
+	case SampleRateChange:
+	case PortRegistered:
+	case PortUnregistered:
+	case XRun:
+	case ClientRegistered:
+	case ClientUnregistered:
+	case PropertyChange:
+	case PortRename:
+		return JackEventNoAck;
+	default:
+		return JackEventAck;
+	}
+}
 
-	if (jack_client_is_internal (client)) {
+/* Wake a client whose event queue was empty. */
+static void
+jack_event_queue_ring (jack_engine_t *engine, jack_client_internal_t *client)
+{
+	char c = 0;
 
-		switch (event->type) {
-		case PortConnected:
-		case PortDisconnected:
-			jack_client_handle_port_connection
-				(client->private_client, event);
-			break;
+#ifdef JACK_HAVE_FUTEX_ACTIVATION
+	/* a futex-activated client is not polling its event fd,
+	 * so poke its activation slot.
+	 */
+	if (engine->control->activation_mode == JackActivationFutex) {
+		jack_activation_signal (&engine->control->activation[client->control->activation_slot],
+					JACK_ACTIVATE_EVENT);
+		return;
+	}
+#endif
 
-		case BufferSizeChange:
-			jack_client_fix_port_buffers (client->private_client);
+	if (write (client->event_fd, &c, sizeof (c)) != sizeof (c)) {
+		jack_error ("cannot send event to client [%s] (%s)",
+			    client->control->name, strerror (errno));
+		client->error += JACK_ERROR_WITH_SOCKETS;
+		jack_engine_signal_problems (engine);
+	}
+}
 
-			if (client->control->bufsize_cbset) {
-                                if (event->x.n < 16) {
-                                        abort ();
-                                }
-				client->private_client->bufsize
-					(event->x.n, client->private_client->bufsize_arg);
-			}
-			break;
+/* Wait until a client's event fd is readable.  Returns 0 then, -1 if
+ * poll(2) failed and -2 if the client lost its connection or did not
+ * answer in time.
+ */
+static int
+jack_event_reply_wait (jack_engine_t *engine, jack_client_internal_t *client)
+{
+	struct pollfd pfd[1];
+	jack_time_t poll_timeout = JACKD_CLIENT_EVENT_TIMEOUT;
+	jack_time_t then = jack_get_microseconds ();
+	jack_time_t now;
+	int poll_ret;
+	int status = 0;
 
-		case SampleRateChange:
-			if (client->control->srate_cbset) {
-				client->private_client->srate
-					(event->x.n,
-					 client->private_client->srate_arg);
-			}
-			break;
+	pfd[0].fd = client->event_fd;
+	pfd[0].events = POLLERR|POLLIN|POLLHUP|POLLNVAL;
 
-		case GraphReordered:
-			if (client->control->graph_order_cbset) {
-				client->private_client->graph_order
-					(client->private_client->graph_order_arg);
-			}
-			break;
+	/* if we're not running realtime and there is a client timeout set
+	   that exceeds the default client event timeout (which is not
+	   bound by RT limits, then use the larger timeout.
+	*/
 
-		case XRun:
-			if (client->control->xrun_cbset) {
-				client->private_client->xrun
-					(client->private_client->xrun_arg);
-			}
-			break;
+	if (!engine->control->real_time && (engine->client_timeout_msecs > poll_timeout)) {
+		poll_timeout = engine->client_timeout_msecs;
+	}
 
-                case PropertyChange:
-                        if (client->control->property_cbset) {
-                                client->private_client->property_cb
-                                        (event->x.uuid, key, event->z.property_change, client->private_client->property_cb_arg);
-                        }
-                        break;
+#ifdef __linux
+  again:
+#endif
+	VERBOSE(engine,"client event poll on %d for %s starts at %lld", 
+		client->event_fd, client->control->name, then);
+	if ((poll_ret = poll (pfd, 1, poll_timeout)) < 0) {
+		DEBUG ("client event poll not ok! (-1) poll returned an error");
+		jack_error ("poll on subgraph processing failed (%s)", strerror (errno));
+		status = -1; 
+	} else {
 
-		case LatencyCallback:
-			jack_client_handle_latency_callback (client->private_client, event, (client->control->type == ClientDriver));
-			break;
+		DEBUG ("\n\n\n\n\n back from client event poll, revents = 0x%x\n\n\n", pfd[0].revents);
+		now = jack_get_microseconds();
+		VERBOSE(engine,"back from client event poll after %lld usecs", now - then);
 
-		default:
-			/* internal clients don't need to know */
-			break;
-		}
+		if (pfd[0].revents & ~POLLIN) {
 
-	} else {
+			/* some kind of OOB socket event */
 
-		if (client->control->active) {
+			DEBUG ("client event poll not ok! (-2), revents = %d\n", pfd[0].revents);
+			jack_error ("subgraph starting at %s lost client", client->control->name);
+			status = -2; 
 
-			/* there's a thread waiting for events, so
-			 * it's worth telling the client */
+		} else if (pfd[0].revents & POLLIN) {
 
-			DEBUG ("engine writing on event fd");
+			/* client responded normally */
 
-			if (write (client->event_fd, event, sizeof (*event))
-			    != sizeof (*event)) {
-				jack_error ("cannot send event to client [%s]"
-					    " (%s)", client->control->name,
-					    strerror (errno));
-				client->error += JACK_ERROR_WITH_SOCKETS;
-				jack_engine_signal_problems (engine);
-			}
+			DEBUG ("client event poll ok!");
+			status = 0;
 
-                        /* for property changes, deliver the extra data representing
-                           the variable length "key" that has changed in some way.
-                        */
-                        
-                        if (event->type == PropertyChange) {
-                                if (write (client->event_fd, key, keylen) != keylen) {
-                                        jack_error ("cannot send property change key to client [%s] (%s)",
-                                                    client->control->name,
-                                                    strerror (errno));
-                                        client->error += JACK_ERROR_WITH_SOCKETS;
-                                        jack_engine_signal_problems (engine);
-                                }
-                        }
+		} else if (poll_ret == 0) {
 
- 			if (client->error) {
- 				status = -1;
- 			} else {
- 				// then we check whether there really is an error.... :)
- 
- 				struct pollfd pfd[1];
- 				pfd[0].fd = client->event_fd;
- 				pfd[0].events = POLLERR|POLLIN|POLLHUP|POLLNVAL;
- 				jack_time_t poll_timeout = JACKD_CLIENT_EVENT_TIMEOUT;
- 				int poll_ret;
-				jack_time_t then = jack_get_microseconds ();
-				jack_time_t now;
-				
-                                /* if we're not running realtime and there is a client timeout set
-                                   that exceeds the default client event timeout (which is not
-                                   bound by RT limits, then use the larger timeout.
-                                */
+			/* no events, no errors, we woke up because poll()
+			   decided that time was up ...
+			*/
 
-                                if (!engine->control->real_time && (engine->client_timeout_msecs > poll_timeout)) {
-                                        poll_timeout = engine->client_timeout_msecs;
-                                }
+#ifdef __linux		
+			if (linux_poll_bug_encountered (engine, then, &poll_timeout)) {
+				goto again;
+			}
 
+			if (poll_timeout < 200) {
+				VERBOSE (engine, "FALSE WAKEUP skipped, remaining = %lld usec", poll_timeout);
+				status = 0;
+			} else {
+#endif
+				DEBUG ("client event poll not ok! (1 = poll timed out, revents = 0x%04x, poll_ret = %d)", pfd[0].revents, poll_ret);
+				VERBOSE (engine,"client %s did not respond to event type %d in time"
+					    "(fd=%d, revents = 0x%04x, timeout was %lld)", 
+					    client->control->name, client->event_ack_type,
+					    client->event_fd,
+					    pfd[0].revents,
+					    poll_timeout);
+				status = -2;
 #ifdef __linux
-			again:
+			}
 #endif
-				VERBOSE(engine,"client event poll on %d for %s starts at %lld", 
-					client->event_fd, client->control->name, then);
- 				if ((poll_ret = poll (pfd, 1, poll_timeout)) < 0) {
- 					DEBUG ("client event poll not ok! (-1) poll returned an error");
- 					jack_error ("poll on subgraph processing failed (%s)", strerror (errno));
- 					status = -1; 
- 				} else {
- 
- 					DEBUG ("\n\n\n\n\n back from client event poll, revents = 0x%x\n\n\n", pfd[0].revents);
-					now = jack_get_microseconds();
-					VERBOSE(engine,"back from client event poll after %lld usecs", now - then);
-
- 					if (pfd[0].revents & ~POLLIN) {
-
-						/* some kind of OOB socket event */
-
- 						DEBUG ("client event poll not ok! (-2), revents = %d\n", pfd[0].revents);
- 						jack_error ("subgraph starting at %s lost client", client->control->name);
- 						status = -2; 
+		}
+	}
 
- 					} else if (pfd[0].revents & POLLIN) {
+	return status;
+}
 
-						/* client responded normally */
+/* Read the answers to the events a client still owes us, in the
+ * order they were posted.  Returns the worst status.
+ */
+static int
+jack_collect_client_acks (jack_engine_t *engine, jack_client_internal_t *client)
+{
+	char replies[JACK_EVENT_QUEUE_SIZE];
+	int status = 0;
+	ssize_t n, i;
 
- 						DEBUG ("client event poll ok!");
- 						status = 0;
+	while (client->event_acks_pending > 0) {
 
- 					} else if (poll_ret == 0) {
+		if (client->error) {
+			status = -1;
+		} else if ((status = jack_event_reply_wait (engine, client)) == 0) {
 
-						/* no events, no errors, we woke up because poll()
-						   decided that time was up ...
-						*/
-						
-#ifdef __linux		
-						if (linux_poll_bug_encountered (engine, then, &poll_timeout)) {
-							goto again;
-						}
-						
-						if (poll_timeout < 200) {
-							VERBOSE (engine, "FALSE WAKEUP skipped, remaining = %lld usec", poll_timeout);
-							status = 0;
-						} else {
-#endif
-							DEBUG ("client event poll not ok! (1 = poll timed out, revents = 0x%04x, poll_ret = %d)", pfd[0].revents, poll_ret);
-							VERBOSE (engine,"client %s did not respond to event type %d in time"
-								    "(fd=%d, revents = 0x%04x, timeout was %lld)", 
-								    client->control->name, event->type,
-								    client->event_fd,
-								    pfd[0].revents,
-								    poll_timeout);
-							status = -2;
-#ifdef __linux
-						}
-#endif
- 					}
- 				}
-  			}
-                        
- 			if (status == 0) {
- 				if (read (client->event_fd, &status, sizeof (status)) != sizeof (status)) {
- 					jack_error ("cannot read event response from "
- 							"client [%s] (%s)",
- 							client->control->name,
- 							strerror (errno));
-					status = -1;
- 				} 
+			n = client->event_acks_pending;
+			if (n > (ssize_t) sizeof (replies)) {
+				n = sizeof (replies);
+			}
 
- 			} else {
-                                switch (status) {
-                                case -1:
-                                        jack_error ("internal poll failure reading response from client %s to a %s event",
-                                                    client->control->name,
-                                                    jack_event_type_name (event->type));
-                                        break;
-                                case -2:
-                                        jack_error ("timeout waiting for client %s to handle a %s event",
-                                                    client->control->name,
-                                                    jack_event_type_name (event->type));
-                                        break;
-                                default:
-                                        jack_error ("bad status (%d) from client %s while handling a %s event",
-                                                    (int) status, 
-                                                    client->control->name,
-                                                    jack_event_type_name (event->type));
-                                }
-  			}
-
-			if (status<0) {
-				client->error += JACK_ERROR_WITH_SOCKETS;
-				jack_engine_signal_problems (engine);
+			if ((n = read (client->event_fd, replies, n)) <= 0) {
+				jack_error ("cannot read event response from "
+					    "client [%s] (%s)",
+					    client->control->name,
+					    strerror (errno));
+				status = -1;
+			} else {
+				client->event_acks_pending -= n;
+				for (i = 0; i < n; i++) {
+					if (replies[i] < status) {
+						status = replies[i];
+					}
+				}
+				if (status == 0) {
+					continue;
+				}
 			}
 		}
+
+		switch (status) {
+		case -1:
+			jack_error ("internal poll failure reading response from client %s to a %s event",
+				    client->control->name,
+				    jack_event_type_name (client->event_ack_type));
+			break;
+		case -2:
+			jack_error ("timeout waiting for client %s to handle a %s event",
+				    client->control->name,
+				    jack_event_type_name (client->event_ack_type));
+			break;
+		default:
+			jack_error ("bad status (%d) from client %s while handling a %s event",
+				    (int) status, 
+				    client->control->name,
+				    jack_event_type_name (client->event_ack_type));
+		}
+
+		client->event_acks_pending = 0;
+		client->error += JACK_ERROR_WITH_SOCKETS;
+		jack_engine_signal_problems (engine);
 	}
-	DEBUG ("event delivered");
 
 	return status;
 }
 
-int
-jack_rechain_graph (jack_engine_t *engine)
+/* Wait for a client that has fallen JACK_EVENT_QUEUE_SIZE events
+ * behind to take some.  The entry that filled its queue asked for an
+ * answer (see jack_post_event()), so this blocks on the event fd until
+ * the client has worked through the queue.  A client that does not
+ * answer within the client event timeout is dropped.
+ */
+static int
+jack_event_queue_wait (jack_engine_t *engine, jack_client_internal_t *client,
+		       jack_event_queue_t *queue)
 {
-	JSList *node, *next;
-	unsigned long n;
-	int err = 0;
-	jack_client_internal_t *subgraph_client, *next_client;
-	jack_event_t event;
-	int upstream_is_jackd;
+	VERBOSE (engine, "event queue of %s is full", client->control->name);
 
-        VALGRIND_MEMSET(&event, 0, sizeof (event));
+	if (jack_collect_client_acks (engine, client)) {
+		return -1;
+	}
 
-	jack_clear_fifos (engine);
+	if (queue->tail - queue->head >= JACK_EVENT_QUEUE_SIZE) {
+		jack_error ("client %s is not taking events",
+			    client->control->name);
+		client->error += JACK_ERROR_WITH_SOCKETS;
+		jack_engine_signal_problems (engine);
+		return -1;
+	}
 
-	subgraph_client = 0;
+	return 0;
+}
 
-	VERBOSE(engine, "++ jack_rechain_graph():");
+/* Wait for every client that owes us answers.  Clients handle the
+ * events at the same time, so this takes as long as the slowest one.
+ */
+static void
+jack_collect_event_acks (jack_engine_t *engine)
+{
+	JSList *node;
 
-	event.type = GraphReordered;
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		jack_client_internal_t *client =
+			(jack_client_internal_t *) node->data;
+		if (client->event_acks_pending) {
+			jack_collect_client_acks (engine, client);
+		}
+	}
+}
 
-	for (n = 0, node = engine->clients, next = NULL; node; node = next) {
+/* Queue an event for a client.  Internal clients handle it right
+ * away.  With JackEventAck, wait for the client to handle it (and
+ * whatever was queued before it); with JackEventAckLater the caller
+ * does that through jack_collect_event_acks().
+ */
+static int
+jack_post_event (jack_engine_t *engine, jack_client_internal_t *client,
+		 const jack_event_t *event, const char *key, jack_event_ack_t ack)
+{
+	jack_event_queue_t *queue;
+	jack_queued_event_t *entry;
+	size_t keylen = 0;
+	uint32_t tail;
 
-                jack_client_internal_t* client = (jack_client_internal_t *) node->data;
+	/* caller must hold the graph lock */
 
-		next = jack_slist_next (node);
-                
-		if (!client->control->process_cbset && !client->control->thread_cb_cbset) {
-			continue;
-		}
+	DEBUG ("delivering event (type %s)", jack_event_type_name (event->type));
 
-		VERBOSE(engine, "+++ client is now %s active ? %d",
-			client->control->name, client->control->active);
+	/* we are not RT-constrained here, so use kill(2) to beef up
+	   our check on a client's continued well-being
+	*/
 
-		if (client->control->active) {
+	if (client->control->dead || client->error >= JACK_ERROR_WITH_SOCKETS 
+	    || (client->control->type == ClientExternal && kill (client->control->pid, 0))) {
+		DEBUG ("client %s is dead - no event sent",
+		       client->control->name);
+		return 0;
+	}
 
-			/* find the next active client. its ok for
-			 * this to be NULL */
-			
-			while (next) {
-				if (client->control->active && (client->control->process_cbset || client->control->thread_cb_cbset)) {
-					break;
-				}
-				next = jack_slist_next (next);
-			};
+	DEBUG ("client %s is still alive", client->control->name);
 
-			if (next == NULL) {
-				next_client = NULL;
-			} else {
-				next_client = (jack_client_internal_t *)
-					next->data;
-			}
+	if (jack_client_is_internal (client)) {
+		jack_deliver_event_internal (client, event, key);
+		return 0;
+	}
 
-			client->execution_order = n;
-			client->next_client = next_client;
-			
-			if (jack_client_is_internal (client)) {
-				
-				/* break the chain for the current
-				 * subgraph. the server will wait for
-				 * chain on the nth FIFO, and will
-				 * then execute this internal
-				 * client. */
-				
-				if (subgraph_client) {
-					subgraph_client->subgraph_wait_fd =
-						jack_get_fifo_fd (engine, n);
+	if (!client->control->active) {
+		/* no thread waiting for events */
+		return 0;
+	}
+
+	queue = (jack_event_queue_t *) &client->control->events;
+	tail = queue->tail;
+
+	if (tail - queue->head >= JACK_EVENT_QUEUE_SIZE
+	    && jack_event_queue_wait (engine, client, queue)) {
+		return -1;
+	}
+
+	entry = &queue->entries[tail & (JACK_EVENT_QUEUE_SIZE - 1)];
+	memcpy (&entry->event, event, sizeof (*event));
+	entry->ack = (ack != JackEventNoAck) ? JACK_EVENT_ACK_STATUS : 0;
+
+	/* the entry that fills the queue is answered in any case, so
+	   that there is something to wait for on the event fd when the
+	   queue is found full; see jack_event_queue_wait().
+	*/
+
+	if (!entry->ack && tail + 1 - queue->head >= JACK_EVENT_QUEUE_SIZE) {
+		entry->ack = JACK_EVENT_ACK_ROOM;
+	}
+
+	/* for property changes, the variable length "key" that has
+	   changed in some way goes along with the event.
+	*/
+
+	if (event->type == PropertyChange) {
+		if (key && key[0] != '\0') {
+			keylen = strlen (key) + 1;
+		}
+		if (keylen > JACK_EVENT_KEY_MAX) {
+			VERBOSE (engine, "property key %s too long to queue, "
+				 "sending a change of the whole subject", key);
+			keylen = 0;
+		}
+		memcpy (entry->key, key, keylen);
+		entry->event.y.key_size = keylen;
+	}
+
+	/* publish the entry, then see whether the client may have
+	   gone to sleep on an empty queue; the client does the
+	   opposite when it has caught up.
+	*/
+
+	__sync_synchronize ();
+	queue->tail = tail + 1;
+	__sync_synchronize ();
+
+	if (queue->head == tail) {
+		DEBUG ("engine ringing %s", client->control->name);
+		jack_event_queue_ring (engine, client);
+	}
+
+	if (entry->ack) {
+		client->event_acks_pending++;
+		client->event_ack_type = event->type;
+	}
+
+	if (ack == JackEventAck) {
+		return jack_collect_client_acks (engine, client);
+	}
+
+	return 0;
+}
+
+int
+jack_deliver_event (jack_engine_t *engine, jack_client_internal_t *client,
+		    const jack_event_t *event, ...)
+{
+        va_list ap;
+        char* key = 0;
+
+        va_start (ap, event);
+
+        /* Check property change events for matching key_size and keys */
+
+        if (event->type == PropertyChange) {
+                key = va_arg (ap, char*);
+                if (key && key[0] != '\0') {
+                        size_t keylen = strlen (key) + 1;
+                        if (event->y.key_size != keylen) {
+                                jack_error ("property change key %s sent with wrong length (%d vs %d)", key, event->y.key_size, keylen);
+                                va_end (ap);
+                                return -1;
+                        }
+                }
+        }
+
+        va_end (ap);
+
+	return jack_post_event (engine, client, event, key,
+				jack_event_ack_mode (event->type));
+}
+
+/* Build the dependency graph used by parallel scheduling.  A client's
+ * successors are the members of its own subgraph found on its
+ * sortfeeds list, which is already acyclic; a client with none is a
+ * sink of the subgraph and releases the engine slot instead.
+ */
+static void
+jack_rechain_parallel (jack_engine_t *engine)
+{
+	jack_client_internal_t *head_of[JACK_ACTIVATION_MAX];
+	jack_client_internal_t *client, *head, *dst;
+	jack_activation_t *slots = engine->control->activation;
+	jack_activation_t *act;
+	JSList *node, *fnode;
+	uint32_t slot, dslot;
+	int nsucc;
+
+	memset (head_of, 0, sizeof (head_of));
+	head = NULL;
+
+	/* find the members of each external subgraph */
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+
+		client = (jack_client_internal_t *) node->data;
+
+		if (!client->control->active ||
+		    (!client->control->process_cbset &&
+		     !client->control->thread_cb_cbset)) {
+			continue;
+		}
+
+		if (jack_client_is_internal (client)) {
+			head = NULL;
+			continue;
+		}
+
+		if (head == NULL) {
+			head = client;
+			memset (head->subgraph_members, 0,
+				sizeof (head->subgraph_members));
+			head->subgraph_sinks = 0;
+		}
+
+		slot = client->control->activation_slot;
+		act = &slots[slot];
+		memset (act->successors, 0, sizeof (act->successors));
+		act->npredecessors = 0;
+		head_of[slot] = head;
+		jack_activation_set_add (head->subgraph_members, slot);
+	}
+
+	/* link each member to the members it feeds */
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+
+		client = (jack_client_internal_t *) node->data;
+		slot = client->control->activation_slot;
+
+		if (jack_client_is_internal (client) || head_of[slot] == NULL) {
+			continue;
+		}
+
+		act = &slots[slot];
+		nsucc = 0;
+
+		for (fnode = client->sortfeeds; fnode;
+		     fnode = jack_slist_next (fnode)) {
+
+			dst = (jack_client_internal_t *) fnode->data;
+			dslot = dst->control->activation_slot;
+
+			if (dst == client || jack_client_is_internal (dst)
+			    || head_of[dslot] != head_of[slot]) {
+				continue;
+			}
+
+			/* sortfeeds has one entry per connection */
+			if (!jack_activation_set_has (act->successors, dslot)) {
+				jack_activation_set_add (act->successors, dslot);
+				slots[dslot].npredecessors++;
+			}
+			nsucc++;
+		}
+
+		if (nsucc == 0) {
+			jack_activation_set_add (act->successors,
+						 JACK_ACTIVATION_ENGINE);
+			head_of[slot]->subgraph_sinks++;
+		}
+	}
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+
+		client = (jack_client_internal_t *) node->data;
+		slot = client->control->activation_slot;
+
+		if (!jack_client_is_internal (client) && head_of[slot]) {
+			VERBOSE (engine, "client %s: slot %u in subgraph "
+				 "of %s, %d predecessors%s",
+				 client->control->name, slot,
+				 head_of[slot]->control->name,
+				 slots[slot].npredecessors,
+				 jack_activation_set_has (slots[slot].successors,
+							  JACK_ACTIVATION_ENGINE) ?
+				 ", sink" : "");
+		}
+	}
+}
+
+int
+jack_rechain_graph (jack_engine_t *engine)
+{
+	JSList *node, *next;
+	unsigned long n;
+	int err = 0;
+	jack_client_internal_t *subgraph_client, *next_client;
+	jack_event_t event;
+	int upstream_is_jackd;
+
+        VALGRIND_MEMSET(&event, 0, sizeof (event));
+
+	jack_clear_fifos (engine);
+
+	subgraph_client = 0;
+
+	VERBOSE(engine, "++ jack_rechain_graph():");
+
+	event.type = GraphReordered;
+
+	for (n = 0, node = engine->clients, next = NULL; node; node = next) {
+
+                jack_client_internal_t* client = (jack_client_internal_t *) node->data;
+
+		next = jack_slist_next (node);
+                
+		if (!client->control->process_cbset && !client->control->thread_cb_cbset) {
+			continue;
+		}
+
+		VERBOSE(engine, "+++ client is now %s active ? %d",
+			client->control->name, client->control->active);
+
+		if (client->control->active) {
+
+			/* find the next active client. its ok for
+			 * this to be NULL.  test the candidate's own
+			 * state: `client' is known to be active, so
+			 * testing it would chain inactive clients in.
+			 */
+			
+			while (next) {
+				jack_client_internal_t* nc = (jack_client_internal_t *) next->data;
+				if (nc->control->active && (nc->control->process_cbset || nc->control->thread_cb_cbset)) {
+					break;
+				}
+				next = jack_slist_next (next);
+			};
+
+			if (next == NULL) {
+				next_client = NULL;
+			} else {
+				next_client = (jack_client_internal_t *)
+					next->data;
+			}
+
+			client->execution_order = n;
+			client->next_client = next_client;
+			
+			if (jack_client_is_internal (client)) {
+				
+				/* break the chain for the current
+				 * subgraph. the server will wait for
+				 * chain on the nth FIFO, and will
+				 * then execute this internal
+				 * client. */
+				
+				if (subgraph_client) {
+					subgraph_client->subgraph_wait_fd =
+						jack_get_fifo_fd (engine, n);
 					VERBOSE (engine, "client %s: wait_fd="
 						 "%d, execution_order="
 						 "%lu.", 
@@ -3318,12 +4237,28 @@ jack_rechain_graph (jack_engine_t *engine)
 					engine, client->execution_order + 1);
 				event.x.n = client->execution_order;
 				event.y.n = upstream_is_jackd;
-				jack_deliver_event (engine, client, &event);
+
+				/* the slot to trigger when this client
+				 * is done: the next client in the
+				 * subgraph, or the engine.
+				 */
+				if (next_client && !jack_client_is_internal (next_client)) {
+					event.z.n = next_client->control->activation_slot;
+				} else {
+					event.z.n = JACK_ACTIVATION_ENGINE;
+				}
+
+				jack_post_event (engine, client, &event, NULL,
+						 JackEventAckLater);
 				n++;
 			}
 		}
 	}
 
+	/* all clients must know their place before the next cycle */
+
+	jack_collect_event_acks (engine);
+
 	if (subgraph_client) {
 		subgraph_client->subgraph_wait_fd =
 			jack_get_fifo_fd (engine, n);
@@ -3333,6 +4268,10 @@ jack_rechain_graph (jack_engine_t *engine)
 			 subgraph_client->subgraph_wait_fd, n);
 	}
 
+	if (engine->control->parallel) {
+		jack_rechain_parallel (engine);
+	}
+
 	VERBOSE (engine, "-- jack_rechain_graph()");
 
 	return err;
@@ -3469,6 +4408,8 @@ jack_compute_all_port_total_latencies (jack_engine_t *engine)
 	unsigned int i;
  	int toward_port;
 
+	engine->latency_ports = 0;
+
 	for (i = 0; i < engine->control->port_max; i++) {
 		if (shared[i].in_use) {
 
@@ -3482,10 +4423,193 @@ jack_compute_all_port_total_latencies (jack_engine_t *engine)
  				jack_get_port_total_latency (
  					engine, &engine->internal_ports[i],
  					0, toward_port);
+			engine->latency_ports++;
  		}
  	}
 }
 
+/* Recompute the total latency of a client's ports and of the ports
+ * they are connected to, which are the only ones that can depend on
+ * what the client's latency callback did to its ports.
+ */
+static void
+jack_compute_client_total_latencies (jack_engine_t *engine,
+				     jack_client_internal_t *client)
+{
+	JSList *pnode, *cnode;
+
+	for (pnode = client->ports; pnode; pnode = jack_slist_next (pnode)) {
+		jack_port_internal_t *port = (jack_port_internal_t *) pnode->data;
+
+		jack_compute_port_total_latency (engine, port->shared);
+		engine->latency_ports++;
+
+		for (cnode = port->connections; cnode; cnode = jack_slist_next (cnode)) {
+			jack_connection_internal_t *c =
+				(jack_connection_internal_t *) cnode->data;
+			jack_port_internal_t *other =
+				(c->source == port) ? c->destination : c->source;
+
+			jack_compute_port_total_latency (engine, other->shared);
+			engine->latency_ports++;
+		}
+	}
+}
+
+/* A connection between src and dst was made or broken.  The total
+ * latency of a port only depends on the ports it is connected to, so
+ * only these two need it recomputed.  Capture latencies can now differ
+ * downstream of dst's client and playback latencies upstream of src's,
+ * which is where jack_update_new_latency() starts looking.
+ */
+static void
+jack_latency_edge_changed (jack_engine_t *engine, jack_port_internal_t *src,
+			   jack_port_internal_t *dst)
+{
+	jack_client_internal_t *client;
+
+	jack_compute_port_total_latency (engine, src->shared);
+	jack_compute_port_total_latency (engine, dst->shared);
+	engine->latency_ports += 2;
+
+	if ((client = jack_client_internal_by_id (engine, src->shared->client_id))) {
+		client->latency_dirty |= JACK_LATENCY_PLAYBACK_DIRTY;
+	}
+	if ((client = jack_client_internal_by_id (engine, dst->shared->client_id))) {
+		client->latency_dirty |= JACK_LATENCY_CAPTURE_DIRTY;
+	}
+	engine->latency_seeded = 1;
+}
+
+/* Whether a latency callback in `mode' (0 capture, 1 playback) would
+ * find different ranges on the client's ports than they have now.
+ * The callback starts by setting the range of each input (capture) or
+ * output (playback) port from the ports it is connected to, as
+ * jack_port_recalculate_latency() does, and everything else it does
+ * follows from those.
+ */
+static int
+jack_client_latency_stale (jack_engine_t *engine,
+			   jack_client_internal_t *client, int mode)
+{
+	JSList *pnode, *cnode;
+	uint32_t min, max;
+
+	for (pnode = client->ports; pnode; pnode = jack_slist_next (pnode)) {
+		jack_port_internal_t *port = (jack_port_internal_t *) pnode->data;
+		volatile jack_latency_range_t *range;
+
+		if (!(port->shared->flags &
+		      (mode ? JackPortIsOutput : JackPortIsInput))) {
+			continue;
+		}
+
+		engine->latency_ports++;
+		min = UINT32_MAX;
+		max = 0;
+
+		for (cnode = port->connections; cnode; cnode = jack_slist_next (cnode)) {
+			jack_connection_internal_t *c =
+				(jack_connection_internal_t *) cnode->data;
+			jack_port_internal_t *other =
+				(c->source == port) ? c->destination : c->source;
+
+			range = mode ? &other->shared->playback_latency
+				: &other->shared->capture_latency;
+			if (range->max > max) {
+				max = range->max;
+			}
+			if (range->min < min) {
+				min = range->min;
+			}
+		}
+
+		if (min == UINT32_MAX) {
+			min = 0;
+		}
+
+		range = mode ? &port->shared->playback_latency
+			: &port->shared->capture_latency;
+		if (range->min != min || range->max != max) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void
+jack_update_latency_callback (jack_engine_t *engine,
+			      jack_client_internal_t *client, int mode)
+{
+	jack_event_t event;
+
+	if (!jack_client_latency_stale (engine, client, mode)) {
+		return;
+	}
+
+        VALGRIND_MEMSET (&event, 0, sizeof (event));
+
+	event.type = LatencyCallback;
+	event.x.n = mode;
+	jack_deliver_event (engine, client, &event);
+	engine->latency_callbacks++;
+
+	jack_compute_client_total_latencies (engine, client);
+}
+
+/* jack_compute_new_latency() for connection changes in a graph
+ * without feedback: go over the clients in the same order, but from
+ * the first one that a changed connection touched, and only call
+ * those whose ports would get different ranges.  A client left alone
+ * cannot change anything further on.
+ */
+static void
+jack_update_new_latency (jack_engine_t *engine)
+{
+	JSList *node;
+	JSList *reverse_list = NULL;
+	jack_client_internal_t *client;
+	int started;
+
+	engine->latency_callbacks = 0;
+	started = 0;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t *) node->data;
+		reverse_list = jack_slist_prepend (reverse_list, client);
+		if (client->latency_dirty & JACK_LATENCY_CAPTURE_DIRTY) {
+			started = 1;
+		}
+		if (started) {
+			jack_update_latency_callback (engine, client, 0);
+		}
+	}
+
+        if (started && engine->driver) {
+		jack_update_latency_callback (engine, engine->driver->internal_client, 0);
+        }
+
+	started = 0;
+
+	for (node = reverse_list; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t *) node->data;
+		if (client->latency_dirty & JACK_LATENCY_PLAYBACK_DIRTY) {
+			started = 1;
+		}
+		if (started) {
+			jack_update_latency_callback (engine, client, 1);
+		}
+		client->latency_dirty = 0;
+	}
+
+        if (started && engine->driver) {
+		jack_update_latency_callback (engine, engine->driver->internal_client, 1);
+        }
+
+	jack_slist_free (reverse_list);
+}
+
 static void
 jack_compute_new_latency (jack_engine_t *engine)
 {
@@ -3506,6 +4630,7 @@ jack_compute_new_latency (jack_engine_t *engine)
 
                 jack_client_internal_t* client = (jack_client_internal_t *) node->data;
 		reverse_list = jack_slist_prepend (reverse_list, client);
+		client->latency_dirty = 0;
 		jack_deliver_event (engine, client, &event);
 	}
 
@@ -3525,6 +4650,10 @@ jack_compute_new_latency (jack_engine_t *engine)
                 jack_deliver_event (engine, engine->driver->internal_client, &event);
         }
 
+	engine->latency_callbacks = 2 * jack_slist_length (reverse_list)
+		+ (engine->driver ? 2 : 0);
+	engine->latency_seeded = 0;
+
 	jack_slist_free (reverse_list);
 }
 
@@ -3554,6 +4683,12 @@ jack_compute_new_latency (jack_engine_t *engine)
  * except that feedback connections appear normally instead of reversed.
  * This is used to detect whether the graph has become acyclic.
  *
+ * The execution order is a topological sort of the sortfeeds relation,
+ * and each client remembers its position in it.  A new connection that
+ * agrees with that order, and any disconnection that does not turn
+ * feedback connections around, leave the order valid, so the clients
+ * are not re-sorted for them.
+ *
  */ 
 
 void
@@ -3561,52 +4696,276 @@ jack_sort_graph (jack_engine_t *engine)
 {
 	/* called, obviously, must hold engine->client_lock */
 
+	jack_time_t then;
+
+	if (engine->graph_batch) {
+		/* the order is sorted now all the same, as
+		   jack_client_reaches() relies on it being topological
+		   for the rest of the batch; only the rest waits */
+		jack_topological_sort (engine);
+		engine->graph_batch_changed = 1;
+		return;
+	}
+
+	then = jack_get_microseconds ();
+
 	VERBOSE (engine, "++ jack_sort_graph");
-	engine->clients = jack_slist_sort (engine->clients,
-					   (JCompareFunc) jack_client_sort);
-	jack_compute_all_port_total_latencies (engine);
-	jack_compute_new_latency (engine);
-	jack_rechain_graph (engine);
-	engine->timeout_count = 0;
+	jack_topological_sort (engine);
+	VERBOSE (engine, "sorted clients in %" PRIu64 " usecs",
+		 jack_get_microseconds () - then);
+	jack_graph_changed (engine);
 	VERBOSE (engine, "-- jack_sort_graph");
 }
 
-static int 
-jack_client_sort (jack_client_internal_t *a, jack_client_internal_t *b)
+/* Everything jack_sort_graph() does except the sort itself, for
+ * callers that know the current client order is still valid.
+ */
+static void
+jack_graph_changed (jack_engine_t *engine)
 {
-	/* drivers are forced to the front, ie considered as sources
-	   rather than sinks for purposes of the sort */
+	if (engine->graph_batch) {
+		engine->graph_batch_changed = 1;
+		return;
+	}
 
-	if (jack_client_feeds_transitive (a, b) ||
-	    (a->control->type == ClientDriver &&
-	     b->control->type != ClientDriver)) {
-		return -1;
-	} else if (jack_client_feeds_transitive (b, a) ||
-		   (b->control->type == ClientDriver &&
-		    a->control->type != ClientDriver)) {
-		return 1;
+	/* around a feedback loop every pass can move the ranges again,
+	   so keep doing exactly one full pass there */
+
+	if (engine->latency_seeded && engine->feedbackcount == 0) {
+		jack_update_new_latency (engine);
+		engine->latency_seeded = 0;
 	} else {
-		return 0;
+		jack_compute_all_port_total_latencies (engine);
+		jack_compute_new_latency (engine);
+	}
+
+	VERBOSE (engine, "latency: %lu ports recomputed, %lu callbacks",
+		 engine->latency_ports, engine->latency_callbacks);
+	engine->latency_ports = 0;
+
+	jack_rechain_graph (engine);
+	engine->timeout_count = 0;
+}
+
+/* Between these two, jack_sort_graph() only re-sorts the clients and
+ * jack_graph_changed() only notes that it is needed, and
+ * jack_graph_batch_end() recomputes latencies and rechains the graph
+ * once.  Caller must hold the graph lock.
+ */
+static void
+jack_graph_batch_begin (jack_engine_t *engine)
+{
+	engine->graph_batch = 1;
+	engine->graph_batch_changed = 0;
+}
+
+static void
+jack_graph_batch_end (jack_engine_t *engine)
+{
+	engine->graph_batch = 0;
+
+	/* the owners of the ports have seen their connections change */
+
+	jack_collect_event_acks (engine);
+
+	if (engine->graph_batch_changed) {
+		jack_graph_changed (engine);
+	}
+}
+
+/* The ready clients in jack_topological_sort() are kept in a binary
+ * min-heap on this key: drivers first, then everything else, each in
+ * the order the clients had before the sort.
+ */
+static inline int
+jack_sort_key (jack_client_internal_t *client, int n)
+{
+	return (client->control->type == ClientDriver ? 0 : n)
+		+ client->sort_index;
+}
+
+static void
+jack_sort_heap_push (jack_client_internal_t **heap, int *size,
+		     jack_client_internal_t *client, int n)
+{
+	int i = (*size)++;
+	int parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (jack_sort_key (heap[parent], n)
+		    <= jack_sort_key (client, n)) {
+			break;
+		}
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = client;
+}
+
+static jack_client_internal_t *
+jack_sort_heap_pop (jack_client_internal_t **heap, int *size, int n)
+{
+	jack_client_internal_t *top = heap[0];
+	jack_client_internal_t *last = heap[--(*size)];
+	int i = 0;
+	int child;
+
+	while ((child = 2 * i + 1) < *size) {
+		if (child + 1 < *size
+		    && jack_sort_key (heap[child + 1], n)
+		    < jack_sort_key (heap[child], n)) {
+			child++;
+		}
+		if (jack_sort_key (last, n) <= jack_sort_key (heap[child], n)) {
+			break;
+		}
+		heap[i] = heap[child];
+		i = child;
 	}
+	heap[i] = last;
+
+	return top;
 }
 
-/* transitive closure of the relation expressed by the sortfeeds lists. */
+/* Kahn's algorithm over the sortfeeds lists, always taking the ready
+ * client that comes first in the current order.  That makes the sort
+ * stable: if the current order is still topological it comes out
+ * unchanged, and otherwise clients only move as far as the new
+ * connections make them.  Drivers are taken before anything else:
+ * they are only ever fed by other drivers, so this puts all of them at
+ * the front.
+ */
+static void
+jack_topological_sort (jack_engine_t *engine)
+{
+	jack_client_internal_t **order, **ready;
+	jack_client_internal_t *client, *dst;
+	JSList *node, *fnode;
+	int n, i, nout, nready;
+
+	if ((n = jack_slist_length (engine->clients)) == 0) {
+		return;
+	}
+
+	if ((order = (jack_client_internal_t **)
+	     malloc (2 * n * sizeof (jack_client_internal_t *))) == NULL) {
+		jack_error ("cannot allocate space to sort %d clients", n);
+		return;
+	}
+	ready = order + n;
+
+	/* sort_index is rewritten below, so it can hold the current
+	   position until then */
+
+	for (i = 0, node = engine->clients; node;
+	     node = jack_slist_next (node), ++i) {
+		client = (jack_client_internal_t *) node->data;
+		client->tfedcount = 0;
+		client->sort_index = i;
+	}
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t *) node->data;
+		for (fnode = client->sortfeeds; fnode;
+		     fnode = jack_slist_next (fnode)) {
+			((jack_client_internal_t *) fnode->data)->tfedcount++;
+		}
+	}
+
+	nready = 0;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t *) node->data;
+		if (client->tfedcount == 0) {
+			jack_sort_heap_push (ready, &nready, client, n);
+		}
+	}
+
+	nout = 0;
+
+	while (nready > 0) {
+
+		client = jack_sort_heap_pop (ready, &nready, n);
+		client->tfedcount = -1;
+		order[nout++] = client;
+
+		for (fnode = client->sortfeeds; fnode;
+		     fnode = jack_slist_next (fnode)) {
+			dst = (jack_client_internal_t *) fnode->data;
+			if (--dst->tfedcount == 0) {
+				jack_sort_heap_push (ready, &nready, dst, n);
+			}
+		}
+	}
+
+	if (nout < n) {
+
+		/* can't happen: connections that would close a cycle
+		   are entered in sortfeeds the other way around.
+		*/
+
+		jack_error ("client graph contains a cycle, %d clients "
+			    "left in their previous order", n - nout);
+
+		for (node = engine->clients; node; node = jack_slist_next (node)) {
+			client = (jack_client_internal_t *) node->data;
+			if (client->tfedcount >= 0) {
+				order[nout++] = client;
+			}
+		}
+	}
+
+	/* reuse the list nodes rather than building a new list */
+
+	for (i = 0, node = engine->clients; node;
+	     node = jack_slist_next (node), ++i) {
+		node->data = order[i];
+		order[i]->sort_index = i;
+	}
+
+	free (order);
+}
+
+/* Is `b' in its place relative to `a' in the current sort, so that
+ * an a -> b sortfeeds entry needs no re-sort?
+ */
 static int
-jack_client_feeds_transitive (jack_client_internal_t *source,
-			      jack_client_internal_t *dest )
+jack_client_sorted_before (jack_client_internal_t *a,
+			   jack_client_internal_t *b)
+{
+	return a->sort_index >= 0 && b->sort_index >= 0
+		&& a->sort_index < b->sort_index;
+}
+
+static int
+jack_client_reaches (unsigned long mark, jack_client_internal_t *source,
+		     jack_client_internal_t *dest)
 {
 	jack_client_internal_t *med;
 	JSList *node;
-	
-	if (jack_slist_find (source->sortfeeds, dest)) {
-		return 1;
+
+	if (source->sort_mark == mark) {
+		return 0;
 	}
+	source->sort_mark = mark;
 
 	for (node = source->sortfeeds; node; node = jack_slist_next (node)) {
 
 		med = (jack_client_internal_t *) node->data;
 
-		if (jack_client_feeds_transitive (med, dest)) {
+		if (med == dest) {
+			return 1;
+		}
+
+		/* the current order is a topological one, so nothing
+		   sorted after dest can lead back to it.
+		*/
+		if (jack_client_sorted_before (dest, med)) {
+			continue;
+		}
+
+		if (jack_client_reaches (mark, med, dest)) {
 			return 1;
 		}
 	}
@@ -3614,60 +4973,76 @@ jack_client_feeds_transitive (jack_client_internal_t *source,
 	return 0;
 }
 
+/* transitive closure of the relation expressed by the sortfeeds
+ * lists, visiting each client at most once.
+ */
+static int
+jack_client_feeds_transitive (jack_engine_t *engine,
+			      jack_client_internal_t *source,
+			      jack_client_internal_t *dest)
+{
+	return jack_client_reaches (++engine->sort_generation, source, dest);
+}
+
 /**
  * Checks whether the graph has become acyclic and if so modifies client
  * sortfeeds lists to turn leftover feedback connections into normal ones.
  * This lowers latency, but at the expense of some data corruption.
+ * Returns non-zero if the sortfeeds lists were changed.
  */
-static void
+static int
 jack_check_acyclic (jack_engine_t *engine)
 {
 	JSList *srcnode, *dstnode, *portnode, *connnode;
 	jack_client_internal_t *src, *dst;
+	jack_client_internal_t **ready;
 	jack_port_internal_t *port;
 	jack_connection_internal_t *conn;
 	int stuck;
-	int unsortedclients = 0;
+	int n, head, tail;
 
 	VERBOSE (engine, "checking for graph become acyclic");
 
+	if ((n = jack_slist_length (engine->clients)) == 0) {
+		return 0;
+	}
+
+	if ((ready = (jack_client_internal_t **)
+	     malloc (n * sizeof (jack_client_internal_t *))) == NULL) {
+		jack_error ("cannot allocate space to check %d clients", n);
+		return 0;
+	}
+
+	head = tail = 0;
+
 	for (srcnode = engine->clients; srcnode;
 	     srcnode = jack_slist_next (srcnode)) {
 
 		src = (jack_client_internal_t *) srcnode->data;
 		src->tfedcount = src->fedcount;
-		unsortedclients++;
+		if (!src->tfedcount) {
+			ready[tail++] = src;
+		}
 	}
 	
-	stuck = FALSE;
-
 	/* find out whether a normal sort would have been possible */
-	while (unsortedclients && !stuck) {
-	
-		stuck = TRUE;
+	while (head < tail) {
 
-		for (srcnode = engine->clients; srcnode;
-	     	     srcnode = jack_slist_next (srcnode)) {
+		src = ready[head++];
 
-			src = (jack_client_internal_t *) srcnode->data;
-			
-			if (!src->tfedcount) {
-			
-				stuck = FALSE;
-				unsortedclients--;
-				src->tfedcount = -1;
-				
-				for (dstnode = src->truefeeds; dstnode;
-				     dstnode = jack_slist_next (dstnode)) {
-				     
-					dst = (jack_client_internal_t *)
-						dstnode->data;
-					dst->tfedcount--;
-				}
+		for (dstnode = src->truefeeds; dstnode;
+		     dstnode = jack_slist_next (dstnode)) {
+
+			dst = (jack_client_internal_t *) dstnode->data;
+			if (--dst->tfedcount == 0) {
+				ready[tail++] = dst;
 			}
 		}
 	}
-	
+
+	free (ready);
+	stuck = (tail < n);
+
 	if (stuck) {
 
 		VERBOSE (engine, "graph is still cyclic" );
@@ -3718,6 +5093,8 @@ jack_check_acyclic (jack_engine_t *engine)
 		}
 		engine->feedbackcount = 0;
 	}
+
+	return !stuck;
 }
 
 /**
@@ -3753,6 +5130,23 @@ void jack_dump_configuration(jack_engine_t *engine, int take_lock)
 			 client->subgraph_start_fd,
 			 client->subgraph_wait_fd);
 
+		if (ctl->activation_slot != JACK_ACTIVATION_ENGINE) {
+			jack_activation_t *act =
+				&engine->control->activation[ctl->activation_slot];
+			jack_info ("\t activation slot %d: %" PRIu64 " hops,"
+				   " mean wakeup %.3f usecs, max %" PRIu32 " usecs",
+				   ctl->activation_slot, act->hop_count,
+				   act->hop_count ?
+				   (float) act->hop_usecs / act->hop_count : 0.0f,
+				   act->hop_max_usecs);
+		}
+
+		if (ctl->tlb_cycles) {
+			jack_info ("\t %" PRIu64 " dTLB load misses in %" PRIu64
+				   " cycles, NUMA node %d", ctl->tlb_misses,
+				   ctl->tlb_cycles, ctl->numa_node);
+		}
+
 		for(m = 0, portnode = client->ports; portnode;
 		    portnode = jack_slist_next (portnode)) {
 		        port = (jack_port_internal_t *) portnode->data;
@@ -3787,15 +5181,16 @@ void jack_dump_configuration(jack_engine_t *engine, int take_lock)
 }
 
 static int 
-jack_port_do_connect (jack_engine_t *engine,
-		       const char *source_port,
-		       const char *destination_port)
+jack_port_connect_internal (jack_engine_t *engine,
+			    const char *source_port,
+			    const char *destination_port)
 {
 	jack_connection_internal_t *connection;
 	jack_port_internal_t *srcport, *dstport;
 	jack_port_id_t src_id, dst_id;
 	jack_client_internal_t *srcclient, *dstclient;
 	JSList *it;
+	int resort = 0;
 
 	if ((srcport = jack_get_port_by_name (engine, source_port)) == NULL) {
 		jack_error ("unknown source port in attempted connection [%s]",
@@ -3876,7 +5271,7 @@ jack_port_do_connect (jack_engine_t *engine,
 	src_id = srcport->shared->id;
 	dst_id = dstport->shared->id;
 
-	jack_lock_graph (engine);
+	/* caller must hold the graph lock */
 
 	if (dstport->connections && !dstport->shared->has_mixdown) {
 		jack_port_type_info_t *port_type =
@@ -3884,7 +5279,6 @@ jack_port_do_connect (jack_engine_t *engine,
 		jack_error ("cannot make multiple connections to a port of"
 			    " type [%s]", port_type->type_name);
 		free (connection);
-		jack_unlock_graph (engine);
 		return -1;
 	} else {
 
@@ -3911,7 +5305,7 @@ jack_port_do_connect (jack_engine_t *engine,
 
 			dstclient->fedcount++;				
 
-			if (jack_client_feeds_transitive (dstclient,
+			if (jack_client_feeds_transitive (engine, dstclient,
 							  srcclient ) ||
 			    (dstclient->control->type == ClientDriver &&
 			     srcclient->control->type != ClientDriver)) {
@@ -3946,6 +5340,11 @@ jack_port_do_connect (jack_engine_t *engine,
 					(srcclient->sortfeeds, dstclient);
 
 				connection->dir = 1;
+
+				/* only a new forward edge can break
+				   the current order */
+				resort = !jack_client_sorted_before
+					(srcclient, dstclient);
 			}
 		}
 		else
@@ -3964,6 +5363,8 @@ jack_port_do_connect (jack_engine_t *engine,
 			jack_slist_prepend (dstport->connections, connection);
 		srcport->connections =
 			jack_slist_prepend (srcport->connections, connection);
+
+		jack_latency_edge_changed (engine, srcport, dstport);
 		
 		DEBUG ("actually sorted the graph...");
 
@@ -3980,12 +5381,30 @@ jack_port_do_connect (jack_engine_t *engine,
 
 		jack_notify_all_port_interested_clients (engine, srcport->shared->client_id, dstport->shared->client_id, src_id, dst_id, 1);
 
-		jack_sort_graph (engine);
+		if (resort) {
+			jack_sort_graph (engine);
+		} else {
+			VERBOSE (engine, "client order unchanged");
+			jack_graph_changed (engine);
+		}
 	}
 
+	return 0;
+}
+
+static int 
+jack_port_do_connect (jack_engine_t *engine,
+		       const char *source_port,
+		       const char *destination_port)
+{
+	int ret;
+
+	jack_lock_graph (engine);
+	ret = jack_port_connect_internal (engine, source_port,
+					  destination_port);
 	jack_unlock_graph (engine);
 
-	return 0;
+	return ret;
 }
 
 int
@@ -4035,6 +5454,8 @@ jack_port_disconnect_internal (jack_engine_t *engine,
 				srcport->shared->monitor_requests = 0;
 			}
 
+			jack_latency_edge_changed (engine, srcport, dstport);
+
 			jack_send_connection_notification (
 				engine, srcport->shared->client_id, src_id,
 				dst_id, FALSE);
@@ -4086,11 +5507,14 @@ jack_port_disconnect_internal (jack_engine_t *engine,
 		}
 	}
 
-	if (check_acyclic) {
-		jack_check_acyclic (engine);
+	/* removing an edge leaves the current order valid, unless
+	   feedback connections got turned around.
+	*/
+	if (check_acyclic && jack_check_acyclic (engine)) {
+		jack_sort_graph (engine);
+	} else {
+		jack_graph_changed (engine);
 	}
-	
-	jack_sort_graph (engine);
 
 	return ret;
 }
@@ -4109,20 +5533,22 @@ jack_port_do_disconnect_all (jack_engine_t *engine,
 		 engine->internal_ports[port_id].shared->name);
 
 	jack_lock_graph (engine);
+	jack_graph_batch_begin (engine);
 	jack_port_clear_connections (engine, &engine->internal_ports[port_id]);
-	jack_sort_graph (engine);
+	jack_graph_batch_end (engine);
 	jack_unlock_graph (engine);
 
 	return 0;
 }
 
 static int 
-jack_port_do_disconnect (jack_engine_t *engine,
-			 const char *source_port,
-			 const char *destination_port)
+jack_port_disconnect_names (jack_engine_t *engine,
+			    const char *source_port,
+			    const char *destination_port)
 {
 	jack_port_internal_t *srcport, *dstport;
-	int ret = -1;
+
+	/* caller must hold the graph lock */
 
 	if ((srcport = jack_get_port_by_name (engine, source_port)) == NULL) {
 		jack_error ("unknown source port in attempted disconnection"
@@ -4137,15 +5563,66 @@ jack_port_do_disconnect (jack_engine_t *engine,
 		return -1;
 	}
 
-	jack_lock_graph (engine);
+	return jack_port_disconnect_internal (engine, srcport, dstport);
+}
 
-	ret = jack_port_disconnect_internal (engine, srcport, dstport);
+static int 
+jack_port_do_disconnect (jack_engine_t *engine,
+			 const char *source_port,
+			 const char *destination_port)
+{
+	int ret;
 
+	jack_lock_graph (engine);
+	ret = jack_port_disconnect_names (engine, source_port,
+					  destination_port);
 	jack_unlock_graph (engine);
 
 	return ret;
 }
 
+/* Apply a list of connection changes, sorting the graph, computing
+ * latencies and telling clients about the new order once at the end
+ * rather than after each change.  Each change gets its own status, as
+ * jack_connect() or jack_disconnect() would have returned.
+ */
+static int
+jack_port_do_change_connections (jack_engine_t *engine,
+				 const jack_connection_change_t *changes,
+				 uint32_t count, int32_t *results)
+{
+	jack_time_t then = jack_get_microseconds ();
+	uint32_t i;
+	int failed = 0;
+
+	jack_lock_graph (engine);
+	jack_graph_batch_begin (engine);
+
+	for (i = 0; i < count; i++) {
+		if (changes[i].connect) {
+			results[i] = jack_port_connect_internal
+				(engine, changes[i].source_port,
+				 changes[i].destination_port);
+		} else {
+			results[i] = jack_port_disconnect_names
+				(engine, changes[i].source_port,
+				 changes[i].destination_port);
+		}
+		if (results[i] < 0) {
+			failed++;
+		}
+	}
+
+	jack_graph_batch_end (engine);
+	jack_unlock_graph (engine);
+
+	VERBOSE (engine, "%" PRIu32 " connection changes (%d failed) in %"
+		 PRIu64 " usecs", count, failed,
+		 jack_get_microseconds () - then);
+
+	return failed ? -1 : 0;
+}
+
 int 
 jack_get_fifo_fd (jack_engine_t *engine, unsigned int which_fifo)
 {
@@ -4309,6 +5786,7 @@ jack_port_release (jack_engine_t *engine, jack_port_internal_t *port)
 
 
 	pthread_mutex_lock (&engine->port_lock);
+	jack_port_name_index_remove (engine->control, port->shared->id);
 	port->shared->in_use = 0;
 	port->shared->alias1[0] = '\0';
 	port->shared->alias2[0] = '\0';
@@ -4331,17 +5809,7 @@ jack_get_port_internal_by_name (jack_engine_t *engine, const char *name)
 {
 	jack_port_id_t id;
 
-	pthread_mutex_lock (&engine->port_lock);
-
-	for (id = 0; id < engine->port_max; id++) {
-		if (jack_port_name_equals (&engine->control->ports[id], name)) {
-			break;
-		}
-	}
-
-	pthread_mutex_unlock (&engine->port_lock);
-	
-	if (id != engine->port_max) {
+	if ((id = jack_port_name_index_find (engine->control, name)) != NO_PORT) {
 		return &engine->internal_ports[id];
 	} else {
 		return NULL;
@@ -4453,13 +5921,16 @@ next:
 	shared->playback_latency.min = shared->playback_latency.max = 0;
 	shared->monitor_requests = 0;
 
+	jack_port_name_index_add (engine->control, port_id);
+
 	port = &engine->internal_ports[port_id];
 
 	port->shared = shared;
 	port->connections = 0;
 	port->buffer_info = NULL;
 	
-	if (jack_port_assign_buffer (engine, port)) {
+	if (jack_port_assign_buffer (engine, port,
+				     client->control->numa_node)) {
 		jack_error ("cannot assign buffer for port");
 		jack_port_release (engine, &engine->internal_ports[port_id]);
 		jack_unlock_graph (engine);
@@ -4728,12 +6199,15 @@ jack_property_change_notify (jack_engine_t *engine,
 	}
 }
 
+/* Give an output port a buffer, preferably one on NUMA `node'. */
 int
-jack_port_assign_buffer (jack_engine_t *engine, jack_port_internal_t *port)
+jack_port_assign_buffer (jack_engine_t *engine, jack_port_internal_t *port,
+			 int32_t node)
 {
 	jack_port_buffer_list_t *blist =
 		jack_port_buffer_list (engine, port);
 	jack_port_buffer_info_t *bi;
+	JSList *n;
 
 	if (port->shared->flags & JackPortIsInput) {
 		port->shared->offset = 0;
@@ -4752,6 +6226,19 @@ jack_port_assign_buffer (jack_engine_t *engine, jack_port_internal_t *port)
 	}
 
 	bi = (jack_port_buffer_info_t *) blist->freelist->data;
+
+	if (blist->nodes > 1 && node >= 0) {
+		for (n = blist->freelist; n; n = jack_slist_next (n)) {
+			jack_port_buffer_info_t *b =
+				(jack_port_buffer_info_t *) n->data;
+			if ((unsigned long) (b - blist->info) / blist->per_node
+			    == (unsigned long) node) {
+				bi = b;
+				break;
+			}
+		}
+	}
+
 	blist->freelist = jack_slist_remove (blist->freelist, bi);
 
 	port->shared->offset = bi->offset;
@@ -4770,11 +6257,8 @@ jack_get_port_by_name (jack_engine_t *engine, const char *name)
 	   elements prevent this from being a problem.
 	*/
 
-	for (id = 0; id < engine->port_max; id++) {
-		if (engine->control->ports[id].in_use &&
-		    jack_port_name_equals (&engine->control->ports[id], name)) {
-			return &engine->internal_ports[id];
-		}
+	if ((id = jack_port_name_index_find (engine->control, name)) != NO_PORT) {
+		return &engine->internal_ports[id];
 	}
 
 	return NULL;
@@ -4803,7 +6287,9 @@ jack_send_connection_notification (jack_engine_t *engine,
 		event.x.self_id = self_id;
 		event.y.other_id = other_id;
 		
-		if (jack_deliver_event (engine, client, &event)) {
+		if (jack_post_event (engine, client, &event, NULL,
+				     engine->graph_batch ?
+				     JackEventAckLater : JackEventAck)) {
 			jack_error ("cannot send port connection notification"
 				    " to client %s (%s)", 
 				    client->control->name, strerror (errno));
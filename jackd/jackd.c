@@ -72,6 +72,10 @@ static int do_unlock = 0;
 static jack_nframes_t frame_time_offset = 0;
 static int nozombies = 0;
 static int timeout_count_threshold = 0;
+static jack_activation_mode_t activation = JackActivationFifo;
+static int parallel = 0;
+static const char *hugepages = NULL;
+static jack_nframes_t max_buffer_size = 0;
 
 extern int sanitycheck (int, int);
 
@@ -257,7 +261,9 @@ jack_main (jack_driver_desc_t * driver_desc, JSList * driver_params, JSList * sl
 				       do_mlock, do_unlock, server_name,
 				       temporary, verbose, client_timeout,
 				       port_max, getpid(), frame_time_offset, 
-				       nozombies, timeout_count_threshold, drivers)) == 0) {
+				       nozombies, timeout_count_threshold,
+				       activation, parallel, hugepages,
+				       max_buffer_size, drivers)) == 0) {
 		jack_error ("cannot create engine");
 		return -1;
 	}
@@ -496,6 +502,10 @@ static void usage (FILE *file)
 "             [ --no-sanity-checks OR -N ]\n"
 "             [ --verbose OR -v ]\n"
 "             [ --clocksource OR -c [ c(ycle) | h(pet) | s(ystem) ]\n"
+"             [ --activation OR -a [ fifo | futex ] ]\n"
+"             [ --parallel OR -j ]\n"
+"             [ --hugepages[=hugetlbfs-mount] OR -H[hugetlbfs-mount] ]\n"
+"             [ --max-buffer-size OR -B frames ]\n"
 "             [ --replace-registry ]\n"
 "             [ --silent OR -s ]\n"
 "             [ --version OR -V ]\n"
@@ -641,16 +651,20 @@ main (int argc, char *argv[])
 	int do_sanity_checks = 1;
 	int show_version = 0;
 
-	const char *options = "-d:P:uvshVrRZTFlI:t:mM:n:Np:c:X:C:";
+	const char *options = "-d:P:uvshVrRZTFlI:t:mM:n:Np:c:X:C:a:jH::B:";
 	struct option long_options[] = 
 	{ 
 		/* keep ordered by single-letter option code */
 
+		{ "activation", 1, 0, 'a' },
+		{ "max-buffer-size", 1, 0, 'B' },
 		{ "clock-source", 1, 0, 'c' },
 		{ "driver", 1, 0, 'd' },
 		{ "help", 0, 0, 'h' },
+		{ "hugepages", 2, 0, 'H' },
 		{ "tmpdir-location", 0, 0, 'l' },
 		{ "internal-client", 0, 0, 'I' },
+		{ "parallel", 0, 0, 'j' },
 		{ "no-mlock", 0, 0, 'm' },
 		{ "midi-bufsize", 1, 0, 'M' },
 		{ "name", 1, 0, 'n' },
@@ -695,6 +709,21 @@ main (int argc, char *argv[])
 				   long_options, &option_index)) != EOF) {
 		switch (opt) {
 
+		case 'a':
+			if (strcmp (optarg, "fifo") == 0) {
+				activation = JackActivationFifo;
+			} else if (strcmp (optarg, "futex") == 0) {
+				activation = JackActivationFutex;
+			} else {
+				usage (stderr);
+				return -1;
+			}
+			break;
+
+		case 'B':
+			max_buffer_size = atoi (optarg);
+			break;
+
 		case 'c':
 			if (tolower (optarg[0]) == 'h') {
 				clock_source = JACK_TIMER_HPET;
@@ -724,6 +753,14 @@ main (int argc, char *argv[])
 			frame_time_offset = JACK_MAX_FRAMES - atoi(optarg); 
 			break;
 
+		case 'j':
+			parallel = 1;
+			break;
+
+		case 'H':
+			hugepages = optarg ? optarg : "auto";
+			break;
+
 		case 'l':
 			/* special flag to allow libjack to determine jackd's idea of where tmpdir is */
 			printf ("%s\n", jack_tmpdir);
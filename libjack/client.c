@@ -30,7 +30,6 @@
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
 #endif
-#include <regex.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -44,6 +43,8 @@
 
 #include "internal.h"
 #include "engine.h"
+#include "activation.h"
+#include "locality.h"
 #include "pool.h"
 #include "version.h"
 #include "shm.h"
@@ -51,6 +52,7 @@
 #include "varargs.h"
 #include "intsimd.h"
 #include "messagebuffer.h"
+#include "metadatastore.h"
 
 #include <sysdeps/time.h>
 
@@ -90,8 +92,12 @@ int cpu_type = 0;
 static void
 init_cpu ()
 {
-	cpu_type = ((have_3dnow() << 8) | have_sse());
+	cpu_type = ((have_avx() << 16) | (have_3dnow() << 8) | have_sse());
 #if 0
+	if (ARCH_X86_HAVE_AVX512(cpu_type))
+		jack_debug("AVX-512 detected");
+	else if (ARCH_X86_HAVE_AVX2(cpu_type))
+		jack_debug("AVX2 detected");
 	if (ARCH_X86_HAVE_3DNOW(cpu_type))
 		jack_debug("Enhanced3DNow! detected");
 	if (ARCH_X86_HAVE_SSE2(cpu_type))
@@ -242,32 +248,96 @@ jack_info (const char *fmt, ...)
 	va_end (ap);
 }
 
+static int
+write_property_data (int fd, const char *data, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		if ((n = write (fd, data, len)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int
+read_connection_results (int fd, int32_t *results, uint32_t count)
+{
+	char *data = (char *) results;
+	size_t len = count * sizeof (int32_t);
+	ssize_t n;
+
+	while (len) {
+		if ((n = read (fd, data, len)) <= 0) {
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
 static int
 oop_client_deliver_request (void *ptr, jack_request_t *req)
 {
 	int wok, rok;
 	jack_client_t *client = (jack_client_t*) ptr;
+	jack_connection_change_t *changes = req->x.connections.changes;
+	int32_t *results = req->x.connections.results;
+	uint32_t count = req->x.connections.count;
 
 	wok = (write (client->request_fd, req, sizeof (*req))
 	       == sizeof (*req));
 
-        /* if necessary, add variable length key data after a PropertyChange request
+        /* if necessary, add variable length key, value and type data
+         * after a property request
          */
 
-        if (req->type == PropertyChangeNotify) {
-                if (req->x.property.keylen) {
-                        if (write (client->request_fd, req->x.property.key, req->x.property.keylen) != req->x.property.keylen) {
-                                jack_error ("cannot send property key of length %d to server",
-                                            req->x.property.keylen);
-                                req->status = -1;
-                                return req->status;
-                        }
+        if (jack_is_property_request (req->type)) {
+                if (write_property_data (client->request_fd, req->x.property.key, req->x.property.keylen)
+                    || write_property_data (client->request_fd, req->x.property.value, req->x.property.valuelen)
+                    || write_property_data (client->request_fd, req->x.property.type, req->x.property.typelen)) {
+                        jack_error ("cannot send property data for %s to server",
+                                    req->x.property.key ? req->x.property.key : "all keys");
+                        req->status = -1;
+                        return req->status;
                 }
         }
 
+	/* and the changes after a ChangeConnections request, whose
+	 * results follow the reply
+	 */
+
+	if (req->type == ChangeConnections
+	    && write_property_data (client->request_fd,
+				    (const char *) req->x.connections.changes,
+				    req->x.connections.count
+				    * sizeof (jack_connection_change_t))) {
+		jack_error ("cannot send connection changes to server");
+		req->status = -1;
+		return req->status;
+	}
+
 	rok = (read (client->request_fd, req, sizeof (*req))
 	       == sizeof (*req));
 
+	if (rok && req->type == ChangeConnections) {
+		/* the reply carries the server's pointers */
+		req->x.connections.changes = changes;
+		req->x.connections.results = results;
+		rok = (read_connection_results (client->request_fd,
+						results, count) == 0);
+	}
+
 	if (wok && rok) {		/* everything OK? */
 		return req->status;
 	}
@@ -320,6 +390,7 @@ jack_client_alloc ()
 	client->event_fd = -1;
 	client->upstream_is_jackd = 0;
 	client->graph_next_fd = -1;
+	client->next_slot = JACK_ACTIVATION_ENGINE;
 	client->ports = NULL;
 	client->ports_ext = NULL;
 	client->engine = NULL;
@@ -331,6 +402,13 @@ jack_client_alloc ()
 	client->on_info_shutdown = NULL;
 	client->n_port_types = 0;
 	client->port_segment = NULL;
+	client->tlb_fd = -1;
+	jack_port_query_init (client);
+	pthread_mutex_init (&client->connection_changes_lock, NULL);
+	client->connection_batch = 0;
+	client->connection_changes = NULL;
+	client->connection_changes_cnt = 0;
+	client->connection_changes_max = 0;
 
 #ifdef USE_DYNSIMD
 	init_cpu();
@@ -360,6 +438,7 @@ jack_client_alloc ()
 	client->upstream_is_jackd = 0;
 	client->graph_wait_fd = -1;
 	client->graph_next_fd = -1;
+	client->next_slot = JACK_ACTIVATION_ENGINE;
 	client->ports = NULL;
 	client->ports_ext = NULL;
 	client->engine = NULL;
@@ -370,6 +449,13 @@ jack_client_alloc ()
 	client->on_info_shutdown = NULL;
 	client->n_port_types = 0;
 	client->port_segment = NULL;
+	client->tlb_fd = -1;
+	jack_port_query_init (client);
+	pthread_mutex_init (&client->connection_changes_lock, NULL);
+	client->connection_batch = 0;
+	client->connection_changes = NULL;
+	client->connection_changes_cnt = 0;
+	client->connection_changes_max = 0;
 
 #ifdef USE_DYNSIMD
 	init_cpu();
@@ -406,6 +492,13 @@ jack_client_free (jack_client_t *client)
 		free (client->pollfd);
 	}
 
+	if (client->tlb_fd >= 0) {
+		close (client->tlb_fd);
+	}
+
+	jack_port_query_cleanup (client);
+	pthread_mutex_destroy (&client->connection_changes_lock);
+	free (client->connection_changes);
 	free (client);
 }
 
@@ -431,6 +524,7 @@ jack_client_fix_port_buffers (jack_client_t *client)
 								    client->engine->buffer_size );
 				jack_pool_release (port->mix_buffer);
 				port->mix_buffer = NULL;
+				port->mixed_nframes = 0;
 				pthread_mutex_lock (&port->connection_lock);
 				if (jack_slist_length (port->connections) > 1) {
 					port->mix_buffer = jack_pool_alloc (buffer_size);
@@ -483,6 +577,7 @@ jack_client_handle_port_connection (jack_client_t *client, jack_event_t *event)
 			control_port->connections =
 				jack_slist_prepend (control_port->connections,
 						    (void *) other);
+			jack_port_update_sources (control_port);
 			pthread_mutex_unlock (&control_port->connection_lock);
 			break;
 
@@ -505,6 +600,7 @@ jack_client_handle_port_connection (jack_client_t *client, jack_event_t *event)
 							control_port->connections,
 							node);
 					jack_slist_free_1 (node);
+					jack_port_update_sources (control_port);
 					free (other);
 					break;
 				}
@@ -714,6 +810,23 @@ jack_handle_reorder (jack_client_t *client, jack_event_t *event)
 
 	DEBUG ("graph reorder\n");
 
+	client->next_slot = event->z.n;
+
+	if (client->engine->activation_mode == JackActivationFutex) {
+
+		/* nothing to open: we wait on our own activation
+		   slot and trigger the next one.
+		*/
+
+		client->upstream_is_jackd = event->y.n;
+
+		if (client->control->graph_order_cbset) {
+			client->graph_order (client->graph_order_arg);
+		}
+
+		return 0;
+	}
+
 	if (client->graph_wait_fd >= 0) {
 		DEBUG ("closing graph_wait_fd==%d", client->graph_wait_fd);
 		close (client->graph_wait_fd);
@@ -1321,6 +1434,14 @@ jack_client_open_aux (const char *client_name,
             goto fail;
         };
 #endif /* JACK_USE_MACH_THREADS */
+
+	/* metadata is read straight from the server's store */
+	jack_metadata_store_attach (client->engine_shm.index);
+
+	/* where our port buffers should go, until the process
+	   thread runs and says otherwise */
+	client->control->numa_node = jack_numa_node ();
+
  	return client;
 
   fail:
@@ -1717,159 +1838,243 @@ jack_client_thread_suicide (jack_client_t* client, const char* reason)
 	/*NOTREACHED*/
 }
 
-static int
-jack_client_process_events (jack_client_t* client)
+/* Handle one event from the server, returning the status to answer
+ * it with, if it has to be answered.
+ */
+static char
+jack_client_handle_event (jack_client_t* client, jack_event_t *event,
+			  const char *key)
 {
-	jack_event_t event;
-	char status = 0;
 	jack_client_control_t *control = client->control;
 	JSList *node;
 	jack_port_t* port;
-        char* key = 0;
+	char status = 0;
+
+	switch (event->type) {
+	case PortRegistered:
+		for (node = client->ports_ext; node; node = jack_slist_next (node)) {
+			port = node->data;
+			if (port->shared->id == event->x.port_id) { // Found port, update port type
+				port->type_info = &client->engine->port_types[port->shared->ptype_id];
+			}
+		}
+		if (control->port_register_cbset) {
+			client->port_register
+				(event->x.port_id, TRUE,
+				 client->port_register_arg);
+		}
+		break;
+
+	case PortUnregistered:
+		if (control->port_register_cbset) {
+			client->port_register
+				(event->x.port_id, FALSE,
+				 client->port_register_arg);
+		}
+		break;
+
+	case ClientRegistered:
+		if (control->client_register_cbset) {
+			client->client_register
+				(event->x.name, TRUE,
+				 client->client_register_arg);
+		}
+		break;
+
+	case ClientUnregistered:
+		if (control->client_register_cbset) {
+			client->client_register
+				(event->x.name, FALSE,
+				 client->client_register_arg);
+		}
+		break;
+
+	case GraphReordered:
+		status = jack_handle_reorder (client, event);
+		break;
+
+	case PortConnected:
+	case PortDisconnected:
+		status = jack_client_handle_port_connection
+			(client, event);
+		break;
+
+	case BufferSizeChange:
+		jack_client_fix_port_buffers (client);
+		if (control->bufsize_cbset) {
+			status = client->bufsize
+				(client->engine->buffer_size,
+				 client->bufsize_arg);
+		}
+		break;
+
+	case SampleRateChange:
+		if (control->srate_cbset) {
+			status = client->srate
+				(client->engine->current_time.frame_rate,
+				 client->srate_arg);
+		}
+		break;
+
+	case XRun:
+		if (control->xrun_cbset) {
+			status = client->xrun
+				(client->xrun_arg);
+		}
+		break;
+
+	case AttachPortSegment:
+		jack_attach_port_segment (client, event->y.ptid);
+		break;
+
+	case StartFreewheel:
+		jack_start_freewheel (client);
+		break;
+
+	case StopFreewheel:
+		jack_stop_freewheel (client);
+		break;
+	case SaveSession:
+		status = jack_client_handle_session_callback (client, event );
+		break;
+	case LatencyCallback:
+		status = jack_client_handle_latency_callback (client, event, 0 );
+		break;
+	case PropertyChange:
+		if (control->property_cbset) {
+			client->property_cb (event->x.uuid, key, event->z.property_change, client->property_cb_arg);
+		}
+		break;
+	case PortRename:
+		if (control->port_rename_cbset) {
+			client->port_rename_cb (event->y.other_id, event->x.name, event->z.other_name, client->port_rename_cb_arg);
+		}
+		break;
+	}
+
+	return status;
+}
+
+/* Whether a queued event only repeats what a later one in the same
+ * batch will tell us anyway.  These handlers look at the engine's
+ * current state rather than at the event, so running the last one
+ * is enough.  XRun is not one of them: clients count their xrun
+ * callbacks, so each one is delivered.
+ */
+static int
+jack_event_superseded (jack_event_queue_t *queue, uint32_t head, uint32_t tail)
+{
+	JackEventType type =
+		queue->entries[head & (JACK_EVENT_QUEUE_SIZE - 1)].event.type;
+
+	switch (type) {
+	case BufferSizeChange:
+	case SampleRateChange:
+	case GraphReordered:
+		break;
+	default:
+		return 0;
+	}
+
+	for (head++; head != tail; head++) {
+		if (queue->entries[head & (JACK_EVENT_QUEUE_SIZE - 1)].event.type == type) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+jack_client_process_events (jack_client_t* client)
+{
+	jack_event_queue_t *queue = (jack_event_queue_t *) &client->control->events;
+	jack_queued_event_t *entry;
+	jack_event_t event;
+	char key[JACK_EVENT_KEY_MAX];
+	char doorbell[64];
+	char status;
+	uint32_t head, tail;
+	int ack, superseded;
 
 	DEBUG ("process events");
 
 	if (client->pollfd[EVENT_POLL_INDEX].revents & POLLIN) {
 
-		DEBUG ("client receives an event, "
-		       "now reading on event fd");
+		/* the server has queued events for us and rang; how
+		   many times does not matter. */
 
-		/* server has sent us an event. process the
-		 * event and reply */
-
-		if (read (client->event_fd, &event, sizeof (event))
-		    != sizeof (event)) {
+		if (read (client->event_fd, doorbell, sizeof (doorbell)) <= 0) {
 			jack_error ("cannot read server event (%s)",
 				    strerror (errno));
 			return -1;
 		}
+	}
 
-                if (event.type == PropertyChange) {
-                        key = (char *) malloc (event.y.key_size);
-                        if (read (client->event_fd, key, event.y.key_size) !=
-                            event.y.key_size) {
-                                jack_error ("cannot read property change key (%s)",
-                                            strerror (errno));
-                                return -1;
-                        }
-                }
+	head = queue->head;
 
-		status = 0;
+	while (1) {
 
-		switch (event.type) {
-		case PortRegistered:
-			for (node = client->ports_ext; node; node = jack_slist_next (node)) {
-				port = node->data;
-				if (port->shared->id == event.x.port_id) { // Found port, update port type
-					port->type_info = &client->engine->port_types[port->shared->ptype_id];
-				}
-			}
-			if (control->port_register_cbset) {
-				client->port_register
-					(event.x.port_id, TRUE,
-					 client->port_register_arg);
-			}
-			break;
+		tail = queue->tail;
+		__sync_synchronize ();
 
-		case PortUnregistered:
-			if (control->port_register_cbset) {
-				client->port_register
-					(event.x.port_id, FALSE,
-					 client->port_register_arg);
-			}
-			break;
+		while (head != tail) {
 
-		case ClientRegistered:
-			if (control->client_register_cbset) {
-				client->client_register
-					(event.x.name, TRUE,
-					 client->client_register_arg);
-			}
-			break;
+			entry = &queue->entries[head & (JACK_EVENT_QUEUE_SIZE - 1)];
+			memcpy (&event, &entry->event, sizeof (event));
+			ack = entry->ack;
 
-		case ClientUnregistered:
-			if (control->client_register_cbset) {
-				client->client_register
-					(event.x.name, FALSE,
-					 client->client_register_arg);
+			if (event.type == PropertyChange) {
+				if (event.y.key_size > JACK_EVENT_KEY_MAX) {
+					event.y.key_size = 0;
+				}
+				memcpy (key, entry->key, event.y.key_size);
 			}
-			break;
 
-		case GraphReordered:
-			status = jack_handle_reorder (client, &event);
-			break;
+			superseded = jack_event_superseded (queue, head, tail);
 
-		case PortConnected:
-		case PortDisconnected:
-			status = jack_client_handle_port_connection
-				(client, &event);
-			break;
+			/* the server may reuse the entry from here on */
+
+			__sync_synchronize ();
+			queue->head = ++head;
 
-		case BufferSizeChange:
-			jack_client_fix_port_buffers (client);
-			if (control->bufsize_cbset) {
-				status = client->bufsize
-					(client->engine->buffer_size,
-					 client->bufsize_arg);
+			if (superseded) {
+				DEBUG ("skipping %s, there is a newer one",
+				       jack_event_type_name (event.type));
+				status = 0;
+			} else {
+				status = jack_client_handle_event
+					(client, &event,
+					 (event.type == PropertyChange && event.y.key_size) ? key : NULL);
 			}
-			break;
 
-		case SampleRateChange:
-			if (control->srate_cbset) {
-				status = client->srate
-					(client->engine->current_time.frame_rate,
-					 client->srate_arg);
+			if (!ack) {
+				continue;
+			}
+			if (ack == JACK_EVENT_ACK_ROOM) {
+				status = 0;
 			}
-			break;
 
-		case XRun:
-			if (control->xrun_cbset) {
-				status = client->xrun
-					(client->xrun_arg);
+			DEBUG ("client has dealt with the event, writing "
+			       "response on event fd");
+
+			if (write (client->event_fd, &status, sizeof (status))
+			    != sizeof (status)) {
+				jack_error ("cannot send event response to "
+					    "engine (%s)", strerror (errno));
+				return -1;
 			}
-			break;
+		}
 
-		case AttachPortSegment:
-			jack_attach_port_segment (client, event.y.ptid);
-			break;
+		/* caught up.  Make sure the server sees that before
+		   looking once more, see jack_post_event(). */
 
-		case StartFreewheel:
-			jack_start_freewheel (client);
-			break;
+		__sync_synchronize ();
 
-		case StopFreewheel:
-			jack_stop_freewheel (client);
-			break;
-		case SaveSession:
-			status = jack_client_handle_session_callback (client, &event );
-			break;
-		case LatencyCallback:
-			status = jack_client_handle_latency_callback (client, &event, 0 );
+		if (queue->tail == head) {
 			break;
-                case PropertyChange:
-                        if (control->property_cbset) {
-                                client->property_cb (event.x.uuid, key, event.z.property_change, client->property_cb_arg);
-                        }
-                        if (key) {
-                                free (key);
-                        }
-                case PortRename:
-                        if (control->port_rename_cbset) {
-                                client->port_rename_cb (event.y.other_id, event.x.name, event.z.other_name, client->port_rename_cb_arg);
-                        }
-                        break;
-		}
-
-		DEBUG ("client has dealt with the event, writing "
-		       "response on event fd");
-
-		if (write (client->event_fd, &status, sizeof (status))
-		    != sizeof (status)) {
-			jack_error ("cannot send event response to "
-				    "engine (%s)", strerror (errno));
-			return -1;
 		}
-        }
+	}
 
 	return 0;
 }
@@ -1882,6 +2087,28 @@ jack_wake_next_client (jack_client_t* client)
 	struct pollfd pfds[1];
 	int pret = 0;
 	char c = 0;
+	jack_activation_t *next = &client->engine->activation[client->next_slot];
+
+#ifdef JACK_HAVE_FUTEX_ACTIVATION
+	if (client->engine->parallel) {
+		jack_activation_release (client->engine->activation,
+					 &client->engine->activation[client->control->activation_slot]);
+		DEBUG ("client released successors by %" PRIu64 "",
+		       jack_get_microseconds());
+		return 0;
+	}
+#endif
+
+	jack_activation_stamp (next);
+
+#ifdef JACK_HAVE_FUTEX_ACTIVATION
+	if (client->engine->activation_mode == JackActivationFutex) {
+		jack_activation_signal (next, JACK_ACTIVATE_PROCESS);
+		DEBUG ("client triggered slot %d by %" PRIu64 "",
+		       client->next_slot, jack_get_microseconds());
+		return 0;
+	}
+#endif
 
 	if (write (client->graph_next_fd, &c, sizeof (c))
 	    != sizeof (c)) {
@@ -1987,11 +2214,82 @@ jack_osx_event_thread_work (void* arg)
 
 #else /* !JACK_USE_MACH_THREADS */
 
+#ifdef JACK_HAVE_FUTEX_ACTIVATION
+static int
+jack_client_core_wait_futex (jack_client_t* client)
+{
+	jack_client_control_t *control = client->control;
+	jack_activation_t *act = &client->engine->activation[control->activation_slot];
+	int32_t bits;
+
+	/* the engine pokes our activation slot both for process()
+	   wakeups and for events it queues for us, so this
+	   is the only thing we need to sleep on.
+	*/
+
+	while (1) {
+		if ((bits = jack_activation_wait (act, 1000000)) < 0) {
+			jack_error ("futex wait failed in client (%s)",
+				    strerror (errno));
+			return -1;
+		}
+
+		pthread_testcancel();
+
+		if (bits & JACK_ACTIVATE_PROCESS) {
+			control->awake_at = jack_get_microseconds();
+			jack_activation_hop (act, control->awake_at);
+		}
+
+		/* events are in our queue, so the event fd only
+		   needs a look after a timeout, so that a dead
+		   server is noticed.
+		*/
+
+		client->pollfd[EVENT_POLL_INDEX].revents = 0;
+
+		if (bits == 0
+		    && poll (client->pollfd, 1, 0) < 0 && errno != EINTR) {
+			jack_error ("poll failed in client (%s)",
+				    strerror (errno));
+			return -1;
+		}
+
+		if (jack_client_process_events (client)) {
+			DEBUG ("event processing failed\n");
+			return 0;
+		}
+
+		if (control->dead || client->pollfd[EVENT_POLL_INDEX].revents & ~POLLIN) {
+			break;
+		}
+
+		if (bits & JACK_ACTIVATE_PROCESS) {
+			DEBUG ("time to run process()\n");
+			break;
+		}
+	}
+
+	if (control->dead || client->pollfd[EVENT_POLL_INDEX].revents & ~POLLIN) {
+		DEBUG ("client appears dead or event pollfd has error status\n");
+		return -1;
+	}
+
+	return 0;
+}
+#endif /* JACK_HAVE_FUTEX_ACTIVATION */
+
 static int
 jack_client_core_wait (jack_client_t* client)
 {
 	jack_client_control_t *control = client->control;
 
+#ifdef JACK_HAVE_FUTEX_ACTIVATION
+	if (client->engine->activation_mode == JackActivationFutex) {
+		return jack_client_core_wait_futex (client);
+	}
+#endif
+
         /* this is not OS X - we're waiting on events & process wakeups */
 
 	DEBUG ("client polling on %s", client->pollmax == 2 ?
@@ -2017,6 +2315,8 @@ jack_client_core_wait (jack_client_t* client)
 		if (client->graph_wait_fd >= 0
 		    && client->pollfd[WAIT_POLL_INDEX].revents & POLLIN) {
 			control->awake_at = jack_get_microseconds();
+			jack_activation_hop (&client->engine->activation[control->activation_slot],
+					     control->awake_at);
 		}
 
 		DEBUG ("pfd[EVENT].revents = 0x%x pfd[WAIT].revents = 0x%x",
@@ -2101,6 +2401,7 @@ jack_process_thread_work (void* arg)
 
         control->pid = getpid();
         control->pgrp = getpgrp();
+	control->numa_node = jack_numa_node ();
 
 #ifdef JACK_USE_MACH_THREADS
 	client->rt_thread_ok = TRUE;
@@ -2221,6 +2522,17 @@ void jack_cycle_signal (jack_client_t* client, int status)
 	client->control->finished_at = jack_get_microseconds();
         client->control->state = Finished;
 
+	if (client->engine->tlb_stats && client->tlb_fd != -2) {
+		if (client->tlb_fd == -1
+		    && (client->tlb_fd = jack_tlb_counter_open ()) < 0) {
+			client->tlb_fd = -2;
+		} else {
+			client->control->tlb_misses =
+				jack_tlb_counter_read (client->tlb_fd);
+			client->control->tlb_cycles++;
+		}
+	}
+
 	/* wake the next client in the chain (could be the server),
 	   and check if we were killed during the process
 	   cycle.
@@ -2457,6 +2769,8 @@ jack_client_close_aux (jack_client_t *client)
 			client->engine = NULL;
 		}
 
+		jack_metadata_store_detach ();
+
 		if (client->port_segment) {
 			jack_port_type_id_t ptid;
 			for (ptid = 0; ptid < client->n_port_types; ++ptid) {
@@ -2540,11 +2854,135 @@ jack_set_buffer_size (jack_client_t *client, jack_nframes_t nframes)
 #endif /* DO_BUFFER_RESIZE */
 }
 
+/* Remember a connection change for jack_connections_commit().
+ * Returns 1 if there is no batch to add it to.
+ */
+static int
+jack_connection_change_add (jack_client_t *client, int connect,
+			    const char *source_port,
+			    const char *destination_port)
+{
+	jack_connection_change_t *change;
+	uint32_t max;
+	int ret = 0;
+
+	pthread_mutex_lock (&client->connection_changes_lock);
+
+	if (client->connection_batch == 0) {
+		ret = 1;
+		goto out;
+	}
+
+	if (client->connection_changes_cnt == client->connection_changes_max) {
+		max = client->connection_changes_max ?
+			client->connection_changes_max * 2 : 64;
+		if (max > JACK_CONNECTION_CHANGES_MAX) {
+			jack_error ("too many connection changes in one batch");
+			ret = -1;
+			goto out;
+		}
+		change = (jack_connection_change_t *)
+			realloc (client->connection_changes,
+				 max * sizeof (jack_connection_change_t));
+		if (change == NULL) {
+			ret = -1;
+			goto out;
+		}
+		client->connection_changes = change;
+		client->connection_changes_max = max;
+	}
+
+	change = &client->connection_changes[client->connection_changes_cnt++];
+	change->connect = connect;
+	snprintf (change->source_port, sizeof (change->source_port),
+		  "%s", source_port);
+	snprintf (change->destination_port, sizeof (change->destination_port),
+		  "%s", destination_port);
+
+  out:
+	pthread_mutex_unlock (&client->connection_changes_lock);
+	return ret;
+}
+
+int
+jack_connections_begin (jack_client_t *client)
+{
+	pthread_mutex_lock (&client->connection_changes_lock);
+	client->connection_batch++;
+	pthread_mutex_unlock (&client->connection_changes_lock);
+
+	return 0;
+}
+
+int
+jack_connections_commit (jack_client_t *client)
+{
+	jack_request_t req;
+	int32_t *results;
+	uint32_t i;
+	int failed = 0;
+
+	pthread_mutex_lock (&client->connection_changes_lock);
+
+	if (client->connection_batch == 0) {
+		pthread_mutex_unlock (&client->connection_changes_lock);
+		jack_error ("jack_connections_commit() without "
+			    "jack_connections_begin()");
+		return -1;
+	}
+
+	/* only the outermost commit sends anything */
+
+	if (--client->connection_batch || client->connection_changes_cnt == 0) {
+		pthread_mutex_unlock (&client->connection_changes_lock);
+		return 0;
+	}
+
+	if ((results = (int32_t *) calloc (client->connection_changes_cnt,
+					   sizeof (int32_t))) == NULL) {
+		client->connection_changes_cnt = 0;
+		pthread_mutex_unlock (&client->connection_changes_lock);
+		return -1;
+	}
+
+        VALGRIND_MEMSET (&req, 0, sizeof (req));
+
+	req.type = ChangeConnections;
+	req.x.connections.count = client->connection_changes_cnt;
+	req.x.connections.changes = client->connection_changes;
+	req.x.connections.results = results;
+
+	if (jack_client_deliver_request (client, &req) < 0) {
+		for (i = 0; i < client->connection_changes_cnt; i++) {
+			if (results[i] < 0) {
+				failed++;
+			}
+		}
+		if (failed == 0) {
+			/* the request itself failed */
+			failed = -1;
+		}
+	}
+
+	client->connection_changes_cnt = 0;
+	pthread_mutex_unlock (&client->connection_changes_lock);
+
+	free (results);
+
+	return failed;
+}
+
 int
 jack_connect (jack_client_t *client, const char *source_port,
 	      const char *destination_port)
 {
 	jack_request_t req;
+	int ret;
+
+	if ((ret = jack_connection_change_add (client, TRUE, source_port,
+					       destination_port)) <= 0) {
+		return ret;
+	}
 
         VALGRIND_MEMSET (&req, 0, sizeof (req));
 
@@ -2586,6 +3024,12 @@ jack_disconnect (jack_client_t *client, const char *source_port,
 		 const char *destination_port)
 {
 	jack_request_t req;
+	int ret;
+
+	if ((ret = jack_connection_change_add (client, FALSE, source_port,
+					       destination_port)) <= 0) {
+		return ret;
+	}
 
         VALGRIND_MEMSET (&req, 0, sizeof (req));
 
@@ -2881,88 +3325,6 @@ jack_reserve_client_name (jack_client_t *client, const char *name, const char *u
 	return jack_client_deliver_request (client, &request);
 }
 
-const char **
-jack_get_ports (jack_client_t *client,
-		const char *port_name_pattern,
-		const char *type_name_pattern,
-		unsigned long flags)
-{
-	jack_control_t *engine;
-	const char **matching_ports;
-	unsigned long match_cnt;
-	jack_port_shared_t *psp;
-	unsigned long i;
-	regex_t port_regex;
-	regex_t type_regex;
-	int matching;
-
-	engine = client->engine;
-
-	if (port_name_pattern && port_name_pattern[0]) {
-		regcomp (&port_regex, port_name_pattern,
-			 REG_EXTENDED|REG_NOSUB);
-	}
-	if (type_name_pattern && type_name_pattern[0]) {
-		regcomp (&type_regex, type_name_pattern,
-			 REG_EXTENDED|REG_NOSUB);
-	}
-
-	psp = engine->ports;
-	match_cnt = 0;
-
-	if ((matching_ports = (const char **) malloc (sizeof (char *) * (engine->port_max + 1))) == NULL) {
-		return NULL;
-	}
-
-	for (i = 0; i < engine->port_max; i++) {
-		matching = 1;
-
-		if (!psp[i].in_use) {
-			continue;
-		}
-
-		if (flags) {
-			if ((psp[i].flags & flags) != flags) {
-				matching = 0;
-			}
-		}
-
-		if (matching && port_name_pattern && port_name_pattern[0]) {
-			if (regexec (&port_regex, psp[i].name, 0, NULL, 0)) {
-				matching = 0;
-			}
-		}
-
-		if (matching && type_name_pattern && type_name_pattern[0]) {
-			jack_port_type_id_t ptid = psp[i].ptype_id;
-			if (regexec (&type_regex,
-				     engine->port_types[ptid].type_name,
-				     0, NULL, 0)) {
-				matching = 0;
-			}
-		}
-
-		if (matching) {
-			matching_ports[match_cnt++] = psp[i].name;
-		}
-	}
-	if (port_name_pattern && port_name_pattern[0]) {
-		regfree (&port_regex);
-	}
-	if (type_name_pattern && type_name_pattern[0]) {
-		regfree (&type_regex);
-	}
-
-	if (match_cnt == 0) {
-		free (matching_ports);
-		matching_ports = 0;
-	} else {
-                matching_ports[match_cnt] = 0;
-        }
-
-	return matching_ports;
-}
-
 float
 jack_cpu_load (jack_client_t *client)
 {
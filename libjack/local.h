@@ -14,6 +14,7 @@ struct _jack_client {
     int             graph_next_fd;
     int             request_fd;
     int             upstream_is_jackd;
+    uint32_t        next_slot;      /* activation slot to trigger when done */
 
     /* these two are copied from the engine when the 
      * client is created.
@@ -87,13 +88,34 @@ struct _jack_client {
     int (*deliver_request)(void*, jack_request_t*); /* JOQ: 64/32 bug! */
     void *deliver_arg;
 
+    /* jack_get_ports() and port queries, see portquery.c */
+    pthread_mutex_t port_query_lock;
+    struct _jack_port_query *port_queries;  /* most recently used first */
+    jack_port_id_t *port_snapshot;	    /* ports in use ... */
+    uint32_t port_snapshot_cnt;
+    uint32_t port_snapshot_seq;		    /* ... as of this index seq */
+    int port_snapshot_valid;
+
+    int tlb_fd;		/* dTLB miss counter, -2 if unavailable */
+
+    /* jack_connections_begin() ... jack_connections_commit() */
+    pthread_mutex_t connection_changes_lock;
+    int connection_batch;		    /* nesting depth */
+    jack_connection_change_t *connection_changes;
+    uint32_t connection_changes_cnt;
+    uint32_t connection_changes_max;
+
 };
 
+extern void jack_port_query_init (jack_client_t *client);
+extern void jack_port_query_cleanup (jack_client_t *client);
+
 extern int jack_client_deliver_request (const jack_client_t *client,
 					jack_request_t *req);
 extern jack_port_t *jack_port_new (const jack_client_t *client,
 				   jack_port_id_t port_id,
 				   jack_control_t *control);
+extern int jack_port_update_sources (jack_port_t *port);
 
 extern void *jack_zero_filled_buffer;
 
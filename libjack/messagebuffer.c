@@ -27,50 +27,470 @@
 
 #include <unistd.h>
 #include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #include "messagebuffer.h"
 #include "atomicity.h"
 #include "internal.h"
 
-/* MB_NEXT() relies on the fact that MB_BUFFERS is a power of two */
-#define MB_BUFFERS	128
-#define MB_NEXT(index) ((index+1) & (MB_BUFFERS-1))
-#define MB_BUFFERSIZE	256		/* message length limit */
+/* Realtime threads must not format messages or take locks.  So each
+ * thread that logs gets its own single producer, single consumer
+ * ring of binary records: a copy of the format string (the caller's
+ * may live in a driver or internal client that is unloaded before
+ * the record is printed), a timestamp, and the raw arguments, with
+ * any strings copied in.  The writer thread merges the rings in time
+ * order and does the formatting.
+ *
+ * The writer sleeps in read() on a pipe while all rings are empty.
+ * Whoever queues the first record after it went idle writes one byte
+ * to wake it; the write end is non-blocking, and every other record
+ * costs no system call at all.  Rings are allocated by the writer
+ * thread as they get claimed, keeping a couple spare, and are kept
+ * until the process exits, since threads hold on to theirs.
+ */
+
+#define MB_RINGS	16		/* threads that can log at once */
+#define MB_SPARE_RINGS	2		/* kept free for new threads */
+#define MB_RECORDS	64		/* per ring, a power of two */
+#define MB_MAXARGS	8
+#define MB_POOLSIZE	168		/* bytes of copied string arguments */
+#define MB_FMTSIZE	128		/* format string length limit */
+#define MB_BUFFERSIZE	256		/* formatted message length limit */
+
+#define MB_NULL_STRING	0xffff
+
+typedef union {
+	int64_t		i;
+	double		d;
+	const void     *p;
+	uint16_t	s;		/* offset into pool */
+} mb_arg_t;
+
+typedef struct {
+	char		fmt[MB_FMTSIZE];
+	jack_time_t	usecs;
+	jack_nframes_t	frames;		/* frame time of the current cycle */
+	uint16_t	nargs;
+	uint16_t	poolused;
+	mb_arg_t	args[MB_MAXARGS];
+	char		pool[MB_POOLSIZE];
+} mb_record_t;
+
+typedef struct {
+	volatile uint32_t head;		/* advanced by the owning thread */
+	volatile uint32_t tail;		/* advanced by the writer thread */
+	volatile int32_t state;		/* MB_RING_* */
+	mb_record_t	records[MB_RECORDS];
+} mb_ring_t;
+
+enum {
+	MB_RING_FREE = 0,
+	MB_RING_OWNED,
+	MB_RING_ORPHANED		/* owner exited, free once drained */
+};
+
+static mb_ring_t *mb_rings[MB_RINGS];
+static volatile int mb_nrings = 0;
+static volatile int mb_ring_misses = 0;	/* claims that found no ring */
+static __thread mb_ring_t *mb_ring = NULL;
+static pthread_key_t mb_ring_key;
 
-static char mb_buffers[MB_BUFFERS][MB_BUFFERSIZE];
 static volatile unsigned int mb_initialized = 0;
-static volatile unsigned int mb_inbuffer = 0;
-static volatile unsigned int mb_outbuffer = 0;
 static volatile _Atomic_word mb_overruns = 0;
+static _Atomic_word mb_overruns_reported = 0;
+static jack_frame_timer_t * volatile mb_frame_timer = NULL;
+static volatile int mb_stamp_frames = 0;
 static pthread_t mb_writer_thread;
+static int mb_wake_fds[2] = { -1, -1 };
+static volatile int mb_writer_idle = 0;
 static pthread_mutex_t mb_write_lock;
 static pthread_cond_t mb_ready_cond;
 static void (*mb_thread_init_callback)(void*) = 0;
 static void* mb_thread_init_callback_arg = 0;
 
+/* Conversion specifications, as far as both sides need to agree on
+ * them.  `spec' is advanced past the specification.
+ */
+
+typedef enum {
+	MB_CONV_NONE,			/* %% or the end of the string */
+	MB_CONV_SIGNED,
+	MB_CONV_UNSIGNED,
+	MB_CONV_DOUBLE,
+	MB_CONV_CHAR,
+	MB_CONV_STRING,
+	MB_CONV_POINTER
+} mb_conv_t;
+
+typedef struct {
+	mb_conv_t	conv;
+	int		star_width;
+	int		star_precision;
+	char		length[3];	/* "hh", "h", "l", "ll", "j", "z", "t", "L", "q" */
+	char		letter;
+} mb_spec_t;
+
+static const char *
+mb_parse_spec (const char *spec, mb_spec_t *out)
+{
+	int n = 0;
+
+	memset (out, 0, sizeof (*out));
+
+	/* flags, width and precision */
+	while (*spec && strchr ("-+ #0'", *spec))
+		spec++;
+	if (*spec == '*') {
+		out->star_width = 1;
+		spec++;
+	}
+	while (*spec >= '0' && *spec <= '9')
+		spec++;
+	if (*spec == '.') {
+		spec++;
+		if (*spec == '*') {
+			out->star_precision = 1;
+			spec++;
+		}
+		while (*spec >= '0' && *spec <= '9')
+			spec++;
+	}
+
+	while (*spec && strchr ("hljztLq", *spec) && n < 2)
+		out->length[n++] = *spec++;
+
+	out->letter = *spec;
+
+	switch (*spec) {
+	case 'd': case 'i':
+		out->conv = MB_CONV_SIGNED;
+		break;
+	case 'u': case 'x': case 'X': case 'o':
+		out->conv = MB_CONV_UNSIGNED;
+		break;
+	case 'f': case 'F': case 'e': case 'E':
+	case 'g': case 'G': case 'a': case 'A':
+		out->conv = MB_CONV_DOUBLE;
+		break;
+	case 'c':
+		out->conv = MB_CONV_CHAR;
+		break;
+	case 's':
+		out->conv = MB_CONV_STRING;
+		break;
+	case 'p': case 'n':
+		out->conv = MB_CONV_POINTER;
+		break;
+	default:
+		out->conv = MB_CONV_NONE;
+		break;
+	}
+
+	if (*spec)
+		spec++;
+	return spec;
+}
+
+/* RT side: take one argument off `ap' in the form described by
+ * `spec', converted so that the writer can print it with an "ll"
+ * length modifier.
+ */
+static int64_t
+mb_take_integer (const mb_spec_t *spec, va_list *ap)
+{
+	const char *len = spec->length;
+	int is_signed = (spec->conv == MB_CONV_SIGNED);
+
+	if (len[0] == 'l' && len[1] == 'l')
+		return is_signed ? (int64_t) va_arg (*ap, long long)
+			: (int64_t) va_arg (*ap, unsigned long long);
+	if (len[0] == 'j' || len[0] == 'q')
+		return (int64_t) va_arg (*ap, int64_t);
+	if (len[0] == 'l')
+		return is_signed ? (int64_t) va_arg (*ap, long)
+			: (int64_t) va_arg (*ap, unsigned long);
+	if (len[0] == 'z' || len[0] == 't')
+		return is_signed ? (int64_t) va_arg (*ap, ssize_t)
+			: (int64_t) va_arg (*ap, size_t);
+	if (len[0] == 'h' && len[1] == 'h')
+		return is_signed ? (int64_t) (signed char) va_arg (*ap, int)
+			: (int64_t) (unsigned char) va_arg (*ap, int);
+	if (len[0] == 'h')
+		return is_signed ? (int64_t) (short) va_arg (*ap, int)
+			: (int64_t) (unsigned short) va_arg (*ap, int);
+	return is_signed ? (int64_t) va_arg (*ap, int)
+		: (int64_t) va_arg (*ap, unsigned int);
+}
+
+/* Wake the writer thread if it is, or is about to be, asleep.  The
+ * barrier pairs with the one the writer makes between going idle
+ * and looking at the rings, so that one of the two sides always
+ * sees the other.
+ */
 static void
-mb_flush()
+mb_wake ()
+{
+	char c = 0;
+
+	__sync_synchronize ();
+	if (mb_writer_idle
+	    && __sync_bool_compare_and_swap (&mb_writer_idle, 1, 0)) {
+		/* a full pipe already holds a wakeup */
+		if (write (mb_wake_fds[1], &c, 1) != 1)
+			return;
+	}
+}
+
+static mb_ring_t *
+mb_claim_ring ()
 {
-	/* called WITHOUT the mb_write_lock */
-	while (mb_outbuffer != mb_inbuffer) {
-		jack_info(mb_buffers[mb_outbuffer]);
-		mb_outbuffer = MB_NEXT(mb_outbuffer);
+	int i, n = mb_nrings;
+
+	/* read the ring pointers only after their count */
+	__sync_synchronize ();
+
+	for (i = 0; i < n; i++) {
+		if (__sync_bool_compare_and_swap (&mb_rings[i]->state,
+						  MB_RING_FREE, MB_RING_OWNED)) {
+			mb_ring = mb_rings[i];
+			pthread_setspecific (mb_ring_key, mb_ring);
+			return mb_ring;
+		}
+	}
+	return NULL;
+}
+
+/* Writer side: add a ring for each thread that found none, and
+ * keep a few free for the next threads that log, while there is
+ * room.
+ */
+static void
+mb_add_spare_rings ()
+{
+	mb_ring_t *ring;
+	int wanted = MB_SPARE_RINGS + __sync_fetch_and_and (&mb_ring_misses, 0);
+	int i;
+
+	for (i = 0; i < mb_nrings; i++) {
+		if (mb_rings[i]->state == MB_RING_FREE)
+			wanted--;
+	}
+	while (wanted-- > 0 && mb_nrings < MB_RINGS) {
+		if ((ring = calloc (1, sizeof (*ring))) == NULL)
+			return;
+		mb_rings[mb_nrings] = ring;
+		__sync_synchronize ();
+		mb_nrings++;
+	}
+}
+
+/* Whether any ring holds a record. */
+static int
+mb_pending ()
+{
+	int i;
+
+	for (i = 0; i < mb_nrings; i++) {
+		if (mb_rings[i]->tail != mb_rings[i]->head)
+			return 1;
+	}
+	return 0;
+}
+
+static void
+mb_release_ring (void *arg)
+{
+	mb_ring_t *ring = (mb_ring_t *) arg;
+
+	/* the writer thread frees it once it is empty */
+	__sync_synchronize ();
+	ring->state = MB_RING_ORPHANED;
+}
+
+/* writer side: format one record */
+static void
+mb_format (const mb_record_t *rec, char *out, size_t size)
+{
+	const char *fmt = rec->fmt;
+	size_t used = 0;
+	int argn = 0;
+	int n;
+
+	if (mb_stamp_frames) {
+		n = snprintf (out, size, "%u: ", (unsigned int) rec->frames);
+		used = (n > 0 && (size_t) n < size) ? n : 0;
+	}
+
+	while (*fmt && used < size - 1) {
+		const char *start;
+		char spec[32];
+		mb_spec_t parsed;
+		int star[2];
+		int nstar = 0;
+		size_t speclen;
+
+		if (*fmt != '%') {
+			out[used++] = *fmt++;
+			continue;
+		}
+
+		start = fmt;
+		fmt = mb_parse_spec (fmt + 1, &parsed);
+
+		if (parsed.conv == MB_CONV_NONE) {
+			if (parsed.letter == '%')
+				out[used++] = '%';
+			continue;
+		}
+
+		if (argn + parsed.star_width + parsed.star_precision >= rec->nargs) {
+			/* more arguments than we could store */
+			n = snprintf (out + used, size - used, "...");
+			used += (n > 0) ? n : 0;
+			break;
+		}
+
+		if (parsed.star_width)
+			star[nstar++] = (int) rec->args[argn++].i;
+		if (parsed.star_precision)
+			star[nstar++] = (int) rec->args[argn++].i;
+
+		/* rebuild the specification with our own length modifier */
+		speclen = fmt - start - 1 - strlen (parsed.length);
+		if (speclen >= sizeof (spec) - 4)
+			speclen = sizeof (spec) - 4;
+		memcpy (spec, start, speclen);
+		spec[speclen] = '\0';
+		if (parsed.conv == MB_CONV_SIGNED || parsed.conv == MB_CONV_UNSIGNED)
+			strcat (spec, "ll");
+		strncat (spec, &parsed.letter, 1);
+
+#define MB_PRINT(value)							\
+		switch (nstar) {					\
+		case 0: n = snprintf (out + used, size - used, spec, value); break; \
+		case 1: n = snprintf (out + used, size - used, spec, star[0], value); break; \
+		default: n = snprintf (out + used, size - used, spec, star[0], star[1], value); break; \
+		}
+
+		switch (parsed.conv) {
+		case MB_CONV_SIGNED:
+		case MB_CONV_UNSIGNED:
+			MB_PRINT ((long long) rec->args[argn].i);
+			break;
+		case MB_CONV_DOUBLE:
+			MB_PRINT (rec->args[argn].d);
+			break;
+		case MB_CONV_CHAR:
+			MB_PRINT ((int) rec->args[argn].i);
+			break;
+		case MB_CONV_STRING:
+			MB_PRINT (rec->args[argn].s == MB_NULL_STRING ?
+				  "(null)" : rec->pool + rec->args[argn].s);
+			break;
+		case MB_CONV_POINTER:
+			if (parsed.letter == 'n') {
+				n = 0;	/* nothing sensible to do */
+			} else {
+				MB_PRINT (rec->args[argn].p);
+			}
+			break;
+		default:
+			n = 0;
+			break;
+		}
+#undef MB_PRINT
+
+		argn++;
+		if (n < 0)
+			break;
+		used += n;
+		if (used >= size) {
+			used = size - 1;
+			break;
+		}
+	}
+
+	out[used] = '\0';
+}
+
+/* Print everything that is queued, oldest first across all rings.
+ * Only the writer thread (or the exiting thread, once the writer
+ * has stopped) calls this.
+ */
+static void
+mb_flush ()
+{
+	char msg[MB_BUFFERSIZE];
+	_Atomic_word overruns;
+	mb_ring_t *oldest;
+	int i;
+
+	for (;;) {
+		oldest = NULL;
+
+		for (i = 0; i < mb_nrings; i++) {
+			mb_ring_t *ring = mb_rings[i];
+			int32_t state = ring->state;
+
+			if (ring->tail == ring->head) {
+				if (state == MB_RING_ORPHANED) {
+					__sync_bool_compare_and_swap (&ring->state,
+								      MB_RING_ORPHANED,
+								      MB_RING_FREE);
+				}
+				continue;
+			}
+			if (oldest == NULL ||
+			    ring->records[ring->tail & (MB_RECORDS-1)].usecs <
+			    oldest->records[oldest->tail & (MB_RECORDS-1)].usecs) {
+				oldest = ring;
+			}
+		}
+
+		if (oldest == NULL)
+			break;
+
+		/* read the record only after seeing the head move */
+		__sync_synchronize ();
+		mb_format (&oldest->records[oldest->tail & (MB_RECORDS-1)],
+			   msg, sizeof (msg));
+		__sync_synchronize ();
+		oldest->tail++;
+
+		jack_info ("%s", msg);
+	}
+
+	overruns = mb_overruns;
+	if (overruns != mb_overruns_reported) {
+		jack_error ("WARNING: %d realtime log messages dropped",
+			    overruns - mb_overruns_reported);
+		mb_overruns_reported = overruns;
 	}
 }
 
 static void *
 mb_thread_func(void *arg)
 {
-	/* The mutex is only to eliminate collisions between multiple
-	 * writer threads and protect the condition variable. */
-	pthread_mutex_lock(&mb_write_lock);
+	char buf[64];
 
 	while (mb_initialized) {
-		pthread_cond_wait(&mb_ready_cond, &mb_write_lock);
+		mb_writer_idle = 1;
+		__sync_synchronize ();
+		if (!mb_pending ()) {
+			/* drains the wakeups that piled up */
+			if (read (mb_wake_fds[0], buf, sizeof (buf)) < 0)
+				continue;
+		}
+		mb_writer_idle = 0;
 
+		/* The mutex protects the condition variable, which
+		 * jack_messagebuffer_thread_init() waits on. */
+		pthread_mutex_lock(&mb_write_lock);
 		if (mb_thread_init_callback) {
 			/* the client asked for all threads to run a thread
 			   initialization callback, which includes us.
@@ -81,15 +501,12 @@ mb_thread_func(void *arg)
 			/* note that we've done it */
 			pthread_cond_signal(&mb_ready_cond);
 		}
-
-		/* releasing the mutex reduces contention */
 		pthread_mutex_unlock(&mb_write_lock);
+
 		mb_flush();
-		pthread_mutex_lock(&mb_write_lock);
+		mb_add_spare_rings();
 	}
 
-	pthread_mutex_unlock(&mb_write_lock);
-
 	return NULL;
 }
 
@@ -99,71 +516,190 @@ jack_messagebuffer_init ()
 	if (mb_initialized)
 		return;
 
+	if (pipe (mb_wake_fds) != 0)
+		return;
+	fcntl (mb_wake_fds[1], F_SETFL, O_NONBLOCK);
+
 	pthread_mutex_init(&mb_write_lock, NULL);
 	pthread_cond_init(&mb_ready_cond, NULL);
+	pthread_key_create(&mb_ring_key, mb_release_ring);
+
+	mb_add_spare_rings();
 
 	mb_overruns = 0;
+	mb_overruns_reported = 0;
+	mb_writer_idle = 0;
 	mb_initialized = 1;
 
-	if (jack_thread_creator (&mb_writer_thread, NULL, &mb_thread_func, NULL) != 0)
+	if (jack_thread_creator (&mb_writer_thread, NULL, &mb_thread_func, NULL) != 0) {
 		mb_initialized = 0;
+		close (mb_wake_fds[0]);
+		close (mb_wake_fds[1]);
+	}
 }
 
 void 
 jack_messagebuffer_exit ()
 {
+	char c = 0;
+
 	if (!mb_initialized)
 		return;
 
-	pthread_mutex_lock(&mb_write_lock);
 	mb_initialized = 0;
-	pthread_cond_signal(&mb_ready_cond);
-	pthread_mutex_unlock(&mb_write_lock);
+	if (write (mb_wake_fds[1], &c, 1) != 1) {
+		/* the pipe is full of wakeups already */
+	}
 
 	pthread_join(mb_writer_thread, NULL);
 	mb_flush();
 
-	if (mb_overruns)
-		jack_error("WARNING: %d message buffer overruns!",
-			mb_overruns);
+	close (mb_wake_fds[0]);
+	close (mb_wake_fds[1]);
+
+	mb_frame_timer = NULL;
 
 	pthread_mutex_destroy(&mb_write_lock);
 	pthread_cond_destroy(&mb_ready_cond);
 }
 
+void
+jack_messagebuffer_set_frame_timer (struct _jack_frame_timer *timer, int stamp)
+{
+	mb_frame_timer = timer;
+	mb_stamp_frames = (timer != NULL) && stamp;
+}
 
 void 
 jack_messagebuffer_add (const char *fmt, ...)
 {
-	char msg[MB_BUFFERSIZE];
+	mb_ring_t *ring = mb_ring;
+	mb_record_t *rec;
+	jack_frame_timer_t *timer;
+	const char *f;
+	mb_spec_t spec;
 	va_list ap;
-
-	/* format the message first, to reduce lock contention */
-	va_start(ap, fmt);
-	vsnprintf(msg, MB_BUFFERSIZE, fmt, ap);
-	va_end(ap);
+	uint32_t head;
 
 	if (!mb_initialized) {
 		/* Unable to print message with realtime safety.
 		 * Complain and print it anyway. */
+		char msg[MB_BUFFERSIZE];
+		va_start(ap, fmt);
+		vsnprintf(msg, MB_BUFFERSIZE, fmt, ap);
+		va_end(ap);
 		fprintf(stderr, "ERROR: messagebuffer not initialized: %s",
 			msg);
 		return;
 	}
 
-	if (pthread_mutex_trylock(&mb_write_lock) == 0) {
-		strncpy(mb_buffers[mb_inbuffer], msg, MB_BUFFERSIZE);
-		mb_inbuffer = MB_NEXT(mb_inbuffer);
-		pthread_cond_signal(&mb_ready_cond);
-		pthread_mutex_unlock(&mb_write_lock);
-	} else {			/* lock collision */
+	if (ring == NULL && (ring = mb_claim_ring ()) == NULL) {
+		/* the writer reports it, and adds a ring if it may */
+		atomic_add(&mb_overruns, 1);
+		__sync_fetch_and_add (&mb_ring_misses, 1);
+		mb_wake ();
+		return;
+	}
+
+	head = ring->head;
+	if (head - ring->tail >= MB_RECORDS) {
+		/* ring full */
 		atomic_add(&mb_overruns, 1);
+		mb_wake ();
+		return;
 	}
+
+	rec = &ring->records[head & (MB_RECORDS-1)];
+	f = memccpy (rec->fmt, fmt, '\0', MB_FMTSIZE);
+	if (f == NULL)
+		rec->fmt[MB_FMTSIZE - 1] = '\0';
+	rec->usecs = jack_get_microseconds ();
+	rec->frames = 0;
+	if ((timer = mb_frame_timer) != NULL) {
+		/* no retry loop here: a torn read only costs accuracy */
+		rec->frames = timer->frames;
+	}
+	rec->nargs = 0;
+	rec->poolused = 0;
+
+	va_start(ap, fmt);
+
+	for (f = fmt; *f; ) {
+		mb_arg_t *arg;
+
+		if (*f++ != '%')
+			continue;
+
+		f = mb_parse_spec (f, &spec);
+		if (spec.conv == MB_CONV_NONE)
+			continue;
+
+		if (rec->nargs + spec.star_width + spec.star_precision >= MB_MAXARGS) {
+			/* the writer prints what we have, then "..." */
+			break;
+		}
+		if (spec.star_width)
+			rec->args[rec->nargs++].i = va_arg (ap, int);
+		if (spec.star_precision)
+			rec->args[rec->nargs++].i = va_arg (ap, int);
+
+		arg = &rec->args[rec->nargs++];
+
+		switch (spec.conv) {
+		case MB_CONV_SIGNED:
+		case MB_CONV_UNSIGNED:
+			arg->i = mb_take_integer (&spec, &ap);
+			break;
+		case MB_CONV_DOUBLE:
+			arg->d = (spec.length[0] == 'L') ?
+				(double) va_arg (ap, long double) :
+				va_arg (ap, double);
+			break;
+		case MB_CONV_CHAR:
+			arg->i = va_arg (ap, int);
+			break;
+		case MB_CONV_STRING: {
+			const char *str = va_arg (ap, const char *);
+			size_t len;
+
+			if (str == NULL) {
+				arg->s = MB_NULL_STRING;
+				break;
+			}
+			if (rec->poolused >= MB_POOLSIZE) {
+				/* an earlier string used up the pool */
+				arg->s = MB_NULL_STRING;
+				break;
+			}
+			len = strlen (str);
+			if (len > MB_POOLSIZE - 1u - rec->poolused)
+				len = MB_POOLSIZE - 1u - rec->poolused;
+			memcpy (rec->pool + rec->poolused, str, len);
+			rec->pool[rec->poolused + len] = '\0';
+			arg->s = rec->poolused;
+			rec->poolused += len + 1;
+			break;
+		}
+		default:
+			arg->p = va_arg (ap, void *);
+			break;
+		}
+	}
+
+	va_end(ap);
+
+	/* publish the record */
+	__sync_synchronize ();
+	ring->head = head + 1;
+
+	mb_wake ();
 }
 
 void
 jack_messagebuffer_thread_init (void (*cb)(void*), void* arg)
 {
+	char c = 0;
+
 	pthread_mutex_lock (&mb_write_lock);
 
 	/* set up the callback */
@@ -171,10 +707,13 @@ jack_messagebuffer_thread_init (void (*cb)(void*), void* arg)
 	mb_thread_init_callback = cb;
 
 	/* wake msg buffer thread */
-	pthread_cond_signal(&mb_ready_cond);
+	if (write (mb_wake_fds[1], &c, 1) != 1) {
+		/* the pipe is full of wakeups already */
+	}
 
 	/* wait for it to be done */
-	pthread_cond_wait(&mb_ready_cond, &mb_write_lock);
+	while (mb_thread_init_callback)
+		pthread_cond_wait(&mb_ready_cond, &mb_write_lock);
 
 	/* and we're done */
 	pthread_mutex_unlock (&mb_write_lock);
@@ -25,6 +25,7 @@
 
 #include "internal.h"
 #include "local.h"
+#include "metadatastore.h"
 
 const char* JACK_METADATA_PRETTY_NAME = "http://jackaudio.org/metadata/pretty-name";
 const char* JACK_METADATA_HARDWARE    = "http://jackaudio.org/metadata/hardware";
@@ -76,6 +77,15 @@ jack_property_init (const char* server_name)
         return 0;
 }
 
+DB*
+jack_property_db (const char* server_name)
+{
+        if (jack_property_init (server_name)) {
+                return NULL;
+        }
+        return db;
+}
+
 static void jack_properties_uninit () __attribute__ ((destructor));
 
 void
@@ -111,24 +121,196 @@ jack_free_description(jack_description_t* desc, int free_actual_description_too)
         }
 }
 
+/* Property changes go through the server, which keeps the store
+ * and tells everyone with a property change callback.  The engine
+ * itself, and internal clients in its address space, pass a NULL
+ * client when they change metadata without notifying anyone.
+ */
 static int
-jack_property_change_notify (jack_client_t* client, jack_uuid_t uuid, const char* key, jack_property_change_t change)
+jack_property_request (jack_client_t* client, uint32_t type, jack_uuid_t subject,
+                       const char* key, const char* value, const char* mime_type)
 {
         jack_request_t req;
 
-        /* the engine passes in a NULL client when it removes metadata during port or client removal
-         */
+        memset (&req, 0, sizeof (req));
+        req.type = type;
+        jack_uuid_copy (&req.x.property.uuid, subject);
+        req.x.property.keylen = key ? strlen (key) + 1 : 0;
+        req.x.property.key = key;
+        req.x.property.valuelen = value ? strlen (value) + 1 : 0;
+        req.x.property.value = value;
+        req.x.property.typelen = (mime_type && mime_type[0] != '\0') ? strlen (mime_type) + 1 : 0;
+        req.x.property.type = mime_type;
+
+        return jack_client_deliver_request (client, &req);
+}
+
+static int
+jack_property_no_client (void)
+{
+        jack_error ("metadata can only be changed through a client of the server");
+        return -1;
+}
+
+static char*
+copy_string (const char* str, uint32_t len)
+{
+        char* s;
+
+        if ((s = (char *) malloc (len)) != NULL) {
+                memcpy (s, str, len);
+        }
+        return s;
+}
+
+/* Readers of the server's metadata store, run by jack_metadata_store_read().
+ */
+
+typedef struct {
+        jack_uuid_t subject;
+        const char* key;
+        char* value;
+        char* type;
+} get_property_arg_t;
+
+static int
+get_property_reader (const jack_metadata_store_t* store, void* ptr)
+{
+        get_property_arg_t* arg = (get_property_arg_t*) ptr;
+        jack_metadata_view_t view;
+        int ret;
 
-        if (client == NULL) {
+        if ((ret = jack_metadata_store_find (store, arg->subject, arg->key, &view)) != 0) {
+                return ret;
+        }
+
+        arg->value = copy_string (view.value, view.valuelen);
+        arg->type = view.type ? copy_string (view.type, view.typelen) : NULL;
+
+        return 0;
+}
+
+static void
+get_property_discard (void* ptr)
+{
+        get_property_arg_t* arg = (get_property_arg_t*) ptr;
+
+        free (arg->value);
+        free (arg->type);
+        arg->value = NULL;
+        arg->type = NULL;
+}
+
+static int
+fill_description (const jack_metadata_store_t* store, jack_description_t* desc,
+                  uint32_t offset, uint32_t count)
+{
+        jack_metadata_view_t view;
+        jack_property_t* prop;
+
+        if (count == 0) {
                 return 0;
         }
 
-        req.type = PropertyChangeNotify;
-        req.x.property.change = change;
-        jack_uuid_copy (&req.x.property.uuid, uuid);
-        req.x.property.keylen = key ? strlen (key) + 1 : 0;
-        req.x.property.key = key;
-        return jack_client_deliver_request (client, &req);
+        if (count > store->size / sizeof (jack_metadata_entry_t)) {
+                return JACK_METADATA_TORN;
+        }
+
+        if ((desc->properties = (jack_property_t*) calloc (count, sizeof (jack_property_t))) == NULL) {
+                return -1;
+        }
+        desc->property_size = count;
+
+        while (desc->property_cnt < count) {
+                if (jack_metadata_store_entry (store, offset, &view)) {
+                        return JACK_METADATA_TORN;
+                }
+                prop = &desc->properties[desc->property_cnt++];
+                prop->key = copy_string (view.key, view.keylen);
+                prop->data = copy_string (view.value, view.valuelen);
+                prop->type = view.type ? copy_string (view.type, view.typelen) : NULL;
+                offset = view.subject_next;
+        }
+
+        return offset ? JACK_METADATA_TORN : 0;
+}
+
+static int
+get_properties_reader (const jack_metadata_store_t* store, void* ptr)
+{
+        jack_description_t* desc = (jack_description_t*) ptr;
+        uint32_t count, first;
+        int ret;
+
+        if ((ret = jack_metadata_store_first (store, desc->subject, &count, &first)) != 0) {
+                return (ret == -1) ? 0 : ret;
+        }
+        if ((ret = fill_description (store, desc, first, count)) != 0) {
+                return ret;
+        }
+        return desc->property_cnt;
+}
+
+static void
+get_properties_discard (void* ptr)
+{
+        jack_description_t* desc = (jack_description_t*) ptr;
+
+        jack_free_description (desc, 0);
+        desc->properties = NULL;
+        desc->property_cnt = 0;
+        desc->property_size = 0;
+}
+
+typedef struct {
+        jack_description_t* desc;
+        uint32_t cnt;
+} get_all_properties_arg_t;
+
+static int
+get_all_properties_reader (const jack_metadata_store_t* store, void* ptr)
+{
+        get_all_properties_arg_t* arg = (get_all_properties_arg_t*) ptr;
+        const jack_metadata_subject_t* node;
+        uint32_t nsubjects = store->nsubjects;
+        uint32_t offset;
+        int ret;
+
+        if (nsubjects > store->size / sizeof (jack_metadata_subject_t)) {
+                return JACK_METADATA_TORN;
+        }
+
+        if ((arg->desc = (jack_description_t*) calloc (nsubjects ? nsubjects : 1, sizeof (jack_description_t))) == NULL) {
+                return -1;
+        }
+
+        for (offset = store->subjects; offset; offset = node->all_next) {
+                if (arg->cnt == nsubjects
+                    || (node = jack_metadata_store_subject_at (store, offset)) == NULL) {
+                        return JACK_METADATA_TORN;
+                }
+                jack_uuid_copy (&arg->desc[arg->cnt].subject, node->subject);
+                ret = fill_description (store, &arg->desc[arg->cnt++], node->first, node->count);
+                if (ret) {
+                        return ret;
+                }
+        }
+
+        return (arg->cnt == nsubjects) ? (int) arg->cnt : JACK_METADATA_TORN;
+}
+
+static void
+get_all_properties_discard (void* ptr)
+{
+        get_all_properties_arg_t* arg = (get_all_properties_arg_t*) ptr;
+        uint32_t n;
+
+        for (n = 0; n < arg->cnt; ++n) {
+                jack_free_description (&arg->desc[n], 0);
+        }
+        free (arg->desc);
+        arg->desc = NULL;
+        arg->cnt = 0;
 }
 
 static void
@@ -156,12 +338,6 @@ jack_set_property (jack_client_t* client,
                    const char* value,
                    const char* type)
 {
-        DBT d_key;
-        DBT data;
-        int ret;
-        size_t len1, len2;
-        jack_property_change_t change;
-
         if (!key || key[0] == '\0') {
                 jack_error ("empty key string for metadata not allowed");
                 return -1;
@@ -172,49 +348,15 @@ jack_set_property (jack_client_t* client,
                 return -1;
         }
 
-        if (jack_property_init (NULL)) {
-                return -1;
+        if (client) {
+                return jack_property_request (client, SetProperty, subject, key, value, type);
         }
 
-        /* build a key */
-
-        make_key_dbt (&d_key, subject, key);
-
-        /* build data */
-
-        memset(&data, 0, sizeof(data));
-
-        len1 = strlen(value) + 1;
-        if (type && type[0] != '\0') {
-                len2 = strlen(type) + 1;
-        } else {
-                len2 = 0;
-        }
-
-        data.size = len1 + len2;
-        data.data = malloc (data.size);
-        memcpy (data.data, value, len1);
-
-        if (len2) {
-                memcpy (data.data + len1, type, len2);
-        }
-
-        if (db->exists (db, NULL, &d_key, 0) == DB_NOTFOUND) {
-                change = PropertyCreated;
-        } else {
-                change = PropertyChanged;
-        }
-
-        if ((ret = db->put (db, NULL, &d_key, &data, 0)) != 0) {
-                char ustr[JACK_UUID_STRING_SIZE];
-                jack_uuid_unparse (subject, ustr);
-                jack_error ("Cannot store metadata for %s/%s (%s)", ustr, key, db_strerror (ret));
-                return -1;
+        if (jack_metadata_store_local ()) {
+                return jack_metadata_store_set (subject, key, value, type, NULL);
         }
 
-        jack_property_change_notify (client, subject, key, change);
-
-        return 0;
+        return jack_property_no_client ();
 }
 
 int
@@ -228,10 +370,31 @@ jack_get_property (jack_uuid_t subject,
         int ret;
         size_t len1, len2;
 
+        get_property_arg_t arg;
+
         if (key == NULL || key[0] == '\0') {
                 return -1;
         }
 
+        arg.subject = subject;
+        arg.key = key;
+        arg.value = NULL;
+        arg.type = NULL;
+
+        ret = jack_metadata_store_read (get_property_reader, get_property_discard, &arg);
+
+        if (ret != JACK_METADATA_NO_STORE) {
+                if (ret != 0 || arg.value == NULL) {
+                        get_property_discard (&arg);
+                        return -1;
+                }
+                *value = arg.value;
+                *type = arg.type;
+                return 0;
+        }
+
+        /* no server to ask, look in its database */
+
         if (jack_property_init (NULL)) {
                 return -1;
         }
@@ -245,7 +408,10 @@ jack_get_property (jack_uuid_t subject,
         memset(&data, 0, sizeof(data));
         data.flags = DB_DBT_MALLOC;
 
-        if ((ret = db->get (db, NULL, &d_key, &data, 0)) != 0) {
+        ret = db->get (db, NULL, &d_key, &data, 0);
+        free (d_key.data);
+
+        if (ret != 0) {
                 if (ret != DB_NOTFOUND) {
                         char ustr[JACK_UUID_STRING_SIZE];
                         jack_uuid_unparse (subject, ustr);
@@ -301,6 +467,19 @@ jack_get_properties (jack_uuid_t subject,
 
         desc->properties = NULL;
         desc->property_cnt = 0;
+        desc->property_size = 0;
+        jack_uuid_copy (&desc->subject, subject);
+
+        ret = jack_metadata_store_read (get_properties_reader, get_properties_discard, desc);
+
+        if (ret != JACK_METADATA_NO_STORE) {
+                if (ret < 0) {
+                        get_properties_discard (desc);
+                }
+                return ret;
+        }
+
+        /* no server to ask, look in its database */
 
         jack_uuid_unparse (subject, ustr);
 
@@ -419,6 +598,23 @@ jack_get_all_properties (jack_description_t** descriptions)
         jack_description_t* current_desc = NULL;
         jack_property_t* current_prop = NULL;
         size_t len1, len2;
+        get_all_properties_arg_t arg;
+
+        arg.desc = NULL;
+        arg.cnt = 0;
+
+        ret = jack_metadata_store_read (get_all_properties_reader, get_all_properties_discard, &arg);
+
+        if (ret != JACK_METADATA_NO_STORE) {
+                if (ret < 0) {
+                        get_all_properties_discard (&arg);
+                        return ret;
+                }
+                (*descriptions) = arg.desc;
+                return ret;
+        }
+
+        /* no server to ask, look in its database */
 
         if (jack_property_init (NULL)) {
                 return -1;
@@ -566,110 +762,47 @@ jack_set_property_change_callback (jack_client_t *client,
 int        
 jack_remove_property (jack_client_t* client, jack_uuid_t subject, const char* key)
 {
-        DBT d_key;
-        int ret;
-
-        if (jack_property_init (NULL)) {
+        if (!key || key[0] == '\0') {
                 return -1;
         }
 
-        make_key_dbt (&d_key, subject, key);
-        if ((ret = db->del (db, NULL, &d_key, 0)) != 0) {
-                jack_error ("Cannot delete key %s (%s)", key, db_strerror (ret));
-                return -1;
+        if (client) {
+                return jack_property_request (client, RemoveProperty, subject, key, NULL, NULL);
         }
 
-        jack_property_change_notify (client, subject, key, PropertyDeleted);
+        if (jack_metadata_store_local ()) {
+                return jack_metadata_store_remove (subject, key);
+        }
 
-        return 0;
+        return jack_property_no_client ();
 }
 
 int        
 jack_remove_properties (jack_client_t* client, jack_uuid_t subject)
 {
-        DBT key;
-        DBT data;
-        DBC* cursor;
-        int ret;
-        char ustr[JACK_UUID_STRING_SIZE];
-        int retval = 0;
-        uint32_t cnt = 0;
-
-        jack_uuid_unparse (subject, ustr);
-
-        if (jack_property_init (NULL)) {
-                return -1;
+        if (client) {
+                return jack_property_request (client, RemoveProperties, subject, NULL, NULL, NULL);
         }
 
-        if ((ret = db->cursor (db, NULL, &cursor, 0)) != 0) {
-                jack_error ("Cannot create cursor for metadata search (%s)", db_strerror (ret));
-                return -1;
+        if (jack_metadata_store_local ()) {
+                return jack_metadata_store_remove_subject (subject);
         }
 
-        memset(&key, 0, sizeof(key));
-	memset(&data, 0, sizeof(data));
-        data.flags = DB_DBT_MALLOC;
-
-        while ((ret = cursor->get(cursor, &key, &data, DB_NEXT)) == 0) {
-
-                /* require 2 extra chars (data+null) for key,
-                   which is composed of UUID str plus a key name
-                */
-
-                if (key.size < JACK_UUID_STRING_SIZE + 2) {
-                        if (data.size > 0) {
-                                free (data.data);
-                        }
-                        continue;
-                }
-
-                if (memcmp (ustr, key.data, JACK_UUID_STRING_SIZE) != 0) {
-                        /* not relevant */
-                        if (data.size > 0) {
-                                free (data.data);
-                        }
-                        continue;
-                }
-
-                if ((ret = cursor->del (cursor, 0)) != 0) {
-                        jack_error ("cannot delete property (%s)", db_strerror (ret));
-                        /* don't return -1 here since this would leave things
-                           even more inconsistent. wait till the cursor is finished
-                        */
-                        retval = -1;
-                }
-                cnt++;
-        }
-
-        cursor->close (cursor);
-
-        if (cnt) {
-                jack_property_change_notify (client, subject, NULL, PropertyDeleted);
-        }
-
-        if (retval) {
-                return -1;
-        } 
-
-        return cnt;
+        return jack_property_no_client ();
 }
 
 int        
 jack_remove_all_properties (jack_client_t* client)
 {
-        int ret;
         jack_uuid_t empty_uuid = JACK_UUID_EMPTY_INITIALIZER;
 
-        if (jack_property_init (NULL)) {
-                return -1;
+        if (client) {
+                return jack_property_request (client, RemoveAllProperties, empty_uuid, NULL, NULL, NULL);
         }
 
-        if ((ret = db->truncate (db, NULL, NULL, 0)) != 0) {
-                jack_error ("Cannot clear properties (%s)", db_strerror (ret));
-                return -1;
+        if (jack_metadata_store_local ()) {
+                return jack_metadata_store_remove_all ();
         }
 
-        jack_property_change_notify (client, empty_uuid, NULL, PropertyDeleted);
-
-        return 0;
+        return jack_property_no_client ();
 }
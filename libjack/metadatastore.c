@@ -0,0 +1,1102 @@
+/*
+ * metadatastore.c -- the server's in-memory metadata index, and
+ * lock-free access to it from clients.  See metadatastore.h.
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <db.h>
+
+#include <jack/uuid.h>
+#include <jack/metadata.h>
+
+#include "internal.h"
+#include "metadatastore.h"
+
+#define MDS_ALIGN(n)		(((n) + 7) & ~7U)
+#define MDS_PTR(store, offset)	((void *) ((char *) (store) + (offset)))
+#define MDS_CPTR(store, offset)	((const void *) ((const char *) (store) + (offset)))
+#define MDS_MAX_DATA		(16 * 1024 * 1024)	/* per property */
+#define MDS_READ_TRIES		1000
+#define MDS_MAP_TRIES		3
+
+typedef enum {
+	MDS_OP_SET,
+	MDS_OP_REMOVE,
+	MDS_OP_REMOVE_ALL
+} mds_op_type_t;
+
+/* a change still to be written to disk */
+typedef struct _mds_op {
+	struct _mds_op *next;
+	mds_op_type_t	what;
+	jack_uuid_t	subject;
+	uint32_t	keylen;
+	uint32_t	datalen;	/* value and type, as the db keeps them */
+	char		data[0];
+} mds_op_t;
+
+/* server side, all under store_lock */
+
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_cond = PTHREAD_COND_INITIALIZER;
+static jack_control_t *server_control = NULL;
+static jack_metadata_store_t *server_store = NULL;
+static jack_shm_info_t server_shm;
+static jack_shm_info_t retired_shm;	/* the previous segment, see mds_rebuild() */
+static uint32_t server_generation = 0;
+static char *server_name_copy = NULL;
+static mds_op_t *ops_head = NULL;
+static mds_op_t **ops_tail = &ops_head;
+static pthread_t flush_thread;
+static int flush_running = 0;
+static int flush_stop = 0;
+
+/* client side, all under attach_lock */
+
+static pthread_mutex_t attach_lock = PTHREAD_MUTEX_INITIALIZER;
+static int attach_count = 0;
+static jack_shm_info_t control_shm;
+static jack_control_t *client_control = NULL;
+static jack_shm_info_t client_shm;
+static jack_metadata_store_t *client_store = NULL;
+
+static inline uint32_t
+mds_hash (jack_uuid_t subject, const char *key)
+{
+	uint32_t h = 2166136261U;	/* FNV-1a */
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		h ^= (uint8_t) (subject >> (i * 8));
+		h *= 16777619U;
+	}
+	if (key) {
+		for (; *key; key++) {
+			h ^= (uint8_t) *key;
+			h *= 16777619U;
+		}
+	}
+	return h;
+}
+
+static inline uint32_t
+mds_arena (const jack_metadata_store_t *store)
+{
+	return MDS_ALIGN (store->subject_buckets
+			  + store->nbuckets * sizeof (uint32_t));
+}
+
+static inline uint32_t
+mds_entry_size (size_t keylen, size_t valuelen, size_t typelen)
+{
+	return MDS_ALIGN (sizeof (jack_metadata_entry_t)
+			  + keylen + valuelen + typelen);
+}
+
+/* Readers.  Nothing a reader looks at can be trusted while the
+ * server may be writing, so every offset is checked before it is
+ * followed and chains are walked for a bounded number of steps.
+ */
+
+static inline int
+mds_valid (const jack_metadata_store_t *store, uint32_t offset, uint32_t len)
+{
+	return offset >= sizeof (jack_metadata_store_t)
+		&& (offset & 7) == 0
+		&& offset < store->size
+		&& len <= store->size - offset;
+}
+
+static int
+mds_sane (const jack_metadata_store_t *store)
+{
+	uint32_t tables = store->nbuckets * sizeof (uint32_t);
+
+	return store->magic == JACK_METADATA_MAGIC
+		&& store->nbuckets
+		&& (store->nbuckets & (store->nbuckets - 1)) == 0
+		&& store->nbuckets < store->size / sizeof (uint32_t)
+		&& mds_valid (store, store->entry_buckets, tables)
+		&& mds_valid (store, store->subject_buckets, tables);
+}
+
+int
+jack_metadata_store_entry (const jack_metadata_store_t *store,
+			   uint32_t offset, jack_metadata_view_t *view)
+{
+	const jack_metadata_entry_t *entry;
+	uint32_t size, keylen, valuelen, typelen;
+
+	if (!mds_valid (store, offset, sizeof (*entry))) {
+		return JACK_METADATA_TORN;
+	}
+
+	entry = (const jack_metadata_entry_t *) MDS_CPTR (store, offset);
+	size = entry->size;
+	keylen = entry->keylen;
+	valuelen = entry->valuelen;
+	typelen = entry->typelen;
+
+	if (!mds_valid (store, offset, size)
+	    || keylen == 0 || valuelen == 0
+	    || (uint64_t) sizeof (*entry) + keylen + valuelen + typelen > size) {
+		return JACK_METADATA_TORN;
+	}
+
+	view->key = entry->data;
+	view->value = entry->data + keylen;
+	view->type = typelen ? view->value + valuelen : NULL;
+
+	if (view->key[keylen-1] != '\0'
+	    || view->value[valuelen-1] != '\0'
+	    || (typelen && view->type[typelen-1] != '\0')) {
+		return JACK_METADATA_TORN;
+	}
+
+	view->subject = entry->subject;
+	view->keylen = keylen;
+	view->valuelen = valuelen;
+	view->typelen = typelen;
+	view->subject_next = entry->subject_next;
+
+	return 0;
+}
+
+const jack_metadata_subject_t *
+jack_metadata_store_subject_at (const jack_metadata_store_t *store,
+				uint32_t offset)
+{
+	if (!mds_valid (store, offset, sizeof (jack_metadata_subject_t))) {
+		return NULL;
+	}
+	return (const jack_metadata_subject_t *) MDS_CPTR (store, offset);
+}
+
+int
+jack_metadata_store_find (const jack_metadata_store_t *store,
+			  jack_uuid_t subject, const char *key,
+			  jack_metadata_view_t *view)
+{
+	const uint32_t *buckets = (const uint32_t *)
+		MDS_CPTR (store, store->entry_buckets);
+	uint32_t steps = store->size / sizeof (jack_metadata_entry_t);
+	uint32_t keylen = strlen (key) + 1;
+	uint32_t offset;
+
+	offset = buckets[mds_hash (subject, key) & (store->nbuckets - 1)];
+
+	while (offset) {
+		if (steps-- == 0
+		    || jack_metadata_store_entry (store, offset, view)) {
+			return JACK_METADATA_TORN;
+		}
+		if (jack_uuid_compare (view->subject, subject) == 0
+		    && view->keylen == keylen
+		    && memcmp (view->key, key, keylen) == 0) {
+			return 0;
+		}
+		offset = ((const jack_metadata_entry_t *)
+			  MDS_CPTR (store, offset))->next;
+	}
+
+	return -1;
+}
+
+int
+jack_metadata_store_first (const jack_metadata_store_t *store,
+			   jack_uuid_t subject, uint32_t *count,
+			   uint32_t *first)
+{
+	const uint32_t *buckets = (const uint32_t *)
+		MDS_CPTR (store, store->subject_buckets);
+	uint32_t steps = store->size / sizeof (jack_metadata_subject_t);
+	const jack_metadata_subject_t *node;
+	uint32_t offset;
+
+	offset = buckets[mds_hash (subject, NULL) & (store->nbuckets - 1)];
+
+	while (offset) {
+		if (steps-- == 0
+		    || (node = jack_metadata_store_subject_at (store, offset))
+		    == NULL) {
+			return JACK_METADATA_TORN;
+		}
+		if (jack_uuid_compare (node->subject, subject) == 0) {
+			*count = node->count;
+			*first = node->first;
+			return 0;
+		}
+		offset = node->next;
+	}
+
+	return -1;
+}
+
+/* Server side.  The server's own pointers are trusted. */
+
+static inline void
+mds_write_begin (jack_metadata_store_t *store)
+{
+	store->seq++;
+	__sync_synchronize ();
+}
+
+static inline void
+mds_write_end (jack_metadata_store_t *store)
+{
+	__sync_synchronize ();
+	store->seq++;
+}
+
+static jack_metadata_store_t *
+mds_create (jack_shm_info_t *shm, uint32_t size, uint32_t nbuckets)
+{
+	jack_metadata_store_t *store;
+	uint32_t tables = nbuckets * sizeof (uint32_t);
+
+	if (jack_shmalloc (size, shm)) {
+		jack_error ("cannot create metadata shared memory segment "
+			    "(%s)", strerror (errno));
+		return NULL;
+	}
+
+	if (jack_attach_shm (shm)) {
+		jack_error ("cannot attach metadata shared memory segment "
+			    "(%s)", strerror (errno));
+		jack_destroy_shm (shm);
+		return NULL;
+	}
+
+	store = (jack_metadata_store_t *) jack_shm_addr (shm);
+	memset (store, 0, sizeof (*store));
+
+	store->magic = JACK_METADATA_MAGIC;
+	store->generation = ++server_generation;
+	store->size = size;
+	store->nbuckets = nbuckets;
+	store->entry_buckets = MDS_ALIGN (sizeof (*store));
+	store->subject_buckets = store->entry_buckets + tables;
+	store->used = mds_arena (store);
+
+	memset (MDS_PTR (store, store->entry_buckets), 0, 2 * tables);
+
+	return store;
+}
+
+static uint32_t
+mds_alloc (jack_metadata_store_t *store, uint32_t size)
+{
+	uint32_t offset;
+
+	if (size > store->size - store->used) {
+		return 0;
+	}
+	offset = store->used;
+	store->used += size;
+	return offset;
+}
+
+static uint32_t
+mds_lookup_subject (jack_metadata_store_t *store, jack_uuid_t subject)
+{
+	uint32_t *buckets = (uint32_t *) MDS_PTR (store, store->subject_buckets);
+	uint32_t offset;
+	jack_metadata_subject_t *node;
+
+	offset = buckets[mds_hash (subject, NULL) & (store->nbuckets - 1)];
+
+	for (; offset; offset = node->next) {
+		node = (jack_metadata_subject_t *) MDS_PTR (store, offset);
+		if (jack_uuid_compare (node->subject, subject) == 0) {
+			break;
+		}
+	}
+	return offset;
+}
+
+static uint32_t
+mds_lookup (jack_metadata_store_t *store, jack_uuid_t subject,
+	    const char *key, uint32_t keylen)
+{
+	uint32_t *buckets = (uint32_t *) MDS_PTR (store, store->entry_buckets);
+	uint32_t offset;
+	jack_metadata_entry_t *entry;
+
+	offset = buckets[mds_hash (subject, key) & (store->nbuckets - 1)];
+
+	for (; offset; offset = entry->next) {
+		entry = (jack_metadata_entry_t *) MDS_PTR (store, offset);
+		if (jack_uuid_compare (entry->subject, subject) == 0
+		    && entry->keylen == keylen
+		    && memcmp (entry->data, key, keylen) == 0) {
+			break;
+		}
+	}
+	return offset;
+}
+
+/* The caller has made sure there is room for the entry and, if the
+ * subject is new, for its node.
+ */
+static void
+mds_insert (jack_metadata_store_t *store, jack_uuid_t subject,
+	    const char *key, uint32_t keylen,
+	    const char *value, uint32_t valuelen,
+	    const char *type, uint32_t typelen)
+{
+	uint32_t *ebuckets = (uint32_t *) MDS_PTR (store, store->entry_buckets);
+	uint32_t *sbuckets = (uint32_t *) MDS_PTR (store, store->subject_buckets);
+	uint32_t mask = store->nbuckets - 1;
+	jack_metadata_subject_t *node;
+	jack_metadata_entry_t *entry;
+	uint32_t soffset, eoffset, size, h;
+
+	if ((soffset = mds_lookup_subject (store, subject)) == 0) {
+		soffset = mds_alloc (store, MDS_ALIGN (sizeof (*node)));
+		node = (jack_metadata_subject_t *) MDS_PTR (store, soffset);
+		memset (node, 0, sizeof (*node));
+		jack_uuid_copy (&node->subject, subject);
+
+		h = mds_hash (subject, NULL) & mask;
+		node->next = sbuckets[h];
+		sbuckets[h] = soffset;
+
+		node->all_next = store->subjects;
+		if (store->subjects) {
+			((jack_metadata_subject_t *)
+			 MDS_PTR (store, store->subjects))->all_prev = soffset;
+		}
+		store->subjects = soffset;
+		store->nsubjects++;
+	}
+	node = (jack_metadata_subject_t *) MDS_PTR (store, soffset);
+
+	size = mds_entry_size (keylen, valuelen, typelen);
+	eoffset = mds_alloc (store, size);
+	entry = (jack_metadata_entry_t *) MDS_PTR (store, eoffset);
+
+	entry->size = size;
+	entry->keylen = keylen;
+	entry->valuelen = valuelen;
+	entry->typelen = typelen;
+	jack_uuid_copy (&entry->subject, subject);
+	memcpy (entry->data, key, keylen);
+	memcpy (entry->data + keylen, value, valuelen);
+	if (typelen) {
+		memcpy (entry->data + keylen + valuelen, type, typelen);
+	}
+
+	h = mds_hash (subject, key) & mask;
+	entry->next = ebuckets[h];
+	ebuckets[h] = eoffset;
+
+	entry->subject_next = node->first;
+	node->first = eoffset;
+	node->count++;
+
+	store->nentries++;
+}
+
+static void
+mds_unlink_subject (jack_metadata_store_t *store, uint32_t soffset)
+{
+	uint32_t *buckets = (uint32_t *) MDS_PTR (store, store->subject_buckets);
+	jack_metadata_subject_t *node = (jack_metadata_subject_t *)
+		MDS_PTR (store, soffset);
+	uint32_t *link;
+
+	link = &buckets[mds_hash (node->subject, NULL) & (store->nbuckets - 1)];
+	while (*link != soffset) {
+		link = &((jack_metadata_subject_t *) MDS_PTR (store, *link))->next;
+	}
+	*link = node->next;
+
+	if (node->all_prev) {
+		((jack_metadata_subject_t *)
+		 MDS_PTR (store, node->all_prev))->all_next = node->all_next;
+	} else {
+		store->subjects = node->all_next;
+	}
+	if (node->all_next) {
+		((jack_metadata_subject_t *)
+		 MDS_PTR (store, node->all_next))->all_prev = node->all_prev;
+	}
+
+	store->garbage += MDS_ALIGN (sizeof (*node));
+	store->nsubjects--;
+}
+
+static void
+mds_unlink (jack_metadata_store_t *store, uint32_t eoffset)
+{
+	uint32_t *buckets = (uint32_t *) MDS_PTR (store, store->entry_buckets);
+	jack_metadata_entry_t *entry = (jack_metadata_entry_t *)
+		MDS_PTR (store, eoffset);
+	jack_metadata_subject_t *node;
+	uint32_t soffset;
+	uint32_t *link;
+
+	link = &buckets[mds_hash (entry->subject, entry->data)
+			& (store->nbuckets - 1)];
+	while (*link != eoffset) {
+		link = &((jack_metadata_entry_t *) MDS_PTR (store, *link))->next;
+	}
+	*link = entry->next;
+
+	soffset = mds_lookup_subject (store, entry->subject);
+	node = (jack_metadata_subject_t *) MDS_PTR (store, soffset);
+
+	link = &node->first;
+	while (*link != eoffset) {
+		link = &((jack_metadata_entry_t *)
+			 MDS_PTR (store, *link))->subject_next;
+	}
+	*link = entry->subject_next;
+
+	store->garbage += entry->size;
+	store->nentries--;
+
+	if (--node->count == 0) {
+		mds_unlink_subject (store, soffset);
+	}
+}
+
+/* Make room for `need' more bytes by building a new, compacted and
+ * large enough segment and publishing it.  Clients notice the new
+ * generation on their next read.  The segment it replaces is kept
+ * until the next rebuild, so that a client still mapping it can
+ * unmap it through the registry as usual.
+ */
+static int
+mds_rebuild (uint32_t need)
+{
+	jack_metadata_store_t *old = server_store;
+	jack_metadata_store_t *store;
+	jack_metadata_subject_t *node;
+	jack_metadata_entry_t *entry;
+	jack_shm_info_t shm;
+	uint64_t size;
+	uint32_t nbuckets, soffset, eoffset;
+
+	nbuckets = JACK_METADATA_MIN_BUCKETS;
+	while (nbuckets <= old->nentries + 1) {
+		nbuckets <<= 1;
+	}
+
+	size = (uint64_t) old->used - mds_arena (old) - old->garbage + need;
+	size = 2 * size + MDS_ALIGN (sizeof (*old))
+		+ 2 * nbuckets * sizeof (uint32_t);
+	if (size < JACK_METADATA_MIN_SIZE) {
+		size = JACK_METADATA_MIN_SIZE;
+	}
+	size = (size + 4095) & ~4095ULL;
+
+	if (size > UINT32_MAX / 2) {
+		jack_error ("metadata store cannot grow beyond %u bytes",
+			    old->size);
+		return -1;
+	}
+
+	if ((store = mds_create (&shm, (uint32_t) size, nbuckets)) == NULL) {
+		return -1;
+	}
+
+	for (soffset = old->subjects; soffset; soffset = node->all_next) {
+		node = (jack_metadata_subject_t *) MDS_PTR (old, soffset);
+		for (eoffset = node->first; eoffset;
+		     eoffset = entry->subject_next) {
+			entry = (jack_metadata_entry_t *) MDS_PTR (old, eoffset);
+			mds_insert (store, entry->subject,
+				    entry->data, entry->keylen,
+				    entry->data + entry->keylen,
+				    entry->valuelen,
+				    entry->data + entry->keylen
+				    + entry->valuelen,
+				    entry->typelen);
+		}
+	}
+
+	if (retired_shm.index != JACK_SHM_NULL_INDEX) {
+		jack_release_shm (&retired_shm);
+		jack_destroy_shm (&retired_shm);
+	}
+	retired_shm = server_shm;
+	server_shm = shm;
+	server_store = store;
+
+	server_control->metadata_shm_index = shm.index;
+	__sync_synchronize ();
+	server_control->metadata_generation = store->generation;
+
+	return 0;
+}
+
+static void
+mds_journal (mds_op_type_t what, jack_uuid_t subject,
+	     const char *key, uint32_t keylen,
+	     const char *value, uint32_t valuelen,
+	     const char *type, uint32_t typelen)
+{
+	mds_op_t *op;
+
+	if (!flush_running) {
+		return;
+	}
+
+	if ((op = (mds_op_t *) malloc (sizeof (*op) + keylen + valuelen
+				       + typelen)) == NULL) {
+		jack_error ("cannot queue metadata change for disk");
+		return;
+	}
+
+	op->next = NULL;
+	op->what = what;
+	jack_uuid_copy (&op->subject, subject);
+	op->keylen = keylen;
+	op->datalen = valuelen + typelen;
+	if (keylen) {
+		memcpy (op->data, key, keylen);
+	}
+	if (valuelen) {
+		memcpy (op->data + keylen, value, valuelen);
+	}
+	if (typelen) {
+		memcpy (op->data + keylen + valuelen, type, typelen);
+	}
+
+	*ops_tail = op;
+	ops_tail = &op->next;
+	pthread_cond_signal (&flush_cond);
+}
+
+static void
+mds_flush (mds_op_t *batch)
+{
+	DB *db = jack_property_db (server_name_copy);
+	char kbuf[JACK_UUID_STRING_SIZE + 128];
+	DBT key, data;
+	mds_op_t *op;
+	int ret;
+
+	for (; (op = batch) != NULL; free (op)) {
+
+		batch = op->next;
+
+		if (db == NULL) {
+			continue;
+		}
+
+		memset (&key, 0, sizeof (key));
+		memset (&data, 0, sizeof (data));
+
+		if (op->what == MDS_OP_REMOVE_ALL) {
+			u_int32_t count;
+			if ((ret = db->truncate (db, NULL, &count, 0)) != 0) {
+				jack_error ("Cannot clear properties (%s)",
+					    db_strerror (ret));
+			}
+			continue;
+		}
+
+		/* same layout as make_key_dbt() in metadata.c */
+
+		key.size = JACK_UUID_STRING_SIZE + op->keylen;
+		if (key.size <= sizeof (kbuf)) {
+			key.data = kbuf;
+		} else if ((key.data = malloc (key.size)) == NULL) {
+			continue;
+		}
+		memset (key.data, 0, JACK_UUID_STRING_SIZE);
+		jack_uuid_unparse (op->subject, key.data);
+		memcpy ((char *) key.data + JACK_UUID_STRING_SIZE,
+			op->data, op->keylen);
+
+		if (op->what == MDS_OP_SET) {
+			data.data = op->data + op->keylen;
+			data.size = op->datalen;
+			if ((ret = db->put (db, NULL, &key, &data, 0)) != 0) {
+				jack_error ("Cannot store metadata for %s (%s)",
+					    op->data, db_strerror (ret));
+			}
+		} else {
+			if ((ret = db->del (db, NULL, &key, 0)) != 0
+			    && ret != DB_NOTFOUND) {
+				jack_error ("Cannot delete key %s (%s)",
+					    op->data, db_strerror (ret));
+			}
+		}
+
+		if (key.data != kbuf) {
+			free (key.data);
+		}
+	}
+
+	if (db) {
+		db->sync (db, 0);
+	}
+}
+
+/* Writes the store's changes to Berkeley DB, so that processes
+ * without a client can still find them.  Changes that arrive
+ * together are written, and synced, together.
+ */
+static void *
+mds_flush_thread (void *arg)
+{
+	mds_op_t *batch;
+
+	pthread_mutex_lock (&store_lock);
+
+	for (;;) {
+		while (ops_head == NULL && !flush_stop) {
+			pthread_cond_wait (&flush_cond, &store_lock);
+		}
+		if (ops_head == NULL) {
+			break;
+		}
+
+		if (!flush_stop) {
+			pthread_mutex_unlock (&store_lock);
+			usleep (JACK_METADATA_FLUSH_USECS);
+			pthread_mutex_lock (&store_lock);
+		}
+
+		batch = ops_head;
+		ops_head = NULL;
+		ops_tail = &ops_head;
+
+		pthread_mutex_unlock (&store_lock);
+		mds_flush (batch);
+		pthread_mutex_lock (&store_lock);
+	}
+
+	pthread_mutex_unlock (&store_lock);
+
+	return NULL;
+}
+
+int
+jack_metadata_store_init (jack_control_t *control, const char *server_name)
+{
+	jack_metadata_store_t *store;
+
+	pthread_mutex_lock (&store_lock);
+
+	server_shm.index = JACK_SHM_NULL_INDEX;
+	retired_shm.index = JACK_SHM_NULL_INDEX;
+
+	store = mds_create (&server_shm, JACK_METADATA_MIN_SIZE,
+			    JACK_METADATA_MIN_BUCKETS);
+	if (store == NULL) {
+		pthread_mutex_unlock (&store_lock);
+		return -1;
+	}
+
+	server_control = control;
+	server_store = store;
+	control->metadata_shm_index = server_shm.index;
+	control->metadata_generation = store->generation;
+
+	server_name_copy = server_name ? strdup (server_name) : NULL;
+	flush_stop = 0;
+
+	if (pthread_create (&flush_thread, NULL, mds_flush_thread, NULL)) {
+		jack_error ("cannot start metadata writer thread, properties "
+			    "will not be written to disk");
+	} else {
+		flush_running = 1;
+	}
+
+	pthread_mutex_unlock (&store_lock);
+
+	return 0;
+}
+
+void
+jack_metadata_store_exit (void)
+{
+	pthread_mutex_lock (&store_lock);
+
+	if (server_store == NULL) {
+		pthread_mutex_unlock (&store_lock);
+		return;
+	}
+
+	if (flush_running) {
+		flush_stop = 1;
+		pthread_cond_signal (&flush_cond);
+		pthread_mutex_unlock (&store_lock);
+		pthread_join (flush_thread, NULL);
+		pthread_mutex_lock (&store_lock);
+		flush_running = 0;
+	}
+
+	if (retired_shm.index != JACK_SHM_NULL_INDEX) {
+		jack_release_shm (&retired_shm);
+		jack_destroy_shm (&retired_shm);
+		retired_shm.index = JACK_SHM_NULL_INDEX;
+	}
+	jack_release_shm (&server_shm);
+	jack_destroy_shm (&server_shm);
+	server_shm.index = JACK_SHM_NULL_INDEX;
+
+	server_control->metadata_shm_index = JACK_SHM_NULL_INDEX;
+	server_control = NULL;
+	server_store = NULL;
+
+	free (server_name_copy);
+	server_name_copy = NULL;
+
+	pthread_mutex_unlock (&store_lock);
+}
+
+int
+jack_metadata_store_local (void)
+{
+	return server_store != NULL;
+}
+
+int
+jack_metadata_store_set (jack_uuid_t subject, const char *key,
+			 const char *value, const char *type,
+			 jack_property_change_t *change)
+{
+	uint32_t keylen, valuelen, typelen, need, old;
+
+	if (strlen (key) + strlen (value) + (type ? strlen (type) : 0)
+	    > MDS_MAX_DATA) {
+		jack_error ("metadata value for %s is too large", key);
+		return -1;
+	}
+
+	keylen = strlen (key) + 1;
+	valuelen = strlen (value) + 1;
+	typelen = (type && type[0] != '\0') ? strlen (type) + 1 : 0;
+
+	pthread_mutex_lock (&store_lock);
+
+	if (server_store == NULL) {
+		pthread_mutex_unlock (&store_lock);
+		return -1;
+	}
+
+	old = mds_lookup (server_store, subject, key, keylen);
+	need = mds_entry_size (keylen, valuelen, typelen);
+	if (!old && !mds_lookup_subject (server_store, subject)) {
+		need += MDS_ALIGN (sizeof (jack_metadata_subject_t));
+	}
+
+	if (need > server_store->size - server_store->used
+	    || server_store->nentries >= 2 * server_store->nbuckets) {
+		if (mds_rebuild (need)) {
+			pthread_mutex_unlock (&store_lock);
+			return -1;
+		}
+		old = mds_lookup (server_store, subject, key, keylen);
+	}
+
+	/* insert first, so that replacing a subject's only property
+	 * does not drop and recreate the subject */
+
+	mds_write_begin (server_store);
+	mds_insert (server_store, subject, key, keylen, value, valuelen,
+		    type, typelen);
+	if (old) {
+		mds_unlink (server_store, old);
+	}
+	mds_write_end (server_store);
+
+	mds_journal (MDS_OP_SET, subject, key, keylen, value, valuelen,
+		     type, typelen);
+
+	pthread_mutex_unlock (&store_lock);
+
+	if (change) {
+		*change = old ? PropertyChanged : PropertyCreated;
+	}
+
+	return 0;
+}
+
+int
+jack_metadata_store_remove (jack_uuid_t subject, const char *key)
+{
+	uint32_t keylen = strlen (key) + 1;
+	uint32_t offset;
+
+	pthread_mutex_lock (&store_lock);
+
+	if (server_store == NULL
+	    || (offset = mds_lookup (server_store, subject, key, keylen)) == 0) {
+		pthread_mutex_unlock (&store_lock);
+		return -1;
+	}
+
+	mds_write_begin (server_store);
+	mds_unlink (server_store, offset);
+	mds_write_end (server_store);
+
+	mds_journal (MDS_OP_REMOVE, subject, key, keylen, NULL, 0, NULL, 0);
+
+	pthread_mutex_unlock (&store_lock);
+
+	return 0;
+}
+
+int
+jack_metadata_store_remove_subject (jack_uuid_t subject)
+{
+	jack_metadata_subject_t *node;
+	jack_metadata_entry_t *entry;
+	uint32_t soffset, offset;
+	int last, cnt = 0;
+
+	pthread_mutex_lock (&store_lock);
+
+	if (server_store == NULL) {
+		pthread_mutex_unlock (&store_lock);
+		return -1;
+	}
+
+	if ((soffset = mds_lookup_subject (server_store, subject)) == 0) {
+		pthread_mutex_unlock (&store_lock);
+		return 0;
+	}
+	node = (jack_metadata_subject_t *) MDS_PTR (server_store, soffset);
+
+	mds_write_begin (server_store);
+
+	/* unlinking the last entry unlinks the subject too */
+	do {
+		offset = node->first;
+		last = (node->count == 1);
+		entry = (jack_metadata_entry_t *) MDS_PTR (server_store, offset);
+		mds_journal (MDS_OP_REMOVE, subject, entry->data,
+			     entry->keylen, NULL, 0, NULL, 0);
+		mds_unlink (server_store, offset);
+		cnt++;
+	} while (!last);
+
+	mds_write_end (server_store);
+
+	pthread_mutex_unlock (&store_lock);
+
+	return cnt;
+}
+
+int
+jack_metadata_store_remove_all (void)
+{
+	jack_metadata_store_t *store;
+	mds_op_t *op;
+
+	pthread_mutex_lock (&store_lock);
+
+	if ((store = server_store) == NULL) {
+		pthread_mutex_unlock (&store_lock);
+		return -1;
+	}
+
+	mds_write_begin (store);
+	memset (MDS_PTR (store, store->entry_buckets), 0,
+		2 * store->nbuckets * sizeof (uint32_t));
+	store->used = mds_arena (store);
+	store->garbage = 0;
+	store->nentries = 0;
+	store->nsubjects = 0;
+	store->subjects = 0;
+	mds_write_end (store);
+
+	/* nothing queued matters once the db is truncated */
+
+	while ((op = ops_head) != NULL) {
+		ops_head = op->next;
+		free (op);
+	}
+	ops_tail = &ops_head;
+
+	mds_journal (MDS_OP_REMOVE_ALL, 0, NULL, 0, NULL, 0, NULL, 0);
+
+	pthread_mutex_unlock (&store_lock);
+
+	return 0;
+}
+
+/* Client side */
+
+void
+jack_metadata_store_attach (jack_shm_registry_index_t control_index)
+{
+	pthread_mutex_lock (&attach_lock);
+
+	/* the first client's server is the one we read from */
+
+	if (attach_count++ == 0) {
+		control_shm.index = control_index;
+		client_shm.index = JACK_SHM_NULL_INDEX;
+		if (jack_attach_shm (&control_shm) == 0) {
+			client_control = (jack_control_t *)
+				jack_shm_addr (&control_shm);
+		} else {
+			client_control = NULL;
+		}
+	}
+
+	pthread_mutex_unlock (&attach_lock);
+}
+
+static void
+mds_client_unmap (void)
+{
+	if (client_store) {
+		jack_release_shm (&client_shm);
+		client_shm.index = JACK_SHM_NULL_INDEX;
+		client_store = NULL;
+	}
+}
+
+void
+jack_metadata_store_detach (void)
+{
+	pthread_mutex_lock (&attach_lock);
+
+	if (attach_count > 0 && --attach_count == 0) {
+		mds_client_unmap ();
+		if (client_control) {
+			jack_release_shm (&control_shm);
+			client_control = NULL;
+		}
+	}
+
+	pthread_mutex_unlock (&attach_lock);
+}
+
+/* make sure client_store is the segment the server last published */
+static int
+mds_client_map (void)
+{
+	jack_metadata_store_t *store;
+	uint32_t generation;
+
+	generation = client_control->metadata_generation;
+	__sync_synchronize ();
+
+	if (client_store && client_store->generation == generation) {
+		return 0;
+	}
+
+	mds_client_unmap ();
+
+	client_shm.index = client_control->metadata_shm_index;
+	if (client_shm.index < 0 || jack_attach_shm (&client_shm)) {
+		client_shm.index = JACK_SHM_NULL_INDEX;
+		return -1;
+	}
+
+	/* the registry slot may have been reused meanwhile */
+
+	store = (jack_metadata_store_t *) jack_shm_addr (&client_shm);
+	if (store->generation != generation || !mds_sane (store)) {
+		jack_release_shm (&client_shm);
+		client_shm.index = JACK_SHM_NULL_INDEX;
+		return -1;
+	}
+
+	client_store = store;
+
+	return 0;
+}
+
+static int
+mds_client_read (jack_metadata_reader_t reader,
+		 jack_metadata_discard_t discard, void *arg)
+{
+	int tries, maps = 0;
+	int ret = JACK_METADATA_NO_STORE;
+	uint32_t seq;
+
+	pthread_mutex_lock (&attach_lock);
+
+	if (client_control == NULL) {
+		goto out;
+	}
+
+	for (tries = 0; tries < MDS_READ_TRIES; tries++) {
+
+		if (mds_client_map ()) {
+			if (++maps == MDS_MAP_TRIES) {
+				ret = -1;
+				goto out;
+			}
+			continue;
+		}
+
+		seq = client_store->seq;
+		__sync_synchronize ();
+
+		if (seq & 1) {
+			sched_yield ();
+			continue;
+		}
+
+		ret = reader (client_store, arg);
+
+		__sync_synchronize ();
+		if (ret != JACK_METADATA_TORN && client_store->seq == seq) {
+			goto out;
+		}
+
+		if (discard) {
+			discard (arg);
+		}
+	}
+
+	jack_error ("cannot get a consistent view of the metadata store");
+	ret = -1;
+
+  out:
+	pthread_mutex_unlock (&attach_lock);
+
+	return ret;
+}
+
+int
+jack_metadata_store_read (jack_metadata_reader_t reader,
+			  jack_metadata_discard_t discard, void *arg)
+{
+	int ret;
+
+	if (server_store) {
+		pthread_mutex_lock (&store_lock);
+		if (server_store) {
+			ret = reader (server_store, arg);
+			pthread_mutex_unlock (&store_lock);
+			return ret;
+		}
+		pthread_mutex_unlock (&store_lock);
+	}
+
+	return mds_client_read (reader, discard, arg);
+}
@@ -124,9 +124,10 @@ jack_midi_max_event_size(void           *port_buffer)
 		info->buffer_size;
 	
 	/* (event_count + 1) below accounts for jack_midi_port_internal_event_t
-	 * which would be needed to store the next event */
+	 * which would be needed to store the next event, and the + 1 for the
+	 * byte that jack_midi_event_reserve() leaves below the event data */
 	size_t used_size = sizeof(jack_midi_port_info_private_t)
-		+ info->last_write_loc
+		+ info->last_write_loc + 1
 		+ ((info->event_count + 1)
 		   * sizeof(jack_midi_port_internal_event_t));
 	
@@ -221,93 +222,189 @@ jack_midi_clear_buffer(void           *port_buffer)
 }
 
 
+/* Append events [from, to) of `in_buffer' to `out_buffer', as
+ * jack_midi_event_write() would, but with runs of inline events that
+ * fit copied in one go.  Returns the number of events written, which
+ * is less than asked if a write failed.
+ */
+static uint32_t
+jack_midi_copy_events(void *out_buffer, void *in_buffer,
+                      uint32_t from, uint32_t to)
+{
+	jack_midi_port_info_private_t *out_info =
+		(jack_midi_port_info_private_t *) out_buffer;
+	jack_midi_port_internal_event_t *out_events =
+		(jack_midi_port_internal_event_t *) (out_info + 1);
+	jack_midi_port_internal_event_t *in_events =
+		(jack_midi_port_internal_event_t *)
+		((jack_midi_port_info_private_t *) in_buffer + 1);
+	uint32_t copied = 0;
+	uint32_t run, room;
+	size_t used;
+
+	while (from < to) {
+		/* inline events need nothing but their slot */
+		for (run = 0; from + run < to; ++run) {
+			if (in_events[from + run].size > MIDI_INLINE_MAX
+			    || in_events[from + run].size == 0
+			    || in_events[from + run].time >= out_info->nframes)
+				break;
+		}
+
+		/* as counted by jack_midi_max_event_size() */
+		used = sizeof(jack_midi_port_info_private_t)
+			+ out_info->last_write_loc + 1
+			+ out_info->event_count
+			  * sizeof(jack_midi_port_internal_event_t);
+		room = (used < out_info->buffer_size)
+			? (out_info->buffer_size - used)
+			  / sizeof(jack_midi_port_internal_event_t)
+			: 0;
+		if (run > room)
+			run = room;
+
+		if (run) {
+			memcpy(&out_events[out_info->event_count], &in_events[from],
+			       run * sizeof(jack_midi_port_internal_event_t));
+			out_info->event_count += run;
+			copied += run;
+			from += run;
+			continue;
+		}
+
+		if (jack_midi_event_write(out_buffer, in_events[from].time,
+		                          jack_midi_event_data(in_buffer,
+		                                               &in_events[from]),
+		                          in_events[from].size))
+			break;
+		++copied;
+		++from;
+	}
+
+	return copied;
+}
+
+
+/* The merge order: by time, and by position in port->sources between
+ * events at the same time. */
+static inline int
+jack_midi_source_before(jack_port_t *port, uint32_t a, uint32_t b)
+{
+	jack_midi_port_internal_event_t *ea = (jack_midi_port_internal_event_t *)
+		((jack_midi_port_info_private_t *) port->source_buffers[a] + 1);
+	jack_midi_port_internal_event_t *eb = (jack_midi_port_internal_event_t *)
+		((jack_midi_port_info_private_t *) port->source_buffers[b] + 1);
+	uint16_t ta = ea[port->source_next[a]].time;
+	uint16_t tb = eb[port->source_next[b]].time;
+
+	return ta < tb || (ta == tb && a < b);
+}
+
+static void
+jack_midi_heap_down(jack_port_t *port, uint32_t n, uint32_t i)
+{
+	uint32_t *heap = port->source_heap;
+	uint32_t top = heap[i];
+	uint32_t child;
+
+	while ((child = 2 * i + 1) < n) {
+		if (child + 1 < n
+		    && jack_midi_source_before(port, heap[child + 1], heap[child]))
+			++child;
+		if (!jack_midi_source_before(port, heap[child], top))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = top;
+}
+
 /* jack_midi_port_functions.mixdown */
 static void
 jack_midi_port_mixdown(jack_port_t    *port, jack_nframes_t nframes)
 {
-	JSList         *node;
-	jack_port_t    *input;
+	void          **buffers = port->source_buffers;
+	uint32_t       *heap    = port->source_heap;
+	uint32_t       *next    = port->source_next;
 	jack_nframes_t  num_events = 0;
 	jack_nframes_t  i          = 0;
-	int             err        = 0;
 	jack_nframes_t  lost_events = 0;
+	uint32_t        n = 0;
+	uint32_t        s, count, first, limit, want, done;
+	uint32_t        other;
 
-	/* The next (single) event to mix in to the buffer */
-	jack_midi_port_info_private_t   *earliest_info;
-	jack_midi_port_internal_event_t *earliest_event;
-	jack_midi_data_t                *earliest_buffer;
-	
-	jack_midi_port_info_private_t   *in_info;   /* For finding next event */
-	jack_midi_port_internal_event_t *in_events; /* Corresponds to in_info */
+	jack_midi_port_info_private_t   *in_info;
 	jack_midi_port_info_private_t   *out_info;  /* Output 'buffer' */
 
 	jack_midi_clear_buffer(port->mix_buffer);
 	
 	out_info = (jack_midi_port_info_private_t *) port->mix_buffer;
 
-	/* This function uses jack_midi_port_info_private_t.last_write_loc of the
-	 * source ports to store indices of the last event read from that buffer
-	 * so far.  This is OK because last_write_loc is used when writing events
-	 * to a buffer, which at this stage is already complete so the value
-	 * can be safely smashed. */
-	
-	/* Iterate through all connections to see how many events we need to mix,
-	 * and initialise their 'last event read' (last_write_loc) to 0 */
-	for (node = port->connections; node; node = jack_slist_next(node)) {
-		input = (jack_port_t *) node->data;
-		in_info =
-			(jack_midi_port_info_private_t *) jack_output_port_buffer(input);
+	/* The sources are k-way merged: port->source_heap is a min-heap of
+	 * the sources that still have events, ordered by their next one,
+	 * and port->source_next holds each source's read position.  The
+	 * source buffers themselves are left alone. */
+	for (s = 0; s < port->nsources; ++s) {
+		buffers[s] = jack_output_port_buffer(port->sources[s]);
+		in_info = (jack_midi_port_info_private_t *) buffers[s];
 		num_events += in_info->event_count;
 		lost_events += in_info->events_lost;
-		in_info->last_write_loc = 0;
+		next[s] = 0;
+		if (in_info->event_count)
+			heap[n++] = s;
 	}
 
-	/* Write the events in the order of their timestamps */
-	for (i = 0; i < num_events; ++i) {
-		earliest_info = NULL;
-		earliest_event = NULL;
-		earliest_buffer = NULL;
-
-		/* Find the earliest unread event, to mix next
-		 * (search for an event earlier than earliest_event) */
-		for (node = port->connections; node; node = jack_slist_next(node)) {
-			in_info = (jack_midi_port_info_private_t *)
-				jack_output_port_buffer(((jack_port_t *) node->data));
-			in_events = (jack_midi_port_internal_event_t *) (in_info + 1);
-
-			/* If there are unread events left in this port.. */
-			if (in_info->event_count > in_info->last_write_loc) {
-				/* .. and this event is the new earliest .. */
-				/* NOTE: that's why we compare time with <, not <= */
-				if (earliest_info == NULL
-						|| in_events[in_info->last_write_loc].time
-					       < earliest_event->time) {
-					/* .. then set this event as the next earliest */
-					earliest_info = in_info;
-					earliest_event = (jack_midi_port_internal_event_t *)
-						(&in_events[in_info->last_write_loc]);
-				}
-			}
-		}
+	/* One source with events: nothing to merge */
+	if (n == 1) {
+		in_info = (jack_midi_port_info_private_t *) buffers[heap[0]];
+		i = jack_midi_copy_events(port->mix_buffer, in_info, 0,
+		                          in_info->event_count);
+		n = 0;
+	}
 
-		if (earliest_info && earliest_event) {
-			earliest_buffer = (jack_midi_data_t *) earliest_info;
-			
-			/* Write event to output */
-			err = jack_midi_event_write(
-				jack_port_buffer(port),
-				earliest_event->time,
-				jack_midi_event_data(earliest_buffer, earliest_event),
-				earliest_event->size);
-			
-			earliest_info->last_write_loc++;
-
-			if (err) {
-				out_info->events_lost = num_events - i;
-				break;
+	for (s = n / 2; s-- > 0; )
+		jack_midi_heap_down(port, n, s);
+
+	while (n) {
+		s = heap[0];
+		in_info = (jack_midi_port_info_private_t *) buffers[s];
+		count = in_info->event_count;
+
+		/* Take every event of this source that comes before the next
+		 * event of any other source, which is at one of the root's
+		 * children. */
+		first = next[s];
+		limit = first + 1;
+		if (n > 1) {
+			other = heap[1];
+			if (n > 2 && jack_midi_source_before(port, heap[2], other))
+				other = heap[2];
+			while (limit < count) {
+				next[s] = limit;
+				if (!jack_midi_source_before(port, s, other))
+					break;
+				++limit;
 			}
+		} else {
+			limit = count;
 		}
+
+		want = limit - first;
+		done = jack_midi_copy_events(port->mix_buffer, in_info,
+		                             first, limit);
+		i += done;
+		if (done < want)
+			break;
+
+		next[s] = limit;
+		if (limit == count)
+			heap[0] = heap[--n];
+		if (n)
+			jack_midi_heap_down(port, n, 0);
 	}
+
+	if (i < num_events)
+		out_info->events_lost = num_events - i;
 	assert(out_info->event_count == num_events - out_info->events_lost);
 
 	// inherit total lost events count from all connected ports.
@@ -20,7 +20,12 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <sched.h>
 #include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
 
 #include <config.h>
 #include <sys/mman.h>
@@ -74,55 +79,63 @@ jack_port_type_info_t jack_builtin_port_types[] = {
 	{ .type_name = "", }
 };
 
-/* these functions have been taken from libDSP X86.c  -jl */
-
-#ifdef USE_DYNSIMD
-
-static void (*opt_copy) (float *, const float *, int);
-static void (*opt_mix) (float *, const float *, int);
-
+/* Write the sum of `nsrcs' (at least one) buffers to dest in one
+ * pass.  This is the reference the SIMD versions in simd.c follow.
+ */
 static void
-gen_copyf (float *dest, const float *src, int length)
+gen_mixnf (float *dest, const float **srcs, int nsrcs, int length)
 {
-	memcpy(dest, src, length * sizeof(float));
+	int i, s;
+	float sum;
+
+	for (i = 0; i < length; i++) {
+		sum = srcs[0][i];
+		for (s = 1; s < nsrcs; s++)
+			sum += srcs[s][i];
+		dest[i] = sum;
+	}
 }
 
-static void
-gen_mixf (float *dest, const float *src, int length)
-{
-	int n;
+#ifdef USE_DYNSIMD
 
-	n = length;
-	while (n--)
-		*dest++ += *src++;
-	/*for (iSample = 0; iSample < iDataLength; iSample++)
-		fpDest[iSample] += fpSrc[iSample];*/
-}
+static void (*opt_mixn) (float *, const float **, int, int) = gen_mixnf;
 
 #ifdef ARCH_X86
 
 void jack_port_set_funcs ()
 {
+#ifdef USE_AVX_KERNELS
+	if (ARCH_X86_HAVE_AVX512(cpu_type)) {
+		opt_mixn = x86_avx512_mixnf;
+	}
+	else if (ARCH_X86_HAVE_AVX2(cpu_type)) {
+		opt_mixn = x86_avx2_mixnf;
+	}
+	else
+#endif /* USE_AVX_KERNELS */
 	if (ARCH_X86_HAVE_SSE2(cpu_type)) {
-		opt_copy = x86_sse_copyf;
-		opt_mix = x86_sse_add2f;
+		opt_mixn = x86_sse_mixnf;
 	}
 	else if (ARCH_X86_HAVE_3DNOW(cpu_type)) {
-		opt_copy = x86_3dnow_copyf;
-		opt_mix = x86_3dnow_add2f;
+		opt_mixn = x86_3dnow_mixnf;
 	}
 	else {
-		opt_copy = gen_copyf;
-		opt_mix = gen_mixf;
+		opt_mixn = gen_mixnf;
 	}
 }
 
+#elif defined(ARCH_ARM_NEON)
+
+void jack_port_set_funcs ()
+{
+	opt_mixn = arm_neon_mixnf;
+}
+
 #else /* ARCH_X86 */
 
 void jack_port_set_funcs ()
 {
-	opt_copy = gen_copyf;
-	opt_mix = gen_mixf;
+	opt_mixn = gen_mixnf;
 }
 
 #endif /* ARCH_X86 */
@@ -151,6 +164,372 @@ jack_port_name_equals (jack_port_shared_t* port, const char* target)
 		strcmp (port->alias2, target) == 0);
 }
 
+/* Port name index.
+ *
+ * An open addressing hash table over every in-use port's name and
+ * aliases, kept in the engine control segment after the ports, so
+ * that jackd and clients can resolve names without scanning all
+ * port_max ports.  Each slot holds the name's hash and which name of
+ * which port it is; a hit is always confirmed against the port
+ * itself.  jackd adds and removes ports, clients change names and
+ * aliases in place, so writers take a spin lock in the segment and
+ * bump seq around every change.  Readers take no lock and retry if
+ * seq moved.
+ *
+ * The lock holds the writer's pid.  A process killed while holding
+ * it would otherwise stop every other writer and reader for good, so
+ * whoever has waited a while checks whether the holder still exists,
+ * and if not takes the lock over and rebuilds the table.  A reader
+ * that finds a live writer taking too long gives up on the table and
+ * falls back to scanning the ports.
+ */
+
+#define JACK_NAME_SLOT_EMPTY	0
+#define JACK_NAME_SLOT_DELETED	(~(uint64_t) 0)
+
+#define JACK_NAME_LOCK_SPINS	1000	/* yields between holder checks */
+#define JACK_NAME_READ_CHECKS	10	/* holder checks before a reader gives up */
+
+static inline uint32_t
+jack_port_name_hash (const char *name)
+{
+	uint32_t h = 2166136261U;	/* FNV-1a */
+
+	for (; *name; name++) {
+		h ^= (uint8_t) *name;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static inline char *
+jack_port_name_field (jack_port_shared_t *port, unsigned int which)
+{
+	switch (which) {
+	case 0:
+		return port->name;
+	case 1:
+		return port->alias1;
+	default:
+		return port->alias2;
+	}
+}
+
+static inline uint64_t
+jack_port_name_slot (uint32_t hash, jack_port_id_t id, unsigned int which)
+{
+	return ((uint64_t) hash << 32) | (((id << 2) | which) + 1);
+}
+
+size_t
+jack_port_name_index_size (uint32_t port_max)
+{
+	uint32_t nslots = 1;
+
+	/* at most three names per port, at most 3/4 full */
+	while (nslots < 4 * port_max) {
+		nslots <<= 1;
+	}
+	return sizeof (jack_port_name_index_t) + 8
+		+ nslots * sizeof (uint64_t);
+}
+
+jack_port_name_index_t *
+jack_port_name_index (jack_control_t *control)
+{
+	uintptr_t addr = (uintptr_t) &control->ports[control->port_max];
+
+	return (jack_port_name_index_t *) ((addr + 7) & ~(uintptr_t) 7);
+}
+
+/* Whether the process holding the lock is gone; `*owner' is set to
+   the holder that was checked. */
+static int
+jack_port_name_index_owner_dead (jack_port_name_index_t *index,
+				 int32_t *owner)
+{
+	*owner = index->lock;
+	return *owner > 0 && kill (*owner, 0) && errno == ESRCH;
+}
+
+static void jack_port_name_index_rebuild (jack_control_t *control);
+
+static void
+jack_port_name_index_lock (jack_control_t *control)
+{
+	jack_port_name_index_t *index = jack_port_name_index (control);
+	int32_t self = getpid ();
+	int32_t owner;
+	unsigned int spins = 0;
+
+	while (!__sync_bool_compare_and_swap (&index->lock, 0, self)) {
+		if (++spins % JACK_NAME_LOCK_SPINS == 0
+		    && jack_port_name_index_owner_dead (index, &owner)
+		    && __sync_bool_compare_and_swap (&index->lock, owner, self)) {
+			break;
+		}
+		sched_yield ();
+	}
+	__sync_synchronize ();
+
+	if (index->seq & 1) {
+		/* the last writer died half way through a change */
+		jack_port_name_index_rebuild (control);
+	} else {
+		index->seq++;
+	}
+	__sync_synchronize ();
+}
+
+static void
+jack_port_name_index_unlock (jack_port_name_index_t *index)
+{
+	__sync_synchronize ();
+	index->seq++;
+	__sync_lock_release (&index->lock);
+}
+
+static void
+jack_port_name_index_insert (jack_control_t *control, jack_port_id_t id,
+			     unsigned int which)
+{
+	jack_port_name_index_t *index = jack_port_name_index (control);
+	const char *name = jack_port_name_field (&control->ports[id], which);
+	uint32_t mask = index->nslots - 1;
+	uint32_t hash, i;
+
+	if (name[0] == '\0') {
+		return;
+	}
+
+	/* deleted slots are only reclaimed by a rebuild */
+	if (index->used >= index->nslots - (index->nslots >> 3)) {
+		jack_port_name_index_rebuild (control);
+	}
+
+	hash = jack_port_name_hash (name);
+	for (i = hash & mask; index->slots[i] != JACK_NAME_SLOT_EMPTY;
+	     i = (i + 1) & mask) {
+		if (index->slots[i] == JACK_NAME_SLOT_DELETED) {
+			index->slots[i] = jack_port_name_slot (hash, id, which);
+			return;
+		}
+	}
+	index->slots[i] = jack_port_name_slot (hash, id, which);
+	index->used++;
+}
+
+static void
+jack_port_name_index_delete (jack_control_t *control, jack_port_id_t id,
+			     unsigned int which)
+{
+	jack_port_name_index_t *index = jack_port_name_index (control);
+	const char *name = jack_port_name_field (&control->ports[id], which);
+	uint32_t mask = index->nslots - 1;
+	uint32_t hash, i, n;
+	uint64_t slot;
+
+	if (name[0] == '\0') {
+		return;
+	}
+
+	hash = jack_port_name_hash (name);
+	slot = jack_port_name_slot (hash, id, which);
+
+	for (i = hash & mask, n = 0;
+	     index->slots[i] != JACK_NAME_SLOT_EMPTY && n < index->nslots;
+	     i = (i + 1) & mask, n++) {
+		if (index->slots[i] == slot) {
+			index->slots[i] = JACK_NAME_SLOT_DELETED;
+			return;
+		}
+	}
+}
+
+static void
+jack_port_name_index_rebuild (jack_control_t *control)
+{
+	jack_port_name_index_t *index = jack_port_name_index (control);
+	jack_port_id_t id;
+	unsigned int which;
+
+	memset ((void *) index->slots, 0, index->nslots * sizeof (uint64_t));
+	index->used = 0;
+
+	for (id = 0; id < control->port_max; id++) {
+		if (control->ports[id].in_use) {
+			for (which = 0; which < 3; which++) {
+				jack_port_name_index_insert (control, id, which);
+			}
+		}
+	}
+}
+
+void
+jack_port_name_index_init (jack_control_t *control)
+{
+	jack_port_name_index_t *index = jack_port_name_index (control);
+
+	index->lock = 0;
+	index->seq = 0;
+	index->nslots = (jack_port_name_index_size (control->port_max)
+			 - sizeof (jack_port_name_index_t) - 8)
+		/ sizeof (uint64_t);
+	index->used = 0;
+	memset ((void *) index->slots, 0, index->nslots * sizeof (uint64_t));
+}
+
+/* Called by jackd once a new port's name (and any alias) is set */
+void
+jack_port_name_index_add (jack_control_t *control, jack_port_id_t id)
+{
+	jack_port_name_index_t *index = jack_port_name_index (control);
+	unsigned int which;
+
+	jack_port_name_index_lock (control);
+	for (which = 0; which < 3; which++) {
+		jack_port_name_index_insert (control, id, which);
+	}
+	jack_port_name_index_unlock (index);
+}
+
+/* Called by jackd before a port's names are cleared */
+void
+jack_port_name_index_remove (jack_control_t *control, jack_port_id_t id)
+{
+	jack_port_name_index_t *index = jack_port_name_index (control);
+	unsigned int which;
+
+	jack_port_name_index_lock (control);
+	for (which = 0; which < 3; which++) {
+		jack_port_name_index_delete (control, id, which);
+	}
+	jack_port_name_index_unlock (index);
+}
+
+/* Wait until no writer is changing the index and return its seq.  A
+ * writer that was killed is taken over; one that is still there is
+ * only waited for so long, after which the odd seq is returned and
+ * the caller must not trust the table.
+ */
+uint32_t
+jack_port_name_index_seq (jack_control_t *control)
+{
+	jack_port_name_index_t *index = jack_port_name_index (control);
+	unsigned int spins = 0;
+	int32_t owner;
+	uint32_t seq;
+
+	while ((seq = index->seq) & 1) {
+		if (++spins % JACK_NAME_LOCK_SPINS == 0) {
+			if (jack_port_name_index_owner_dead (index, &owner)) {
+				jack_port_name_index_lock (control);
+				jack_port_name_index_unlock (index);
+			} else if (spins >= JACK_NAME_LOCK_SPINS * JACK_NAME_READ_CHECKS) {
+				break;
+			}
+		}
+		sched_yield ();
+	}
+	__sync_synchronize ();
+
+	return seq;
+}
+
+/* Returns the id of the in-use port called or aliased `target', or
+ * NO_PORT.
+ */
+jack_port_id_t
+jack_port_name_index_find (jack_control_t *control, const char *target)
+{
+	jack_port_name_index_t *index = jack_port_name_index (control);
+	char buf[JACK_PORT_NAME_SIZE+1];
+	uint32_t mask = index->nslots - 1;
+	uint32_t hash, seq, i, n, ref;
+	jack_port_id_t id;
+	uint64_t slot;
+	const char *name;
+
+	/* see jack_port_name_equals() */
+
+	if (strncmp (target, "ALSA:capture", 12) == 0 || strncmp (target, "ALSA:playback", 13) == 0) {
+		snprintf (buf, sizeof (buf), "alsa_pcm%s", target+4);
+		target = buf;
+	}
+
+	hash = jack_port_name_hash (target);
+
+	for (;;) {
+		if ((seq = jack_port_name_index_seq (control)) & 1) {
+			for (id = 0; id < control->port_max; id++) {
+				if (control->ports[id].in_use
+				    && jack_port_name_equals (&control->ports[id], target)) {
+					return id;
+				}
+			}
+			return NO_PORT;
+		}
+
+		id = NO_PORT;
+
+		for (i = hash & mask, n = 0; n < index->nslots;
+		     i = (i + 1) & mask, n++) {
+
+			slot = index->slots[i];
+
+			if (slot == JACK_NAME_SLOT_EMPTY) {
+				break;
+			}
+			if (slot == JACK_NAME_SLOT_DELETED
+			    || (uint32_t) (slot >> 32) != hash) {
+				continue;
+			}
+
+			ref = (uint32_t) slot - 1;
+			if ((ref >> 2) >= control->port_max) {
+				continue;
+			}
+			name = jack_port_name_field (&control->ports[ref >> 2],
+						     ref & 3);
+			if (control->ports[ref >> 2].in_use
+			    && strncmp (name, target, sizeof (control->ports[0].name)) == 0) {
+				id = ref >> 2;
+				break;
+			}
+		}
+
+		__sync_synchronize ();
+		if (index->seq == seq) {
+			return id;
+		}
+	}
+}
+
+/* Client side changes to a port's name or aliases.  The shared port
+ * lives in the engine control segment this process has mapped.
+ */
+static jack_control_t *
+jack_port_control (jack_port_shared_t *shared)
+{
+	return (jack_control_t *) ((char *) (shared - shared->id)
+				   - offsetof (jack_control_t, ports));
+}
+
+static void
+jack_port_name_change (jack_port_shared_t *shared, unsigned int which,
+		       size_t offset, size_t len, const char *name)
+{
+	jack_control_t *control = jack_port_control (shared);
+	jack_port_name_index_t *index = jack_port_name_index (control);
+
+	jack_port_name_index_lock (control);
+	jack_port_name_index_delete (control, shared->id, which);
+	snprintf (jack_port_name_field (shared, which) + offset, len,
+		  "%s", name);
+	jack_port_name_index_insert (control, shared->id, which);
+	jack_port_name_index_unlock (index);
+}
+
 jack_port_functions_t *
 jack_get_port_functions(jack_port_type_id_t ptid)
 {
@@ -194,6 +573,14 @@ jack_port_new (const jack_client_t *client, jack_port_id_t port_id,
 	pthread_mutex_init (&port->connection_lock, NULL);
 	port->connections = 0;
 	port->tied = NULL;
+	port->sources = NULL;
+	port->source_buffers = NULL;
+	port->source_heap = NULL;
+	port->source_next = NULL;
+	port->nsources = 0;
+	port->cycle = &control->process_cycle;
+	port->mixed_cycle = 0;
+	port->mixed_nframes = 0;
 
 	if (jack_uuid_compare (client->control->uuid, port->shared->client_id) == 0) {
 
@@ -489,20 +876,13 @@ jack_port_by_id (jack_client_t *client, jack_port_id_t id)
 jack_port_t *
 jack_port_by_name_int (jack_client_t *client, const char *port_name)
 {
-	unsigned long i, limit;
-	jack_port_shared_t *port;
-
-	limit = client->engine->port_max;
-	port = &client->engine->ports[0];
+	jack_port_id_t id;
 
-	for (i = 0; i < limit; i++) {
-		if (port[i].in_use && jack_port_name_equals (&port[i], port_name)) {
-			return jack_port_new (client, port[i].id,
-					      client->engine);
-		}
+	if ((id = jack_port_name_index_find (client->engine, port_name)) == NO_PORT) {
+		return NULL;
 	}
 
-	return NULL;
+	return jack_port_new (client, id, client->engine);
 }
 
 jack_port_t *
@@ -560,7 +940,7 @@ jack_port_set_latency (jack_port_t *port, jack_nframes_t nframes)
 void *
 jack_port_get_buffer (jack_port_t *port, jack_nframes_t nframes)
 {
-	JSList *node, *next;
+	jack_port_t *source;
 
 	/* Output port.  The buffer was assigned by the engine
 	   when the port was registered.
@@ -582,7 +962,7 @@ jack_port_get_buffer (jack_port_t *port, jack_nframes_t nframes)
 	   made/broken during this phase (enforced by the jack
 	   server), there is no need to take the connection lock here
 	*/
-	if ((node = port->connections) == NULL) {
+	if (port->nsources == 0) {
 
                 if (port->client_segment_base == NULL || *port->client_segment_base == MAP_FAILED) {
                         return NULL;
@@ -592,28 +972,78 @@ jack_port_get_buffer (jack_port_t *port, jack_nframes_t nframes)
 		return (void *) (*(port->client_segment_base) + port->type_info->zero_buffer_offset);
 	}
 
-	if ((next = jack_slist_next (node)) == NULL) {
+	if (port->nsources == 1) {
 
 		/* one connection: use zero-copy mode - just pass
 		   the buffer of the connected (output) port.
 		*/
-		return jack_port_get_buffer (((jack_port_t *) node->data),
-					     nframes);
+		source = port->sources[0];
+
+                if (source->client_segment_base == NULL || *source->client_segment_base == MAP_FAILED) {
+                        return NULL;
+                }
+
+		return jack_output_port_buffer (source);
 	}
 
 	/* Multiple connections.  Use a local buffer and mix the
 	   incoming data into that buffer.  We have already
 	   established the existence of a mixdown function during the
-	   connection process.
+	   connection process.  The mix is only done once per cycle,
+	   however often the client asks for the buffer.
 	*/
 	if (port->mix_buffer == NULL) {
 		jack_error( "internal jack error: mix_buffer not allocated" );
 		return NULL;
 	}
-	port->fptr.mixdown (port, nframes);
+	if (port->mixed_nframes != nframes || port->mixed_cycle != *port->cycle) {
+		port->fptr.mixdown (port, nframes);
+		port->mixed_cycle = *port->cycle;
+		port->mixed_nframes = nframes;
+	}
 	return (void *) port->mix_buffer;
 }
 
+/* Rebuild the flat array of source ports that jack_port_get_buffer()
+ * and the mixdown functions use in place of port->connections.  The
+ * caller holds port->connection_lock and has just changed the list.
+ */
+int
+jack_port_update_sources (jack_port_t *port)
+{
+	jack_port_t **sources = NULL;
+	jack_port_t **old = port->sources;
+	uint32_t n = jack_slist_length (port->connections);
+	uint32_t i;
+	JSList *node;
+	int ret = 0;
+
+	/* the mixdown scratch arrays share the allocation */
+	if (n && (sources = (jack_port_t **)
+		  malloc (n * (sizeof (jack_port_t *) + sizeof (void *)
+			       + 2 * sizeof (uint32_t)))) == NULL) {
+		jack_error ("cannot allocate source list for port %s",
+			    port->shared->name);
+		n = 0;
+		ret = -1;
+	}
+
+	for (i = 0, node = port->connections; i < n;
+	     node = jack_slist_next (node), ++i) {
+		sources[i] = (jack_port_t *) node->data;
+	}
+
+	port->sources = sources;
+	port->source_buffers = n ? (void **) (sources + n) : NULL;
+	port->source_heap = n ? (uint32_t *) (port->source_buffers + n) : NULL;
+	port->source_next = n ? port->source_heap + n : NULL;
+	port->nsources = n;
+	port->mixed_nframes = 0;
+	free (old);
+
+	return ret;
+}
+
 size_t
 jack_port_type_buffer_size (jack_port_type_info_t* port_type_info, jack_nframes_t nframes)
 {
@@ -808,7 +1238,8 @@ jack_port_set_name (jack_port_t *port, const char *new_name)
 	colon = strchr (port->shared->name, ':');
 	len = sizeof (port->shared->name) -
 		((int) (colon - port->shared->name)) - 2;
-	snprintf (colon+1, len, "%s", new_name);
+	jack_port_name_change (port->shared, 0,
+			       colon + 1 - port->shared->name, len, new_name);
 
 	return 0;
 }
@@ -817,9 +1248,9 @@ int
 jack_port_set_alias (jack_port_t *port, const char *alias)
 {
 	if (port->shared->alias1[0] == '\0') {
-		snprintf (port->shared->alias1, sizeof (port->shared->alias1), "%s", alias);
+		jack_port_name_change (port->shared, 1, 0, sizeof (port->shared->alias1), alias);
 	} else if (port->shared->alias2[0] == '\0') {
-		snprintf (port->shared->alias2, sizeof (port->shared->alias2), "%s", alias);
+		jack_port_name_change (port->shared, 2, 0, sizeof (port->shared->alias2), alias);
 	} else {
 		return -1;
 	}
@@ -831,9 +1262,9 @@ int
 jack_port_unset_alias (jack_port_t *port, const char *alias)
 {
 	if (strcmp (port->shared->alias1, alias) == 0) {
-		port->shared->alias1[0] = '\0';
+		jack_port_name_change (port->shared, 1, 0, sizeof (port->shared->alias1), "");
 	} else if (strcmp (port->shared->alias2, alias) == 0) {
-		port->shared->alias2[0] = '\0';
+		jack_port_name_change (port->shared, 2, 0, sizeof (port->shared->alias2), "");
 	} else {
 		return -1;
 	}
@@ -888,13 +1319,8 @@ static inline float f_max(float x, float a)
 static void
 jack_audio_port_mixdown (jack_port_t *port, jack_nframes_t nframes)
 {
-	JSList *node;
-	jack_port_t *input;
-#ifndef ARCH_X86
-	jack_nframes_t n;
-	jack_default_audio_sample_t *dst, *src;
-#endif
-	jack_default_audio_sample_t *buffer;
+	const float **buffers = (const float **) port->source_buffers;
+	uint32_t i;
 
 	/* by the time we've called this, we've already established
 	   the existence of more than one connection to this input
@@ -907,37 +1333,13 @@ jack_audio_port_mixdown (jack_port_t *port, jack_nframes_t nframes)
 	   during this time.
 	*/
 
-	node = port->connections;
-	input = (jack_port_t *) node->data;
-	buffer = port->mix_buffer;
-
-#ifndef USE_DYNSIMD
-	memcpy (buffer, jack_output_port_buffer (input),
-		sizeof (jack_default_audio_sample_t) * nframes);
-#else /* USE_DYNSIMD */
-	opt_copy (buffer, jack_output_port_buffer (input), nframes);
-#endif /* USE_DYNSIMD */
-
-	for (node = jack_slist_next (node); node;
-	     node = jack_slist_next (node)) {
-
-		input = (jack_port_t *) node->data;
+	for (i = 0; i < port->nsources; i++) {
+		buffers[i] = jack_output_port_buffer (port->sources[i]);
+	}
 
 #ifndef USE_DYNSIMD
-		n = nframes;
-		dst = buffer;
-		src = jack_output_port_buffer (input);
-
-		while (n--) {
-			*dst++ += *src++;
-		}
+	gen_mixnf (port->mix_buffer, buffers, port->nsources, nframes);
 #else /* USE_DYNSIMD */
-		opt_mix (buffer, jack_output_port_buffer (input), nframes);
+	opt_mixn (port->mix_buffer, buffers, port->nsources, nframes);
 #endif /* USE_DYNSIMD */
-	}
 }
-
-
-
-
-
@@ -0,0 +1,400 @@
+/*
+ * portquery.c -- compiled port queries behind jack_get_ports().
+ *
+ *  Patterns are compiled once and kept, either by the application
+ *  (jack_port_query_new()) or in a small per-client cache that
+ *  jack_get_ports() uses.  Patterns that are plain strings, possibly
+ *  anchored with ^ and $, are matched without regexec().  Queries run
+ *  over a per-client list of the ports in use, and remember their
+ *  last answer; both are only recomputed once the port name index
+ *  has changed, which happens whenever a port is registered,
+ *  unregistered, renamed or (un)aliased.
+ */
+
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation; either version 2.1 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <regex.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <config.h>
+
+#include <jack/jack.h>
+
+#include "internal.h"
+#include "local.h"
+
+#define JACK_PORT_QUERY_CACHE	8	/* patterns kept per client */
+
+typedef enum {
+	PatternAny,
+	PatternExact,
+	PatternPrefix,
+	PatternSuffix,
+	PatternSubstring,
+	PatternRegex
+} jack_port_pattern_kind_t;
+
+typedef struct {
+	jack_port_pattern_kind_t kind;
+	char	       *source;		/* as given, for the cache */
+	char	       *literal;
+	size_t		len;
+	regex_t		regex;
+} jack_port_pattern_t;
+
+struct _jack_port_query {
+	struct _jack_port_query *next;	/* in the client's cache */
+	jack_port_pattern_t name;
+	jack_port_pattern_t type;
+	unsigned long	flags;
+
+	/* the last answer, valid while the index seq is unchanged */
+	const jack_control_t *engine;
+	uint32_t	seq;
+	int		valid;
+	jack_port_id_t *ids;
+	uint32_t	nids;
+};
+
+static int
+jack_port_pattern_compile (jack_port_pattern_t *pattern, const char *source)
+{
+	const char *start, *end;
+	size_t len;
+
+	memset (pattern, 0, sizeof (*pattern));
+
+	if (source == NULL || source[0] == '\0') {
+		pattern->kind = PatternAny;
+		return 0;
+	}
+
+	if ((pattern->source = strdup (source)) == NULL) {
+		return -1;
+	}
+
+	/* a plain string, perhaps anchored at either end? */
+
+	start = source + (source[0] == '^');
+	end = source + strlen (source);
+	if (end > start && end[-1] == '$') {
+		end--;
+	}
+	len = end - start;
+
+	if (len && strcspn (start, ".[]()*+?{}|\\^$") >= len) {
+		if ((pattern->literal = strndup (start, len)) == NULL) {
+			free (pattern->source);
+			return -1;
+		}
+		pattern->len = len;
+		if (source[0] == '^') {
+			pattern->kind = (*end == '$') ? PatternExact : PatternPrefix;
+		} else {
+			pattern->kind = (*end == '$') ? PatternSuffix : PatternSubstring;
+		}
+		return 0;
+	}
+
+	if (regcomp (&pattern->regex, source, REG_EXTENDED|REG_NOSUB)) {
+		jack_error ("invalid port pattern \"%s\"", source);
+		free (pattern->source);
+		return -1;
+	}
+	pattern->kind = PatternRegex;
+
+	return 0;
+}
+
+static void
+jack_port_pattern_free (jack_port_pattern_t *pattern)
+{
+	if (pattern->kind == PatternRegex) {
+		regfree (&pattern->regex);
+	}
+	free (pattern->literal);
+	free (pattern->source);
+}
+
+static inline int
+jack_port_pattern_match (const jack_port_pattern_t *pattern, const char *str)
+{
+	size_t len;
+
+	switch (pattern->kind) {
+	case PatternAny:
+		return 1;
+	case PatternExact:
+		return strcmp (str, pattern->literal) == 0;
+	case PatternPrefix:
+		return strncmp (str, pattern->literal, pattern->len) == 0;
+	case PatternSuffix:
+		len = strlen (str);
+		return len >= pattern->len
+			&& memcmp (str + len - pattern->len, pattern->literal,
+				   pattern->len) == 0;
+	case PatternSubstring:
+		return strstr (str, pattern->literal) != NULL;
+	default:
+		return regexec (&pattern->regex, str, 0, NULL, 0) == 0;
+	}
+}
+
+static inline int
+jack_port_pattern_is (const jack_port_pattern_t *pattern, const char *source)
+{
+	if (source == NULL || source[0] == '\0') {
+		return pattern->kind == PatternAny;
+	}
+	return pattern->source && strcmp (pattern->source, source) == 0;
+}
+
+jack_port_query_t *
+jack_port_query_new (const char *port_name_pattern,
+		     const char *type_name_pattern,
+		     unsigned long flags)
+{
+	jack_port_query_t *query;
+
+	if ((query = (jack_port_query_t *) calloc (1, sizeof (*query))) == NULL) {
+		return NULL;
+	}
+
+	if (jack_port_pattern_compile (&query->name, port_name_pattern)) {
+		free (query);
+		return NULL;
+	}
+	if (jack_port_pattern_compile (&query->type, type_name_pattern)) {
+		jack_port_pattern_free (&query->name);
+		free (query);
+		return NULL;
+	}
+	query->flags = flags;
+
+	return query;
+}
+
+void
+jack_port_query_free (jack_port_query_t *query)
+{
+	if (query == NULL) {
+		return;
+	}
+	jack_port_pattern_free (&query->name);
+	jack_port_pattern_free (&query->type);
+	free (query->ids);
+	free (query);
+}
+
+/* Bring the client's list of ports in use up to date.  Returns the
+ * index seq it corresponds to.  The caller holds port_query_lock.
+ */
+static uint32_t
+jack_port_snapshot (jack_client_t *client)
+{
+	jack_control_t *engine = client->engine;
+	jack_port_name_index_t *index = jack_port_name_index (engine);
+	jack_port_id_t i;
+	uint32_t seq;
+
+	seq = jack_port_name_index_seq (engine);
+
+	if (client->port_snapshot_valid && client->port_snapshot_seq == seq) {
+		return seq;
+	}
+
+	if (client->port_snapshot == NULL) {
+		client->port_snapshot = (jack_port_id_t *)
+			malloc (sizeof (jack_port_id_t) * engine->port_max);
+		if (client->port_snapshot == NULL) {
+			client->port_snapshot_cnt = 0;
+			return seq;
+		}
+	}
+
+	client->port_snapshot_cnt = 0;
+	for (i = 0; i < engine->port_max; i++) {
+		if (engine->ports[i].in_use) {
+			client->port_snapshot[client->port_snapshot_cnt++] = i;
+		}
+	}
+
+	/* only trust it if nothing changed while we looked */
+	__sync_synchronize ();
+	client->port_snapshot_seq = seq;
+	client->port_snapshot_valid = !(seq & 1) && index->seq == seq;
+
+	return seq;
+}
+
+static const char **
+jack_port_query_run (jack_client_t *client, jack_port_query_t *query)
+{
+	jack_control_t *engine = client->engine;
+	jack_port_shared_t *psp = engine->ports;
+	char type_match[JACK_MAX_PORT_TYPES];
+	const char **matching_ports;
+	jack_port_type_id_t ptid;
+	jack_port_id_t id;
+	uint32_t seq, n, cnt;
+
+	seq = jack_port_snapshot (client);
+
+	if (!query->valid || query->engine != engine || query->seq != seq
+	    || !client->port_snapshot_valid) {
+
+		if (query->ids == NULL) {
+			query->ids = (jack_port_id_t *)
+				malloc (sizeof (jack_port_id_t) * engine->port_max);
+			if (query->ids == NULL) {
+				return NULL;
+			}
+		}
+
+		for (ptid = 0; ptid < engine->n_port_types; ptid++) {
+			type_match[ptid] = jack_port_pattern_match (
+				&query->type, engine->port_types[ptid].type_name);
+		}
+
+		query->nids = 0;
+		for (n = 0; n < client->port_snapshot_cnt; n++) {
+			id = client->port_snapshot[n];
+			if ((psp[id].flags & query->flags) != query->flags
+			    || psp[id].ptype_id >= engine->n_port_types
+			    || !type_match[psp[id].ptype_id]
+			    || !jack_port_pattern_match (&query->name, psp[id].name)) {
+				continue;
+			}
+			query->ids[query->nids++] = id;
+		}
+
+		query->engine = engine;
+		query->seq = seq;
+		query->valid = client->port_snapshot_valid;
+	}
+
+	if (query->nids == 0) {
+		return NULL;
+	}
+
+	if ((matching_ports = (const char **) malloc (sizeof (char *) * (query->nids + 1))) == NULL) {
+		return NULL;
+	}
+
+	/* a port may be on its way out */
+	for (n = 0, cnt = 0; n < query->nids; n++) {
+		if (psp[query->ids[n]].in_use) {
+			matching_ports[cnt++] = psp[query->ids[n]].name;
+		}
+	}
+
+	if (cnt == 0) {
+		free (matching_ports);
+		return NULL;
+	}
+	matching_ports[cnt] = NULL;
+
+	return matching_ports;
+}
+
+const char **
+jack_port_query_get_ports (jack_client_t *client, jack_port_query_t *query)
+{
+	const char **ports;
+
+	pthread_mutex_lock (&client->port_query_lock);
+	ports = jack_port_query_run (client, query);
+	pthread_mutex_unlock (&client->port_query_lock);
+
+	return ports;
+}
+
+const char **
+jack_get_ports (jack_client_t *client,
+		const char *port_name_pattern,
+		const char *type_name_pattern,
+		unsigned long flags)
+{
+	jack_port_query_t *query, **link;
+	const char **ports = NULL;
+	int n;
+
+	pthread_mutex_lock (&client->port_query_lock);
+
+	/* look for the same query in the cache, dropping the least
+	   recently used one if it is full */
+
+	for (link = &client->port_queries, n = 0; (query = *link) != NULL;
+	     link = &query->next, n++) {
+		if (query->flags == flags
+		    && jack_port_pattern_is (&query->name, port_name_pattern)
+		    && jack_port_pattern_is (&query->type, type_name_pattern)) {
+			*link = query->next;
+			break;
+		}
+		if (n == JACK_PORT_QUERY_CACHE - 1) {
+			*link = NULL;
+			jack_port_query_free (query);
+			query = NULL;
+			break;
+		}
+	}
+
+	if (query == NULL) {
+		query = jack_port_query_new (port_name_pattern,
+					     type_name_pattern, flags);
+	}
+
+	if (query) {
+		query->next = client->port_queries;
+		client->port_queries = query;
+		ports = jack_port_query_run (client, query);
+	}
+
+	pthread_mutex_unlock (&client->port_query_lock);
+
+	return ports;
+}
+
+void
+jack_port_query_init (jack_client_t *client)
+{
+	pthread_mutex_init (&client->port_query_lock, NULL);
+	client->port_queries = NULL;
+	client->port_snapshot = NULL;
+	client->port_snapshot_cnt = 0;
+	client->port_snapshot_seq = 0;
+	client->port_snapshot_valid = 0;
+}
+
+void
+jack_port_query_cleanup (jack_client_t *client)
+{
+	jack_port_query_t *query;
+
+	while ((query = client->port_queries) != NULL) {
+		client->port_queries = query->next;
+		jack_port_query_free (query);
+	}
+	free (client->port_snapshot);
+	client->port_snapshot = NULL;
+	pthread_mutex_destroy (&client->port_query_lock);
+}
@@ -18,17 +18,171 @@
     
   ISO/POSIX C version of Paul Davis's lock free ringbuffer C++ code.
   This is safe for the case of one read thread and one write thread.
+
+  The read and write indices are kept in a private extension of
+  jack_ringbuffer_t, each on a cache line of its own together with
+  what only its side uses, so that the two threads do not keep taking
+  a line away from each other.  They run freely and are only masked
+  when used, are published with release stores and read with acquire
+  loads, and each side keeps the last value it saw of the other's
+  index and only looks again when that is not enough for what it was
+  asked.  Every published index is also stored, masked, in the
+  read_ptr and write_ptr members of jack_ringbuffer_t, for code that
+  looks at those.
 */
 
 #include <config.h>
 
 #include <stdlib.h>
 #include <string.h>
-#ifdef USE_MLOCK
+#include <unistd.h>
 #include <sys/mman.h>
-#endif /* USE_MLOCK */
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
 #include <jack/ringbuffer.h>
 
+#include "internal.h"
+
+#ifdef SYS_memfd_create
+#define JACK_RINGBUFFER_MIRROR 1
+#endif
+
+#define JACK_RINGBUFFER_LINE	64	/* cache line size, or a multiple */
+
+#ifdef __ATOMIC_ACQUIRE
+#define rb_load_acquire(p)	__atomic_load_n ((p), __ATOMIC_ACQUIRE)
+#define rb_load_relaxed(p)	__atomic_load_n ((p), __ATOMIC_RELAXED)
+#define rb_store_release(p,v)	__atomic_store_n ((p), (v), __ATOMIC_RELEASE)
+#define rb_store_relaxed(p,v)	__atomic_store_n ((p), (v), __ATOMIC_RELAXED)
+#else
+static inline size_t
+rb_load_acquire (volatile size_t *p)
+{
+	size_t v = *p;
+	__sync_synchronize ();
+	return v;
+}
+#define rb_load_relaxed(p)	(*(volatile size_t *) (p))
+#define rb_store_release(p,v)	do { __sync_synchronize (); *(p) = (v); } while (0)
+#define rb_store_relaxed(p,v)	(*(volatile size_t *) (p) = (v))
+#endif
+
+typedef struct {
+	jack_ringbuffer_t rb;		/* what callers get, must be first */
+	size_t		map_size;	/* of the mirrored mapping, 0 if none */
+
+	/* the writer's */
+	struct {
+		size_t	write;		/* published */
+		size_t	staged;		/* written but not yet published */
+		size_t	read_cache;	/* the read index as last seen */
+	} w __attribute__ ((aligned (JACK_RINGBUFFER_LINE)));
+
+	/* the reader's */
+	struct {
+		size_t	read;		/* published */
+		size_t	staged;		/* read but not yet released */
+		size_t	write_cache;	/* the write index as last seen */
+	} r __attribute__ ((aligned (JACK_RINGBUFFER_LINE)));
+} jack_ringbuffer_private_t;
+
+#define RB_PRIVATE(rb)	((jack_ringbuffer_private_t *) (rb))
+
+static jack_ringbuffer_private_t *
+jack_ringbuffer_alloc (void)
+{
+	jack_ringbuffer_private_t *p;
+
+#ifdef HAVE_POSIX_MEMALIGN
+	if (posix_memalign ((void **) &p, JACK_RINGBUFFER_LINE, sizeof (*p))) {
+		return NULL;
+	}
+#else
+	if ((p = malloc (sizeof (*p))) == NULL) {
+		return NULL;
+	}
+#endif
+	memset (p, 0, sizeof (*p));
+	return p;
+}
+
+/* Bytes the writer may still stage, looking at the reader's index
+   again only if the last value seen leaves none or less than
+   `want'. */
+
+static inline size_t
+jack_ringbuffer_writable (jack_ringbuffer_private_t *p, size_t want)
+{
+	size_t space = p->rb.size_mask - (p->w.staged - p->w.read_cache);
+
+	if (space < want || space == 0) {
+		p->w.read_cache = rb_load_acquire (&p->r.read);
+		space = p->rb.size_mask - (p->w.staged - p->w.read_cache);
+	}
+	return space;
+}
+
+/* Bytes the reader may still take, likewise. */
+
+static inline size_t
+jack_ringbuffer_readable (jack_ringbuffer_private_t *p, size_t want)
+{
+	size_t space = p->r.write_cache - p->r.staged;
+
+	if (space < want || space == 0) {
+		p->r.write_cache = rb_load_acquire (&p->w.write);
+		space = p->r.write_cache - p->r.staged;
+	}
+	return space;
+}
+
+/* Publish a new write or read index, and mirror it into the public
+   member. */
+
+static inline void
+jack_ringbuffer_publish_write (jack_ringbuffer_private_t *p, size_t w)
+{
+	rb_store_release (&p->w.write, w);
+	rb_store_relaxed (&p->rb.write_ptr, w & p->rb.size_mask);
+}
+
+static inline void
+jack_ringbuffer_publish_read (jack_ringbuffer_private_t *p, size_t r)
+{
+	rb_store_release (&p->r.read, r);
+	rb_store_relaxed (&p->rb.read_ptr, r & p->rb.size_mask);
+}
+
+static inline void
+jack_ringbuffer_copy_in (jack_ringbuffer_private_t *p, size_t pos,
+			 const char *src, size_t cnt)
+{
+	size_t off = pos & p->rb.size_mask;
+	size_t n1 = cnt;
+
+	if (!p->map_size && off + cnt > p->rb.size) {
+		n1 = p->rb.size - off;
+		memcpy (p->rb.buf, src + n1, cnt - n1);
+	}
+	memcpy (&p->rb.buf[off], src, n1);
+}
+
+static inline void
+jack_ringbuffer_copy_out (jack_ringbuffer_private_t *p, size_t pos,
+			  char *dest, size_t cnt)
+{
+	size_t off = pos & p->rb.size_mask;
+	size_t n1 = cnt;
+
+	if (!p->map_size && off + cnt > p->rb.size) {
+		n1 = p->rb.size - off;
+		memcpy (dest + n1, p->rb.buf, cnt - n1);
+	}
+	memcpy (dest, &p->rb.buf[off], n1);
+}
+
+
 /* Create a new ringbuffer to hold at least `sz' bytes of data. The
    actual buffer size is rounded up to the next power of two.  */
 
@@ -36,26 +190,91 @@ jack_ringbuffer_t *
 jack_ringbuffer_create (size_t sz)
 {
 	int power_of_two;
-	jack_ringbuffer_t *rb;
+	jack_ringbuffer_private_t *p;
 	
-	if ((rb = malloc (sizeof (jack_ringbuffer_t))) == NULL) {
+	if ((p = jack_ringbuffer_alloc ()) == NULL) {
 		return NULL;
 	}
 	
 	for (power_of_two = 1; 1 << power_of_two < sz; power_of_two++);
 	
-	rb->size = 1 << power_of_two;
-	rb->size_mask = rb->size;
-	rb->size_mask -= 1;
-	rb->write_ptr = 0;
-	rb->read_ptr = 0;
-	if ((rb->buf = malloc (rb->size)) == NULL) {
-		free (rb);
+	p->rb.size = 1 << power_of_two;
+	p->rb.size_mask = p->rb.size;
+	p->rb.size_mask -= 1;
+	if ((p->rb.buf = malloc (p->rb.size)) == NULL) {
+		free (p);
 		return NULL;
 	}
-	rb->mlocked = 0;
 	
-	return rb;
+	return &p->rb;
+}
+
+/* Like jack_ringbuffer_create(), but with the buffer mapped twice in
+   a row, so that the window functions always return all there is as
+   one piece and nothing is ever copied in two parts.  The size is
+   also rounded up to the page size.  Where that mapping cannot be
+   made this returns an ordinary ringbuffer, which
+   jack_ringbuffer_mirrored() tells apart. */
+
+jack_ringbuffer_t *
+jack_ringbuffer_create_mirrored (size_t sz)
+{
+#ifdef JACK_RINGBUFFER_MIRROR
+	jack_ringbuffer_private_t *p;
+	size_t size, page = sysconf (_SC_PAGESIZE);
+	char *addr;
+	int fd;
+
+	for (size = page; size < sz; size <<= 1);
+
+	if ((fd = syscall (SYS_memfd_create, "jack-ringbuffer", 0)) < 0) {
+		goto ordinary;
+	}
+	if (ftruncate (fd, size)) {
+		close (fd);
+		goto ordinary;
+	}
+
+	/* reserve both halves, then put the same pages in each */
+
+	addr = mmap (NULL, 2 * size, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) {
+		close (fd);
+		goto ordinary;
+	}
+	if (mmap (addr, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED,
+		  fd, 0) == MAP_FAILED
+	    || mmap (addr + size, size, PROT_READ|PROT_WRITE,
+		     MAP_SHARED|MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap (addr, 2 * size);
+		close (fd);
+		goto ordinary;
+	}
+	close (fd);
+
+	if ((p = jack_ringbuffer_alloc ()) == NULL) {
+		munmap (addr, 2 * size);
+		return NULL;
+	}
+	p->rb.buf = addr;
+	p->rb.size = size;
+	p->rb.size_mask = size - 1;
+	p->map_size = 2 * size;
+
+	return &p->rb;
+
+  ordinary:
+#endif /* JACK_RINGBUFFER_MIRROR */
+	return jack_ringbuffer_create (sz);
+}
+
+/* Whether `rb' came from jack_ringbuffer_create_mirrored() and got
+   its mirrored mapping. */
+
+int
+jack_ringbuffer_mirrored (const jack_ringbuffer_t * rb)
+{
+	return RB_PRIVATE (rb)->map_size != 0;
 }
 
 /* Free all data associated with the ringbuffer `rb'. */
@@ -63,13 +282,19 @@ jack_ringbuffer_create (size_t sz)
 void
 jack_ringbuffer_free (jack_ringbuffer_t * rb)
 {
+	jack_ringbuffer_private_t *p = RB_PRIVATE (rb);
+
+	if (p->map_size) {
+		munmap (rb->buf, p->map_size);
+	} else {
 #ifdef USE_MLOCK
-	if (rb->mlocked) {
-		munlock (rb->buf, rb->size);
-	}
+		if (rb->mlocked) {
+			munlock (rb->buf, rb->size);
+		}
 #endif /* USE_MLOCK */
-	free (rb->buf);
-	free (rb);
+		free (rb->buf);
+	}
+	free (p);
 }
 
 /* Lock the data block of `rb' using the system call 'mlock'.  */
@@ -92,6 +317,10 @@ jack_ringbuffer_mlock (jack_ringbuffer_t * rb)
 void
 jack_ringbuffer_reset (jack_ringbuffer_t * rb)
 {
+	jack_ringbuffer_private_t *p = RB_PRIVATE (rb);
+
+	p->w.write = p->w.staged = p->w.read_cache = 0;
+	p->r.read = p->r.staged = p->r.write_cache = 0;
 	rb->read_ptr = 0;
 	rb->write_ptr = 0;
 }
@@ -103,16 +332,9 @@ jack_ringbuffer_reset (jack_ringbuffer_t * rb)
 size_t
 jack_ringbuffer_read_space (const jack_ringbuffer_t * rb)
 {
-	size_t w, r;
-	
-	w = rb->write_ptr;
-	r = rb->read_ptr;
-	
-	if (w > r) {
-		return w - r;
-	} else {
-		return (w - r + rb->size) & rb->size_mask;
-	}
+	jack_ringbuffer_private_t *p = RB_PRIVATE (rb);
+
+	return rb_load_acquire (&p->w.write) - rb_load_relaxed (&p->r.staged);
 }
 
 /* Return the number of bytes available for writing.  This is the
@@ -122,53 +344,57 @@ jack_ringbuffer_read_space (const jack_ringbuffer_t * rb)
 size_t
 jack_ringbuffer_write_space (const jack_ringbuffer_t * rb)
 {
-	size_t w, r;
-
-	w = rb->write_ptr;
-	r = rb->read_ptr;
+	jack_ringbuffer_private_t *p = RB_PRIVATE (rb);
 
-	if (w > r) {
-		return ((r - w + rb->size) & rb->size_mask) - 1;
-	} else if (w < r) {
-		return (r - w) - 1;
-	} else {
-		return rb->size - 1;
-	}
+	return rb->size_mask
+		- (rb_load_relaxed (&p->w.staged) - rb_load_acquire (&p->r.read));
 }
 
-/* The copying data reader.  Copy at most `cnt' bytes from `rb' to
-   `dest'.  Returns the actual number of bytes copied. */
+/* Copy at most `cnt' bytes from `rb' to `dest', without making the
+   space they took available to the writer yet; see
+   jack_ringbuffer_read_commit().  Returns the number of bytes
+   copied. */
 
 size_t
-jack_ringbuffer_read (jack_ringbuffer_t * rb, char *dest, size_t cnt)
+jack_ringbuffer_read_stage (jack_ringbuffer_t * rb, char *dest, size_t cnt)
 {
+	jack_ringbuffer_private_t *p = RB_PRIVATE (rb);
 	size_t free_cnt;
-	size_t cnt2;
-	size_t to_read;
-	size_t n1, n2;
 
-	if ((free_cnt = jack_ringbuffer_read_space (rb)) == 0) {
+	if ((free_cnt = jack_ringbuffer_readable (p, cnt)) == 0) {
 		return 0;
 	}
+	if (cnt > free_cnt) {
+		cnt = free_cnt;
+	}
 
-	to_read = cnt > free_cnt ? free_cnt : cnt;
+	jack_ringbuffer_copy_out (p, p->r.staged, dest, cnt);
+	p->r.staged += cnt;
 
-	cnt2 = rb->read_ptr + to_read;
+	return cnt;
+}
 
-	if (cnt2 > rb->size) {
-		n1 = rb->size - rb->read_ptr;
-		n2 = cnt2 & rb->size_mask;
-	} else {
-		n1 = to_read;
-		n2 = 0;
-	}
+/* Give the space of everything read since the last commit back to
+   the writer. */
+
+void
+jack_ringbuffer_read_commit (jack_ringbuffer_t * rb)
+{
+	jack_ringbuffer_private_t *p = RB_PRIVATE (rb);
+
+	jack_ringbuffer_publish_read (p, p->r.staged);
+}
 
-	memcpy (dest, &(rb->buf[rb->read_ptr]), n1);
-	rb->read_ptr = (rb->read_ptr + n1) & rb->size_mask;
+/* The copying data reader.  Copy at most `cnt' bytes from `rb' to
+   `dest'.  Returns the actual number of bytes copied. */
+
+size_t
+jack_ringbuffer_read (jack_ringbuffer_t * rb, char *dest, size_t cnt)
+{
+	size_t to_read;
 
-	if (n2) {
-		memcpy (dest + n1, &(rb->buf[rb->read_ptr]), n2);
-		rb->read_ptr = (rb->read_ptr + n2) & rb->size_mask;
+	if ((to_read = jack_ringbuffer_read_stage (rb, dest, cnt))) {
+		jack_ringbuffer_read_commit (rb);
 	}
 
 	return to_read;
@@ -181,40 +407,55 @@ jack_ringbuffer_read (jack_ringbuffer_t * rb, char *dest, size_t cnt)
 size_t
 jack_ringbuffer_peek (jack_ringbuffer_t * rb, char *dest, size_t cnt)
 {
+	jack_ringbuffer_private_t *p = RB_PRIVATE (rb);
 	size_t free_cnt;
-	size_t cnt2;
-	size_t to_read;
-	size_t n1, n2;
-	size_t tmp_read_ptr;
-
-	tmp_read_ptr = rb->read_ptr;
 
-	if ((free_cnt = jack_ringbuffer_read_space (rb)) == 0) {
+	if ((free_cnt = jack_ringbuffer_readable (p, cnt)) == 0) {
 		return 0;
 	}
+	if (cnt > free_cnt) {
+		cnt = free_cnt;
+	}
 
-	to_read = cnt > free_cnt ? free_cnt : cnt;
+	jack_ringbuffer_copy_out (p, p->r.staged, dest, cnt);
 
-	cnt2 = tmp_read_ptr + to_read;
+	return cnt;
+}
 
-	if (cnt2 > rb->size) {
-		n1 = rb->size - tmp_read_ptr;
-		n2 = cnt2 & rb->size_mask;
-	} else {
-		n1 = to_read;
-		n2 = 0;
-	}
+/* Copy at most `cnt' bytes to `rb' from `src', without letting the
+   reader see them yet; see jack_ringbuffer_write_commit().  Returns
+   the number of bytes copied. */
 
-	memcpy (dest, &(rb->buf[tmp_read_ptr]), n1);
-	tmp_read_ptr = (tmp_read_ptr + n1) & rb->size_mask;
+size_t
+jack_ringbuffer_write_stage (jack_ringbuffer_t * rb, const char *src,
+			     size_t cnt)
+{
+	jack_ringbuffer_private_t *p = RB_PRIVATE (rb);
+	size_t free_cnt;
 
-	if (n2) {
-		memcpy (dest + n1, &(rb->buf[tmp_read_ptr]), n2);
+	if ((free_cnt = jack_ringbuffer_writable (p, cnt)) == 0) {
+		return 0;
+	}
+	if (cnt > free_cnt) {
+		cnt = free_cnt;
 	}
 
-	return to_read;
+	jack_ringbuffer_copy_in (p, p->w.staged, src, cnt);
+	p->w.staged += cnt;
+
+	return cnt;
 }
 
+/* Let the reader see everything written since the last commit, all
+   at once. */
+
+void
+jack_ringbuffer_write_commit (jack_ringbuffer_t * rb)
+{
+	jack_ringbuffer_private_t *p = RB_PRIVATE (rb);
+
+	jack_ringbuffer_publish_write (p, p->w.staged);
+}
 
 /* The copying data writer.  Copy at most `cnt' bytes to `rb' from
    `src'.  Returns the actual number of bytes copied. */
@@ -222,33 +463,10 @@ jack_ringbuffer_peek (jack_ringbuffer_t * rb, char *dest, size_t cnt)
 size_t
 jack_ringbuffer_write (jack_ringbuffer_t * rb, const char *src, size_t cnt)
 {
-	size_t free_cnt;
-	size_t cnt2;
 	size_t to_write;
-	size_t n1, n2;
-
-	if ((free_cnt = jack_ringbuffer_write_space (rb)) == 0) {
-		return 0;
-	}
-
-	to_write = cnt > free_cnt ? free_cnt : cnt;
-
-	cnt2 = rb->write_ptr + to_write;
-
-	if (cnt2 > rb->size) {
-		n1 = rb->size - rb->write_ptr;
-		n2 = cnt2 & rb->size_mask;
-	} else {
-		n1 = to_write;
-		n2 = 0;
-	}
-
-	memcpy (&(rb->buf[rb->write_ptr]), src, n1);
-	rb->write_ptr = (rb->write_ptr + n1) & rb->size_mask;
 
-	if (n2) {
-		memcpy (&(rb->buf[rb->write_ptr]), src + n1, n2);
-		rb->write_ptr = (rb->write_ptr + n2) & rb->size_mask;
+	if ((to_write = jack_ringbuffer_write_stage (rb, src, cnt))) {
+		jack_ringbuffer_write_commit (rb);
 	}
 
 	return to_write;
@@ -259,8 +477,10 @@ jack_ringbuffer_write (jack_ringbuffer_t * rb, const char *src, size_t cnt)
 void
 jack_ringbuffer_read_advance (jack_ringbuffer_t * rb, size_t cnt)
 {
-	size_t tmp = (rb->read_ptr + cnt) & rb->size_mask;
-	rb->read_ptr = tmp;
+	jack_ringbuffer_private_t *p = RB_PRIVATE (rb);
+
+	p->r.staged += cnt;
+	jack_ringbuffer_publish_read (p, p->r.staged);
 }
 
 /* Advance the write pointer `cnt' places. */
@@ -268,8 +488,50 @@ jack_ringbuffer_read_advance (jack_ringbuffer_t * rb, size_t cnt)
 void
 jack_ringbuffer_write_advance (jack_ringbuffer_t * rb, size_t cnt)
 {
-	size_t tmp = (rb->write_ptr + cnt) & rb->size_mask;
-	rb->write_ptr = tmp;
+	jack_ringbuffer_private_t *p = RB_PRIVATE (rb);
+
+	p->w.staged += cnt;
+	jack_ringbuffer_publish_write (p, p->w.staged);
+}
+
+/* The zero-copy reader: return where the readable data starts and
+   set `*len' to how much of it is contiguous there, which is all of
+   it for a mirrored ringbuffer.  The write index is only looked at
+   again if less than `want' bytes, or none, were known to be
+   readable.  Use
+   jack_ringbuffer_read_advance() when done. */
+
+char *
+jack_ringbuffer_read_window (jack_ringbuffer_t * rb, size_t want, size_t *len)
+{
+	jack_ringbuffer_private_t *p = RB_PRIVATE (rb);
+	size_t off = p->r.staged & rb->size_mask;
+	size_t cnt = jack_ringbuffer_readable (p, want);
+
+	if (!p->map_size && off + cnt > rb->size) {
+		cnt = rb->size - off;
+	}
+	*len = cnt;
+
+	return &rb->buf[off];
+}
+
+/* The zero-copy writer, likewise; use jack_ringbuffer_write_advance()
+   to publish what was written. */
+
+char *
+jack_ringbuffer_write_window (jack_ringbuffer_t * rb, size_t want, size_t *len)
+{
+	jack_ringbuffer_private_t *p = RB_PRIVATE (rb);
+	size_t off = p->w.staged & rb->size_mask;
+	size_t cnt = jack_ringbuffer_writable (p, want);
+
+	if (!p->map_size && off + cnt > rb->size) {
+		cnt = rb->size - off;
+	}
+	*len = cnt;
+
+	return &rb->buf[off];
 }
 
 /* The non-copying data reader.  `vec' is an array of two places.  Set
@@ -281,22 +543,18 @@ void
 jack_ringbuffer_get_read_vector (const jack_ringbuffer_t * rb,
 				 jack_ringbuffer_data_t * vec)
 {
+	jack_ringbuffer_private_t *p = RB_PRIVATE (rb);
 	size_t free_cnt;
 	size_t cnt2;
-	size_t w, r;
+	size_t r;
 
-	w = rb->write_ptr;
-	r = rb->read_ptr;
-
-	if (w > r) {
-		free_cnt = w - r;
-	} else {
-		free_cnt = (w - r + rb->size) & rb->size_mask;
-	}
+	r = rb_load_relaxed (&p->r.staged);
+	free_cnt = rb_load_acquire (&p->w.write) - r;
+	r &= rb->size_mask;
 
 	cnt2 = r + free_cnt;
 
-	if (cnt2 > rb->size) {
+	if (cnt2 > rb->size && !p->map_size) {
 
 		/* Two part vector: the rest of the buffer after the current write
 		   ptr, plus some from the start of the buffer. */
@@ -325,24 +583,18 @@ void
 jack_ringbuffer_get_write_vector (const jack_ringbuffer_t * rb,
 				  jack_ringbuffer_data_t * vec)
 {
+	jack_ringbuffer_private_t *p = RB_PRIVATE (rb);
 	size_t free_cnt;
 	size_t cnt2;
-	size_t w, r;
-
-	w = rb->write_ptr;
-	r = rb->read_ptr;
+	size_t w;
 
-	if (w > r) {
-		free_cnt = ((r - w + rb->size) & rb->size_mask) - 1;
-	} else if (w < r) {
-		free_cnt = (r - w) - 1;
-	} else {
-		free_cnt = rb->size - 1;
-	}
+	w = rb_load_relaxed (&p->w.staged);
+	free_cnt = rb->size_mask - (w - rb_load_acquire (&p->r.read));
+	w &= rb->size_mask;
 
 	cnt2 = w + free_cnt;
 
-	if (cnt2 > rb->size) {
+	if (cnt2 > rb->size && !p->map_size) {
 
 		/* Two part vector: the rest of the buffer after the current write
 		   ptr, plus some from the start of the buffer. */
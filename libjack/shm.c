@@ -46,6 +46,10 @@
 #include <sys/shm.h>
 #include <sys/sem.h>
 #include <sysdeps/ipc.h>
+#ifdef __linux__
+#include <mntent.h>
+#include <sys/vfs.h>
+#endif
 
 #include "shm.h"
 #include "internal.h"
@@ -85,6 +89,13 @@ static jack_shm_header_t   *jack_shm_header = NULL;
 static jack_shm_registry_t *jack_shm_registry = NULL;
 static char jack_shm_server_prefix[JACK_SERVER_NAME_SIZE] = "";
 
+/* huge page backing, see jack_shm_use_hugepages() */
+static jack_shmsize_t jack_hugepage_size = 0;	/* 0 when not in use */
+static char jack_hugetlb_dir[PATH_MAX+1] = "";
+static char jack_shm_huge[MAX_SHM_ID];		/* what we allocated huge */
+
+#define JACK_HUGETLBFS_MAGIC 0x958458f6		/* from linux/magic.h */
+
 /* jack_shm_lock_registry() serializes updates to the shared memory
  * segment JACK uses to keep track of the SHM segements allocated to
  * all its processes, including multiple servers.
@@ -539,16 +550,112 @@ jack_cleanup_shm ()
 int
 jack_resize_shm (jack_shm_info_t* si, jack_shmsize_t size)
 {
+	int huge = jack_shm_huge[si->index];
+
 	jack_release_shm (si);
 	jack_destroy_shm (si);
 
-	if (jack_shmalloc (size, si)) {
+	if ((huge ? jack_shmalloc_huge (size, si) : jack_shmalloc (size, si))) {
 		return -1;
 	}
 
 	return jack_attach_shm (si);
 }
 
+/* Back the segments allocated with jack_shmalloc_huge() by huge
+ * pages.  With POSIX shm they are created as files in a hugetlbfs
+ * `mount' (the first one in /proc/mounts if NULL or empty), which
+ * clients open by path; with System V shm they are allocated with
+ * SHM_HUGETLB.
+ *
+ * returns 0 if huge pages can be used, -1 otherwise
+ */
+int
+jack_shm_use_hugepages (const char *mount)
+{
+#ifdef __linux__
+#ifdef USE_POSIX_SHM
+	struct statfs sfs;
+	struct mntent *ent;
+	FILE *mounts;
+
+	jack_hugetlb_dir[0] = '\0';
+
+	if (mount && mount[0]) {
+		snprintf (jack_hugetlb_dir, sizeof (jack_hugetlb_dir),
+			  "%s", mount);
+	} else if ((mounts = setmntent ("/proc/mounts", "r")) != NULL) {
+		while ((ent = getmntent (mounts)) != NULL) {
+			if (strcmp (ent->mnt_type, "hugetlbfs") == 0) {
+				snprintf (jack_hugetlb_dir,
+					  sizeof (jack_hugetlb_dir),
+					  "%s", ent->mnt_dir);
+				break;
+			}
+		}
+		endmntent (mounts);
+	}
+
+	if (jack_hugetlb_dir[0] == '\0') {
+		jack_error ("no hugetlbfs mount found for huge page "
+			    "shared memory");
+		return -1;
+	}
+
+	if (statfs (jack_hugetlb_dir, &sfs) < 0) {
+		jack_error ("cannot stat hugetlbfs mount %s (%s)",
+			    jack_hugetlb_dir, strerror (errno));
+		return -1;
+	}
+
+	if (sfs.f_type != JACK_HUGETLBFS_MAGIC) {
+		jack_error ("%s is not a hugetlbfs mount", jack_hugetlb_dir);
+		return -1;
+	}
+
+	jack_hugepage_size = sfs.f_bsize;
+#else
+	char line[128];
+	unsigned long kb;
+	FILE *meminfo;
+
+	if ((meminfo = fopen ("/proc/meminfo", "r")) == NULL) {
+		jack_error ("cannot read /proc/meminfo (%s)", strerror (errno));
+		return -1;
+	}
+	while (fgets (line, sizeof (line), meminfo)) {
+		if (sscanf (line, "Hugepagesize: %lu kB", &kb) == 1) {
+			jack_hugepage_size = kb * 1024;
+			break;
+		}
+	}
+	fclose (meminfo);
+
+	if (jack_hugepage_size == 0) {
+		jack_error ("this kernel does not support huge pages");
+		return -1;
+	}
+#endif /* USE_POSIX_SHM */
+	return 0;
+#else
+	jack_error ("huge page shared memory is not supported "
+		    "on this platform");
+	return -1;
+#endif /* __linux__ */
+}
+
+jack_shmsize_t
+jack_shm_hugepage_size (void)
+{
+	return jack_hugepage_size;
+}
+
+static inline jack_shmsize_t
+jack_hugepage_round (jack_shmsize_t size)
+{
+	return (size + jack_hugepage_size - 1) & ~(jack_hugepage_size - 1);
+}
+
 #ifdef USE_POSIX_SHM
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
@@ -653,6 +760,24 @@ jack_create_registry (jack_shm_info_t *ri)
 	return 0;
 }
 
+/* Segments normally live in the POSIX shm namespace ("/jack-N"),
+ * huge page backed ones are files in a hugetlbfs mount.
+ */
+static inline int
+jack_shm_is_file (const char *id)
+{
+	return strchr (id + 1, '/') != NULL;
+}
+
+static inline int
+jack_shm_open (const char *id, int flags)
+{
+	if (jack_shm_is_file (id)) {
+		return open (id, flags, 0666);
+	}
+	return shm_open (id, flags, 0666);
+}
+
 static void
 jack_remove_shm (jack_shm_id_t *id)
 {
@@ -662,7 +787,11 @@ jack_remove_shm (jack_shm_id_t *id)
 	   XXX it would be good to differentiate between these
 	   two conditions.
 	*/
-	shm_unlink ((char *) id);
+	if (jack_shm_is_file ((char *) id)) {
+		unlink ((char *) id);
+	} else {
+		shm_unlink ((char *) id);
+	}
 }
 
 void
@@ -724,6 +853,7 @@ jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
 	registry->allocator = getpid();
 	si->index = registry->index;
 	si->attached_at = MAP_FAILED;	/* not attached */
+	jack_shm_huge[si->index] = 0;
 	rc = 0;				/* success */
 
  unlock:
@@ -731,14 +861,82 @@ jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
 	return rc;
 }
 
+/* allocate a segment in the hugetlbfs mount, falling back to
+ * jack_shmalloc() if there are not enough huge pages */
+int
+jack_shmalloc_huge (jack_shmsize_t size, jack_shm_info_t* si)
+{
+	jack_shm_registry_t* registry;
+	int shm_fd;
+	void *addr;
+	char name[PATH_MAX+1];
+
+	if (jack_hugepage_size == 0) {
+		return jack_shmalloc (size, si);
+	}
+
+	size = jack_hugepage_round (size);
+
+	jack_shm_lock_registry ();
+
+	if ((registry = jack_get_free_shm_info ()) == NULL) {
+		jack_error ("shm registry full");
+		jack_shm_unlock_registry ();
+		return -1;
+	}
+
+	snprintf (name, sizeof (name), "%s/jack-%d", jack_hugetlb_dir,
+		  registry->index);
+
+	if (strlen (name) >= sizeof (registry->id)) {
+		jack_error ("shm segment name too long %s", name);
+		goto fallback;
+	}
+
+	if ((shm_fd = open (name, O_RDWR|O_CREAT, 0666)) < 0) {
+		jack_error ("cannot create huge page segment %s (%s)",
+			    name, strerror (errno));
+		goto fallback;
+	}
+
+	/* hugetlbfs reserves the pages of a shared file mapping when
+	 * it is first mapped, so find out now whether there are
+	 * enough rather than when a client attaches.
+	 */
+	if (ftruncate (shm_fd, size) < 0
+	    || (addr = mmap (0, size, PROT_READ|PROT_WRITE, MAP_SHARED,
+			     shm_fd, 0)) == MAP_FAILED) {
+		jack_error ("cannot get %d bytes of huge pages "
+			    "(%s), using normal pages", size, strerror (errno));
+		close (shm_fd);
+		unlink (name);
+		goto fallback;
+	}
+	munmap (addr, size);
+	close (shm_fd);
+
+	registry->size = size;
+	strncpy (registry->id, name, sizeof (registry->id));
+	registry->allocator = getpid();
+	si->index = registry->index;
+	si->attached_at = MAP_FAILED;	/* not attached */
+	jack_shm_huge[si->index] = 1;
+
+	jack_shm_unlock_registry ();
+	return 0;
+
+ fallback:
+	jack_shm_unlock_registry ();
+	return jack_shmalloc (size, si);
+}
+
 int
 jack_attach_shm (jack_shm_info_t* si)
 {
 	int shm_fd;
 	jack_shm_registry_t *registry = &jack_shm_registry[si->index];
 
-	if ((shm_fd = shm_open (registry->id,
-				O_RDWR, 0666)) < 0) {
+	if ((shm_fd = jack_shm_open (registry->id, O_RDWR)) < 0) {
 		jack_error ("cannot open shm segment %s (%s)", registry->id,
 			    strerror (errno));
 		return -1;
@@ -891,6 +1089,7 @@ jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
 			registry->allocator = getpid();
 			si->index = registry->index;
 			si->attached_at = MAP_FAILED; /* not attached */
+			jack_shm_huge[si->index] = 0;
 			rc = 0;
 
 		} else {
@@ -904,6 +1103,51 @@ jack_shmalloc (jack_shmsize_t size, jack_shm_info_t* si)
 	return rc;
 }
 
+/* allocate a SHM_HUGETLB segment, falling back to jack_shmalloc() if
+ * there are not enough huge pages */
+int
+jack_shmalloc_huge (jack_shmsize_t size, jack_shm_info_t* si)
+{
+#ifdef SHM_HUGETLB
+	int shmid;
+	jack_shm_registry_t* registry;
+
+	if (jack_hugepage_size == 0) {
+		return jack_shmalloc (size, si);
+	}
+
+	size = jack_hugepage_round (size);
+
+	jack_shm_lock_registry ();
+
+	if ((registry = jack_get_free_shm_info ()) == NULL) {
+		jack_error ("shm registry full");
+		jack_shm_unlock_registry ();
+		return -1;
+	}
+
+	if ((shmid = shmget (IPC_PRIVATE, size, 0666 | IPC_CREAT | IPC_EXCL
+			     | SHM_HUGETLB)) < 0) {
+		jack_error ("cannot get %d bytes of huge pages (%s), "
+			    "using normal pages", size, strerror (errno));
+		jack_shm_unlock_registry ();
+		return jack_shmalloc (size, si);
+	}
+
+	registry->size = size;
+	registry->id = shmid;
+	registry->allocator = getpid();
+	si->index = registry->index;
+	si->attached_at = MAP_FAILED; /* not attached */
+	jack_shm_huge[si->index] = 1;
+
+	jack_shm_unlock_registry ();
+	return 0;
+#else
+	return jack_shmalloc (size, si);
+#endif /* SHM_HUGETLB */
+}
+
 int
 jack_attach_shm (jack_shm_info_t* si)
 {
@@ -26,6 +26,11 @@
 
 #ifdef ARCH_X86
 
+#include <xmmintrin.h>
+#ifdef USE_AVX_KERNELS
+#include <immintrin.h>
+#endif /* USE_AVX_KERNELS */
+
 int
 have_3dnow ()
 {
@@ -206,7 +211,7 @@ x86_3dnow_add2f (float *dest, const float *src, int length)
 			  "m" (m64p_src[i])
 			: "mm0", "memory");
 	}
-	if (n & 0x1)
+	if (length & 0x1)
 	{
 		asm volatile (
 			"movd %1, %%mm0\n\t" \
@@ -223,6 +228,19 @@ x86_3dnow_add2f (float *dest, const float *src, int length)
 		"sfence\n\t");
 }
 
+/* 3DNow! has no N-way mix: copy the first source, then add the
+ * others one at a time, in the same order as the other mixes. */
+
+void
+x86_3dnow_mixnf (float *dest, const float **srcs, int nsrcs, int length)
+{
+	int s;
+
+	x86_3dnow_copyf (dest, srcs[0], length);
+	for (s = 1; s < nsrcs; s++)
+		x86_3dnow_add2f (dest, srcs[s], length);
+}
+
 void
 x86_sse_copyf (float *dest, const float *src, int length)
 {
@@ -423,7 +441,328 @@ sse_nonalign:
 	}
 }
 
+/* The N-way mixes below write the sum of `nsrcs' (at least one)
+ * buffers to dest in a single pass, keeping the partial sums in
+ * registers instead of going back to memory once per source.
+ */
+
+void
+x86_sse_mixnf (float *dest, const float **srcs, int nsrcs, int length)
+{
+	int i, s;
+	__m128 a0, a1, a2, a3;
+	float sum;
+
+	for (i = 0; i + 16 <= length; i += 16)
+	{
+		a0 = _mm_loadu_ps (srcs[0] + i);
+		a1 = _mm_loadu_ps (srcs[0] + i + 4);
+		a2 = _mm_loadu_ps (srcs[0] + i + 8);
+		a3 = _mm_loadu_ps (srcs[0] + i + 12);
+		for (s = 1; s < nsrcs; s++)
+		{
+			a0 = _mm_add_ps (a0, _mm_loadu_ps (srcs[s] + i));
+			a1 = _mm_add_ps (a1, _mm_loadu_ps (srcs[s] + i + 4));
+			a2 = _mm_add_ps (a2, _mm_loadu_ps (srcs[s] + i + 8));
+			a3 = _mm_add_ps (a3, _mm_loadu_ps (srcs[s] + i + 12));
+		}
+		_mm_storeu_ps (dest + i, a0);
+		_mm_storeu_ps (dest + i + 4, a1);
+		_mm_storeu_ps (dest + i + 8, a2);
+		_mm_storeu_ps (dest + i + 12, a3);
+	}
+	for (; i < length; i++)
+	{
+		sum = srcs[0][i];
+		for (s = 1; s < nsrcs; s++)
+			sum += srcs[s][i];
+		dest[i] = sum;
+	}
+}
+
+#ifdef USE_AVX_KERNELS
+
+int
+have_avx ()
+{
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("avx512f"))
+		return 2;
+	if (__builtin_cpu_supports ("avx2"))
+		return 1;
+	return 0;
+}
+
+__attribute__((target("avx2"))) void
+x86_avx2_copyf (float *dest, const float *src, int length)
+{
+	int i;
+
+	for (i = 0; i + 32 <= length; i += 32)
+	{
+		__m256 a0 = _mm256_loadu_ps (src + i);
+		__m256 a1 = _mm256_loadu_ps (src + i + 8);
+		__m256 a2 = _mm256_loadu_ps (src + i + 16);
+		__m256 a3 = _mm256_loadu_ps (src + i + 24);
+		_mm256_storeu_ps (dest + i, a0);
+		_mm256_storeu_ps (dest + i + 8, a1);
+		_mm256_storeu_ps (dest + i + 16, a2);
+		_mm256_storeu_ps (dest + i + 24, a3);
+	}
+	for (; i + 8 <= length; i += 8)
+		_mm256_storeu_ps (dest + i, _mm256_loadu_ps (src + i));
+	for (; i < length; i++)
+		dest[i] = src[i];
+}
+
+__attribute__((target("avx2"))) void
+x86_avx2_add2f (float *dest, const float *src, int length)
+{
+	int i;
+
+	for (i = 0; i + 32 <= length; i += 32)
+	{
+		__m256 a0 = _mm256_add_ps (_mm256_loadu_ps (dest + i),
+					   _mm256_loadu_ps (src + i));
+		__m256 a1 = _mm256_add_ps (_mm256_loadu_ps (dest + i + 8),
+					   _mm256_loadu_ps (src + i + 8));
+		__m256 a2 = _mm256_add_ps (_mm256_loadu_ps (dest + i + 16),
+					   _mm256_loadu_ps (src + i + 16));
+		__m256 a3 = _mm256_add_ps (_mm256_loadu_ps (dest + i + 24),
+					   _mm256_loadu_ps (src + i + 24));
+		_mm256_storeu_ps (dest + i, a0);
+		_mm256_storeu_ps (dest + i + 8, a1);
+		_mm256_storeu_ps (dest + i + 16, a2);
+		_mm256_storeu_ps (dest + i + 24, a3);
+	}
+	for (; i + 8 <= length; i += 8)
+		_mm256_storeu_ps (dest + i,
+				  _mm256_add_ps (_mm256_loadu_ps (dest + i),
+						 _mm256_loadu_ps (src + i)));
+	for (; i < length; i++)
+		dest[i] += src[i];
+}
+
+__attribute__((target("avx2"))) void
+x86_avx2_mixnf (float *dest, const float **srcs, int nsrcs, int length)
+{
+	int i, s;
+	float sum;
+
+	for (i = 0; i + 32 <= length; i += 32)
+	{
+		__m256 a0 = _mm256_loadu_ps (srcs[0] + i);
+		__m256 a1 = _mm256_loadu_ps (srcs[0] + i + 8);
+		__m256 a2 = _mm256_loadu_ps (srcs[0] + i + 16);
+		__m256 a3 = _mm256_loadu_ps (srcs[0] + i + 24);
+		for (s = 1; s < nsrcs; s++)
+		{
+			a0 = _mm256_add_ps (a0, _mm256_loadu_ps (srcs[s] + i));
+			a1 = _mm256_add_ps (a1, _mm256_loadu_ps (srcs[s] + i + 8));
+			a2 = _mm256_add_ps (a2, _mm256_loadu_ps (srcs[s] + i + 16));
+			a3 = _mm256_add_ps (a3, _mm256_loadu_ps (srcs[s] + i + 24));
+		}
+		_mm256_storeu_ps (dest + i, a0);
+		_mm256_storeu_ps (dest + i + 8, a1);
+		_mm256_storeu_ps (dest + i + 16, a2);
+		_mm256_storeu_ps (dest + i + 24, a3);
+	}
+	for (; i < length; i++)
+	{
+		sum = srcs[0][i];
+		for (s = 1; s < nsrcs; s++)
+			sum += srcs[s][i];
+		dest[i] = sum;
+	}
+}
+
+/* AVX-512 handles the tail with masked loads and stores. */
+
+__attribute__((target("avx512f"))) void
+x86_avx512_copyf (float *dest, const float *src, int length)
+{
+	int i;
+	__mmask16 m;
+
+	for (i = 0; i + 64 <= length; i += 64)
+	{
+		__m512 a0 = _mm512_loadu_ps (src + i);
+		__m512 a1 = _mm512_loadu_ps (src + i + 16);
+		__m512 a2 = _mm512_loadu_ps (src + i + 32);
+		__m512 a3 = _mm512_loadu_ps (src + i + 48);
+		_mm512_storeu_ps (dest + i, a0);
+		_mm512_storeu_ps (dest + i + 16, a1);
+		_mm512_storeu_ps (dest + i + 32, a2);
+		_mm512_storeu_ps (dest + i + 48, a3);
+	}
+	for (; i < length; i += 16)
+	{
+		m = (length - i >= 16) ? 0xffff : (__mmask16) ((1U << (length - i)) - 1);
+		_mm512_mask_storeu_ps (dest + i, m,
+				       _mm512_maskz_loadu_ps (m, src + i));
+	}
+}
+
+__attribute__((target("avx512f"))) void
+x86_avx512_add2f (float *dest, const float *src, int length)
+{
+	int i;
+	__mmask16 m;
+
+	for (i = 0; i + 64 <= length; i += 64)
+	{
+		__m512 a0 = _mm512_add_ps (_mm512_loadu_ps (dest + i),
+					   _mm512_loadu_ps (src + i));
+		__m512 a1 = _mm512_add_ps (_mm512_loadu_ps (dest + i + 16),
+					   _mm512_loadu_ps (src + i + 16));
+		__m512 a2 = _mm512_add_ps (_mm512_loadu_ps (dest + i + 32),
+					   _mm512_loadu_ps (src + i + 32));
+		__m512 a3 = _mm512_add_ps (_mm512_loadu_ps (dest + i + 48),
+					   _mm512_loadu_ps (src + i + 48));
+		_mm512_storeu_ps (dest + i, a0);
+		_mm512_storeu_ps (dest + i + 16, a1);
+		_mm512_storeu_ps (dest + i + 32, a2);
+		_mm512_storeu_ps (dest + i + 48, a3);
+	}
+	for (; i < length; i += 16)
+	{
+		m = (length - i >= 16) ? 0xffff : (__mmask16) ((1U << (length - i)) - 1);
+		_mm512_mask_storeu_ps (dest + i, m,
+				       _mm512_add_ps (_mm512_maskz_loadu_ps (m, dest + i),
+						      _mm512_maskz_loadu_ps (m, src + i)));
+	}
+}
+
+__attribute__((target("avx512f"))) void
+x86_avx512_mixnf (float *dest, const float **srcs, int nsrcs, int length)
+{
+	int i, s;
+	__mmask16 m;
+
+	for (i = 0; i + 64 <= length; i += 64)
+	{
+		__m512 a0 = _mm512_loadu_ps (srcs[0] + i);
+		__m512 a1 = _mm512_loadu_ps (srcs[0] + i + 16);
+		__m512 a2 = _mm512_loadu_ps (srcs[0] + i + 32);
+		__m512 a3 = _mm512_loadu_ps (srcs[0] + i + 48);
+		for (s = 1; s < nsrcs; s++)
+		{
+			a0 = _mm512_add_ps (a0, _mm512_loadu_ps (srcs[s] + i));
+			a1 = _mm512_add_ps (a1, _mm512_loadu_ps (srcs[s] + i + 16));
+			a2 = _mm512_add_ps (a2, _mm512_loadu_ps (srcs[s] + i + 32));
+			a3 = _mm512_add_ps (a3, _mm512_loadu_ps (srcs[s] + i + 48));
+		}
+		_mm512_storeu_ps (dest + i, a0);
+		_mm512_storeu_ps (dest + i + 16, a1);
+		_mm512_storeu_ps (dest + i + 32, a2);
+		_mm512_storeu_ps (dest + i + 48, a3);
+	}
+	for (; i < length; i += 16)
+	{
+		__m512 a;
+
+		m = (length - i >= 16) ? 0xffff : (__mmask16) ((1U << (length - i)) - 1);
+		a = _mm512_maskz_loadu_ps (m, srcs[0] + i);
+		for (s = 1; s < nsrcs; s++)
+			a = _mm512_add_ps (a, _mm512_maskz_loadu_ps (m, srcs[s] + i));
+		_mm512_mask_storeu_ps (dest + i, m, a);
+	}
+}
+
+#else /* USE_AVX_KERNELS */
+
+int
+have_avx ()
+{
+	return 0;
+}
+
+#endif /* USE_AVX_KERNELS */
+
 #endif /* ARCH_X86 */
 
+#ifdef ARCH_ARM_NEON
+
+#include <arm_neon.h>
+
+void
+arm_neon_copyf (float *dest, const float *src, int length)
+{
+	int i;
+
+	for (i = 0; i + 16 <= length; i += 16)
+	{
+		float32x4_t a0 = vld1q_f32 (src + i);
+		float32x4_t a1 = vld1q_f32 (src + i + 4);
+		float32x4_t a2 = vld1q_f32 (src + i + 8);
+		float32x4_t a3 = vld1q_f32 (src + i + 12);
+		vst1q_f32 (dest + i, a0);
+		vst1q_f32 (dest + i + 4, a1);
+		vst1q_f32 (dest + i + 8, a2);
+		vst1q_f32 (dest + i + 12, a3);
+	}
+	for (; i < length; i++)
+		dest[i] = src[i];
+}
+
+void
+arm_neon_add2f (float *dest, const float *src, int length)
+{
+	int i;
+
+	for (i = 0; i + 16 <= length; i += 16)
+	{
+		float32x4_t a0 = vaddq_f32 (vld1q_f32 (dest + i),
+					    vld1q_f32 (src + i));
+		float32x4_t a1 = vaddq_f32 (vld1q_f32 (dest + i + 4),
+					    vld1q_f32 (src + i + 4));
+		float32x4_t a2 = vaddq_f32 (vld1q_f32 (dest + i + 8),
+					    vld1q_f32 (src + i + 8));
+		float32x4_t a3 = vaddq_f32 (vld1q_f32 (dest + i + 12),
+					    vld1q_f32 (src + i + 12));
+		vst1q_f32 (dest + i, a0);
+		vst1q_f32 (dest + i + 4, a1);
+		vst1q_f32 (dest + i + 8, a2);
+		vst1q_f32 (dest + i + 12, a3);
+	}
+	for (; i < length; i++)
+		dest[i] += src[i];
+}
+
+void
+arm_neon_mixnf (float *dest, const float **srcs, int nsrcs, int length)
+{
+	int i, s;
+	float sum;
+
+	for (i = 0; i + 16 <= length; i += 16)
+	{
+		float32x4_t a0 = vld1q_f32 (srcs[0] + i);
+		float32x4_t a1 = vld1q_f32 (srcs[0] + i + 4);
+		float32x4_t a2 = vld1q_f32 (srcs[0] + i + 8);
+		float32x4_t a3 = vld1q_f32 (srcs[0] + i + 12);
+		for (s = 1; s < nsrcs; s++)
+		{
+			a0 = vaddq_f32 (a0, vld1q_f32 (srcs[s] + i));
+			a1 = vaddq_f32 (a1, vld1q_f32 (srcs[s] + i + 4));
+			a2 = vaddq_f32 (a2, vld1q_f32 (srcs[s] + i + 8));
+			a3 = vaddq_f32 (a3, vld1q_f32 (srcs[s] + i + 12));
+		}
+		vst1q_f32 (dest + i, a0);
+		vst1q_f32 (dest + i + 4, a1);
+		vst1q_f32 (dest + i + 8, a2);
+		vst1q_f32 (dest + i + 12, a3);
+	}
+	for (; i < length; i++)
+	{
+		sum = srcs[0][i];
+		for (s = 1; s < nsrcs; s++)
+			sum += srcs[s][i];
+		dest[i] = sum;
+	}
+}
+
+#endif /* ARCH_ARM_NEON */
+
 #endif /* USE_DYNSIMD */
 
@@ -0,0 +1,306 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Time the port segment work of a buffer size change, 256 -> 1024
+    frames, with 256 to 2048 ports of each type and 8 clients mapping
+    the segments.  The engine's jack_driver_buffer_size() runs once
+    with the segments laid out for 1024 frames, so that they are set
+    up again in place, and once made to reallocate them, as every size
+    change used to, with the clients remapping the new segments.  Both
+    times include the clients touching their buffers again.
+
+    Checks that a change within the layout keeps the segments and the
+    buffer offsets, and that either way the buffers come out set up for
+    the new size: audio buffers silent and MIDI buffers taking events
+    up to the new period length only.
+
+    The engine is compiled in here by engine_fixture.h, so that its
+    static functions can be used; the rest comes from libjackserver.
+    The port segments are registered in the shm registry under a
+    server name of our own.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include "engine_fixture.h"
+
+#include <time.h>
+
+#include <jack/midiport.h>
+
+#define NCLIENTS	8
+#define SMALL		256
+#define LARGE		1024
+#define REPS		10
+#define SKIP		77	/* automake's "test skipped" */
+
+static const unsigned long port_counts[] = { 256, 1024, 2048 };
+
+/* each client's mapping of each port segment */
+static jack_shm_info_t client_shm[NCLIENTS][JACK_MAX_PORT_TYPES];
+static volatile long sink;
+
+static double
+now (void)
+{
+	struct timespec t;
+
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static jack_engine_t *
+gap_engine (unsigned long nports)
+{
+	jack_engine_t *engine = fixture_engine_new (nports);
+	int i;
+
+	/* as jack_engine_new() does, with room reserved for LARGE */
+	for (i = 0; jack_builtin_port_types[i].type_name[0]; ++i) {
+		memcpy (&engine->control->port_types[i],
+			&jack_builtin_port_types[i],
+			sizeof (jack_port_type_info_t));
+		engine->control->port_types[i].ptype_id = i;
+		pthread_mutex_init (&engine->port_buffers[i].lock, NULL);
+		engine->port_segment[i].index = -1;
+		engine->port_segment[i].attached_at = 0;
+	}
+	engine->control->n_port_types = i;
+	engine->port_buffer_frames = LARGE;
+
+	return engine;
+}
+
+static void
+gap_engine_free (jack_engine_t *engine)
+{
+	int i;
+
+	for (i = 0; i < engine->control->n_port_types; i++) {
+		jack_release_shm (&engine->port_segment[i]);
+		jack_destroy_shm (&engine->port_segment[i]);
+		jack_slist_free (engine->port_buffers[i].freelist);
+		free (engine->port_buffers[i].info);
+	}
+	fixture_engine_free (engine);
+}
+
+static void
+clients_attach (jack_engine_t *engine)
+{
+	int c, i;
+
+	for (c = 0; c < NCLIENTS; c++) {
+		for (i = 0; i < engine->control->n_port_types; i++) {
+			client_shm[c][i].index = engine->port_segment[i].index;
+			jack_attach_shm (&client_shm[c][i]);
+		}
+	}
+}
+
+static void
+clients_detach (jack_engine_t *engine)
+{
+	int c, i;
+
+	for (c = 0; c < NCLIENTS; c++) {
+		for (i = 0; i < engine->control->n_port_types; i++) {
+			jack_release_shm (&client_shm[c][i]);
+		}
+	}
+}
+
+/* Each client reads one word of every page of its share of the
+   buffers, which is what faults a new mapping in. */
+static void
+clients_touch (jack_engine_t *engine, jack_nframes_t nframes)
+{
+	unsigned long n;
+	size_t bytes, off;
+	int c, i;
+
+	for (i = 0; i < engine->control->n_port_types; i++) {
+		jack_port_buffer_list_t *pti = &engine->port_buffers[i];
+
+		bytes = jack_port_type_buffer_size
+			(&engine->control->port_types[i], nframes);
+		for (c = 0; c < NCLIENTS; c++) {
+			char *seg = jack_shm_addr (&client_shm[c][i]);
+
+			for (n = c; n < engine->port_max; n += NCLIENTS) {
+				for (off = 0; off < bytes; off += 4096) {
+					sink += seg[pti->info[n].offset + off];
+				}
+			}
+		}
+	}
+}
+
+/* Scribble over every buffer, so that checking them shows whether
+   they were set up again. */
+static void
+buffers_dirty (jack_engine_t *engine)
+{
+	unsigned long n;
+	int i;
+
+	for (i = 0; i < engine->control->n_port_types; i++) {
+		jack_port_buffer_list_t *pti = &engine->port_buffers[i];
+		char *seg = jack_shm_addr (&engine->port_segment[i]);
+
+		for (n = 0; n < engine->port_max; n++) {
+			memset (seg + pti->info[n].offset, 0x55, pti->one_buffer);
+		}
+	}
+}
+
+static int
+buffers_ok (jack_engine_t *engine, jack_nframes_t nframes)
+{
+	jack_port_buffer_list_t *pti;
+	jack_midi_data_t byte = 0xf8;
+	float *audio;
+	void *midi;
+	unsigned long n;
+	jack_nframes_t f;
+
+	pti = &engine->port_buffers[JACK_AUDIO_PORT_TYPE];
+	for (n = 0; n < engine->port_max; n++) {
+		audio = (float *) (jack_shm_addr (&engine->port_segment[JACK_AUDIO_PORT_TYPE])
+				   + pti->info[n].offset);
+		for (f = 0; f < nframes; f++) {
+			if (audio[f] != 0.0f) {
+				return 0;
+			}
+		}
+	}
+
+	pti = &engine->port_buffers[JACK_MIDI_PORT_TYPE];
+	for (n = 0; n < engine->port_max; n++) {
+		midi = jack_shm_addr (&engine->port_segment[JACK_MIDI_PORT_TYPE])
+			+ pti->info[n].offset;
+		if (jack_midi_get_event_count (midi) != 0
+		    || jack_midi_event_write (midi, nframes - 1, &byte, 1)
+		    || !jack_midi_event_write (midi, nframes, &byte, 1)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int
+run (unsigned long nports)
+{
+	jack_engine_t *engine = gap_engine (nports);
+	jack_shm_info_t before[JACK_MAX_PORT_TYPES];
+	jack_shmsize_t offset[JACK_MAX_PORT_TYPES];
+	double in_place = 0, reallocating = 0, t0;
+	int failures = 0;
+	int r, i;
+
+	if (jack_driver_buffer_size (engine, SMALL)) {
+		gap_engine_free (engine);
+		return 1;
+	}
+	clients_attach (engine);
+	clients_touch (engine, SMALL);
+
+	for (r = 0; r < REPS; r++) {
+
+		/* within the layout: set up again in place */
+
+		for (i = 0; i < engine->control->n_port_types; i++) {
+			before[i] = engine->port_segment[i];
+			offset[i] = engine->port_buffers[i].info[nports - 1].offset;
+		}
+		buffers_dirty (engine);
+
+		t0 = now ();
+		jack_driver_buffer_size (engine, LARGE);
+		clients_touch (engine, LARGE);
+		in_place += now () - t0;
+
+		for (i = 0; i < engine->control->n_port_types; i++) {
+			if (engine->port_segment[i].index != before[i].index
+			    || engine->port_segment[i].attached_at != before[i].attached_at
+			    || engine->port_buffers[i].info[nports - 1].offset != offset[i]) {
+				failures++;
+			}
+		}
+		if (!buffers_ok (engine, LARGE)) {
+			failures++;
+		}
+
+		jack_driver_buffer_size (engine, SMALL);
+		if (!buffers_ok (engine, SMALL)) {
+			failures++;
+		}
+
+		/* made to reallocate: new segments, every client
+		   remaps them */
+
+		buffers_dirty (engine);
+
+		t0 = now ();
+		clients_detach (engine);
+		for (i = 0; i < engine->control->n_port_types; i++) {
+			engine->port_buffers[i].one_buffer = 0;
+		}
+		jack_driver_buffer_size (engine, LARGE);
+		clients_attach (engine);
+		clients_touch (engine, LARGE);
+		reallocating += now () - t0;
+
+		if (!buffers_ok (engine, LARGE)) {
+			failures++;
+		}
+
+		jack_driver_buffer_size (engine, SMALL);
+	}
+
+	printf ("%5lu ports of each type, %d -> %d frames, %d clients: "
+		"realloc %6.2f ms, in place %6.2f ms%s\n",
+		nports, SMALL, LARGE, NCLIENTS, reallocating / REPS * 1e3,
+		in_place / REPS * 1e3, failures ? ", FAILED" : "");
+
+	clients_detach (engine);
+	gap_engine_free (engine);
+
+	return failures;
+}
+
+int
+main ()
+{
+	char server_name[JACK_SERVER_NAME_SIZE];
+	unsigned int i;
+	int failures = 0;
+
+	snprintf (server_name, sizeof (server_name),
+		  "buffer-resize-gap-%d", getpid ());
+	if (jack_register_server (server_name, 0)) {
+		printf ("cannot use the shm registry, skipped\n");
+		return SKIP;
+	}
+
+	for (i = 0; i < sizeof (port_counts) / sizeof (port_counts[0]); i++) {
+		failures += run (port_counts[i]);
+	}
+
+	jack_unregister_server (server_name);
+
+	return failures ? 1 : 0;
+}
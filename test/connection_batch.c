@@ -0,0 +1,158 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Check ChangeConnections requests, as jackd/engine.c applies them
+    through jack_port_do_change_connections(), on three clients a, b
+    and c that start out ordered c, b, a:
+
+    - a->b, b->c, c->a in one batch is a cycle, so one of them must be
+      counted as feedback, even though the order the clients had
+      before the batch would take c->a as a forward connection;
+    - taking the three down in one batch leaves no feedback;
+    - a->b, b->c in one batch leaves the clients ordered a, b, c;
+    - a failing change does not stop the others, and each gets the
+      status jack_connect() would have returned;
+    - re-sorting clients whose order is still valid leaves it as it
+      is, even where taking the ready clients first come, first
+      served would not (a, c, b with only a->c).
+
+    The engine is compiled in here by engine_fixture.h, so that its
+    static functions can be used; the rest comes from libjackserver.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include "engine_fixture.h"
+
+#define NCLIENTS		3	/* a, b, c */
+#define PORTS_PER_CLIENT	2	/* in, out */
+#define NPORTS			(NCLIENTS * PORTS_PER_CLIENT)
+
+static jack_engine_t *
+test_engine (void)
+{
+	jack_engine_t *engine = fixture_engine_new (NPORTS);
+	jack_client_internal_t *client;
+	char client_name[JACK_CLIENT_NAME_SIZE];
+	char name[JACK_PORT_NAME_SIZE];
+	int i;
+
+	for (i = 0; i < NCLIENTS; i++) {
+		snprintf (client_name, sizeof (client_name), "%c", 'a' + i);
+		client = fixture_client_new (i, client_name);
+		snprintf (name, sizeof (name), "%c:in", 'a' + i);
+		fixture_port_new (engine, client, i * PORTS_PER_CLIENT, name,
+				  JackPortIsInput);
+		snprintf (name, sizeof (name), "%c:out", 'a' + i);
+		fixture_port_new (engine, client, i * PORTS_PER_CLIENT + 1, name,
+				  JackPortIsOutput);
+
+		/* c, b, a */
+		engine->clients = jack_slist_prepend (engine->clients, client);
+	}
+
+	jack_sort_graph (engine);
+	return engine;
+}
+
+static void
+change (jack_connection_change_t *c, int connect, char from, char to)
+{
+	c->connect = connect;
+	snprintf (c->source_port, sizeof (c->source_port), "%c:out", from);
+	snprintf (c->destination_port, sizeof (c->destination_port), "%c:in", to);
+}
+
+/* The client names in process order. */
+static const char *
+order (jack_engine_t *engine)
+{
+	static char names[NCLIENTS + 1];
+	JSList *node;
+	int n = 0;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		names[n++] = ((jack_client_internal_t *) node->data)->control->name[0];
+	}
+	names[n] = '\0';
+	return names;
+}
+
+static int
+check (const char *what, int ok)
+{
+	printf ("%s: %s\n", what, ok ? "ok" : "FAIL");
+	return !ok;
+}
+
+int
+main ()
+{
+	jack_engine_t *engine = test_engine ();
+	jack_connection_change_t changes[3];
+	int32_t results[3];
+	int ret, failures = 0;
+
+	failures += check ("clients start out ordered c, b, a",
+			   strcmp (order (engine), "cba") == 0);
+
+	change (&changes[0], 1, 'a', 'b');
+	change (&changes[1], 1, 'b', 'c');
+	change (&changes[2], 1, 'c', 'a');
+	ret = jack_port_do_change_connections (engine, changes, 3, results);
+	failures += check ("cycle in one batch is connected",
+			   ret == 0 && results[0] == 0 && results[1] == 0
+			   && results[2] == 0);
+	failures += check ("cycle in one batch counts as feedback",
+			   engine->feedbackcount > 0);
+
+	changes[0].connect = changes[1].connect = changes[2].connect = 0;
+	ret = jack_port_do_change_connections (engine, changes, 3, results);
+	failures += check ("cycle taken down in one batch",
+			   ret == 0 && results[0] == 0 && results[1] == 0
+			   && results[2] == 0 && engine->feedbackcount == 0);
+
+	change (&changes[0], 1, 'b', 'c');
+	change (&changes[1], 1, 'a', 'b');
+	ret = jack_port_do_change_connections (engine, changes, 2, results);
+	failures += check ("chain in one batch orders a, b, c",
+			   ret == 0 && engine->feedbackcount == 0
+			   && strcmp (order (engine), "abc") == 0);
+
+	change (&changes[0], 0, 'a', 'b');
+	change (&changes[1], 1, 'a', 'x');
+	change (&changes[2], 1, 'b', 'c');
+	ret = jack_port_do_change_connections (engine, changes, 3, results);
+	failures += check ("each change gets its own status",
+			   ret == -1 && results[0] == 0 && results[1] == -1
+			   && results[2] == EEXIST);
+	failures += check ("the rest of a failed batch is applied",
+			   engine->internal_ports[1].connections == NULL
+			   && engine->internal_ports[3].connections != NULL);
+
+	change (&changes[0], 0, 'b', 'c');
+	change (&changes[1], 1, 'c', 'b');
+	change (&changes[2], 1, 'a', 'c');
+	ret = jack_port_do_change_connections (engine, changes, 3, results);
+	change (&changes[0], 0, 'c', 'b');
+	ret |= jack_port_do_change_connections (engine, changes, 1, results);
+	failures += check ("a, c, b with only a->c",
+			   ret == 0 && strcmp (order (engine), "acb") == 0);
+	jack_sort_graph (engine);
+	failures += check ("re-sort keeps an order that is still valid",
+			   strcmp (order (engine), "acb") == 0);
+
+	return failures ? 1 : 0;
+}
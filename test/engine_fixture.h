@@ -0,0 +1,141 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    A fake engine for the tests and benchmarks that compile
+    jackd/engine.c in, so that they can use its static functions; the
+    rest comes from libjackserver.  Include this instead of engine.c.
+
+    The engine has no driver, server thread or request sockets.  Its
+    clients are internal ones with their control blocks in plain
+    memory, and client i has the uuid FIXTURE_UUID_BASE + i.  They
+    have no libjack side: latency callbacks go to
+    fixture_latency_callback if a test sets it, and connection
+    notifications are ignored.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifndef __jack_test_engine_fixture_h__
+#define __jack_test_engine_fixture_h__
+
+#define jack_client_handle_latency_callback fixture_client_latency
+#define jack_client_handle_port_connection fixture_client_connection
+#include "../jackd/engine.c"
+#undef jack_client_handle_latency_callback
+#undef jack_client_handle_port_connection
+
+#define FIXTURE_UUID_BASE	1000
+
+static int (*fixture_latency_callback) (jack_client_t *client,
+					jack_event_t *event, int is_driver);
+
+int
+fixture_client_latency (jack_client_t *client, jack_event_t *event,
+			int is_driver)
+{
+	if (fixture_latency_callback) {
+		return fixture_latency_callback (client, event, is_driver);
+	}
+	return 0;
+}
+
+int
+fixture_client_connection (jack_client_t *client, jack_event_t *event)
+{
+	return 0;
+}
+
+/* An engine with room for nports ports, all of them free, and no
+   clients. */
+static inline jack_engine_t *
+fixture_engine_new (uint32_t nports)
+{
+	jack_engine_t *engine = calloc (1, sizeof (jack_engine_t));
+
+	engine->control = calloc (1, sizeof (jack_control_t)
+				  + nports * sizeof (jack_port_shared_t)
+				  + jack_port_name_index_size (nports));
+	engine->control->port_max = nports;
+	engine->port_max = nports;
+	engine->internal_ports = calloc (nports, sizeof (jack_port_internal_t));
+	pthread_rwlock_init (&engine->client_lock, NULL);
+	pthread_mutex_init (&engine->problem_lock, NULL);
+	jack_port_name_index_init (engine->control);
+
+	return engine;
+}
+
+/* Frees the engine and the clients left on engine->clients. */
+static inline void
+fixture_engine_free (jack_engine_t *engine)
+{
+	jack_client_internal_t *client;
+	JSList *node;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t *) node->data;
+		jack_slist_free (client->ports);
+		jack_slist_free (client->truefeeds);
+		jack_slist_free (client->sortfeeds);
+		free ((void *) client->control);
+		free (client);
+	}
+	jack_slist_free (engine->clients);
+	free (engine->internal_ports);
+	free (engine->control);
+	free (engine);
+}
+
+/* An active internal client, not on engine->clients yet so that the
+   caller can put it where it wants in the order. */
+static inline jack_client_internal_t *
+fixture_client_new (int i, const char *name)
+{
+	jack_client_internal_t *client = calloc (1, sizeof (jack_client_internal_t));
+
+	client->control = calloc (1, sizeof (jack_client_control_t));
+	client->control->type = ClientInternal;
+	client->control->active = 1;
+	client->control->process_cbset = 1;
+	client->control->uuid = FIXTURE_UUID_BASE + i;
+	snprintf ((char *) client->control->name,
+		  sizeof (client->control->name), "%s", name);
+	client->private_client = (jack_client_t *) client;
+	client->execution_order = UINT_MAX;
+
+	return client;
+}
+
+/* Give port `id' to the client, as a port that can have several
+   connections. */
+static inline void
+fixture_port_new (jack_engine_t *engine, jack_client_internal_t *client,
+		  jack_port_id_t id, const char *name, uint32_t flags)
+{
+	jack_port_shared_t *shared = &engine->control->ports[id];
+
+	shared->id = id;
+	shared->in_use = 1;
+	shared->has_mixdown = 1;
+	shared->client_id = client->control->uuid;
+	shared->flags = flags;
+	snprintf (shared->name, sizeof (shared->name), "%s", name);
+	engine->internal_ports[id].shared = shared;
+	client->ports = jack_slist_append (client->ports,
+					   &engine->internal_ports[id]);
+	jack_port_name_index_add (engine->control, id);
+}
+
+#endif /* __jack_test_engine_fixture_h__ */
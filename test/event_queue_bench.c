@@ -0,0 +1,273 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Time how long notifications take to reach 1 to 128 external
+    clients through the event queues in their control blocks.  Each
+    client is a child process on a socketpair, with its control block
+    in shared memory, draining its queue the way
+    jack_client_process_events() in libjack does.  The engine side is
+    jack_post_event() itself.
+
+    For a burst of 32 PortRegistered events per client it reports the
+    time until every client has handled them, waiting for each one as
+    every event used to (round trips), and queued without waiting,
+    where the time to post them is shown too.  Then an ack'd
+    GraphReordered posted to all clients before collecting the
+    answers, and a burst of 256 events, four times what a queue holds,
+    which has the engine block on each client's event fd for room.
+
+    Every client must handle every event, without errors.
+
+    The engine is compiled in here by engine_fixture.h, so that its
+    static functions can be used; the rest comes from libjackserver.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include "engine_fixture.h"
+
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define MAX_CLIENTS	128
+#define BURST		32
+#define OVERFLOW	(4 * JACK_EVENT_QUEUE_SIZE)
+#define ROUNDS		20
+
+static const int client_counts[] = { 1, 4, 16, 64, 128 };
+
+typedef struct {
+	jack_client_control_t control;
+	volatile uint32_t handled;
+	volatile double handled_at;
+} shared_client_t;
+
+static shared_client_t *shared[MAX_CLIENTS];
+static jack_client_internal_t *clients[MAX_CLIENTS];
+static pid_t pids[MAX_CLIENTS];
+
+static double
+now (void)
+{
+	struct timespec t;
+
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* jack_client_process_events() without the handlers */
+static void
+client_run (shared_client_t *sh, int fd)
+{
+	jack_event_queue_t *queue = (jack_event_queue_t *) &sh->control.events;
+	char doorbell[64];
+	char status = 0;
+	uint32_t head = 0, tail;
+	int ack;
+
+	while (read (fd, doorbell, sizeof (doorbell)) > 0) {
+		while (1) {
+			tail = queue->tail;
+			__sync_synchronize ();
+
+			while (head != tail) {
+				ack = queue->entries[head & (JACK_EVENT_QUEUE_SIZE - 1)].ack;
+				__sync_synchronize ();
+				queue->head = ++head;
+				sh->handled_at = now ();
+				sh->handled++;
+				if (ack && write (fd, &status, 1) != 1) {
+					_exit (1);
+				}
+			}
+
+			__sync_synchronize ();
+			if (queue->tail == head) {
+				break;
+			}
+		}
+	}
+
+	_exit (0);
+}
+
+static jack_engine_t *
+bench_engine (int nclients)
+{
+	jack_engine_t *engine = fixture_engine_new (0);
+	jack_client_internal_t *client;
+	int i, sv[2];
+
+	for (i = 0; i < nclients; i++) {
+		shared[i] = mmap (NULL, sizeof (shared_client_t),
+				  PROT_READ|PROT_WRITE,
+				  MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+		if (shared[i] == MAP_FAILED
+		    || socketpair (AF_UNIX, SOCK_STREAM, 0, sv)) {
+			perror ("cannot set up client");
+			exit (1);
+		}
+		if ((pids[i] = fork ()) == 0) {
+			close (sv[0]);
+			client_run (shared[i], sv[1]);
+		}
+		close (sv[1]);
+
+		client = calloc (1, sizeof (jack_client_internal_t));
+		client->control = &shared[i]->control;
+		client->control->type = ClientExternal;
+		client->control->active = 1;
+		client->control->pid = pids[i];
+		client->control->uuid = FIXTURE_UUID_BASE + i;
+		snprintf ((char *) client->control->name,
+			  sizeof (client->control->name), "c%d", i);
+		client->event_fd = sv[0];
+		clients[i] = client;
+		engine->clients = jack_slist_append (engine->clients, client);
+	}
+
+	return engine;
+}
+
+static void
+bench_engine_free (jack_engine_t *engine, int nclients)
+{
+	int i;
+
+	for (i = 0; i < nclients; i++) {
+		close (clients[i]->event_fd);
+		kill (pids[i], SIGKILL);
+		waitpid (pids[i], NULL, 0);
+		munmap (shared[i], sizeof (shared_client_t));
+		free (clients[i]);
+	}
+	jack_slist_free (engine->clients);
+	engine->clients = NULL;
+	fixture_engine_free (engine);
+}
+
+/* Returns when every client has handled `want' events, with the time
+   the last of them did. */
+static double
+clients_caught_up (int nclients, uint32_t want)
+{
+	double last = 0.0;
+	int i;
+
+	for (i = 0; i < nclients; i++) {
+		while (shared[i]->handled < want) {
+			usleep (50);
+		}
+		if (shared[i]->handled_at > last) {
+			last = shared[i]->handled_at;
+		}
+	}
+	return last;
+}
+
+static void
+post_burst (jack_engine_t *engine, int nclients, int count,
+	    jack_event_ack_t ack)
+{
+	jack_event_t event;
+	int b, i;
+
+	memset (&event, 0, sizeof (event));
+	event.type = PortRegistered;
+
+	for (b = 0; b < count; b++) {
+		for (i = 0; i < nclients; i++) {
+			event.x.port_id = b;
+			jack_post_event (engine, clients[i], &event, NULL, ack);
+		}
+	}
+}
+
+int
+main ()
+{
+	jack_engine_t *engine;
+	jack_event_t event;
+	double start, posted, t_trip, t_post, t_queued, t_reorder, t_overflow;
+	uint32_t want;
+	int n, i, r, nclients;
+	int failures = 0;
+
+	printf ("time until every client has handled the events, us\n");
+	printf ("%7s %12s %12s %12s %12s %12s\n", "clients",
+		"32 trips", "32 posted", "32 queued", "reorder ack",
+		"256 queued");
+
+	for (n = 0; n < (int) (sizeof (client_counts) / sizeof (client_counts[0])); n++) {
+		nclients = client_counts[n];
+		engine = bench_engine (nclients);
+		t_trip = t_post = t_queued = t_reorder = t_overflow = 0.0;
+		want = 0;
+
+		for (r = 0; r < ROUNDS; r++) {
+
+			start = now ();
+			post_burst (engine, nclients, BURST, JackEventAck);
+			want += BURST;
+			t_trip += clients_caught_up (nclients, want) - start;
+
+			start = now ();
+			post_burst (engine, nclients, BURST, JackEventNoAck);
+			posted = now ();
+			want += BURST;
+			t_queued += clients_caught_up (nclients, want) - start;
+			t_post += posted - start;
+
+			memset (&event, 0, sizeof (event));
+			event.type = GraphReordered;
+			start = now ();
+			for (i = 0; i < nclients; i++) {
+				jack_post_event (engine, clients[i], &event,
+						 NULL, JackEventAckLater);
+			}
+			jack_collect_event_acks (engine);
+			want++;
+			t_reorder += now () - start;
+
+			start = now ();
+			post_burst (engine, nclients, OVERFLOW, JackEventNoAck);
+			want += OVERFLOW;
+			t_overflow += clients_caught_up (nclients, want) - start;
+		}
+
+		/* the last entries may still owe an answer */
+		jack_collect_event_acks (engine);
+
+		for (i = 0; i < nclients; i++) {
+			if (shared[i]->handled != want || clients[i]->error) {
+				failures++;
+			}
+		}
+
+		printf ("%7d %12.1f %12.1f %12.1f %12.1f %12.1f\n", nclients,
+			t_trip * 1e6 / ROUNDS, t_post * 1e6 / ROUNDS,
+			t_queued * 1e6 / ROUNDS, t_reorder * 1e6 / ROUNDS,
+			t_overflow * 1e6 / ROUNDS);
+		fflush (stdout);
+
+		bench_engine_free (engine, nclients);
+	}
+
+	printf ("%d clients missed events\n", failures);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,206 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Connect-storm benchmark for the client graph sort in jackd/engine.c.
+
+    For 10 to 500 clients, each with two inputs and two outputs, make
+    a chain through all of them plus one forward connection out of
+    each, in random order, then take them all down again.  Every
+    connect and disconnect goes through the engine's own code and so
+    re-sorts the graph, recomputes latencies and rechains as it would
+    in jackd.  Then make and take down the same connections again, each
+    time all of them in one ChangeConnections batch, which sorts the
+    clients as it goes but recomputes latencies and rechains only once.
+    Prints the mean time per change both ways and checks that the
+    order is topological once everything is connected.
+
+    The engine is compiled in here by engine_fixture.h, so that its
+    static functions can be used; the rest comes from libjackserver.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include "engine_fixture.h"
+
+#include <time.h>
+
+#define PORTS_PER_CLIENT	4	/* in0, in1, out0, out1 */
+
+static const int client_counts[] = { 10, 50, 100, 200, 500 };
+
+static double
+now (void)
+{
+	struct timespec t;
+
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static jack_engine_t *
+bench_engine (int nclients)
+{
+	jack_engine_t *engine = fixture_engine_new (nclients * PORTS_PER_CLIENT);
+	jack_client_internal_t *client;
+	char client_name[JACK_CLIENT_NAME_SIZE];
+	char name[JACK_PORT_NAME_SIZE];
+	int i, k;
+
+	for (i = 0; i < nclients; i++) {
+		snprintf (client_name, sizeof (client_name), "c%d", i);
+		client = fixture_client_new (i, client_name);
+
+		for (k = 0; k < PORTS_PER_CLIENT; k++) {
+			snprintf (name, sizeof (name), "c%d:%s%d",
+				  i, (k < 2) ? "in" : "out", k & 1);
+			fixture_port_new (engine, client, i * PORTS_PER_CLIENT + k,
+					  name, (k < 2) ? JackPortIsInput : JackPortIsOutput);
+		}
+
+		/* the reverse of the chain, so that sorting has work to do */
+		engine->clients = jack_slist_prepend (engine->clients, client);
+	}
+
+	jack_sort_graph (engine);
+	return engine;
+}
+
+/* Whether every connection goes from a client to one later in the
+   order. */
+static int
+bench_order_ok (jack_engine_t *engine, int nclients)
+{
+	int *pos = calloc (nclients, sizeof (int));
+	jack_client_internal_t *client;
+	jack_connection_internal_t *connection;
+	jack_port_internal_t *port;
+	JSList *node, *pnode, *cnode;
+	int n = 0, ok = 1;
+
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t *) node->data;
+		pos[client->control->uuid - FIXTURE_UUID_BASE] = n++;
+	}
+	for (node = engine->clients; node; node = jack_slist_next (node)) {
+		client = (jack_client_internal_t *) node->data;
+		for (pnode = client->ports; pnode; pnode = jack_slist_next (pnode)) {
+			port = (jack_port_internal_t *) pnode->data;
+			for (cnode = port->connections; cnode;
+			     cnode = jack_slist_next (cnode)) {
+				connection = (jack_connection_internal_t *) cnode->data;
+				if (pos[connection->source->shared->client_id - FIXTURE_UUID_BASE]
+				    >= pos[connection->destination->shared->client_id - FIXTURE_UUID_BASE]) {
+					ok = 0;
+				}
+			}
+		}
+	}
+
+	free (pos);
+	return ok;
+}
+
+static int
+bench_run (int nclients)
+{
+	jack_engine_t *engine = bench_engine (nclients);
+	int nconn = 2 * nclients - 1;
+	char (*src)[JACK_PORT_NAME_SIZE] = calloc (nconn, JACK_PORT_NAME_SIZE);
+	char (*dst)[JACK_PORT_NAME_SIZE] = calloc (nconn, JACK_PORT_NAME_SIZE);
+	char tmp[JACK_PORT_NAME_SIZE];
+	unsigned int seed = nclients;
+	jack_connection_change_t *changes = calloc (nconn, sizeof (jack_connection_change_t));
+	int32_t *results = calloc (nconn, sizeof (int32_t));
+	double t0, t1, t2, t3, t4, t5;
+	int i, j, n = 0, failed = 0, ok;
+
+	for (i = 0; i + 1 < nclients; i++) {
+		snprintf (src[n], JACK_PORT_NAME_SIZE, "c%d:out0", i);
+		snprintf (dst[n++], JACK_PORT_NAME_SIZE, "c%d:in0", i + 1);
+	}
+	for (i = 0; i < nclients; i++) {
+		j = i + 1 + rand_r (&seed) % nclients;
+		if (j >= nclients) {
+			continue;
+		}
+		snprintf (src[n], JACK_PORT_NAME_SIZE, "c%d:out1", i);
+		snprintf (dst[n++], JACK_PORT_NAME_SIZE, "c%d:in1", j);
+	}
+	for (i = n - 1; i > 0; i--) {
+		j = rand_r (&seed) % (i + 1);
+		memcpy (tmp, src[i], sizeof (tmp));
+		memcpy (src[i], src[j], sizeof (tmp));
+		memcpy (src[j], tmp, sizeof (tmp));
+		memcpy (tmp, dst[i], sizeof (tmp));
+		memcpy (dst[i], dst[j], sizeof (tmp));
+		memcpy (dst[j], tmp, sizeof (tmp));
+	}
+
+	for (i = 0; i < n; i++) {
+		changes[i].connect = 1;
+		memcpy (changes[i].source_port, src[i], JACK_PORT_NAME_SIZE);
+		memcpy (changes[i].destination_port, dst[i], JACK_PORT_NAME_SIZE);
+	}
+
+	t0 = now ();
+	for (i = 0; i < n; i++) {
+		failed += jack_port_do_connect (engine, src[i], dst[i]) != 0;
+	}
+	t1 = now ();
+	ok = bench_order_ok (engine, nclients);
+	for (i = 0; i < n; i++) {
+		failed += jack_port_do_disconnect (engine, src[i], dst[i]) != 0;
+	}
+	t2 = now ();
+
+	failed += jack_port_do_change_connections (engine, changes, n, results) != 0;
+	t3 = now ();
+	ok = ok && bench_order_ok (engine, nclients);
+	for (i = 0; i < n; i++) {
+		changes[i].connect = 0;
+	}
+	t4 = now ();
+	failed += jack_port_do_change_connections (engine, changes, n, results) != 0;
+	t5 = now ();
+
+	printf ("%7d %11d %12.1f %15.1f %12.1f %15.1f   %s\n", nclients, n,
+		(t1 - t0) / n * 1e6, (t2 - t1) / n * 1e6,
+		(t3 - t2) / n * 1e6, (t5 - t4) / n * 1e6,
+		(ok && !failed) ? "ok" : "FAIL");
+
+	free (changes);
+	free (results);
+	free (src);
+	free (dst);
+	fixture_engine_free (engine);
+	return !ok || failed;
+}
+
+int
+main (int argc, char *argv[])
+{
+	size_t i;
+	int failures = 0;
+
+	printf ("%7s %11s %12s %15s %12s %15s\n", "", "",
+		"one by one", "", "batched", "");
+	printf ("%7s %11s %12s %15s %12s %15s\n", "clients", "connections",
+		"connect us", "disconnect us", "connect us", "disconnect us");
+	for (i = 0; i < sizeof (client_counts) / sizeof (client_counts[0]); i++) {
+		failures += bench_run (client_counts[i]);
+	}
+
+	return failures ? 1 : 0;
+}
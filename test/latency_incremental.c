@@ -0,0 +1,267 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Check the incremental latency pass in jackd/engine.c against the
+    full one.  48 clients in 6 chains of 8, each with its own delay,
+    get random connection changes, either anywhere forward in the
+    client order or within their chain.  After each change that left
+    the graph acyclic, every port's capture and playback ranges and
+    total latency must be what a full recompute gives.  Prints the
+    latency callbacks per change both ways.
+
+    Each client answers its latency callbacks the way libjack does for
+    a client without a latency callback of its own, plus its delay.
+
+    The engine is compiled in here by engine_fixture.h, so that its
+    static functions can be used; the rest comes from libjackserver.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include "engine_fixture.h"
+
+#define NCLIENTS		48
+#define CHAIN			8
+#define PORTS_PER_CLIENT	4	/* in0, in1, out0, out1 */
+#define NPORTS			(NCLIENTS * PORTS_PER_CLIENT)
+#define STEPS			3000
+
+typedef struct {
+	jack_latency_range_t capture;
+	jack_latency_range_t playback;
+	jack_nframes_t total;
+} port_latency_t;
+
+static jack_engine_t *engine;
+static jack_nframes_t delay_of[NCLIENTS];
+static unsigned long callbacks;
+
+/* The range over the ports connected to each of the client's ports
+   on one side, carried through to the other side plus the delay. */
+static int
+test_latency_callback (jack_client_t *private_client, jack_event_t *event,
+		       int is_driver)
+{
+	jack_client_internal_t *client =
+		(jack_client_internal_t *) private_client;
+	jack_latency_callback_mode_t mode = event->x.n;
+	unsigned long from = (mode == JackPlaybackLatency)
+		? JackPortIsOutput : JackPortIsInput;
+	jack_latency_range_t all = { UINT32_MAX, 0 };
+	jack_nframes_t delay = delay_of[client->control->uuid - FIXTURE_UUID_BASE];
+	jack_port_internal_t *port, *other;
+	jack_connection_internal_t *connection;
+	volatile jack_latency_range_t *range;
+	JSList *pnode, *cnode;
+
+	callbacks++;
+
+	for (pnode = client->ports; pnode; pnode = jack_slist_next (pnode)) {
+		jack_latency_range_t r = { UINT32_MAX, 0 };
+
+		port = (jack_port_internal_t *) pnode->data;
+		if (!(port->shared->flags & from)) {
+			continue;
+		}
+		for (cnode = port->connections; cnode;
+		     cnode = jack_slist_next (cnode)) {
+			connection = (jack_connection_internal_t *) cnode->data;
+			other = (connection->source == port)
+				? connection->destination : connection->source;
+			range = (mode == JackPlaybackLatency)
+				? &other->shared->playback_latency
+				: &other->shared->capture_latency;
+			if (range->min < r.min) {
+				r.min = range->min;
+			}
+			if (range->max > r.max) {
+				r.max = range->max;
+			}
+		}
+		if (r.min == UINT32_MAX) {
+			r.min = 0;
+		}
+		range = (mode == JackPlaybackLatency)
+			? &port->shared->playback_latency
+			: &port->shared->capture_latency;
+		range->min = r.min;
+		range->max = r.max;
+		if (r.min < all.min) {
+			all.min = r.min;
+		}
+		if (r.max > all.max) {
+			all.max = r.max;
+		}
+	}
+	if (all.min == UINT32_MAX) {
+		all.min = 0;
+	}
+
+	for (pnode = client->ports; pnode; pnode = jack_slist_next (pnode)) {
+		port = (jack_port_internal_t *) pnode->data;
+		if (port->shared->flags & from) {
+			continue;
+		}
+		range = (mode == JackPlaybackLatency)
+			? &port->shared->playback_latency
+			: &port->shared->capture_latency;
+		range->min = all.min + delay;
+		range->max = all.max + delay;
+	}
+
+	return 0;
+}
+
+static void
+client_new (int i, jack_nframes_t delay)
+{
+	jack_client_internal_t *client;
+	char client_name[JACK_CLIENT_NAME_SIZE];
+	char name[JACK_PORT_NAME_SIZE];
+	int k;
+
+	snprintf (client_name, sizeof (client_name), "c%d", i);
+	client = fixture_client_new (i, client_name);
+	delay_of[i] = delay;
+
+	for (k = 0; k < PORTS_PER_CLIENT; k++) {
+		snprintf (name, sizeof (name), "c%d:%s%d",
+			  i, (k < 2) ? "in" : "out", k & 1);
+		fixture_port_new (engine, client, i * PORTS_PER_CLIENT + k, name,
+				  (k < 2) ? JackPortIsInput : JackPortIsOutput);
+	}
+
+	engine->clients = jack_slist_append (engine->clients, client);
+}
+
+static void
+engine_new (void)
+{
+	int i;
+
+	engine = fixture_engine_new (NPORTS);
+	fixture_latency_callback = test_latency_callback;
+
+	/* the first client of each chain is the slow one */
+	for (i = 0; i < NCLIENTS; i++) {
+		client_new (i, (i % CHAIN == 0) ? 256 : 1 + i % 5);
+	}
+}
+
+static void
+test_connect (int src, int out, int dst, int in, int on)
+{
+	char source[JACK_PORT_NAME_SIZE], destination[JACK_PORT_NAME_SIZE];
+
+	snprintf (source, sizeof (source), "c%d:out%d", src, out);
+	snprintf (destination, sizeof (destination), "c%d:in%d", dst, in);
+	if (on) {
+		jack_port_connect_internal (engine, source, destination);
+	} else {
+		jack_port_disconnect_names (engine, source, destination);
+	}
+}
+
+static void
+snapshot (port_latency_t *snap)
+{
+	jack_port_shared_t *shared;
+	int i;
+
+	for (i = 0; i < NPORTS; i++) {
+		shared = &engine->control->ports[i];
+		snap[i].capture.min = shared->capture_latency.min;
+		snap[i].capture.max = shared->capture_latency.max;
+		snap[i].playback.min = shared->playback_latency.min;
+		snap[i].playback.max = shared->playback_latency.max;
+		snap[i].total = shared->total_latency;
+	}
+}
+
+static int
+run (const char *name, int in_chain)
+{
+	port_latency_t incremental[NPORTS], full[NPORTS];
+	unsigned long incremental_callbacks = 0, full_callbacks = 0;
+	unsigned int seed = 7;
+	int changes = 0, mismatches = 0;
+	int step, i, x, y, on;
+
+	engine_new ();
+	for (i = 0; i < NCLIENTS; i++) {
+		if (i % CHAIN != CHAIN - 1) {
+			test_connect (i, 0, i + 1, 0, 1);
+			test_connect (i, 1, i + 1, 1, 1);
+		}
+	}
+	jack_sort_graph (engine);
+
+	for (step = 0; step < STEPS; step++) {
+		x = rand_r (&seed) % NCLIENTS;
+		y = rand_r (&seed) % NCLIENTS;
+		on = rand_r (&seed) % 2;
+
+		if (in_chain) {
+			if (x % CHAIN == CHAIN - 1) {
+				continue;
+			}
+			y = x + 1;
+		} else if (x == y) {
+			continue;
+		} else if (x > y) {
+			int tmp = x;
+			x = y;
+			y = tmp;
+		}
+
+		callbacks = 0;
+		test_connect (x, rand_r (&seed) % 2, y, rand_r (&seed) % 2, on);
+		if (engine->feedbackcount) {
+			continue;
+		}
+		changes++;
+		incremental_callbacks += callbacks;
+		snapshot (incremental);
+
+		callbacks = 0;
+		engine->latency_seeded = 0;
+		jack_graph_changed (engine);
+		full_callbacks += callbacks;
+		snapshot (full);
+
+		if (memcmp (incremental, full, sizeof (incremental))) {
+			mismatches++;
+		}
+	}
+
+	printf ("%-9s %4d changes over %d clients: %d mismatches, "
+		"callbacks per change %.1f, full pass %.1f\n",
+		name, changes, NCLIENTS, mismatches,
+		(double) incremental_callbacks / changes,
+		(double) full_callbacks / changes);
+
+	return mismatches;
+}
+
+int
+main ()
+{
+	int mismatches = 0;
+
+	mismatches += run ("forward", 0);
+	mismatches += run ("in-chain", 1);
+
+	return mismatches ? 1 : 0;
+}
@@ -0,0 +1,200 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Check the vectorized ALSA sample conversions in drivers/alsa/memops.c
+    against the scalar ones, for every kernel this CPU can run: bit for
+    bit without dither, including clipping, infinities and NaN, both
+    interleaved and not, and for every leftover sample count.
+
+    memops.c is compiled in here, so that each kernel can be called
+    and not just the one sample_move_accel_out() would pick.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include "../drivers/alsa/memops.c"
+
+#define NSAMPLES	77	/* not a multiple of any vector width */
+#define MAX_SKIP	8	/* bytes between samples, interleaved */
+#define SKIP		77	/* automake's "test skipped" */
+
+typedef struct {
+	const char *name;
+	sample_move_out_t scalar;
+	sample_move_out_t accel;
+	int width;
+} out_kernel_t;
+
+typedef struct {
+	const char *name;
+	sample_move_in_t scalar;
+	sample_move_in_t accel;
+	int width;
+} in_kernel_t;
+
+static jack_default_audio_sample_t
+test_sample (int i)
+{
+	static const float special[] = {
+		0.0f, -0.0f, 1.0f, -1.0f, 1.5f, -1.5f, 0.99999f, -0.99999f,
+		1.0f / 65536.0f, 0.5f / 32767.0f, 1.5f / 32767.0f, 1e-30f,
+		INFINITY, -INFINITY, NAN, -NAN,
+	};
+
+	if (i < (int) (sizeof (special) / sizeof (special[0]))) {
+		return special[i];
+	}
+	return (float) (rand () - RAND_MAX / 2) / (RAND_MAX / 2) * 1.1f;
+}
+
+static int
+check_out (const char *isa, const out_kernel_t *k)
+{
+	jack_default_audio_sample_t src[NSAMPLES];
+	char want[NSAMPLES * MAX_SKIP + 8], got[NSAMPLES * MAX_SKIP + 8];
+	dither_state_t state;
+	unsigned long n, skip;
+	int i, bad = 0;
+
+	for (i = 0; i < NSAMPLES; i++) {
+		src[i] = test_sample (i);
+	}
+
+	for (skip = k->width; skip <= MAX_SKIP; skip += k->width) {
+		for (n = 0; n <= NSAMPLES; n++) {
+			memset (want, 0x55, sizeof (want));
+			memset (got, 0x55, sizeof (got));
+			memset (&state, 0, sizeof (state));
+			k->scalar (want, src, n, skip, &state);
+			memset (&state, 0, sizeof (state));
+			k->accel (got, src, n, skip, &state);
+			if (memcmp (want, got, sizeof (want))) {
+				bad++;
+			}
+		}
+	}
+
+	printf ("%s %s: %s\n", isa, k->name, bad ? "FAIL" : "ok");
+	return bad;
+}
+
+static int
+check_in (const char *isa, const in_kernel_t *k)
+{
+	char src[NSAMPLES * MAX_SKIP];
+	jack_default_audio_sample_t want[NSAMPLES + 1], got[NSAMPLES + 1];
+	unsigned long n, skip;
+	unsigned int i;
+	int bad = 0;
+
+	for (i = 0; i < sizeof (src); i++) {
+		src[i] = rand ();
+	}
+
+	for (skip = k->width; skip <= MAX_SKIP; skip += k->width) {
+		for (n = 0; n <= NSAMPLES; n++) {
+			for (i = 0; i <= NSAMPLES; i++) {
+				want[i] = got[i] = -2.0f;
+			}
+			k->scalar (want, src, n, skip);
+			k->accel (got, src, n, skip);
+			if (memcmp (want, got, sizeof (want))) {
+				bad++;
+			}
+		}
+	}
+
+	printf ("%s %s: %s\n", isa, k->name, bad ? "FAIL" : "ok");
+	return bad;
+}
+
+/* Dither adds noise, so only check what must not change: a NaN still
+   comes out as silence. */
+static int
+check_dither_nan (const char *isa, const char *name, sample_move_out_t accel)
+{
+	jack_default_audio_sample_t src[NSAMPLES];
+	int16_t got[NSAMPLES];
+	dither_state_t state;
+	int i, bad = 0;
+
+	for (i = 0; i < NSAMPLES; i++) {
+		src[i] = NAN;
+	}
+	memset (&state, 0, sizeof (state));
+	accel ((char *) got, src, NSAMPLES, sizeof (int16_t), &state);
+	for (i = 0; i < NSAMPLES; i++) {
+		if (got[i] != 0) {
+			bad++;
+		}
+	}
+
+	printf ("%s %s NaN: %s\n", isa, name, bad ? "FAIL" : "ok");
+	return bad;
+}
+
+#define OUT(isa, name, width) \
+	{ #name, sample_move_##name, isa##_##name, width }
+#define IN(isa, name, width) \
+	{ #name, sample_move_##name, isa##_##name, width }
+
+#define CHECK_ISA(isa) \
+	do { \
+		const out_kernel_t outs[] = { \
+			OUT (isa, d32u24_sS, 4), \
+			OUT (isa, d24_sS, 3), \
+			OUT (isa, d16_sS, 2), \
+		}; \
+		const in_kernel_t ins[] = { \
+			IN (isa, dS_s32u24, 4), \
+			IN (isa, dS_s24, 3), \
+			IN (isa, dS_s16, 2), \
+		}; \
+		unsigned int i; \
+		for (i = 0; i < sizeof (outs) / sizeof (outs[0]); i++) \
+			failures += check_out (#isa, &outs[i]); \
+		for (i = 0; i < sizeof (ins) / sizeof (ins[0]); i++) \
+			failures += check_in (#isa, &ins[i]); \
+		failures += check_dither_nan (#isa, "dither_rect_d16_sS", \
+					      isa##_dither_rect_d16_sS); \
+		failures += check_dither_nan (#isa, "dither_tri_d16_sS", \
+					      isa##_dither_tri_d16_sS); \
+	} while (0)
+
+int
+main ()
+{
+	int failures = 0;
+
+#if defined(MEMOPS_X86)
+	if (memops_simd_level () >= 1) {
+		CHECK_ISA (sse41);
+	}
+	if (memops_simd_level () >= 2) {
+		CHECK_ISA (avx2);
+	}
+	if (memops_simd_level () == 0) {
+		printf ("no vectorized conversions for this CPU, skipped\n");
+		return SKIP;
+	}
+#elif defined(MEMOPS_NEON)
+	CHECK_ISA (neon);
+#else
+	printf ("no vectorized conversions built, skipped\n");
+	return SKIP;
+#endif
+
+	return failures ? 1 : 0;
+}
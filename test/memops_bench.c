@@ -0,0 +1,226 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Time every vectorized ALSA sample conversion in
+    drivers/alsa/memops.c against the scalar one it replaces, for each
+    kernel this CPU can run, and report millions of samples per second
+    and the speedup.  Each is run on one channel of a 1024 frame period,
+    both on its own (skip = sample width) and interleaved with a second
+    channel.  Undithered results must match the scalar ones;
+    test/memops_accel checks the corner cases.
+
+    The first argument sets the number of periods each kernel converts.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <time.h>
+
+#include "../drivers/alsa/memops.c"
+
+#define FRAMES		1024
+#define MAX_SKIP	8	/* two channels of 32 bit samples */
+#define RUNS		3	/* keep the best */
+#define SKIP		77	/* automake's "test skipped" */
+
+typedef struct {
+	const char *name;
+	sample_move_out_t scalar;
+	sample_move_out_t accel;
+	int width;
+	int dither;
+} out_kernel_t;
+
+typedef struct {
+	const char *name;
+	sample_move_in_t scalar;
+	sample_move_in_t accel;
+	int width;
+} in_kernel_t;
+
+static jack_default_audio_sample_t fsrc[FRAMES];
+static jack_default_audio_sample_t fwant[FRAMES], fgot[FRAMES];
+static char isrc[FRAMES * MAX_SKIP];
+static char iwant[FRAMES * MAX_SKIP], igot[FRAMES * MAX_SKIP];
+static long periods = 4000;
+
+static double
+now (void)
+{
+	struct timespec t;
+
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static double
+time_out (sample_move_out_t func, char *dst, unsigned long skip)
+{
+	dither_state_t state;
+	double start, t, best = 0.0;
+	long p;
+	int r;
+
+	for (r = 0; r < RUNS; r++) {
+		memset (&state, 0, sizeof (state));
+		start = now ();
+		for (p = 0; p < periods; p++) {
+			func (dst, fsrc, FRAMES, skip, &state);
+		}
+		t = now () - start;
+		if (r == 0 || t < best) {
+			best = t;
+		}
+	}
+	return periods * (FRAMES / 1e6) / best;
+}
+
+static double
+time_in (sample_move_in_t func, jack_default_audio_sample_t *dst, unsigned long skip)
+{
+	double start, t, best = 0.0;
+	long p;
+	int r;
+
+	for (r = 0; r < RUNS; r++) {
+		start = now ();
+		for (p = 0; p < periods; p++) {
+			func (dst, isrc, FRAMES, skip);
+		}
+		t = now () - start;
+		if (r == 0 || t < best) {
+			best = t;
+		}
+	}
+	return periods * (FRAMES / 1e6) / best;
+}
+
+static void
+report (const char *isa, const char *name, unsigned long skip,
+	double scalar, double accel, int bad)
+{
+	printf ("%-6s %-20s %4lu %10.0f %10.0f %7.2fx%s\n", isa, name, skip,
+		scalar, accel, accel / scalar, bad ? "  MISMATCH" : "");
+}
+
+static int
+bench_out (const char *isa, const out_kernel_t *k)
+{
+	unsigned long skip;
+	double scalar, accel;
+	int bad, failures = 0;
+
+	for (skip = k->width; skip <= 2UL * k->width; skip += k->width) {
+		memset (iwant, 0, sizeof (iwant));
+		memset (igot, 0, sizeof (igot));
+		scalar = time_out (k->scalar, iwant, skip);
+		accel = time_out (k->accel, igot, skip);
+		bad = !k->dither && memcmp (iwant, igot, sizeof (iwant));
+		report (isa, k->name, skip, scalar, accel, bad);
+		failures += bad;
+	}
+	return failures;
+}
+
+static int
+bench_in (const char *isa, const in_kernel_t *k)
+{
+	unsigned long skip;
+	double scalar, accel;
+	int bad, failures = 0;
+
+	for (skip = k->width; skip <= 2UL * k->width; skip += k->width) {
+		scalar = time_in (k->scalar, fwant, skip);
+		accel = time_in (k->accel, fgot, skip);
+		bad = memcmp (fwant, fgot, sizeof (fwant)) != 0;
+		report (isa, k->name, skip, scalar, accel, bad);
+		failures += bad;
+	}
+	return failures;
+}
+
+#define OUT(isa, name, width, dither) \
+	{ #name, sample_move_##name, isa##_##name, width, dither }
+#define IN(isa, name, width) \
+	{ #name, sample_move_##name, isa##_##name, width }
+
+#define BENCH_ISA(isa) \
+	do { \
+		const out_kernel_t outs[] = { \
+			OUT (isa, d32u24_sS, 4, 0), \
+			OUT (isa, d24_sS, 3, 0), \
+			OUT (isa, d16_sS, 2, 0), \
+			OUT (isa, dither_rect_d16_sS, 2, 1), \
+			OUT (isa, dither_tri_d16_sS, 2, 1), \
+		}; \
+		const in_kernel_t ins[] = { \
+			IN (isa, dS_s32u24, 4), \
+			IN (isa, dS_s24, 3), \
+			IN (isa, dS_s16, 2), \
+		}; \
+		unsigned int i; \
+		for (i = 0; i < sizeof (outs) / sizeof (outs[0]); i++) \
+			failures += bench_out (#isa, &outs[i]); \
+		for (i = 0; i < sizeof (ins) / sizeof (ins[0]); i++) \
+			failures += bench_in (#isa, &ins[i]); \
+	} while (0)
+
+int
+main (int argc, char *argv[])
+{
+	int failures = 0;
+	unsigned int i;
+
+	if (argc > 1) {
+		periods = atol (argv[1]);
+	}
+	if (periods < 1) {
+		fprintf (stderr, "usage: %s [periods]\n", argv[0]);
+		return 1;
+	}
+
+	for (i = 0; i < FRAMES; i++) {
+		fsrc[i] = (float) (rand () - RAND_MAX / 2) / (RAND_MAX / 2) * 1.1f;
+	}
+	for (i = 0; i < sizeof (isrc); i++) {
+		isrc[i] = rand ();
+	}
+
+	printf ("%ld periods of %d frames, Msamples/s\n", periods, FRAMES);
+	printf ("%-6s %-20s %4s %10s %10s %8s\n",
+		"isa", "kernel", "skip", "scalar", "vector", "speedup");
+
+#if defined(MEMOPS_X86)
+	if (memops_simd_level () >= 1) {
+		BENCH_ISA (sse41);
+	}
+	if (memops_simd_level () >= 2) {
+		BENCH_ISA (avx2);
+	}
+	if (memops_simd_level () == 0) {
+		printf ("no vectorized conversions for this CPU, skipped\n");
+		return SKIP;
+	}
+#elif defined(MEMOPS_NEON)
+	BENCH_ISA (neon);
+#else
+	printf ("no vectorized conversions built, skipped\n");
+	return SKIP;
+#endif
+
+	printf ("%d mismatches\n", failures);
+
+	return failures ? 1 : 0;
+}
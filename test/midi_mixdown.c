@@ -0,0 +1,262 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Check the MIDI mixdown of libjack/midiport.c against the linear
+    merge it replaced, and time both: 2 to 128 sources with about 1, 8
+    or 64 events each, in a full sized output buffer and, every seventh
+    round, one too small for them all.  The merged events must come
+    out in the same order, with ties going to the earlier source, at
+    the same places in the buffer, and with the same lost event count,
+    and the data of each must be intact.
+
+    The linear merge is written here with jack_midi_event_write(): for
+    each event, it scans all sources for the earliest next one.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <jack/midiport.h>
+
+#include "internal.h"
+#include "port.h"
+
+#define MAX_SOURCES	128
+#define BUFFER_SIZE	32768
+#define SMALL_BUFFER	2048
+#define NFRAMES		1024
+
+extern jack_port_functions_t jack_builtin_midi_functions;
+
+static const int source_counts[] = { 2, 8, 40, 128 };
+static const int densities[] = { 1, 8, 64 };
+
+static char *segment;
+static jack_port_shared_t shared[MAX_SOURCES];
+static jack_port_t sources[MAX_SOURCES];
+static jack_port_t *source_list[MAX_SOURCES];
+static void *source_buffers[MAX_SOURCES];
+static uint32_t source_heap[MAX_SOURCES], source_next[MAX_SOURCES];
+
+static double
+now (void)
+{
+	struct timespec t;
+
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Returns the lost event count the mixdown should come out with. */
+static uint32_t
+linear_mixdown (void *out, int nsources)
+{
+	uint32_t next[MAX_SOURCES], count[MAX_SOURCES];
+	uint32_t num_events = 0, lost = 0, i;
+	jack_midi_event_t event, earliest;
+	int s, from;
+
+	jack_midi_clear_buffer (out);
+
+	for (s = 0; s < nsources; s++) {
+		count[s] = jack_midi_get_event_count (source_buffers[s]);
+		num_events += count[s];
+		lost += jack_midi_get_lost_event_count (source_buffers[s]);
+		next[s] = 0;
+	}
+
+	for (i = 0; i < num_events; i++) {
+		from = -1;
+		for (s = 0; s < nsources; s++) {
+			if (next[s] == count[s]) {
+				continue;
+			}
+			jack_midi_event_get (&event, source_buffers[s], next[s]);
+			if (from < 0 || event.time < earliest.time) {
+				earliest = event;
+				from = s;
+			}
+		}
+		next[from]++;
+		if (jack_midi_event_write (out, earliest.time, earliest.buffer,
+					   earliest.size)) {
+			break;
+		}
+	}
+
+	return lost + num_events - i;
+}
+
+static int
+same_events (void *a, void *b, uint32_t lost)
+{
+	jack_midi_event_t x, y;
+	uint32_t count = jack_midi_get_event_count (a), i;
+
+	if (jack_midi_get_event_count (b) != count
+	    || jack_midi_get_lost_event_count (b) != lost) {
+		return 0;
+	}
+	for (i = 0; i < count; i++) {
+		jack_midi_event_get (&x, a, i);
+		jack_midi_event_get (&y, b, i);
+		if (x.time != y.time || x.size != y.size
+		    || (char *) x.buffer - (char *) a != (char *) y.buffer - (char *) b
+		    || memcmp (x.buffer, y.buffer, x.size)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Whether every event's data is inside the buffer and still what the
+   sources sent, which a mixdown that let event slots and event data
+   overlap would not leave it. */
+static int
+events_intact (void *buf, size_t size)
+{
+	static const jack_midi_data_t tail[9] = { 1, 2, 3, 4, 5, 6, 7, 8, 0xf7 };
+	jack_midi_event_t event;
+	uint32_t count = jack_midi_get_event_count (buf), i;
+
+	for (i = 0; i < count; i++) {
+		jack_midi_event_get (&event, buf, i);
+		if ((char *) event.buffer < (char *) buf
+		    || (char *) event.buffer + event.size > (char *) buf + size
+		    || event.buffer[0] != 0xb0
+		    || (event.size == 12 && memcmp (event.buffer + 3, tail, 9))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void
+fill_sources (int nsources, int density, int round, unsigned int *seed)
+{
+	jack_midi_data_t msg[12] = {
+		0xb0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 0xf7
+	};
+	jack_nframes_t t;
+	int s, e, n;
+
+	for (s = 0; s < nsources; s++) {
+		void *buf = segment + s * BUFFER_SIZE;
+
+		jack_builtin_midi_functions.buffer_init (buf, BUFFER_SIZE,
+							 NFRAMES);
+
+		/* now and then most sources have nothing to say */
+		n = (round % 3 == 0 && s % 3)
+			? 0 : rand_r (seed) % (2 * density + 1);
+
+		for (e = 0, t = 0; e < n; e++) {
+			msg[1] = e & 0x7f;
+			msg[2] = s & 0x7f;
+			t += rand_r (seed) % (2 * NFRAMES / (n + 1) + 1);
+			if (t >= NFRAMES) {
+				t = NFRAMES - 1;
+			}
+			jack_midi_event_write (buf, t, msg,
+					       (rand_r (seed) % 10) ? 3 : 12);
+		}
+	}
+}
+
+int
+main ()
+{
+	void *want, *got;
+	jack_port_t port;
+	unsigned int seed = 1;
+	int mismatches = 0;
+	int a, d, s, round;
+
+	segment = calloc (MAX_SOURCES, BUFFER_SIZE);
+	want = malloc (BUFFER_SIZE);
+	got = malloc (BUFFER_SIZE);
+
+	for (s = 0; s < MAX_SOURCES; s++) {
+		shared[s].offset = s * BUFFER_SIZE;
+		sources[s].shared = &shared[s];
+		sources[s].client_segment_base = (void **) &segment;
+		source_list[s] = &sources[s];
+	}
+
+	memset (&port, 0, sizeof (port));
+	port.mix_buffer = got;
+	port.sources = source_list;
+	port.source_buffers = source_buffers;
+	port.source_heap = source_heap;
+	port.source_next = source_next;
+
+	for (a = 0; a < (int) (sizeof (source_counts) / sizeof (source_counts[0])); a++) {
+		for (d = 0; d < (int) (sizeof (densities) / sizeof (densities[0])); d++) {
+			int nsources = source_counts[a];
+			int rounds = 2000 / (nsources / 2 + 1) + 20;
+			double linear = 0, heap = 0, t0, t1, t2;
+
+			port.nsources = nsources;
+
+			for (round = 0; round < rounds; round++) {
+				size_t out_size = (round % 7 == 0)
+					? SMALL_BUFFER : BUFFER_SIZE;
+				uint32_t lost;
+
+				fill_sources (nsources, densities[d], round, &seed);
+				for (s = 0; s < nsources; s++) {
+					source_buffers[s] = segment + s * BUFFER_SIZE;
+				}
+				jack_builtin_midi_functions.buffer_init
+					(want, out_size, NFRAMES);
+				jack_builtin_midi_functions.buffer_init
+					(got, out_size, NFRAMES);
+
+				t0 = now ();
+				lost = linear_mixdown (want, nsources);
+				t1 = now ();
+				jack_builtin_midi_functions.mixdown (&port, NFRAMES);
+				t2 = now ();
+				linear += t1 - t0;
+				heap += t2 - t1;
+
+				if (!events_intact (want, out_size)
+				    || !events_intact (got, out_size)
+				    || !same_events (want, got, lost)) {
+					mismatches++;
+				}
+			}
+
+			printf ("%3d sources, ~%2d events each: linear %7.2f us, "
+				"heap %6.2f us per mixdown\n",
+				nsources, densities[d], linear / rounds * 1e6,
+				heap / rounds * 1e6);
+		}
+	}
+
+	printf ("%d mismatches\n", mismatches);
+
+	free (segment);
+	free (want);
+	free (got);
+
+	return mismatches ? 1 : 0;
+}
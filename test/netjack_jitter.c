@@ -0,0 +1,289 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Replay packet arrival traces through the adaptive jitter buffer of
+    the netjack slave, the way an always-deadline slave would see them,
+    and print the latency and the fraction of late packets for several
+    percentiles. The latency is compared with the best fixed delay, in
+    hindsight, that would have let the same fraction of packets be late.
+
+    Without arguments it replays synthetic LAN, WAN and bursty WAN
+    traces, with the master clock 80ppm fast, and fails if the buffer
+    does much worse than that fixed delay or misses its percentile by
+    far. A trace file of "framecnt send_usecs arrival_usecs" lines,
+    with a negative arrival for a lost packet, replays that trace:
+
+	netjack_jitter [trace [period_usecs]]
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include "../drivers/netjack/netjack_packet.c"
+#include "../drivers/netjack/netjack.c"
+
+#define TRACE_LENGTH	200000
+#define MAX_TRACE	1000000
+#define PERIOD_USECS	1333.0	/* 64 frames at 48kHz */
+
+typedef struct {
+	jack_nframes_t framecnt;
+	double send;
+	double arrival;		/* < 0 if lost */
+} trace_event_t;
+
+typedef struct {
+	double at;
+	int index;
+} arrival_t;
+
+static trace_event_t *trace;
+static int trace_len;
+
+static double
+urand (void)
+{
+	return (rand () + 1.0) / (RAND_MAX + 2.0);
+}
+
+static double
+expo (double mean)
+{
+	return -mean * log (urand ());
+}
+
+static double
+gauss (void)
+{
+	return sqrt (-2 * log (urand ())) * cos (2 * M_PI * urand ());
+}
+
+static void
+synth_trace (int kind, int n, double period)
+{
+	double skew = 1.0 + 80e-6;
+	int spike = 0;
+	int i;
+
+	trace = malloc (sizeof (trace_event_t) * n);
+	trace_len = n;
+
+	for (i = 0; i < n; i++) {
+		double send = 1e6 + i * period * skew;
+		double delay;
+
+		switch (kind) {
+		case 0:		/* LAN */
+			delay = 200 + fabs (gauss () * 60);
+			break;
+		case 1:		/* WAN */
+			delay = 20000 + expo (1500);
+			break;
+		default:	/* WAN, bursty, with a route change */
+			delay = 20000 + expo (1500) + (i > n / 2 ? 8000 : 0);
+			if (spike > 0) {
+				delay += spike * 3000.0;
+				spike--;
+			} else if (urand () < 0.002) {
+				spike = 10;
+			}
+			break;
+		}
+
+		trace[i].framecnt = 1000 + i;
+		trace[i].send = send;
+		trace[i].arrival = (urand () < 0.01) ? -1 : send + delay;
+	}
+}
+
+static int
+read_trace (const char *path)
+{
+	FILE *f = fopen (path, "r");
+	unsigned int framecnt;
+	double send, arrival;
+
+	if (f == NULL) {
+		perror (path);
+		return -1;
+	}
+
+	trace = malloc (sizeof (trace_event_t) * MAX_TRACE);
+	trace_len = 0;
+	while (trace_len < MAX_TRACE
+	       && fscanf (f, "%u %lf %lf", &framecnt, &send, &arrival) == 3) {
+		trace[trace_len].framecnt = framecnt;
+		trace[trace_len].send = send;
+		trace[trace_len].arrival = arrival;
+		trace_len++;
+	}
+	fclose (f);
+	return 0;
+}
+
+static int
+cmp_arrival (const void *a, const void *b)
+{
+	double x = ((const arrival_t *) a)->at;
+	double y = ((const arrival_t *) b)->at;
+
+	return x < y ? -1 : x > y;
+}
+
+static int
+cmp_double (const void *a, const void *b)
+{
+	double x = *(const double *) a;
+	double y = *(const double *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Returns 0 if the buffer held up against the fixed delay. */
+static int
+replay (const char *name, double period, unsigned int percentile)
+{
+	static netjack_driver_state_t netj;
+	static packet_cache pcache;
+	arrival_t *arrivals = malloc (sizeof (arrival_t) * trace_len);
+	double *delays = malloc (sizeof (double) * trace_len);
+	long late = 0, lost = 0, played = 0;
+	double latency = 0, now = 0, fixed, late_pct;
+	int first = -1, narrivals = 0, ndelays = 0, i, k, q;
+
+	memset (&netj, 0, sizeof (netj));
+	memset (&pcache, 0, sizeof (pcache));
+	netj.period_usecs = period;
+	netj.latency = 5;
+	netj.packcache = &pcache;
+	netj.jitter.percentile = percentile;
+	netjack_jitter_reset (&netj);
+
+	for (i = 0; i < trace_len; i++) {
+		if (trace[i].arrival >= 0) {
+			arrivals[narrivals].at = trace[i].arrival;
+			arrivals[narrivals].index = i;
+			narrivals++;
+		}
+	}
+	qsort (arrivals, narrivals, sizeof (arrival_t), cmp_arrival);
+
+	for (i = 0, k = 0; i < trace_len; i++) {
+		jack_time_t deadline;
+
+		/* log what the socket would have delivered by now */
+		while (k < narrivals && arrivals[k].at <= now) {
+			packet_arrival *log = &pcache.arrivals[
+				pcache.arrivals_head % NETJACK_ARRIVAL_LOG];
+
+			log->framecnt = trace[arrivals[k].index].framecnt;
+			log->timestamp = (jack_time_t) arrivals[k].at;
+			pcache.arrivals_head++;
+			k++;
+		}
+
+		netjack_jitter_update (&netj);
+		if (!netjack_jitter_ready (&netj.jitter)) {
+			/* warming up, run on arrival */
+			now = trace[i].arrival >= 0 ? trace[i].arrival : now + period;
+			continue;
+		}
+		if (first < 0) {
+			first = i;
+		}
+
+		deadline = netjack_jitter_deadline (&netj.jitter,
+						    trace[i].framecnt);
+		if (deadline < now) {
+			deadline = now;
+		}
+		played++;
+		latency += deadline - trace[i].send;
+		if (trace[i].arrival < 0) {
+			lost++;
+		} else if (trace[i].arrival > deadline) {
+			late++;
+		}
+		now = deadline;
+	}
+
+	if (played == 0) {
+		printf ("%-10s p%-3u never left warm-up\n", name, percentile);
+		free (arrivals);
+		free (delays);
+		return -1;
+	}
+
+	/* the fixed delay, in hindsight, with the same fraction late */
+	for (i = first; i < trace_len; i++) {
+		if (trace[i].arrival >= 0) {
+			delays[ndelays++] = trace[i].arrival - trace[i].send;
+		}
+	}
+	qsort (delays, ndelays, sizeof (double), cmp_double);
+	late_pct = 100.0 * late / played;
+	q = (int) ((1.0 - late_pct / 100.0) * ndelays);
+	if (q >= ndelays) {
+		q = ndelays - 1;
+	}
+	fixed = delays[q];
+	latency /= played;
+
+	printf ("%-10s p%-3u latency %8.0f us, late %6.3f%%, lost %5.2f%%, "
+		"fixed delay for the same late %%: %8.0f us\n",
+		name, percentile, latency, late_pct, 100.0 * lost / played,
+		fixed);
+
+	free (arrivals);
+	free (delays);
+
+	return (latency > fixed * 1.05 + period
+		|| late_pct > 2.0 * (100 - percentile) + 2.0) ? -1 : 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+	const char *names[] = { "lan", "wan", "wan-burst" };
+	unsigned int percentiles[] = { 50, 90, 95, 99, 100 };
+	double period = PERIOD_USECS;
+	int failures = 0;
+	int t, p;
+
+	if (argc > 1) {
+		if (read_trace (argv[1])) {
+			return 1;
+		}
+		if (argc > 2) {
+			period = atof (argv[2]);
+		}
+		for (p = 0; p < 5; p++) {
+			replay (argv[1], period, percentiles[p]);
+		}
+		return 0;
+	}
+
+	for (t = 0; t < 3; t++) {
+		srand (1);
+		synth_trace (t, TRACE_LENGTH, period);
+		for (p = 0; p < 5; p++) {
+			if (replay (names[t], period, percentiles[p])) {
+				failures++;
+			}
+		}
+		free (trace);
+	}
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Send netjack periods to ourselves over UDP loopback and receive
+    them through the packet cache, as the netjack driver does. Report
+    the fragment rate and the CPU time per period, and fail if a
+    period is lost or comes out different from what was sent.
+
+    Usage: netjack_loopback [channels [periods]]
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include "../drivers/netjack/netjack_packet.c"
+
+#include <time.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+
+#define PERIOD		256
+#define MTU		1400
+#define RCVBUF		(8 << 20)
+
+static jack_time_t
+usecs (void)
+{
+	struct timespec t;
+
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000ULL + t.tv_nsec / 1000;
+}
+
+static double
+cpu_secs (void)
+{
+	struct rusage r;
+
+	getrusage (RUSAGE_SELF, &r);
+	return r.ru_utime.tv_sec + r.ru_stime.tv_sec
+		+ (r.ru_utime.tv_usec + r.ru_stime.tv_usec) / 1e6;
+}
+
+static int
+run (int channels, int periods)
+{
+	int hdr_size = sizeof (jacknet_packet_header);
+	int pkt_size = hdr_size + channels * PERIOD * sizeof (uint32_t);
+	int frags = (pkt_size - hdr_size - 1) / (MTU - hdr_size) + 1;
+	int rcvbuf = RCVBUF;
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof (addr);
+	packet_cache *pcache;
+	char *buf, *rx_buf;
+	long lost = 0, bad = 0;
+	jack_time_t t0, t;
+	double c0, c;
+	int rx, tx, f, i;
+
+	rx = socket (AF_INET, SOCK_DGRAM, 0);
+	tx = socket (AF_INET, SOCK_DGRAM, 0);
+	if (rx < 0 || tx < 0) {
+		perror ("socket");
+		return -1;
+	}
+	setsockopt (rx, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof (rcvbuf));
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	if (bind (rx, (struct sockaddr *) &addr, sizeof (addr))
+	    || getsockname (rx, (struct sockaddr *) &addr, &addr_len)) {
+		perror ("bind");
+		return -1;
+	}
+
+	pcache = packet_cache_new (8, pkt_size, MTU);
+	buf = malloc (pkt_size);
+
+	c0 = cpu_secs ();
+	t0 = usecs ();
+
+	for (f = 1; f <= periods; f++) {
+		jacknet_packet_header *pkthdr = (jacknet_packet_header *) buf;
+
+		memset (pkthdr, 0, hdr_size);
+		pkthdr->framecnt = htonl (f);
+		for (i = hdr_size; i < pkt_size; i++) {
+			buf[i] = (char) (i * 7 + f);
+		}
+
+		netjack_sendto (tx, buf, pkt_size, 0, (struct sockaddr *) &addr,
+				sizeof (addr), MTU);
+		packet_cache_drain_socket (pcache, rx, usecs);
+
+		if (packet_cache_retreive_packet_pointer (pcache, f, &rx_buf,
+							  pkt_size, NULL) < 0) {
+			lost++;
+			continue;
+		}
+		if (memcmp (rx_buf + hdr_size, buf + hdr_size,
+			    pkt_size - hdr_size)) {
+			bad++;
+		}
+		packet_cache_release_packet (pcache, f);
+	}
+
+	t = usecs () - t0;
+	c = cpu_secs () - c0;
+
+	printf ("%3d channels, %2d fragments/period: %8.1f kpps, "
+		"%6.1f us CPU/period, %ld lost, %ld bad\n",
+		channels, frags, (double) periods * frags / t * 1000,
+		c * 1e6 / periods, lost, bad);
+
+	packet_cache_free (pcache);
+	free (buf);
+	close (rx);
+	close (tx);
+
+	return (lost || bad) ? -1 : 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+	int channels[] = { 2, 16, 64 };
+	int periods = 2000;
+	unsigned int i;
+	int failures = 0;
+
+	if (argc > 2) {
+		periods = atoi (argv[2]);
+	}
+	if (argc > 1) {
+		return run (atoi (argv[1]), periods) ? 1 : 0;
+	}
+
+	for (i = 0; i < sizeof (channels) / sizeof (channels[0]); i++) {
+		if (run (channels[i], periods)) {
+			failures++;
+		}
+	}
+
+	return failures ? 1 : 0;
+}
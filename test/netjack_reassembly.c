@@ -0,0 +1,220 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Feed the netjack packet cache fragments of two periods at a time,
+    shuffled, some of them twice and some not at all, through a real
+    UDP socket. Check that every complete period comes out as it was
+    sent, and that the framecnt index of the cache always gives the
+    same answers as a scan of all the cache packets.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include "../drivers/netjack/netjack_packet.c"
+
+#include <time.h>
+#include <arpa/inet.h>
+
+#define CHANNELS	16
+#define PERIOD		256
+#define MTU		1400
+#define PERIODS		2000
+#define MAX_FRAGS	64
+#define RCVBUF		(8 << 20)
+
+static long checks;
+static long mismatches;
+
+static jack_time_t
+usecs (void)
+{
+	struct timespec t;
+
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000ULL + t.tv_nsec / 1000;
+}
+
+/* Compare the indexed lookups with a scan of the whole cache. */
+static void
+check_index (packet_cache *pcache, jack_nframes_t expected)
+{
+	jack_nframes_t highest = 0, next = 0, got = 0;
+	int have_highest = 0, have_next = 0;
+	int i, ret;
+
+	for (i = 0; i < pcache->size; i++) {
+		cache_packet *pack = &pcache->packets[i];
+
+		if (!pack->valid || !cache_packet_is_complete (pack)) {
+			continue;
+		}
+		if (!have_highest || pack->framecnt > highest) {
+			highest = pack->framecnt;
+			have_highest = 1;
+		}
+		if (pack->framecnt >= expected
+		    && (!have_next || pack->framecnt < next)) {
+			next = pack->framecnt;
+			have_next = 1;
+		}
+	}
+
+	ret = packet_cache_get_highest_available_framecnt (pcache, &got);
+	if (ret != have_highest || (have_highest && got != highest)) {
+		mismatches++;
+	}
+	ret = packet_cache_get_next_available_framecnt (pcache, expected, &got);
+	if (ret != have_next || (have_next && got != next)) {
+		mismatches++;
+	}
+	checks++;
+}
+
+int
+main ()
+{
+	int hdr_size = sizeof (jacknet_packet_header);
+	int payload_size = MTU - hdr_size;
+	int pkt_size = hdr_size + CHANNELS * PERIOD * sizeof (uint32_t);
+	int frags = (pkt_size - hdr_size - 1) / payload_size + 1;
+	int rcvbuf = RCVBUF;
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof (addr);
+	packet_cache *pcache;
+	char *buf[2], *rx_buf;
+	char dgram[MTU];
+	int order[2 * MAX_FRAGS];
+	long lost = 0, dropped = 0, bad = 0;
+	jack_nframes_t f;
+	int rx, tx, i, j, k, n, lose;
+
+	rx = socket (AF_INET, SOCK_DGRAM, 0);
+	tx = socket (AF_INET, SOCK_DGRAM, 0);
+	if (rx < 0 || tx < 0) {
+		perror ("socket");
+		return 1;
+	}
+	setsockopt (rx, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof (rcvbuf));
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	if (bind (rx, (struct sockaddr *) &addr, sizeof (addr))
+	    || getsockname (rx, (struct sockaddr *) &addr, &addr_len)) {
+		perror ("bind");
+		return 1;
+	}
+
+	pcache = packet_cache_new (8, pkt_size, MTU);
+	buf[0] = malloc (pkt_size);
+	buf[1] = malloc (pkt_size);
+	srand (1);
+
+	for (f = 3; f < PERIODS; f += 2) {
+
+		/* two periods, partly shuffled together, and now and
+		   then one fragment that never arrives */
+
+		n = 0;
+		for (k = 0; k < 2; k++) {
+			for (i = 0; i < frags; i++) {
+				order[n++] = k * MAX_FRAGS + i;
+			}
+		}
+		for (i = n - 1; i > 0; i--) {
+			int tmp;
+
+			if (rand () % 3) {
+				continue;
+			}
+			j = rand () % (i + 1);
+			tmp = order[i];
+			order[i] = order[j];
+			order[j] = tmp;
+		}
+		lose = (rand () % 5 == 0) ? rand () % n : -1;
+
+		for (k = 0; k < 2; k++) {
+			jacknet_packet_header *pkthdr =
+				(jacknet_packet_header *) buf[k];
+
+			memset (pkthdr, 0, hdr_size);
+			pkthdr->framecnt = htonl (f + k);
+			for (i = hdr_size; i < pkt_size; i++) {
+				buf[k][i] = (char) (i * 13 + f + k);
+			}
+		}
+
+		for (i = 0; i < n; i++) {
+			int frag, len;
+
+			if (i == lose) {
+				continue;
+			}
+			k = order[i] / MAX_FRAGS;
+			frag = order[i] % MAX_FRAGS;
+			len = frag < frags - 1
+				? payload_size
+				: pkt_size - hdr_size - frag * payload_size;
+
+			memcpy (dgram, buf[k], hdr_size);
+			((jacknet_packet_header *) dgram)->fragment_nr = htonl (frag);
+			memcpy (dgram + hdr_size,
+				buf[k] + hdr_size + frag * payload_size, len);
+
+			sendto (tx, dgram, hdr_size + len, 0,
+				(struct sockaddr *) &addr, sizeof (addr));
+			if (rand () % 20 == 0) {
+				sendto (tx, dgram, hdr_size + len, 0,
+					(struct sockaddr *) &addr, sizeof (addr));
+			}
+			if (rand () % 7 == 0) {
+				packet_cache_drain_socket (pcache, rx, usecs);
+				check_index (pcache, f);
+			}
+		}
+
+		packet_cache_drain_socket (pcache, rx, usecs);
+		check_index (pcache, f);
+
+		for (k = 0; k < 2; k++) {
+			if (packet_cache_retreive_packet_pointer (
+				    pcache, f + k, &rx_buf, pkt_size, NULL) < 0) {
+				if (lose < 0) {
+					lost++;
+				} else {
+					dropped++;
+				}
+				continue;
+			}
+			if (memcmp (rx_buf + hdr_size, buf[k] + hdr_size,
+				    pkt_size - hdr_size)) {
+				bad++;
+			}
+			packet_cache_release_packet (pcache, f + k);
+			check_index (pcache, f + k);
+		}
+	}
+
+	printf ("%d fragments/period: %ld index checks, %ld mismatches, "
+		"%ld periods lost, %ld with a fragment dropped, %ld bad\n",
+		frags, checks, mismatches, lost, dropped, bad);
+
+	packet_cache_free (pcache);
+	free (buf[0]);
+	free (buf[1]);
+
+	return (mismatches || lost || bad) ? 1 : 0;
+}
@@ -0,0 +1,246 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Check the port name index of libjack/port.c against a plain scan of
+    the ports, over random registrations, renames and alias changes,
+    and check that a writer killed while holding the index lock, or
+    one that never lets go of it, does not stop anyone else.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "internal.h"
+#include "port.h"
+
+#define PORT_MAX	1024
+#define STEPS		100000
+
+static jack_port_id_t
+scan (jack_control_t *control, const char *name)
+{
+	jack_port_id_t id;
+
+	for (id = 0; id < control->port_max; id++) {
+		if (control->ports[id].in_use
+		    && jack_port_name_equals (&control->ports[id], name)) {
+			return id;
+		}
+	}
+	return NO_PORT;
+}
+
+static jack_control_t *
+control_new (void)
+{
+	jack_control_t *control;
+	jack_port_id_t id;
+
+	control = calloc (1, sizeof (jack_control_t)
+			  + sizeof (jack_port_shared_t) * PORT_MAX
+			  + jack_port_name_index_size (PORT_MAX));
+	control->port_max = PORT_MAX;
+	for (id = 0; id < PORT_MAX; id++) {
+		control->ports[id].id = id;
+	}
+	jack_port_name_index_init (control);
+
+	return control;
+}
+
+static int
+check_random (void)
+{
+	jack_control_t *control = control_new ();
+	jack_port_shared_t *shared;
+	jack_port_t port;
+	jack_port_id_t id, probe;
+	unsigned int seed = 3;
+	char name[JACK_PORT_NAME_SIZE];
+	const char *target;
+	int step, op, bad = 0;
+
+	memset (&port, 0, sizeof (port));
+
+	for (step = 0; step < STEPS; step++) {
+		id = rand_r (&seed) % PORT_MAX;
+		op = rand_r (&seed) % 10;
+		shared = &control->ports[id];
+		port.shared = shared;
+
+		if (!shared->in_use && op < 6) {
+			snprintf (shared->name, sizeof (shared->name),
+				  "client%d:port_%d", rand_r (&seed) % 16,
+				  rand_r (&seed) % 500);
+			if (scan (control, shared->name) != NO_PORT) {
+				continue;
+			}
+			shared->in_use = 1;
+			if (op == 0) {
+				snprintf (shared->alias1, sizeof (shared->alias1),
+					  "alsa_pcm:capture_%d", id);
+			}
+			jack_port_name_index_add (control, id);
+		} else if (shared->in_use && op < 3) {
+			jack_port_name_index_remove (control, id);
+			shared->in_use = 0;
+			shared->alias1[0] = shared->alias2[0] = '\0';
+		} else if (shared->in_use && op == 3) {
+			snprintf (name, sizeof (name), "%.*s:renamed_%d",
+				  (int) (strchr (shared->name, ':') - shared->name),
+				  shared->name, rand_r (&seed) % 2000);
+			if (scan (control, name) == NO_PORT) {
+				jack_port_set_name (&port, strchr (name, ':') + 1);
+			}
+		} else if (shared->in_use && op == 4) {
+			snprintf (name, sizeof (name), "alias:%d",
+				  rand_r (&seed) % 100000);
+			if (scan (control, name) == NO_PORT) {
+				jack_port_set_alias (&port, name);
+			}
+		} else if (shared->in_use && op == 5) {
+			if (shared->alias2[0]) {
+				jack_port_unset_alias (&port, shared->alias2);
+			} else if (shared->alias1[0]) {
+				jack_port_unset_alias (&port, shared->alias1);
+			}
+		}
+
+		probe = rand_r (&seed) % PORT_MAX;
+		shared = &control->ports[probe];
+		if (!shared->in_use) {
+			target = "nobody:nothing";
+		} else if ((rand_r (&seed) & 1) && shared->alias1[0]) {
+			target = shared->alias1;
+		} else {
+			target = shared->name;
+		}
+		if (scan (control, target) != jack_port_name_index_find (control, target)) {
+			bad++;
+		}
+
+		/* the old "ALSA:" names of the alsa_pcm ports */
+		if (shared->in_use
+		    && strncmp (shared->alias1, "alsa_pcm:capture", 16) == 0) {
+			snprintf (name, sizeof (name), "ALSA%s", shared->alias1 + 8);
+			if (jack_port_name_index_find (control, name) != probe) {
+				bad++;
+			}
+		}
+	}
+
+	free (control);
+	printf ("random changes: %s\n", bad ? "FAIL" : "ok");
+	return bad;
+}
+
+/* Leave the index locked and half changed by a process that is then
+   killed, or by one that stays around if `live'.  Returns its pid. */
+static pid_t
+lock_and_leave (jack_control_t *control, int live)
+{
+	jack_port_name_index_t *index = jack_port_name_index (control);
+	pid_t pid;
+
+	if ((pid = fork ()) == 0) {
+		pause ();
+		_exit (0);
+	}
+	index->lock = pid;
+	index->seq++;
+	if (!live) {
+		memset ((void *) index->slots, 0,
+			index->nslots * sizeof (uint64_t));
+		index->used = 0;
+		kill (pid, SIGKILL);
+		waitpid (pid, NULL, 0);
+	}
+	return pid;
+}
+
+static int
+check_recovery (void)
+{
+	jack_control_t *control = control_new ();
+	jack_port_name_index_t *index = jack_port_name_index (control);
+	jack_port_id_t id;
+	pid_t pid;
+	int bad = 0;
+
+	for (id = 0; id < 10; id++) {
+		snprintf (control->ports[id].name, sizeof (control->ports[id].name),
+			  "a:p%d", id);
+		control->ports[id].in_use = 1;
+		jack_port_name_index_add (control, id);
+	}
+
+	/* a reader finds the writer gone */
+	lock_and_leave (control, 0);
+	for (id = 0; id < 10; id++) {
+		if (jack_port_name_index_find (control, control->ports[id].name) != id) {
+			bad++;
+		}
+	}
+	if ((index->seq & 1) || index->lock) {
+		bad++;
+	}
+
+	/* so does a writer */
+	lock_and_leave (control, 0);
+	snprintf (control->ports[20].name, sizeof (control->ports[20].name), "a:new");
+	control->ports[20].in_use = 1;
+	jack_port_name_index_add (control, 20);
+	for (id = 0; id < 10; id++) {
+		if (jack_port_name_index_find (control, control->ports[id].name) != id) {
+			bad++;
+		}
+	}
+	if (jack_port_name_index_find (control, "a:new") != 20
+	    || (index->seq & 1) || index->lock) {
+		bad++;
+	}
+
+	/* a writer that is still there but never finishes */
+	pid = lock_and_leave (control, 1);
+	if (jack_port_name_index_find (control, "a:p5") != 5
+	    || jack_port_name_index_find (control, "x:y") != NO_PORT) {
+		bad++;
+	}
+	kill (pid, SIGKILL);
+	waitpid (pid, NULL, 0);
+
+	free (control);
+	printf ("writers that die or hang: %s\n", bad ? "FAIL" : "ok");
+	return bad;
+}
+
+int
+main ()
+{
+	int failures = 0;
+
+	failures += check_random ();
+	failures += check_recovery ();
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,285 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Time jack_get_ports() with 1k, 4k and 16k ports: repeated queries
+    served from the cache, and queries run again after each port change,
+    against the plain regex scan over all ports that jack_get_ports()
+    used to be. Over random port churn, check that every query returns
+    exactly what that scan returns.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <regex.h>
+
+#include "internal.h"
+#include "../libjack/local.h"
+
+#define CHURN		20000
+#define SYSTEM_PORTS	64
+
+static const char *patterns[][2] = {
+	{ NULL, NULL },
+	{ "system:capture_", NULL },
+	{ "^system:", "audio" },
+	{ "^client3:out_7$", NULL },
+	{ "_1$", "midi" },
+	{ ".*midi.*", NULL },
+	{ "client[12]:out_[0-9]+$", JACK_DEFAULT_AUDIO_TYPE },
+	{ "^nobody:", NULL },
+};
+
+#define NPATTERNS (sizeof (patterns) / sizeof (patterns[0]))
+
+static double
+now (void)
+{
+	struct timespec t;
+
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* jack_get_ports() as it was: compile the patterns, scan every port. */
+static const char **
+scan_get_ports (jack_control_t *engine, const char *port_name_pattern,
+		const char *type_name_pattern, unsigned long flags)
+{
+	const char **matching_ports;
+	unsigned long match_cnt = 0;
+	jack_port_shared_t *psp = engine->ports;
+	regex_t port_regex, type_regex;
+	unsigned long i;
+
+	if (port_name_pattern && port_name_pattern[0]) {
+		regcomp (&port_regex, port_name_pattern,
+			 REG_EXTENDED|REG_NOSUB);
+	}
+	if (type_name_pattern && type_name_pattern[0]) {
+		regcomp (&type_regex, type_name_pattern,
+			 REG_EXTENDED|REG_NOSUB);
+	}
+
+	matching_ports = malloc (sizeof (char *) * (engine->port_max + 1));
+
+	for (i = 0; i < engine->port_max; i++) {
+		if (!psp[i].in_use) {
+			continue;
+		}
+		if (flags && (psp[i].flags & flags) != flags) {
+			continue;
+		}
+		if (port_name_pattern && port_name_pattern[0]
+		    && regexec (&port_regex, psp[i].name, 0, NULL, 0)) {
+			continue;
+		}
+		if (type_name_pattern && type_name_pattern[0]
+		    && regexec (&type_regex,
+				engine->port_types[psp[i].ptype_id].type_name,
+				0, NULL, 0)) {
+			continue;
+		}
+		matching_ports[match_cnt++] = psp[i].name;
+	}
+
+	if (port_name_pattern && port_name_pattern[0]) {
+		regfree (&port_regex);
+	}
+	if (type_name_pattern && type_name_pattern[0]) {
+		regfree (&type_regex);
+	}
+
+	if (match_cnt == 0) {
+		free (matching_ports);
+		return NULL;
+	}
+	matching_ports[match_cnt] = NULL;
+	return matching_ports;
+}
+
+static int
+same_ports (const char **a, const char **b)
+{
+	int i;
+
+	if (a == NULL || b == NULL) {
+		return a == b;
+	}
+	for (i = 0; a[i] && b[i]; i++) {
+		if (a[i] != b[i]) {
+			return 0;
+		}
+	}
+	return a[i] == b[i];
+}
+
+static void
+port_add (jack_control_t *engine, jack_port_id_t id)
+{
+	jack_port_shared_t *port = &engine->ports[id];
+
+	if (id < SYSTEM_PORTS) {
+		snprintf (port->name, sizeof (port->name),
+			  "system:capture_%d", id);
+		port->flags = JackPortIsOutput | JackPortIsPhysical;
+	} else {
+		snprintf (port->name, sizeof (port->name),
+			  "client%d:out_%d", id / 64, id % 64);
+		port->flags = (id & 1) ? JackPortIsOutput : JackPortIsInput;
+	}
+	port->ptype_id = (id % 5 == 0);
+	port->in_use = 1;
+	jack_port_name_index_add (engine, id);
+}
+
+static void
+port_remove (jack_control_t *engine, jack_port_id_t id)
+{
+	jack_port_name_index_remove (engine, id);
+	engine->ports[id].in_use = 0;
+}
+
+static int
+run (uint32_t port_max)
+{
+	jack_control_t *engine;
+	jack_client_t client;
+	unsigned int seed = 5;
+	unsigned int i, k, f;
+	int mismatches = 0;
+
+	engine = calloc (1, sizeof (jack_control_t)
+			 + sizeof (jack_port_shared_t) * port_max
+			 + jack_port_name_index_size (port_max));
+	engine->port_max = port_max;
+	engine->n_port_types = 2;
+	strcpy ((char *) engine->port_types[0].type_name, JACK_DEFAULT_AUDIO_TYPE);
+	strcpy ((char *) engine->port_types[1].type_name, JACK_DEFAULT_MIDI_TYPE);
+	for (i = 0; i < port_max; i++) {
+		engine->ports[i].id = i;
+	}
+	jack_port_name_index_init (engine);
+
+	memset (&client, 0, sizeof (client));
+	client.engine = engine;
+	jack_port_query_init (&client);
+
+	/* random churn, checking every query against the scan */
+
+	for (k = 0; k < CHURN; k++) {
+		jack_port_id_t id = rand_r (&seed) % port_max;
+
+		if (!engine->ports[id].in_use) {
+			port_add (engine, id);
+		} else if (k % 3) {
+			port_remove (engine, id);
+		}
+
+		if (k % 50) {
+			continue;
+		}
+		for (i = 0; i < NPATTERNS; i++) {
+			for (f = 0; f < 3; f++) {
+				unsigned long flags = f == 0 ? 0
+					: f == 1 ? JackPortIsOutput
+					: JackPortIsPhysical | JackPortIsOutput;
+				const char **want, **got;
+
+				want = scan_get_ports (engine, patterns[i][0],
+						       patterns[i][1], flags);
+				got = jack_get_ports (&client, patterns[i][0],
+						      patterns[i][1], flags);
+				if (!same_ports (want, got)) {
+					mismatches++;
+				}
+				free (want);
+				free (got);
+			}
+		}
+	}
+
+	/* all ports in use, and time it */
+
+	for (i = 0; i < port_max; i++) {
+		if (!engine->ports[i].in_use) {
+			port_add (engine, i);
+		}
+	}
+
+	printf ("%5u ports%*s %12s %12s %12s\n", port_max, 26, "",
+		"scan us", "cached us", "changed us");
+
+	for (i = 0; i < NPATTERNS; i++) {
+		const char *name = patterns[i][0];
+		const char *type = patterns[i][1];
+		unsigned int n = 1000000 / port_max + 10, r;
+		jack_port_query_t *query = jack_port_query_new (name, type, 0);
+		double t0, t1, t2, t3;
+
+		t0 = now ();
+		for (r = 0; r < n; r++) {
+			free (scan_get_ports (engine, name, type, 0));
+		}
+		t1 = now ();
+		for (r = 0; r < n; r++) {
+			free (jack_get_ports (&client, name, type, 0));
+		}
+		t2 = now ();
+		/* a port changes between each query */
+		for (r = 0; r < n; r++) {
+			port_remove (engine, port_max - 1);
+			port_add (engine, port_max - 1);
+			free (jack_port_query_get_ports (&client, query));
+		}
+		t3 = now ();
+
+		printf ("  %-26s %-6s %12.1f %12.2f %12.1f\n",
+			name ? name : "(any)",
+			type == NULL ? ""
+			: strcmp (type, JACK_DEFAULT_AUDIO_TYPE) == 0 ? "(audio)"
+			: type,
+			(t1 - t0) / n * 1e6, (t2 - t1) / n * 1e6,
+			(t3 - t2) / n * 1e6);
+
+		jack_port_query_free (query);
+	}
+
+	jack_port_query_cleanup (&client);
+	free (engine);
+
+	return mismatches;
+}
+
+int
+main ()
+{
+	uint32_t sizes[] = { 1024, 4096, 16384 };
+	unsigned int i;
+	int mismatches = 0;
+
+	for (i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++) {
+		mismatches += run (sizes[i]);
+	}
+
+	printf ("%d mismatches against the scan\n", mismatches);
+
+	return mismatches ? 1 : 0;
+}
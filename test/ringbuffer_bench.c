@@ -0,0 +1,269 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Measure jack_ringbuffer_t throughput in MB/s with 1 to N
+    producer/consumer thread pairs running at once, each pair on its
+    own ringbuffer, through the copying, vector, staged and (on a
+    mirrored ringbuffer) window calls.  The ends of every piece are
+    checked against the stream, and the byte count must come out even;
+    test/ringbuffer_spsc checks every byte.
+
+    The number of pairs goes up to half the online CPUs, at most 4,
+    or to the first argument.  The second argument sets the MiB each
+    pair moves.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <jack/ringbuffer.h>
+
+#include "internal.h"
+
+#define RB_SIZE		65536
+#define MAX_CHUNK	8192
+#define MAX_PAIRS	16
+#define PERIOD		4093	/* of the stream, prime so it drifts */
+#define BATCH		16	/* staged pieces per commit */
+
+static const size_t chunks[] = { 64, 1024, 8192 };
+
+enum { COPY, VECTOR, STAGED, WINDOW, NMODES };
+
+static const char *mode_names[] = {
+	"copy", "vector", "staged x16", "mirrored window"
+};
+
+static char stream[PERIOD + MAX_CHUNK];
+static size_t total;
+
+typedef struct {
+	jack_ringbuffer_t *rb;
+	size_t chunk;
+	int mode;
+	size_t bad;
+	size_t moved;
+	pthread_t producer;
+	pthread_t consumer;
+} pair_t;
+
+static double
+now (void)
+{
+	struct timespec t;
+
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void *
+producer (void *arg)
+{
+	pair_t *p = arg;
+	size_t done = 0, n, len;
+	int staged = 0;
+	jack_ringbuffer_data_t vec[2];
+	char *src, *win;
+
+	while (done < total) {
+		n = p->chunk;
+		if (n > total - done)
+			n = total - done;
+		src = &stream[done % PERIOD];
+
+		switch (p->mode) {
+		case COPY:
+			n = jack_ringbuffer_write (p->rb, src, n);
+			break;
+		case VECTOR:
+			jack_ringbuffer_get_write_vector (p->rb, vec);
+			if (n > vec[0].len + vec[1].len)
+				n = vec[0].len + vec[1].len;
+			len = n < vec[0].len ? n : vec[0].len;
+			memcpy (vec[0].buf, src, len);
+			memcpy (vec[1].buf, src + len, n - len);
+			jack_ringbuffer_write_advance (p->rb, n);
+			break;
+		case STAGED:
+			n = jack_ringbuffer_write_stage (p->rb, src, n);
+			if (++staged == BATCH || n < p->chunk
+			    || done + n == total) {
+				jack_ringbuffer_write_commit (p->rb);
+				staged = 0;
+			}
+			break;
+		case WINDOW:
+			win = jack_ringbuffer_write_window (p->rb, n, &len);
+			if (n > len)
+				n = len;
+			memcpy (win, src, n);
+			jack_ringbuffer_write_advance (p->rb, n);
+			break;
+		}
+		if (n == 0)
+			sched_yield ();
+		done += n;
+	}
+
+	return NULL;
+}
+
+static void *
+consumer (void *arg)
+{
+	pair_t *p = arg;
+	size_t done = 0, n, len;
+	int staged = 0;
+	jack_ringbuffer_data_t vec[2];
+	char buf[MAX_CHUNK];
+	char *win;
+
+	while (done < total) {
+		n = p->chunk;
+
+		switch (p->mode) {
+		case COPY:
+			n = jack_ringbuffer_read (p->rb, buf, n);
+			break;
+		case VECTOR:
+			jack_ringbuffer_get_read_vector (p->rb, vec);
+			if (n > vec[0].len + vec[1].len)
+				n = vec[0].len + vec[1].len;
+			len = n < vec[0].len ? n : vec[0].len;
+			memcpy (buf, vec[0].buf, len);
+			memcpy (buf + len, vec[1].buf, n - len);
+			jack_ringbuffer_read_advance (p->rb, n);
+			break;
+		case STAGED:
+			n = jack_ringbuffer_read_stage (p->rb, buf, n);
+			if (++staged == BATCH || n < p->chunk) {
+				jack_ringbuffer_read_commit (p->rb);
+				staged = 0;
+			}
+			break;
+		case WINDOW:
+			win = jack_ringbuffer_read_window (p->rb, n, &len);
+			if (n > len)
+				n = len;
+			memcpy (buf, win, n);
+			jack_ringbuffer_read_advance (p->rb, n);
+			break;
+		}
+		if (n == 0) {
+			sched_yield ();
+			continue;
+		}
+		if (buf[0] != stream[done % PERIOD]
+		    || buf[n - 1] != stream[(done + n - 1) % PERIOD])
+			p->bad++;
+		done += n;
+	}
+
+	p->moved = done;
+	return NULL;
+}
+
+static double
+run (pair_t *pairs, int npairs, int mode, size_t chunk, int *failures)
+{
+	double start, elapsed;
+	int i;
+
+	for (i = 0; i < npairs; i++) {
+		pairs[i].rb = mode == WINDOW
+			? jack_ringbuffer_create_mirrored (RB_SIZE)
+			: jack_ringbuffer_create (RB_SIZE);
+		pairs[i].chunk = chunk;
+		pairs[i].mode = mode;
+		pairs[i].bad = 0;
+		pairs[i].moved = 0;
+	}
+
+	start = now ();
+	for (i = 0; i < npairs; i++) {
+		pthread_create (&pairs[i].consumer, NULL, consumer, &pairs[i]);
+		pthread_create (&pairs[i].producer, NULL, producer, &pairs[i]);
+	}
+	for (i = 0; i < npairs; i++) {
+		pthread_join (pairs[i].producer, NULL);
+		pthread_join (pairs[i].consumer, NULL);
+	}
+	elapsed = now () - start;
+
+	for (i = 0; i < npairs; i++) {
+		if (pairs[i].bad || pairs[i].moved != total
+		    || jack_ringbuffer_read_space (pairs[i].rb))
+			(*failures)++;
+		jack_ringbuffer_free (pairs[i].rb);
+	}
+
+	return npairs * (total / 1e6) / elapsed;
+}
+
+int
+main (int argc, char *argv[])
+{
+	pair_t pairs[MAX_PAIRS];
+	long ncpus = sysconf (_SC_NPROCESSORS_ONLN);
+	int max_pairs = ncpus > 1 ? ncpus / 2 : 1;
+	int failures = 0;
+	int npairs, mode;
+	size_t c, i;
+
+	if (max_pairs > 4)
+		max_pairs = 4;
+	if (argc > 1)
+		max_pairs = atoi (argv[1]);
+	if (max_pairs < 1 || max_pairs > MAX_PAIRS) {
+		fprintf (stderr, "usage: %s [pairs (1-%d)] [MiB per pair]\n",
+			 argv[0], MAX_PAIRS);
+		return 1;
+	}
+	total = (argc > 2 ? atoi (argv[2]) : 256) * (size_t) (1 << 20);
+
+	for (i = 0; i < sizeof (stream); i++)
+		stream[i] = (char) ((i % PERIOD) * 7 + ((i % PERIOD) >> 8));
+
+	printf ("%zu MiB per pair through a %d byte ringbuffer, "
+		"%ld CPUs online, MB/s\n", total >> 20, RB_SIZE, ncpus);
+	printf ("%-16s %6s", "path", "chunk");
+	for (npairs = 1; npairs <= max_pairs; npairs++)
+		printf (" %7d pair%s", npairs, npairs > 1 ? "s" : " ");
+	printf ("\n");
+
+	for (mode = 0; mode < NMODES; mode++) {
+		for (c = 0; c < sizeof (chunks) / sizeof (chunks[0]); c++) {
+			printf ("%-16s %6zu", mode_names[mode], chunks[c]);
+			fflush (stdout);
+			for (npairs = 1; npairs <= max_pairs; npairs++)
+				printf (" %12.0f", run (pairs, npairs, mode,
+							chunks[c], &failures));
+			printf ("\n");
+		}
+	}
+
+	printf ("%d failed transfers\n", failures);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,266 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Push a patterned byte stream through a jack_ringbuffer_t from one
+    thread to another in odd sized pieces, with the copying, vector,
+    staged and (on a mirrored ringbuffer) window calls, and check every
+    byte that comes out and that the public read_ptr and write_ptr
+    follow the indices.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <jack/ringbuffer.h>
+
+#include "internal.h"
+
+#define TOTAL		(64u << 20)
+#define RB_SIZE		4096
+
+static const size_t chunks[] = { 1, 7, 64, 777, 4095, 4099 };
+
+#define PATTERN(pos)	((char) ((pos) * 7 + ((pos) >> 8)))
+
+#define BATCH		16	/* staged pieces per commit */
+
+enum { COPY, VECTOR, STAGED, WINDOW, NMODES };
+
+static const char *mode_names[] = { "copy", "vector", "staged", "window" };
+
+typedef struct {
+	jack_ringbuffer_t *rb;
+	size_t chunk;
+	int mode;
+	size_t bad;
+} transfer_t;
+
+static void *
+producer (void *arg)
+{
+	transfer_t *t = arg;
+	char *buf = malloc (t->chunk);
+	char *win;
+	size_t done = 0, n, i, j, len;
+	int staged = 0;
+	jack_ringbuffer_data_t vec[2];
+
+	while (done < TOTAL) {
+		n = t->chunk;
+		if (n > TOTAL - done)
+			n = TOTAL - done;
+		if (t->mode == WINDOW) {
+			win = jack_ringbuffer_write_window (t->rb, n, &len);
+			if (n > len)
+				n = len;
+			for (i = 0; i < n; i++)
+				win[i] = PATTERN (done + i);
+			jack_ringbuffer_write_advance (t->rb, n);
+		} else if (t->mode == VECTOR) {
+			jack_ringbuffer_get_write_vector (t->rb, vec);
+			if (n > vec[0].len + vec[1].len)
+				n = vec[0].len + vec[1].len;
+			for (i = 0, j = 0; j < 2; j++) {
+				size_t k;
+				for (k = 0; k < vec[j].len && i < n; k++, i++)
+					vec[j].buf[k] = PATTERN (done + i);
+			}
+			jack_ringbuffer_write_advance (t->rb, n);
+		} else {
+			for (i = 0; i < n; i++)
+				buf[i] = PATTERN (done + i);
+			if (t->mode == STAGED) {
+				n = jack_ringbuffer_write_stage (t->rb, buf, n);
+				if (++staged == BATCH || n < t->chunk
+				    || done + n == TOTAL) {
+					jack_ringbuffer_write_commit (t->rb);
+					staged = 0;
+				}
+			} else {
+				n = jack_ringbuffer_write (t->rb, buf, n);
+			}
+		}
+		if (n == 0)
+			sched_yield ();
+		done += n;
+	}
+
+	free (buf);
+	return NULL;
+}
+
+static void
+consume (transfer_t *t)
+{
+	char *buf = malloc (t->chunk);
+	char *win;
+	size_t done = 0, n, i, j, len;
+	int staged = 0;
+	jack_ringbuffer_data_t vec[2];
+
+	while (done < TOTAL) {
+		if (t->mode == WINDOW) {
+			win = jack_ringbuffer_read_window (t->rb, t->chunk, &len);
+			n = t->chunk;
+			if (n > len)
+				n = len;
+			for (i = 0; i < n; i++)
+				if (win[i] != PATTERN (done + i))
+					t->bad++;
+			jack_ringbuffer_read_advance (t->rb, n);
+		} else if (t->mode == VECTOR) {
+			jack_ringbuffer_get_read_vector (t->rb, vec);
+			n = t->chunk;
+			if (n > vec[0].len + vec[1].len)
+				n = vec[0].len + vec[1].len;
+			for (i = 0, j = 0; j < 2; j++) {
+				size_t k;
+				for (k = 0; k < vec[j].len && i < n; k++, i++)
+					if (vec[j].buf[k] != PATTERN (done + i))
+						t->bad++;
+			}
+			jack_ringbuffer_read_advance (t->rb, n);
+		} else {
+			if (t->mode == STAGED) {
+				n = jack_ringbuffer_read_stage (t->rb, buf,
+								t->chunk);
+				if (++staged == BATCH || n < t->chunk) {
+					jack_ringbuffer_read_commit (t->rb);
+					staged = 0;
+				}
+			} else {
+				n = jack_ringbuffer_read (t->rb, buf, t->chunk);
+			}
+			for (i = 0; i < n; i++)
+				if (buf[i] != PATTERN (done + i))
+					t->bad++;
+		}
+		if (n == 0)
+			sched_yield ();
+		done += n;
+	}
+
+	free (buf);
+}
+
+static int
+check_pointers (void)
+{
+	jack_ringbuffer_t *rb = jack_ringbuffer_create (RB_SIZE);
+	char buf[RB_SIZE];
+	size_t pos = 0, i;
+	int bad = 0;
+
+	memset (buf, 0, sizeof (buf));
+
+	/* go round several times, so that the private indices are
+	   well past the size when they are masked */
+	for (i = 0; i < 10000; i++) {
+		size_t n = chunks[i % 6] % rb->size;
+
+		n = jack_ringbuffer_write (rb, buf, n);
+		if (rb->write_ptr != ((pos + n) & rb->size_mask)
+		    || jack_ringbuffer_read_space (rb) != n
+		    || jack_ringbuffer_write_space (rb) != rb->size - 1 - n)
+			bad++;
+		jack_ringbuffer_read (rb, buf, n);
+		pos += n;
+		if (rb->read_ptr != (pos & rb->size_mask)
+		    || jack_ringbuffer_read_space (rb) != 0)
+			bad++;
+	}
+
+	jack_ringbuffer_reset (rb);
+	if (rb->read_ptr || rb->write_ptr || jack_ringbuffer_read_space (rb))
+		bad++;
+
+	jack_ringbuffer_free (rb);
+	printf ("read_ptr/write_ptr: %s\n", bad ? "FAIL" : "ok");
+	return bad;
+}
+
+/* Staged data must stay invisible to the other side, and out of
+   read_ptr and write_ptr, until it is committed. */
+
+static int
+check_staged (void)
+{
+	jack_ringbuffer_t *rb = jack_ringbuffer_create (RB_SIZE);
+	char buf[64];
+	int bad = 0;
+
+	memset (buf, 0, sizeof (buf));
+
+	jack_ringbuffer_write_stage (rb, buf, sizeof (buf));
+	jack_ringbuffer_write_stage (rb, buf, sizeof (buf));
+	if (rb->write_ptr != 0 || jack_ringbuffer_read_space (rb) != 0
+	    || jack_ringbuffer_write_space (rb) != rb->size - 1 - 128)
+		bad++;
+	jack_ringbuffer_write_commit (rb);
+	if (rb->write_ptr != 128 || jack_ringbuffer_read_space (rb) != 128)
+		bad++;
+
+	jack_ringbuffer_read_stage (rb, buf, sizeof (buf));
+	if (rb->read_ptr != 0 || jack_ringbuffer_read_space (rb) != 64)
+		bad++;
+	jack_ringbuffer_read_commit (rb);
+	if (rb->read_ptr != 64 || jack_ringbuffer_write_space (rb)
+	    != rb->size - 1 - 64)
+		bad++;
+
+	jack_ringbuffer_free (rb);
+	printf ("staged commits: %s\n", bad ? "FAIL" : "ok");
+	return bad;
+}
+
+int
+main ()
+{
+	transfer_t t;
+	pthread_t thread;
+	size_t c;
+	int failures = check_pointers () + check_staged ();
+
+	for (t.mode = 0; t.mode < NMODES; t.mode++) {
+		for (c = 0; c < sizeof (chunks) / sizeof (chunks[0]); c++) {
+			if (t.mode == WINDOW) {
+				t.rb = jack_ringbuffer_create_mirrored (RB_SIZE);
+			} else {
+				t.rb = jack_ringbuffer_create (RB_SIZE);
+			}
+			t.chunk = chunks[c];
+			t.bad = 0;
+			pthread_create (&thread, NULL, producer, &t);
+			consume (&t);
+			pthread_join (thread, NULL);
+			printf ("%s%s, %zu byte pieces: %s\n",
+				mode_names[t.mode],
+				jack_ringbuffer_mirrored (t.rb) ? " (mirrored)" : "",
+				t.chunk, t.bad ? "FAIL" : "ok");
+			if (t.bad || jack_ringbuffer_read_space (t.rb))
+				failures++;
+			jack_ringbuffer_free (t.rb);
+		}
+	}
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,261 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Measure the copy, accumulate and N-way mix kernels in
+    libjack/simd.c in GB/s, against the plain C loops, for every
+    kernel this CPU can run and for period sized buffers that stay in
+    cache.  The rate counts the source samples read, so a mix of N
+    buffers and the same mix done as a copy followed by N - 1
+    accumulates can be compared directly.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "intsimd.h"
+
+#define MAX_SRCS	8
+#define MAX_LENGTH	1024
+#define RUN_SECS	0.02	/* per measurement */
+
+int cpu_type = 0;
+
+typedef void (*mixn_func) (float *, const float **, int, int);
+typedef void (*copy_func) (float *, const float *, int);
+
+typedef struct {
+	const char *name;
+	copy_func copy;
+	copy_func add;
+	mixn_func mixn;
+} kernels_t;
+
+static const int lengths[] = { 256, MAX_LENGTH };
+static const int nsrcs_list[] = { 2, 4, 8 };
+
+static float data[MAX_SRCS][MAX_LENGTH] __attribute__ ((aligned (64)));
+static float dest[MAX_LENGTH] __attribute__ ((aligned (64)));
+static float check[MAX_LENGTH] __attribute__ ((aligned (64)));
+
+static void
+gen_copyf (float *dest, const float *src, int length)
+{
+	int i;
+
+	for (i = 0; i < length; i++)
+		dest[i] = src[i];
+}
+
+static void
+gen_add2f (float *dest, const float *src, int length)
+{
+	int i;
+
+	for (i = 0; i < length; i++)
+		dest[i] += src[i];
+}
+
+static void
+gen_mixnf (float *dest, const float **srcs, int nsrcs, int length)
+{
+	int i, s;
+	float sum;
+
+	for (i = 0; i < length; i++) {
+		sum = srcs[0][i];
+		for (s = 1; s < nsrcs; s++)
+			sum += srcs[s][i];
+		dest[i] = sum;
+	}
+}
+
+static double
+now (void)
+{
+	struct timespec t;
+
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* 0 copy only, 1 accumulate only, 2 N-way mix, 3 copy and
+   accumulates */
+static void
+run (const kernels_t *k, int how, const float **srcs, int nsrcs,
+     int length)
+{
+	int s;
+
+	switch (how) {
+	case 0:
+		k->copy (dest, srcs[0], length);
+		break;
+	case 1:
+		k->add (dest, srcs[0], length);
+		break;
+	case 2:
+		k->mixn (dest, srcs, nsrcs, length);
+		break;
+	case 3:
+		k->copy (dest, srcs[0], length);
+		for (s = 1; s < nsrcs; s++)
+			k->add (dest, srcs[s], length);
+		break;
+	}
+}
+
+static double
+rate (const kernels_t *k, int how, int nsrcs, int length)
+{
+	const float *srcs[MAX_SRCS];
+	double start, elapsed;
+	long n, reps = 1;
+	int s;
+
+	for (s = 0; s < nsrcs; s++)
+		srcs[s] = data[s];
+
+	/* double the repetitions until a run takes long enough */
+	for (;;) {
+		start = now ();
+		for (n = 0; n < reps; n++)
+			run (k, how, srcs, nsrcs, length);
+		elapsed = now () - start;
+		if (elapsed >= RUN_SECS)
+			break;
+		reps *= 2;
+	}
+
+	return reps * (double) nsrcs * length * sizeof (float)
+		/ elapsed / 1e9;
+}
+
+/* the mix and the copy and accumulates must agree with the C loops */
+static int
+agree (const kernels_t *k, int nsrcs, int length)
+{
+	const float *srcs[MAX_SRCS];
+	int s, bad;
+
+	for (s = 0; s < nsrcs; s++)
+		srcs[s] = data[s];
+
+	gen_mixnf (check, srcs, nsrcs, length);
+	run (k, 2, srcs, nsrcs, length);
+	bad = memcmp (check, dest, length * sizeof (float));
+	run (k, 3, srcs, nsrcs, length);
+	bad |= memcmp (check, dest, length * sizeof (float));
+
+	return bad != 0;
+}
+
+static int
+bench (const kernels_t *k)
+{
+	int failures = 0;
+	size_t l, n;
+
+	for (l = 0; l < sizeof (lengths) / sizeof (lengths[0]); l++) {
+		printf ("%-8s %6d %7.2f %7.2f", k->name, lengths[l],
+			rate (k, 0, 1, lengths[l]), rate (k, 1, 1, lengths[l]));
+		for (n = 0; n < sizeof (nsrcs_list) / sizeof (nsrcs_list[0]);
+		     n++) {
+			printf (" %7.2f %7.2f",
+				rate (k, 2, nsrcs_list[n], lengths[l]),
+				rate (k, 3, nsrcs_list[n], lengths[l]));
+			failures += agree (k, nsrcs_list[n], lengths[l]);
+		}
+		printf ("\n");
+	}
+
+	return failures;
+}
+
+int
+main ()
+{
+	static const kernels_t scalar = {
+		"C", gen_copyf, gen_add2f, gen_mixnf
+	};
+	int failures = 0;
+	int s, i;
+
+	for (s = 0; s < MAX_SRCS; s++) {
+		for (i = 0; i < MAX_LENGTH; i++) {
+			data[s][i] = (float) (rand () - RAND_MAX / 2)
+				/ (float) (rand () % 1000 + 1);
+		}
+	}
+
+	printf ("GB/s of source samples; mixN is the N-way kernel, "
+		"c+aN a copy and N - 1 accumulates\n");
+	printf ("%-8s %6s %7s %7s", "kernel", "frames", "copy", "add");
+	for (s = 0; s < (int) (sizeof (nsrcs_list) / sizeof (nsrcs_list[0]));
+	     s++)
+		printf ("    mix%d    c+a%d", nsrcs_list[s], nsrcs_list[s]);
+	printf ("\n");
+
+	failures += bench (&scalar);
+
+#ifdef ARCH_X86
+	if (have_3dnow ()) {
+		static const kernels_t k = {
+			"3dnow", x86_3dnow_copyf, x86_3dnow_add2f,
+			x86_3dnow_mixnf
+		};
+		failures += bench (&k);
+	}
+	if (have_sse () >= 2) {
+		static const kernels_t k = {
+			"sse", x86_sse_copyf, x86_sse_add2f, x86_sse_mixnf
+		};
+		failures += bench (&k);
+	}
+#ifdef USE_AVX_KERNELS
+	if (have_avx () >= 1) {
+		static const kernels_t k = {
+			"avx2", x86_avx2_copyf, x86_avx2_add2f, x86_avx2_mixnf
+		};
+		failures += bench (&k);
+	}
+	if (have_avx () >= 2) {
+		static const kernels_t k = {
+			"avx512", x86_avx512_copyf, x86_avx512_add2f,
+			x86_avx512_mixnf
+		};
+		failures += bench (&k);
+	}
+#endif /* USE_AVX_KERNELS */
+#endif /* ARCH_X86 */
+
+#ifdef ARCH_ARM_NEON
+	{
+		static const kernels_t k = {
+			"neon", arm_neon_copyf, arm_neon_add2f, arm_neon_mixnf
+		};
+		failures += bench (&k);
+	}
+#endif /* ARCH_ARM_NEON */
+
+	printf ("%d disagreements with the C loops\n", failures);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,171 @@
+/* -*- mode: c; c-file-style: "bsd"; -*- */
+/*
+    Check the SIMD N-way mix kernels in libjack/simd.c against the
+    scalar one-pass mix, for every kernel this CPU can run, and the
+    copy and accumulate kernels the same way, chained into a mix.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intsimd.h"
+
+#define MAX_SRCS	9
+#define MAX_LENGTH	300
+#define GUARD		16
+#define SKIP		77	/* automake's "test skipped" */
+
+int cpu_type = 0;
+
+typedef void (*mixn_func) (float *, const float **, int, int);
+typedef void (*copy_func) (float *, const float *, int);
+
+static copy_func chain_copy;
+static copy_func chain_add;
+
+/* a mix out of the copy and accumulate kernels under test */
+static void
+chain_mixnf (float *dest, const float **srcs, int nsrcs, int length)
+{
+	int s;
+
+	chain_copy (dest, srcs[0], length);
+	for (s = 1; s < nsrcs; s++)
+		chain_add (dest, srcs[s], length);
+}
+
+/* the reference: the same per-sample summation order as gen_mixnf()
+   in libjack/port.c, which every kernel must reproduce bit for bit */
+static void
+ref_mixnf (float *dest, const float **srcs, int nsrcs, int length)
+{
+	int i, s;
+	float sum;
+
+	for (i = 0; i < length; i++) {
+		sum = srcs[0][i];
+		for (s = 1; s < nsrcs; s++)
+			sum += srcs[s][i];
+		dest[i] = sum;
+	}
+}
+
+static int
+check_kernel (const char *name, mixn_func mixn, int offsets)
+{
+	/* rows of a multiple of 16 bytes keep every source aligned */
+	static float data[MAX_SRCS][MAX_LENGTH + 4]
+		__attribute__ ((aligned (64)));
+	static float want[MAX_LENGTH + GUARD];
+	static float got[MAX_LENGTH + GUARD + 1] __attribute__ ((aligned (64)));
+	const float *srcs[MAX_SRCS];
+	int nsrcs, length, offset, s, i;
+	int failures = 0;
+
+	for (s = 0; s < MAX_SRCS; s++) {
+		for (i = 0; i <= MAX_LENGTH; i++) {
+			data[s][i] = (float) (rand () - RAND_MAX / 2)
+				/ (float) (rand () % 1000 + 1);
+		}
+	}
+
+	/* offset 1 checks unaligned sources and destination */
+	for (offset = 0; offset < offsets; offset++) {
+		for (nsrcs = 1; nsrcs <= MAX_SRCS; nsrcs++) {
+			for (s = 0; s < nsrcs; s++)
+				srcs[s] = data[s] + offset;
+			for (length = 0; length <= MAX_LENGTH; length++) {
+				for (i = 0; i < MAX_LENGTH + GUARD; i++)
+					want[i] = got[i + offset] = -1.0f;
+				ref_mixnf (want, srcs, nsrcs, length);
+				mixn (got + offset, srcs, nsrcs, length);
+				if (memcmp (want, got + offset,
+					    (length + GUARD) * sizeof (float))) {
+					fprintf (stderr, "%s: mismatch, %d sources,"
+						 " %d frames, offset %d\n",
+						 name, nsrcs, length, offset);
+					failures++;
+				}
+			}
+		}
+	}
+
+	printf ("%s: %s\n", name, failures ? "FAIL" : "ok");
+	return failures;
+}
+
+/* The SSE copy uses aligned moves, as port buffers are aligned, so
+   the chains are only checked on aligned buffers. */
+static int
+check_chain (const char *name, copy_func copy, copy_func add)
+{
+	chain_copy = copy;
+	chain_add = add;
+	return check_kernel (name, chain_mixnf, 1);
+}
+
+int
+main ()
+{
+	int failures = 0;
+	int checked = 0;
+
+#ifdef ARCH_X86
+	if (have_3dnow ()) {
+		failures += check_kernel ("3dnow", x86_3dnow_mixnf, 2);
+		checked++;
+	}
+	if (have_sse () >= 2) {
+		failures += check_kernel ("sse", x86_sse_mixnf, 2);
+		failures += check_chain ("sse copy+add", x86_sse_copyf,
+					 x86_sse_add2f);
+		checked++;
+	}
+#ifdef USE_AVX_KERNELS
+	if (have_avx () >= 1) {
+		failures += check_kernel ("avx2", x86_avx2_mixnf, 2);
+		failures += check_chain ("avx2 copy+add", x86_avx2_copyf,
+					 x86_avx2_add2f);
+		checked++;
+	}
+	if (have_avx () >= 2) {
+		failures += check_kernel ("avx512", x86_avx512_mixnf, 2);
+		failures += check_chain ("avx512 copy+add", x86_avx512_copyf,
+					 x86_avx512_add2f);
+		checked++;
+	}
+#endif /* USE_AVX_KERNELS */
+#endif /* ARCH_X86 */
+
+#ifdef ARCH_ARM_NEON
+	failures += check_kernel ("neon", arm_neon_mixnf, 2);
+	failures += check_chain ("neon copy+add", arm_neon_copyf,
+				 arm_neon_add2f);
+	checked++;
+#endif /* ARCH_ARM_NEON */
+
+	if (checked == 0) {
+		printf ("no SIMD mix kernels built or supported, skipped\n");
+		return SKIP;
+	}
+
+	return failures ? 1 : 0;
+}